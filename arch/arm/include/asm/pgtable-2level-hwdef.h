@@ -88,6 +88,16 @@
 #define PTE_SMALL_AP_URO_SRW	(_AT(pteval_t, 0xaa) << 4)
 #define PTE_SMALL_AP_URW_SRW	(_AT(pteval_t, 0xff) << 4)
 
+/*
+ *   - large (64K) page, v6/v7.  Occupies 16 consecutive identical entries.
+ */
+#define PTE_LARGE_SHIFT		16
+#define PTE_LARGE_SIZE		(1UL << PTE_LARGE_SHIFT)
+#define PTE_LARGE_MASK		(~(PTE_LARGE_SIZE-1))
+#define PTE_LARGE_PTRS		(PTE_LARGE_SIZE >> PAGE_SHIFT)
+#define PTE_LARGE_TEX(x)	(_AT(pteval_t, (x)) << 12)
+#define PTE_LARGE_XN		(_AT(pteval_t, 1) << 15)
+
 #define PHYS_MASK		(~0UL)
 
 #endif
@@ -206,7 +206,36 @@ static inline pte_t *pmd_page_vaddr(pmd_t pmd)
 #define pte_page(pte)		pfn_to_page(pte_pfn(pte))
 #define mk_pte(page,prot)	pfn_pte(page_to_pfn(page), prot)
 
-#define pte_clear(mm,addr,ptep)	set_pte_ext(ptep, __pte(0), 0)
+struct mm_struct;
+
+#ifdef CONFIG_ARM_USER_LARGE_PAGES
+extern void __pte_split_large(struct mm_struct *mm, pte_t *ptep);
+
+/*
+ * The hardware entries of sixteen user ptes may have been merged into one
+ * 64K large page by remap_pfn_range_large.  Changing just one of them
+ * would leave a mix of large and small descriptors in the block, so turn
+ * the whole block back into small pages first.
+ */
+static inline void pte_split_large(struct mm_struct *mm, pte_t *ptep)
+{
+	u32 *hw = (u32 *)(ptep + PTE_HWTABLE_PTRS);
+
+	if ((*hw & PTE_TYPE_MASK) == PTE_TYPE_LARGE)
+		__pte_split_large(mm, ptep);
+}
+#else
+static inline void pte_split_large(struct mm_struct *mm, pte_t *ptep)
+{
+}
+#endif
+
+static inline void pte_clear(struct mm_struct *mm, unsigned long addr,
+			     pte_t *ptep)
+{
+	pte_split_large(mm, ptep);
+	set_pte_ext(ptep, __pte(0), 0);
+}
 
 #if __LINUX_ARM_ARCH__ < 6
 static inline void __sync_icache_dcache(pte_t pteval)
@@ -223,6 +252,7 @@ static inline void set_pte_at(struct mm_struct *mm, unsigned long addr,
 		set_pte_ext(ptep, pteval, 0);
 	else {
 		__sync_icache_dcache(pteval);
+		pte_split_large(mm, ptep);
 		set_pte_ext(ptep, pteval, PTE_EXT_NG);
 	}
 }
@@ -323,6 +353,19 @@ static inline pte_t pte_modify(pte_t pte, pgprot_t newprot)
 #define io_remap_pfn_range(vma,from,pfn,size,prot) \
 	remap_pfn_range(vma,from,pfn,size,prot)
 
+#ifdef CONFIG_ARM_USER_LARGE_PAGES
+/*
+ * Like remap_pfn_range, but 64K aligned, 64K sized runs of the range are
+ * mapped with large page descriptors so they take a single TLB entry.
+ */
+extern int remap_pfn_range_large(struct vm_area_struct *vma,
+				 unsigned long addr, unsigned long pfn,
+				 unsigned long size, pgprot_t prot);
+#else
+#define remap_pfn_range_large(vma,addr,pfn,size,prot) \
+	remap_pfn_range(vma,addr,pfn,size,prot)
+#endif
+
 #define pgtable_cache_init() do { } while (0)
 
 #endif /* !__ASSEMBLY__ */
@@ -0,0 +1,151 @@
+/*
+ *  linux/arch/arm/mm/largepage.c
+ *
+ *  Userspace mappings of contiguous memory using 64K large pages
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * The Linux ptes are left as sixteen ordinary small page entries so the
+ * generic mm code keeps working on them; only the hardware table is
+ * rewritten.  Every later change to one of the ptes (zap, mprotect,
+ * mremap, access flag updates) goes through set_pte_at or pte_clear,
+ * which first split the whole block back into small pages, so the
+ * hardware never sees a block that is part large and part small.
+ */
+#include <linux/export.h>
+#include <linux/mm.h>
+
+#include <asm/cacheflush.h>
+#include <asm/pgtable.h>
+#include <asm/tlbflush.h>
+
+static u32 small_to_large(u32 small)
+{
+	return (small & PTE_LARGE_MASK) |
+	       (small & (PTE_BUFFERABLE | PTE_CACHEABLE | PTE_EXT_AP_MASK |
+			 PTE_EXT_APX | PTE_EXT_SHARED | PTE_EXT_NG)) |
+	       ((small & PTE_EXT_TEX(7)) << 6) |
+	       ((small & PTE_EXT_XN) ? PTE_LARGE_XN : 0) |
+	       PTE_TYPE_LARGE;
+}
+
+/*
+ * Called with the page table lock held, before one of the ptes of a large
+ * block is changed.  The stale 64K TLB entry could otherwise go on
+ * translating the other fifteen pages with their old attributes, or be
+ * refilled over pages that have been freed, so break the block, flush
+ * the TLB, then rewrite every entry as the small page its Linux pte says.
+ */
+void __pte_split_large(struct mm_struct *mm, pte_t *ptep)
+{
+	pte_t *pte = (pte_t *)((unsigned long)ptep &
+			       ~(PTE_LARGE_PTRS * sizeof(pte_t) - 1));
+	u32 *hw = (u32 *)(pte + PTE_HWTABLE_PTRS);
+	int i;
+
+	for (i = 0; i < PTE_LARGE_PTRS; i++)
+		hw[i] = 0;
+	clean_dcache_area(hw, PTE_LARGE_PTRS * sizeof(u32));
+	flush_tlb_mm(mm);
+
+	for (i = 0; i < PTE_LARGE_PTRS; i++)
+		set_pte_ext(pte + i, pte[i], PTE_EXT_NG);
+}
+EXPORT_SYMBOL(__pte_split_large);
+
+/*
+ * Turn the sixteen small ptes mapping the 64K aligned block at @addr into
+ * one large page, provided they map 64K aligned, contiguous pfns.
+ */
+static int pte_block_mklarge(struct vm_area_struct *vma, unsigned long addr)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *pte;
+	spinlock_t *ptl;
+	u32 *hw, large;
+	unsigned long pfn;
+	int i, ret = -EINVAL;
+
+	pgd = pgd_offset(mm, addr);
+	pud = pud_offset(pgd, addr);
+	pmd = pmd_offset(pud, addr);
+	if (pmd_none(*pmd) || pmd_bad(*pmd))
+		return -EINVAL;
+
+	pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	pfn = pte_pfn(*pte);
+	if (pfn & (PTE_LARGE_PTRS - 1))
+		goto out;
+	for (i = 0; i < PTE_LARGE_PTRS; i++) {
+		if (!pte_present(pte[i]) || pte_pfn(pte[i]) != pfn + i)
+			goto out;
+		/* all sixteen must share the same attributes */
+		if ((pte_val(pte[i]) ^ pte_val(pte[0])) & ~PAGE_MASK &
+		    ~(L_PTE_DIRTY | L_PTE_YOUNG))
+			goto out;
+	}
+
+	/*
+	 * Only small page entries can be combined.  Bit 0 of a small page
+	 * entry is XN on ARMv6 and later, so the type is 2 or 3; both map
+	 * onto a large page, see small_to_large().
+	 */
+	hw = (u32 *)(pte + PTE_HWTABLE_PTRS);
+	if (!(hw[0] & PTE_TYPE_SMALL))
+		goto out;
+
+	/*
+	 * The hardware has no dirty or young bits of its own, Linux gets
+	 * them by faulting on the first access to each small page.  Set
+	 * them up front, otherwise the first write would fault a single
+	 * entry of the block back to a small page.
+	 */
+	for (i = 0; i < PTE_LARGE_PTRS; i++) {
+		pte_t entry = pte_mkyoung(pte[i]);
+
+		if (vma->vm_flags & VM_WRITE)
+			entry = pte_mkdirty(entry);
+		set_pte_ext(pte + i, entry, PTE_EXT_NG);
+	}
+
+	large = small_to_large(hw[0]);
+	for (i = 0; i < PTE_LARGE_PTRS; i++)
+		hw[i] = large;
+	clean_dcache_area(hw, PTE_LARGE_PTRS * sizeof(u32));
+	ret = 0;
+out:
+	pte_unmap_unlock(pte, ptl);
+	if (!ret)
+		flush_tlb_range(vma, addr, addr + PTE_LARGE_SIZE);
+	return ret;
+}
+
+int remap_pfn_range_large(struct vm_area_struct *vma, unsigned long addr,
+			  unsigned long pfn, unsigned long size, pgprot_t prot)
+{
+	unsigned long end = addr + size;
+	unsigned long start;
+	int ret;
+
+	ret = remap_pfn_range(vma, addr, pfn, size, prot);
+	if (ret)
+		return ret;
+
+	/* private mappings may be COWed a page at a time */
+	if (!(vma->vm_flags & VM_SHARED))
+		return 0;
+	/* the virtual and physical offsets into a 64K block must agree */
+	if ((addr >> PAGE_SHIFT ^ pfn) & (PTE_LARGE_PTRS - 1))
+		return 0;
+
+	for (start = ALIGN(addr, PTE_LARGE_SIZE);
+	     start + PTE_LARGE_SIZE <= end; start += PTE_LARGE_SIZE)
+		pte_block_mklarge(vma, start);
+	return 0;
+}
+EXPORT_SYMBOL(remap_pfn_range_large);
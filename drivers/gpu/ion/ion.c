@@ -26,16 +26,20 @@
 #include <linux/list.h>
 #include <linux/list_sort.h>
 #include <linux/memblock.h>
+#include <linux/memcontrol.h>
 #include <linux/miscdevice.h>
 #include <linux/export.h>
 #include <linux/mm.h>
 #include <linux/mm_types.h>
+#include <linux/pagemap.h>
 #include <linux/rbtree.h>
+#include <linux/rcupdate.h>
 #include <linux/slab.h>
 #include <linux/seq_file.h>
 #include <linux/uaccess.h>
 #include <linux/debugfs.h>
 #include <linux/dma-buf.h>
+#include <linux/hashtable.h>
 #include <linux/idr.h>
 #include <linux/msm_ion.h>
 #include <trace/events/kmem.h>
@@ -46,15 +50,18 @@
 /**
  * struct ion_device - the metadata of the ion device node
  * @dev:		the actual misc device
- * @buffers:		an rb tree of all the existing buffers
- * @buffer_lock:	lock protecting the tree of buffers
+ * @buffers:		hash of all the existing buffers, keyed by address
+ * @buffer_lock:	lock protecting the hash of buffers
  * @lock:		rwsem protecting the tree of heaps and clients
  * @heaps:		list of all the heaps in the system
  * @user_clients:	list of all the clients created from userspace
  */
+#define ION_BUFFER_HASH_BITS	8
+#define ION_HANDLE_HASH_BITS	6
+
 struct ion_device {
 	struct miscdevice dev;
-	struct rb_root buffers;
+	DECLARE_HASHTABLE(buffers, ION_BUFFER_HASH_BITS);
 	struct mutex buffer_lock;
 	struct rw_semaphore lock;
 	struct plist_head heaps;
@@ -70,25 +77,30 @@ struct ion_device {
  * struct ion_client - a process/hw block local address space
  * @node:		node in the tree of all clients
  * @dev:		backpointer to ion device
- * @handles:		an rb tree of all the handles in this client
+ * @handles:		hash of all the handles in this client, keyed by
+ *			buffer
  * @idr:		an idr space for allocating handle ids
- * @lock:		lock protecting the tree of handles
+ * @lock:		lock protecting the hash of handles
  * @name:		used for debugging
  * @task:		used for debugging
  *
  * A client represents a list of buffers this client may access.
- * The mutex stored here is used to protect both handles tree
+ * The mutex stored here is used to protect both handles hash
  * as well as the handles themselves, and should be held while modifying either.
+ * Lookups by id or by buffer may instead run under rcu_read_lock, taking
+ * their reference with kref_get_unless_zero.
  */
 struct ion_client {
 	struct rb_node node;
 	struct ion_device *dev;
-	struct rb_root handles;
+	DECLARE_HASHTABLE(handles, ION_HANDLE_HASH_BITS);
 	struct idr idr;
 	struct mutex lock;
 	char *name;
 	struct task_struct *task;
 	pid_t pid;
+	struct mm_struct *mm;
+	struct mem_cgroup *memcg;
 	struct dentry *debug_root;
 };
 
@@ -97,9 +109,13 @@ struct ion_client {
  * @ref:		reference count
  * @client:		back pointer to the client the buffer resides in
  * @buffer:		pointer to the buffer
- * @node:		node in the client's handle rbtree
+ * @node:		node in the client's handle hash
  * @kmap_cnt:		count of times this client has mapped to kernel
  * @id:			client-unique id allocated by client->idr
+ * @charged:		pages charged to the client's mm and memcg, only
+ *			set on the handle a buffer was allocated through
+ * @rcu:		handles are freed after a grace period so lockless
+ *			lookups never see freed memory
  *
  * Modifications to node, map_cnt or mapping should be protected by the
  * lock in the client.  Other fields are never changed after initialization.
@@ -108,9 +124,11 @@ struct ion_handle {
 	struct kref ref;
 	struct ion_client *client;
 	struct ion_buffer *buffer;
-	struct rb_node node;
+	struct hlist_node node;
 	unsigned int kmap_cnt;
 	int id;
+	unsigned long charged;
+	struct rcu_head rcu;
 };
 
 bool ion_buffer_fault_user_mappings(struct ion_buffer *buffer)
@@ -124,33 +142,39 @@ bool ion_buffer_cached(struct ion_buffer *buffer)
         return !!(buffer->flags & ION_FLAG_CACHED);
 }
 
-/* this function should only be called while dev->lock is held */
+/* this function should only be called while dev->buffer_lock is held */
 static void ion_buffer_add(struct ion_device *dev,
 			   struct ion_buffer *buffer)
 {
-	struct rb_node **p = &dev->buffers.rb_node;
-	struct rb_node *parent = NULL;
-	struct ion_buffer *entry;
+	hash_add(dev->buffers, &buffer->node, (unsigned long)buffer);
+}
 
-	while (*p) {
-		parent = *p;
-		entry = rb_entry(parent, struct ion_buffer, node);
+static int ion_buffer_alloc_dirty(struct ion_buffer *buffer);
 
-		if (buffer < entry) {
-			p = &(*p)->rb_left;
-		} else if (buffer > entry) {
-			p = &(*p)->rb_right;
-		} else {
-			pr_err("%s: buffer already found.", __func__);
-			BUG();
-		}
-	}
+/*
+ * Reset a buffer taken back off the deferred free list.  Its memory, sg
+ * table and lock are still set up from the first time it was created.
+ */
+/* the allocating task, until the last handle goes, see below */
+static void ion_buffer_set_owner(struct ion_buffer *buffer)
+{
+	struct task_struct *task = current->group_leader;
 
-	rb_link_node(&buffer->node, parent, p);
-	rb_insert_color(&buffer->node, &dev->buffers);
+	get_task_comm(buffer->task_comm, task);
+	buffer->pid = task_pid_nr(task);
 }
 
-static int ion_buffer_alloc_dirty(struct ion_buffer *buffer);
+static void ion_buffer_reinit(struct ion_buffer *buffer)
+{
+	kref_init(&buffer->ref);
+	buffer->handle_count = 0;
+	buffer->kmap_cnt = 0;
+	buffer->dmap_cnt = 0;
+	buffer->vaddr = NULL;
+	if (ion_buffer_fault_user_mappings(buffer))
+		bitmap_zero(buffer->dirty, buffer->sg_table->nents);
+	ion_buffer_set_owner(buffer);
+}
 
 /* this function should only be called while dev->lock is held */
 static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
@@ -164,6 +188,17 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 	struct scatterlist *sg;
 	int i, ret;
 
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE) {
+		buffer = ion_heap_freelist_reuse(heap, len, align, flags);
+		if (buffer) {
+			ion_buffer_reinit(buffer);
+			mutex_lock(&dev->buffer_lock);
+			ion_buffer_add(dev, buffer);
+			mutex_unlock(&dev->buffer_lock);
+			return buffer;
+		}
+	}
+
 	buffer = kzalloc(sizeof(struct ion_buffer), GFP_KERNEL);
 	if (!buffer)
 		return ERR_PTR(-ENOMEM);
@@ -171,6 +206,7 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 	buffer->heap = heap;
 	buffer->flags = flags;
 	kref_init(&buffer->ref);
+	ion_buffer_set_owner(buffer);
 
 	ret = heap->ops->allocate(heap, buffer, len, align, flags);
 
@@ -266,7 +302,7 @@ static void _ion_buffer_destroy(struct kref *kref)
 	struct ion_device *dev = buffer->dev;
 
 	mutex_lock(&dev->buffer_lock);
-	rb_erase(&buffer->node, &dev->buffers);
+	hash_del(&buffer->node);
 	mutex_unlock(&dev->buffer_lock);
 
 	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE)
@@ -306,13 +342,8 @@ static void ion_buffer_remove_from_handle(struct ion_buffer *buffer)
 	mutex_lock(&buffer->lock);
 	buffer->handle_count--;
 	BUG_ON(buffer->handle_count < 0);
-	if (!buffer->handle_count) {
-		struct task_struct *task;
-
-		task = current->group_leader;
-		get_task_comm(buffer->task_comm, task);
-		buffer->pid = task_pid_nr(task);
-	}
+	if (!buffer->handle_count)
+		ion_buffer_set_owner(buffer);
 	mutex_unlock(&buffer->lock);
 }
 
@@ -325,7 +356,7 @@ static struct ion_handle *ion_handle_create(struct ion_client *client,
 	if (!handle)
 		return ERR_PTR(-ENOMEM);
 	kref_init(&handle->ref);
-	rb_init_node(&handle->node);
+	INIT_HLIST_NODE(&handle->node);
 	handle->client = client;
 	ion_buffer_get(buffer);
 	ion_buffer_add_to_handle(buffer);
@@ -336,6 +367,45 @@ static struct ion_handle *ion_handle_create(struct ion_client *client,
 
 static void ion_handle_kmap_put(struct ion_handle *);
 
+/*
+ * Buffers from heaps backed by system memory are charged to the mm and
+ * memcg of the process that allocated them, so the lowmemorykiller and
+ * the oom killer see what killing it would give back.
+ */
+static void ion_handle_charge(struct ion_handle *handle)
+{
+	struct ion_client *client = handle->client;
+	struct ion_buffer *buffer = handle->buffer;
+
+	if (!client->mm)
+		return;
+
+	switch ((int)buffer->heap->type) {
+	case ION_HEAP_TYPE_SYSTEM:
+	case ION_HEAP_TYPE_SYSTEM_CONTIG:
+	case ION_HEAP_TYPE_DMA:
+		break;
+	default:
+		return;
+	}
+
+	handle->charged = PAGE_ALIGN(buffer->size) >> PAGE_SHIFT;
+	add_mm_counter(client->mm, MM_IONPAGES, handle->charged);
+	mem_cgroup_ion_stat(client->memcg, handle->charged);
+}
+
+static void ion_handle_uncharge(struct ion_handle *handle)
+{
+	struct ion_client *client = handle->client;
+
+	if (!handle->charged)
+		return;
+
+	add_mm_counter(client->mm, MM_IONPAGES, -handle->charged);
+	mem_cgroup_ion_stat(client->memcg, -handle->charged);
+	handle->charged = 0;
+}
+
 static void ion_handle_destroy(struct kref *kref)
 {
 	struct ion_handle *handle = container_of(kref, struct ion_handle, ref);
@@ -347,14 +417,18 @@ static void ion_handle_destroy(struct kref *kref)
 		ion_handle_kmap_put(handle);
 	mutex_unlock(&buffer->lock);
 
-	idr_remove(&client->idr, handle->id);
-	if (!RB_EMPTY_NODE(&handle->node))
-		rb_erase(&handle->node, &client->handles);
+	ion_handle_uncharge(handle);
+
+	/* ids start at 1, so 0 means the handle never made it into the idr */
+	if (handle->id)
+		idr_remove(&client->idr, handle->id);
+	if (hash_hashed(&handle->node))
+		hash_del_rcu(&handle->node);
 
 	ion_buffer_remove_from_handle(buffer);
 	ion_buffer_put(buffer);
 
-	kfree(handle);
+	kfree_rcu(handle, rcu);
 }
 
 struct ion_buffer *ion_handle_buffer(struct ion_handle *handle)
@@ -379,17 +453,17 @@ int ion_handle_put(struct ion_handle *handle)
 	return ret;
 }
 
+/* must be called with client->lock or rcu_read_lock held */
 static struct ion_handle *ion_handle_lookup(struct ion_client *client,
 					    struct ion_buffer *buffer)
 {
-	struct rb_node *n;
+	struct ion_handle *handle;
+	struct hlist_node *n;
 
-	for (n = rb_first(&client->handles); n; n = rb_next(n)) {
-		struct ion_handle *handle = rb_entry(n, struct ion_handle,
-						   node);
+	hash_for_each_possible_rcu(client->handles, handle, n, node,
+				   (unsigned long)buffer)
 		if (handle->buffer == buffer)
 			return handle;
-	}
 	return NULL;
 }
 
@@ -398,11 +472,11 @@ struct ion_handle *ion_handle_get_by_id(struct ion_client *client,
 {
 	struct ion_handle *handle;
 
-	mutex_lock(&client->lock);
+	rcu_read_lock();
 	handle = idr_find(&client->idr, id);
-	if (handle)
-		ion_handle_get(handle);
-	mutex_unlock(&client->lock);
+	if (handle && !kref_get_unless_zero(&handle->ref))
+		handle = NULL;
+	rcu_read_unlock();
 
 	return handle ? handle : ERR_PTR(-EINVAL);
 }
@@ -416,9 +490,6 @@ static bool ion_handle_validate(struct ion_client *client, struct ion_handle *ha
 static int ion_handle_add(struct ion_client *client, struct ion_handle *handle)
 {
 	int rc;
-	struct rb_node **p = &client->handles.rb_node;
-	struct rb_node *parent = NULL;
-	struct ion_handle *entry;
 
 	do {
 		int id;
@@ -432,20 +503,8 @@ static int ion_handle_add(struct ion_client *client, struct ion_handle *handle)
 	if (rc < 0)
 		return rc;
 
-	while (*p) {
-		parent = *p;
-		entry = rb_entry(parent, struct ion_handle, node);
-
-		if (handle < entry)
-			p = &(*p)->rb_left;
-		else if (handle > entry)
-			p = &(*p)->rb_right;
-		else
-			WARN(1, "%s: buffer already found.", __func__);
-	}
-
-	rb_link_node(&handle->node, parent, p);
-	rb_insert_color(&handle->node, &client->handles);
+	hash_add_rcu(client->handles, &handle->node,
+		     (unsigned long)handle->buffer);
 
 	return 0;
 }
@@ -554,6 +613,8 @@ struct ion_handle *ion_alloc(struct ion_client *client, size_t len,
 
 	mutex_lock(&client->lock);
 	ret = ion_handle_add(client, handle);
+	if (!ret)
+		ion_handle_charge(handle);
 	mutex_unlock(&client->lock);
 	if (ret) {
 		ion_handle_put(handle);
@@ -704,17 +765,16 @@ EXPORT_SYMBOL(ion_unmap_kernel);
 static int ion_debug_client_show(struct seq_file *s, void *unused)
 {
 	struct ion_client *client = s->private;
-	struct rb_node *n;
+	struct ion_handle *handle;
+	struct hlist_node *n;
+	int bkt;
 
 	seq_printf(s, "%16.16s: %16.16s : %16.16s : %12.12s\n",
 			"heap_name", "size_in_bytes", "handle refcount",
 			"buffer");
 
 	mutex_lock(&client->lock);
-	for (n = rb_first(&client->handles); n; n = rb_next(n)) {
-		struct ion_handle *handle = rb_entry(n, struct ion_handle,
-						     node);
-
+	hash_for_each(client->handles, bkt, n, handle, node) {
 		seq_printf(s, "%16.16s: %16x : %16d : %12p",
 				handle->buffer->heap->name,
 				handle->buffer->size,
@@ -809,7 +869,7 @@ struct ion_client *ion_client_create(struct ion_device *dev,
 	}
 
 	client->dev = dev;
-	client->handles = RB_ROOT;
+	hash_init(client->handles);
 	idr_init(&client->idr);
 	mutex_init(&client->lock);
 
@@ -822,6 +882,19 @@ struct ion_client *ion_client_create(struct ion_device *dev,
 
 	client->task = task;
 	client->pid = pid;
+	if (task) {
+		/*
+		 * Pin the mm_struct, not the address space: the charges
+		 * against it are dropped with the handles, which may be
+		 * after the process has exited its mm.
+		 */
+		client->mm = get_task_mm(task);
+		if (client->mm) {
+			atomic_inc(&client->mm->mm_count);
+			client->memcg = mem_cgroup_ion_get(client->mm);
+			mmput(client->mm);
+		}
+	}
 
 	down_write(&dev->lock);
 	client_serial = ion_get_client_serial(&dev->clients, name);
@@ -859,18 +932,22 @@ EXPORT_SYMBOL(ion_client_create);
 void ion_client_destroy(struct ion_client *client)
 {
 	struct ion_device *dev = client->dev;
-	struct rb_node *n;
+	struct ion_handle *handle;
+	struct hlist_node *n, *tmp;
+	int bkt;
 
 	pr_debug("%s: %d\n", __func__, __LINE__);
-	while ((n = rb_first(&client->handles))) {
-		struct ion_handle *handle = rb_entry(n, struct ion_handle,
-						     node);
+	hash_for_each_safe(client->handles, bkt, n, tmp, handle, node)
 		ion_handle_destroy(&handle->ref);
-	}
 
 	idr_remove_all(&client->idr);
 	idr_destroy(&client->idr);
 
+	if (client->mm) {
+		mem_cgroup_ion_put(client->memcg);
+		mmdrop(client->mm);
+	}
+
 	down_write(&dev->lock);
 	if (client->task)
 		put_task_struct(client->task);
@@ -1014,35 +1091,118 @@ struct ion_vma_list {
 	struct vm_area_struct *vma;
 };
 
-static void ion_buffer_sync_for_device(struct ion_buffer *buffer,
-				       struct device *dev,
-				       enum dma_data_direction dir)
+static void ion_buffer_zap_page(struct ion_buffer *buffer, unsigned long pgoff)
+{
+	struct ion_vma_list *vma_list;
+
+	list_for_each_entry(vma_list, &buffer->vmas, list) {
+		struct vm_area_struct *vma = vma_list->vma;
+		unsigned long addr;
+
+		if (pgoff < vma->vm_pgoff)
+			continue;
+		addr = vma->vm_start + ((pgoff - vma->vm_pgoff) << PAGE_SHIFT);
+		if (addr >= vma->vm_end)
+			continue;
+		zap_page_range(vma, addr, PAGE_SIZE, NULL);
+	}
+}
+
+/*
+ * Only pages that were written through a user mapping are synced.  For
+ * DMA_TO_DEVICE just those pages are unmapped again, so the next store to
+ * them goes through ion_vm_page_mkwrite and marks them dirty; everything
+ * else stays mapped.  For the other directions the device may write the
+ * buffer, so every user mapping is torn down and refaulting invalidates
+ * any stale lines.  Must be called with buffer->lock held.
+ */
+static void __ion_buffer_sync_dirty(struct ion_buffer *buffer,
+				    struct device *dev,
+				    enum dma_data_direction dir)
 {
 	struct scatterlist *sg;
-	int i;
 	struct ion_vma_list *vma_list;
+	int i, synced = 0;
 
-	pr_debug("%s: syncing for device %s\n", __func__,
-		 dev ? dev_name(dev) : "null");
+	if (dir != DMA_TO_DEVICE) {
+		list_for_each_entry(vma_list, &buffer->vmas, list) {
+			struct vm_area_struct *vma = vma_list->vma;
 
-	if (!ion_buffer_fault_user_mappings(buffer))
-		return;
+			zap_page_range(vma, vma->vm_start,
+				       vma->vm_end - vma->vm_start, NULL);
+		}
+	}
 
-	mutex_lock(&buffer->lock);
 	for_each_sg(buffer->sg_table->sgl, sg, buffer->sg_table->nents, i) {
 		if (!test_bit(i, buffer->dirty))
 			continue;
-		dma_sync_sg_for_device(dev, sg, 1, dir);
+		if (dir == DMA_TO_DEVICE)
+			ion_buffer_zap_page(buffer, i);
 		clear_bit(i, buffer->dirty);
+		dma_sync_sg_for_device(dev, sg, 1, dir);
+		synced++;
 	}
-	list_for_each_entry(vma_list, &buffer->vmas, list) {
-		struct vm_area_struct *vma = vma_list->vma;
 
-		zap_page_range(vma, vma->vm_start, vma->vm_end - vma->vm_start,
-			       NULL);
+	pr_debug("%s: synced %d of %d pages\n", __func__, synced,
+		 buffer->sg_table->nents);
+}
+
+static void ion_buffer_sync_for_device(struct ion_buffer *buffer,
+				       struct device *dev,
+				       enum dma_data_direction dir)
+{
+	pr_debug("%s: syncing for device %s\n", __func__,
+		 dev ? dev_name(dev) : "null");
+
+	if (!ion_buffer_fault_user_mappings(buffer))
+		return;
+
+	mutex_lock(&buffer->lock);
+	__ion_buffer_sync_dirty(buffer, dev, dir);
+	mutex_unlock(&buffer->lock);
+}
+
+/*
+ * Like ion_buffer_sync_for_device, but refuses (-EINVAL) when the dirty
+ * bitmap can't be trusted to cover every cpu write: buffers that aren't
+ * faulted in, or that also have a kernel mapping.  Callers fall back to
+ * maintaining the whole buffer.
+ */
+static int ion_buffer_sync_dirty(struct ion_buffer *buffer,
+				 struct device *dev,
+				 enum dma_data_direction dir)
+{
+	if (!ion_buffer_fault_user_mappings(buffer))
+		return -EINVAL;
+
+	mutex_lock(&buffer->lock);
+	if (buffer->kmap_cnt) {
+		mutex_unlock(&buffer->lock);
+		return -EINVAL;
 	}
+	__ion_buffer_sync_dirty(buffer, dev, dir);
 	mutex_unlock(&buffer->lock);
+	return 0;
+}
+
+int ion_handle_sync_dirty(struct ion_client *client, struct ion_handle *handle,
+			  enum dma_data_direction dir)
+{
+	struct ion_buffer *buffer;
+
+	mutex_lock(&client->lock);
+	if (!ion_handle_validate(client, handle)) {
+		pr_err("%s: invalid handle passed to %s.\n",
+		       __func__, __func__);
+		mutex_unlock(&client->lock);
+		return -EINVAL;
+	}
+	buffer = handle->buffer;
+	mutex_unlock(&client->lock);
+
+	return ion_buffer_sync_dirty(buffer, NULL, dir);
 }
+EXPORT_SYMBOL(ion_handle_sync_dirty);
 
 int ion_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 {
@@ -1050,9 +1210,12 @@ int ion_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	struct scatterlist *sg;
 	int i;
 
+	/*
+	 * Shared writable mappings are write protected (see
+	 * ion_vm_page_mkwrite), so the page is only marked dirty once it
+	 * is actually stored to, not when it is first read.
+	 */
 	mutex_lock(&buffer->lock);
-	set_bit(vmf->pgoff, buffer->dirty);
-
 	for_each_sg(buffer->sg_table->sgl, sg, buffer->sg_table->nents, i) {
 		if (i != vmf->pgoff)
 			continue;
@@ -1065,6 +1228,26 @@ int ion_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	return VM_FAULT_NOPAGE;
 }
 
+static int ion_vm_page_mkwrite(struct vm_area_struct *vma,
+			       struct vm_fault *vmf)
+{
+	struct ion_buffer *buffer = vma->vm_private_data;
+	unsigned long pgoff;
+
+	/* vmf->pgoff is page->index here, which ion pages don't set */
+	pgoff = (((unsigned long)vmf->virtual_address - vma->vm_start)
+		 >> PAGE_SHIFT) + vma->vm_pgoff;
+	if (pgoff >= buffer->sg_table->nents)
+		return VM_FAULT_SIGBUS;
+
+	mutex_lock(&buffer->lock);
+	set_bit(pgoff, buffer->dirty);
+	mutex_unlock(&buffer->lock);
+
+	lock_page(vmf->page);
+	return VM_FAULT_LOCKED;
+}
+
 static void ion_vm_open(struct vm_area_struct *vma)
 {
 	struct ion_buffer *buffer = vma->vm_private_data;
@@ -1105,6 +1288,7 @@ struct vm_operations_struct ion_vma_ops = {
 	.open = ion_vm_open,
 	.close = ion_vm_close,
 	.fault = ion_vm_fault,
+	.page_mkwrite = ion_vm_page_mkwrite,
 };
 
 static int ion_mmap(struct dma_buf *dmabuf, struct vm_area_struct *vma)
@@ -1255,7 +1439,7 @@ struct ion_handle *ion_import_dma_buf(struct ion_client *client, int fd)
 {
 	struct dma_buf *dmabuf;
 	struct ion_buffer *buffer;
-	struct ion_handle *handle;
+	struct ion_handle *handle, *new;
 	int ret;
 
 	dmabuf = dma_buf_get(fd);
@@ -1271,26 +1455,37 @@ struct ion_handle *ion_import_dma_buf(struct ion_client *client, int fd)
 	}
 	buffer = dmabuf->priv;
 
-	mutex_lock(&client->lock);
 	/* if a handle exists for this buffer just take a reference to it */
+	rcu_read_lock();
 	handle = ion_handle_lookup(client, buffer);
-	if (!IS_ERR_OR_NULL(handle)) {
-		ion_handle_get(handle);
-		mutex_unlock(&client->lock);
+	if (handle && !kref_get_unless_zero(&handle->ref))
+		handle = NULL;
+	rcu_read_unlock();
+	if (handle)
 		goto end;
-	}
-	mutex_unlock(&client->lock);
 
-	handle = ion_handle_create(client, buffer);
-	if (IS_ERR_OR_NULL(handle))
+	new = ion_handle_create(client, buffer);
+	if (IS_ERR_OR_NULL(new)) {
+		handle = new;
 		goto end;
+	}
 
 	mutex_lock(&client->lock);
-	ret = ion_handle_add(client, handle);
+	/* somebody else may have imported it while we weren't looking */
+	handle = ion_handle_lookup(client, buffer);
+	if (handle) {
+		ion_handle_get(handle);
+		mutex_unlock(&client->lock);
+		ion_handle_put(new);
+		goto end;
+	}
+	ret = ion_handle_add(client, new);
 	mutex_unlock(&client->lock);
 	if (ret) {
-		ion_handle_put(handle);
+		ion_handle_put(new);
 		handle = ERR_PTR(ret);
+	} else {
+		handle = new;
 	}
 
 end:
@@ -1317,8 +1512,10 @@ static int ion_sync_for_device(struct ion_client *client, int fd)
 	}
 	buffer = dmabuf->priv;
 
-	dma_sync_sg_for_device(NULL, buffer->sg_table->sgl,
-			       buffer->sg_table->nents, DMA_BIDIRECTIONAL);
+	if (ion_buffer_sync_dirty(buffer, NULL, DMA_BIDIRECTIONAL))
+		dma_sync_sg_for_device(NULL, buffer->sg_table->sgl,
+				       buffer->sg_table->nents,
+				       DMA_BIDIRECTIONAL);
 	dma_buf_put(dmabuf);
 	return 0;
 }
@@ -1477,13 +1674,12 @@ static size_t ion_debug_heap_total(struct ion_client *client,
 				   unsigned int id)
 {
 	size_t size = 0;
-	struct rb_node *n;
+	struct ion_handle *handle;
+	struct hlist_node *n;
+	int bkt;
 
 	mutex_lock(&client->lock);
-	for (n = rb_first(&client->handles); n; n = rb_next(n)) {
-		struct ion_handle *handle = rb_entry(n,
-						     struct ion_handle,
-						     node);
+	hash_for_each(client->handles, bkt, n, handle, node) {
 		if (handle->buffer->heap->id == id)
 			size += handle->buffer->size;
 	}
@@ -1510,15 +1706,14 @@ void ion_debug_mem_map_create(struct seq_file *s, struct ion_heap *heap,
 
 	down_read(&dev->lock);
 	for (cnode = rb_first(&dev->clients); cnode; cnode = rb_next(cnode)) {
-		struct rb_node *hnode;
+		struct ion_handle *handle;
+		struct hlist_node *hnode;
+		int bkt;
+
 		client = rb_entry(cnode, struct ion_client, node);
 
 		mutex_lock(&client->lock);
-		for (hnode = rb_first(&client->handles);
-		     hnode;
-		     hnode = rb_next(hnode)) {
-			struct ion_handle *handle = rb_entry(
-				hnode, struct ion_handle, node);
+		hash_for_each(client->handles, bkt, hnode, handle, node) {
 			if (handle->buffer->heap == heap) {
 				struct mem_map_data *data =
 					kzalloc(sizeof(*data), GFP_KERNEL);
@@ -1595,9 +1790,12 @@ static int ion_debug_heap_show(struct seq_file *s, void *unused)
 {
 	struct ion_heap *heap = s->private;
 	struct ion_device *dev = heap->dev;
+	struct ion_buffer *buffer;
 	struct rb_node *n;
+	struct hlist_node *hn;
 	size_t total_size = 0;
 	size_t total_orphaned_size = 0;
+	int bkt;
 
 	seq_printf(s, "%16.s %16.s %16.s\n", "client", "pid", "size");
 	seq_printf(s, "----------------------------------------------------\n");
@@ -1625,9 +1823,7 @@ static int ion_debug_heap_show(struct seq_file *s, void *unused)
 	seq_printf(s, "orphaned allocations (info is from last known client):"
 		   "\n");
 	mutex_lock(&dev->buffer_lock);
-	for (n = rb_first(&dev->buffers); n; n = rb_next(n)) {
-		struct ion_buffer *buffer = rb_entry(n, struct ion_buffer,
-						     node);
+	hash_for_each(dev->buffers, bkt, hn, buffer, node) {
 		if (buffer->heap->id != heap->id)
 			continue;
 		total_size += buffer->size;
@@ -1645,6 +1841,9 @@ static int ion_debug_heap_show(struct seq_file *s, void *unused)
 	seq_printf(s, "%16.s %16u\n", "total ", total_size);
 	seq_printf(s, "----------------------------------------------------\n");
 
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE)
+		ion_heap_freelist_debug_show(heap, s);
+
 	if (heap->debug_show)
 		heap->debug_show(heap, s, unused);
 
@@ -1731,6 +1930,21 @@ void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap)
 			path, heap->name);
 	}
 
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE) {
+		char debug_name[64];
+
+		snprintf(debug_name, 64, "%s_freelist_max", heap->name);
+		debug_file = debugfs_create_size_t(
+			debug_name, 0644, dev->heaps_debug_root,
+			&heap->free_list_max);
+		if (!debug_file) {
+			char buf[256], *path;
+			path = dentry_path(dev->heaps_debug_root, buf, 256);
+			pr_err("Failed to created heap freelist debugfs at %s/%s\n",
+				path, debug_name);
+		}
+	}
+
 #ifdef DEBUG_HEAP_SHRINKER
 	if (heap->shrinker.shrink) {
 		char debug_name[64];
@@ -1933,7 +2147,7 @@ struct ion_device *ion_device_create(long (*custom_ioctl)
 debugfs_done:
 
 	idev->custom_ioctl = custom_ioctl;
-	idev->buffers = RB_ROOT;
+	hash_init(idev->buffers);
 	mutex_init(&idev->buffer_lock);
 	init_rwsem(&idev->lock);
 	plist_head_init(&idev->heaps);
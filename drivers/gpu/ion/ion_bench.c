@@ -0,0 +1,387 @@
+/*
+ * drivers/gpu/ion/ion_bench.c
+ *
+ * In-kernel allocation benchmark and stress driver for ion.
+ *
+ * Copyright (c) 2014, The Linux Foundation. All rights reserved.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Usage, from debugfs (usually /sys/kernel/debug/ion_bench):
+ *
+ *   echo 25 > heap_id         heap to allocate from (ION_SYSTEM_HEAP_ID)
+ *   echo 1048576 > size       bytes per allocation
+ *   echo 1 > flags            ion allocation flags, e.g. ION_FLAG_CACHED
+ *   echo 1000 > iterations    allocations per thread
+ *   echo 4 > threads          number of concurrent clients
+ *   echo 64 > pressure_mb     memory held hostage while the test runs
+ *   echo 1 > run
+ *   cat results
+ *
+ * Each iteration allocates a buffer, maps it into the kernel and touches
+ * every page, exports it as a dma-buf, then frees it.  The latency of
+ * each step is recorded and reported as percentiles.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/dma-buf.h>
+#include <linux/err.h>
+#include <linux/ion.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/msm_ion.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include "ion_priv.h"
+
+#define ION_BENCH_MAX_THREADS	32
+
+enum ion_bench_op {
+	ION_BENCH_ALLOC,
+	ION_BENCH_MAP,
+	ION_BENCH_SHARE,
+	ION_BENCH_FREE,
+	ION_BENCH_NUM_OPS,
+};
+
+static const char * const ion_bench_op_names[ION_BENCH_NUM_OPS] = {
+	"alloc", "map", "share", "free",
+};
+
+/* the knobs as they were when the run started */
+struct ion_bench_params {
+	u32 heap_id;
+	u32 size;
+	u32 flags;
+	u32 iterations;
+	u32 pressure_mb;
+};
+
+struct ion_bench_thread {
+	struct task_struct *task;
+	const struct ion_bench_params *p;
+	int id;
+	u32 *lat[ION_BENCH_NUM_OPS];
+	unsigned int done;
+	unsigned int failed;
+};
+
+static struct dentry *ion_bench_root;
+static DEFINE_MUTEX(ion_bench_lock);
+static DECLARE_WAIT_QUEUE_HEAD(ion_bench_wait);
+static atomic_t ion_bench_running;
+
+static u32 ion_bench_heap_id = ION_SYSTEM_HEAP_ID;
+static u32 ion_bench_size = SZ_1M;
+static u32 ion_bench_flags;
+static u32 ion_bench_iterations = 256;
+static u32 ion_bench_threads = 1;
+static u32 ion_bench_pressure_mb;
+
+static char *ion_bench_report;
+static size_t ion_bench_report_len;
+
+static u32 ion_bench_elapsed(ktime_t start)
+{
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	return min_t(s64, ns, UINT_MAX);
+}
+
+static int ion_bench_thread_fn(void *data)
+{
+	struct ion_bench_thread *t = data;
+	const struct ion_bench_params *p = t->p;
+	struct ion_client *client;
+	char name[32];
+	unsigned int i;
+
+	snprintf(name, sizeof(name), "ion_bench-%d", t->id);
+	client = msm_ion_client_create(-1, name);
+	if (IS_ERR_OR_NULL(client)) {
+		t->failed = p->iterations;
+		goto out;
+	}
+
+	for (i = 0; i < p->iterations; i++) {
+		struct ion_handle *handle;
+		struct dma_buf *dmabuf;
+		ktime_t start;
+		char *vaddr;
+		size_t off;
+
+		start = ktime_get();
+		handle = ion_alloc(client, p->size, SZ_4K,
+				   ION_HEAP(p->heap_id), p->flags);
+		t->lat[ION_BENCH_ALLOC][t->done] = ion_bench_elapsed(start);
+		if (IS_ERR_OR_NULL(handle)) {
+			t->failed++;
+			continue;
+		}
+
+		start = ktime_get();
+		vaddr = ion_map_kernel(client, handle);
+		if (!IS_ERR_OR_NULL(vaddr)) {
+			for (off = 0; off < p->size; off += PAGE_SIZE)
+				vaddr[off] = 1;
+			ion_unmap_kernel(client, handle);
+		}
+		t->lat[ION_BENCH_MAP][t->done] = ion_bench_elapsed(start);
+
+		start = ktime_get();
+		dmabuf = ion_share_dma_buf(client, handle);
+		if (!IS_ERR_OR_NULL(dmabuf))
+			dma_buf_put(dmabuf);
+		t->lat[ION_BENCH_SHARE][t->done] = ion_bench_elapsed(start);
+
+		start = ktime_get();
+		ion_free(client, handle);
+		t->lat[ION_BENCH_FREE][t->done] = ion_bench_elapsed(start);
+
+		t->done++;
+		cond_resched();
+	}
+
+	ion_client_destroy(client);
+out:
+	if (atomic_dec_and_test(&ion_bench_running))
+		wake_up(&ion_bench_wait);
+	return 0;
+}
+
+static int ion_bench_cmp(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* @permille is the percentile in tenths of a percent */
+static u32 ion_bench_pct(u32 *sorted, unsigned int n, unsigned int permille)
+{
+	if (!n)
+		return 0;
+	return sorted[min(n - 1, (n * permille) / 1000)] / NSEC_PER_USEC;
+}
+
+/* hold on to pressure_mb of memory so pools and the allocator have to work */
+static void ion_bench_pressure(struct list_head *held, unsigned int mb)
+{
+	unsigned long nr = (unsigned long)mb << (20 - PAGE_SHIFT);
+	struct page *page;
+
+	while (nr--) {
+		page = alloc_page(GFP_HIGHUSER | __GFP_NOWARN | __GFP_NORETRY);
+		if (!page)
+			break;
+		list_add(&page->lru, held);
+	}
+}
+
+static void ion_bench_release(struct list_head *held)
+{
+	struct page *page, *tmp;
+
+	list_for_each_entry_safe(page, tmp, held, lru) {
+		list_del(&page->lru);
+		__free_page(page);
+	}
+}
+
+static int ion_bench_run(void)
+{
+	struct ion_bench_params p = {
+		.heap_id	= ion_bench_heap_id,
+		.size		= ion_bench_size,
+		.flags		= ion_bench_flags,
+		.iterations	= ion_bench_iterations,
+		.pressure_mb	= ion_bench_pressure_mb,
+	};
+	struct ion_bench_thread *threads;
+	unsigned int nthreads = clamp_t(u32, ion_bench_threads, 1,
+					ION_BENCH_MAX_THREADS);
+	unsigned int total = 0, failed = 0, op, i;
+	size_t report_size = 2048, len = 0;
+	u32 *all = NULL;
+	char *report;
+	LIST_HEAD(held);
+	ktime_t start;
+	u32 wall;
+	int ret = 0;
+
+	if (!p.iterations || !p.size)
+		return -EINVAL;
+
+	threads = kcalloc(nthreads, sizeof(*threads), GFP_KERNEL);
+	report = kzalloc(report_size, GFP_KERNEL);
+	if (!threads || !report) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		threads[i].id = i;
+		threads[i].p = &p;
+		for (op = 0; op < ION_BENCH_NUM_OPS; op++) {
+			threads[i].lat[op] = vmalloc(sizeof(u32) *
+						     p.iterations);
+			if (!threads[i].lat[op]) {
+				ret = -ENOMEM;
+				goto out;
+			}
+		}
+	}
+
+	all = vmalloc(sizeof(u32) * p.iterations * nthreads);
+	if (!all) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ion_bench_pressure(&held, p.pressure_mb);
+
+	atomic_set(&ion_bench_running, nthreads);
+	start = ktime_get();
+	for (i = 0; i < nthreads; i++) {
+		threads[i].task = kthread_run(ion_bench_thread_fn, &threads[i],
+					      "ion_bench/%d", i);
+		if (IS_ERR(threads[i].task)) {
+			threads[i].failed = p.iterations;
+			if (atomic_dec_and_test(&ion_bench_running))
+				wake_up(&ion_bench_wait);
+		}
+	}
+	wait_event(ion_bench_wait, atomic_read(&ion_bench_running) == 0);
+	wall = ion_bench_elapsed(start);
+
+	ion_bench_release(&held);
+
+	for (i = 0; i < nthreads; i++) {
+		total += threads[i].done;
+		failed += threads[i].failed;
+	}
+
+	len += scnprintf(report + len, report_size - len,
+			 "heap %u size %u flags 0x%x threads %u pressure %uMB\n"
+			 "%u iterations ok, %u failed, %u us wall clock\n"
+			 "%-6s %10s %10s %10s %10s %10s (us)\n",
+			 p.heap_id, p.size, p.flags,
+			 nthreads, p.pressure_mb, total, failed,
+			 wall / NSEC_PER_USEC, "op", "p50", "p90", "p99",
+			 "p99.9", "max");
+
+	for (op = 0; op < ION_BENCH_NUM_OPS; op++) {
+		unsigned int n = 0;
+
+		for (i = 0; i < nthreads; i++) {
+			memcpy(all + n, threads[i].lat[op],
+			       sizeof(u32) * threads[i].done);
+			n += threads[i].done;
+		}
+		sort(all, n, sizeof(u32), ion_bench_cmp, NULL);
+		len += scnprintf(report + len, report_size - len,
+				 "%-6s %10u %10u %10u %10u %10u\n",
+				 ion_bench_op_names[op],
+				 ion_bench_pct(all, n, 500),
+				 ion_bench_pct(all, n, 900),
+				 ion_bench_pct(all, n, 990),
+				 ion_bench_pct(all, n, 999),
+				 ion_bench_pct(all, n, 1000));
+	}
+
+	kfree(ion_bench_report);
+	ion_bench_report = report;
+	ion_bench_report_len = len;
+	report = NULL;
+
+out:
+	vfree(all);
+	if (threads)
+		for (i = 0; i < nthreads; i++)
+			for (op = 0; op < ION_BENCH_NUM_OPS; op++)
+				vfree(threads[i].lat[op]);
+	kfree(threads);
+	kfree(report);
+	return ret;
+}
+
+static ssize_t ion_bench_run_write(struct file *file, const char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	int ret;
+
+	mutex_lock(&ion_bench_lock);
+	ret = ion_bench_run();
+	mutex_unlock(&ion_bench_lock);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations ion_bench_run_fops = {
+	.write = ion_bench_run_write,
+};
+
+static ssize_t ion_bench_results_read(struct file *file, char __user *buf,
+				      size_t count, loff_t *ppos)
+{
+	ssize_t ret;
+
+	mutex_lock(&ion_bench_lock);
+	ret = simple_read_from_buffer(buf, count, ppos, ion_bench_report,
+				      ion_bench_report_len);
+	mutex_unlock(&ion_bench_lock);
+	return ret;
+}
+
+static const struct file_operations ion_bench_results_fops = {
+	.read = ion_bench_results_read,
+};
+
+static int __init ion_bench_init(void)
+{
+	ion_bench_root = debugfs_create_dir("ion_bench", NULL);
+	if (IS_ERR_OR_NULL(ion_bench_root))
+		return -ENODEV;
+
+	debugfs_create_u32("heap_id", 0644, ion_bench_root,
+			   &ion_bench_heap_id);
+	debugfs_create_u32("size", 0644, ion_bench_root, &ion_bench_size);
+	debugfs_create_x32("flags", 0644, ion_bench_root, &ion_bench_flags);
+	debugfs_create_u32("iterations", 0644, ion_bench_root,
+			   &ion_bench_iterations);
+	debugfs_create_u32("threads", 0644, ion_bench_root,
+			   &ion_bench_threads);
+	debugfs_create_u32("pressure_mb", 0644, ion_bench_root,
+			   &ion_bench_pressure_mb);
+	debugfs_create_file("run", 0200, ion_bench_root, NULL,
+			    &ion_bench_run_fops);
+	debugfs_create_file("results", 0444, ion_bench_root, NULL,
+			    &ion_bench_results_fops);
+	return 0;
+}
+
+static void __exit ion_bench_exit(void)
+{
+	debugfs_remove_recursive(ion_bench_root);
+	kfree(ion_bench_report);
+}
+
+module_init(ion_bench_init);
+module_exit(ion_bench_exit);
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("ion allocation benchmark");
@@ -20,6 +20,7 @@
 #include <linux/ion.h>
 #include <linux/kthread.h>
 #include <linux/mm.h>
+#include <linux/msm_ion.h>
 #include <linux/rtmutex.h>
 #include <linux/sched.h>
 #include <linux/scatterlist.h>
@@ -91,8 +92,12 @@ int ion_heap_map_user(struct ion_heap *heap, struct ion_buffer *buffer,
 			offset = 0;
 		}
 		len = min(len, remainder);
-		remap_pfn_range(vma, addr, page_to_pfn(page), len,
-				vma->vm_page_prot);
+		/*
+		 * High order chunks are physically contiguous, map them with
+		 * large pages where the user address lines up.
+		 */
+		remap_pfn_range_large(vma, addr, page_to_pfn(page), len,
+				      vma->vm_page_prot);
 		addr += len;
 		if (addr >= vma->vm_end)
 			return 0;
@@ -293,13 +298,74 @@ void ion_heap_free_page(struct ion_buffer *buffer, struct page *page,
 		__free_page(page + i);
 }
 
+/*
+ * How many of the most recently freed buffers ion_heap_freelist_reuse
+ * looks at, so a long freelist can't make allocations slow.
+ */
+#define ION_HEAP_FREELIST_SCAN	32
+
+static size_t _ion_heap_freelist_drain(struct ion_heap *heap, size_t size,
+				bool skip_pools, u64 *stat);
+
 void ion_heap_freelist_add(struct ion_heap *heap, struct ion_buffer * buffer)
 {
+	size_t over = 0;
+
 	rt_mutex_lock(&heap->lock);
-	list_add(&buffer->list, &heap->free_list);
+	list_add_tail(&buffer->list, &heap->free_list);
 	heap->free_list_size += buffer->size;
+	if (heap->free_list_max && heap->free_list_size > heap->free_list_max)
+		over = heap->free_list_size - heap->free_list_max;
 	rt_mutex_unlock(&heap->lock);
 	wake_up(&heap->waitqueue);
+
+	/*
+	 * The deferred free thread runs at SCHED_IDLE and can't keep up
+	 * while something is freeing in a loop; make the freeing task pay
+	 * for the excess itself instead of letting the list grow until
+	 * the shrinker notices.
+	 */
+	if (over)
+		_ion_heap_freelist_drain(heap, over, false,
+					 &heap->free_list_throttled);
+}
+
+struct ion_buffer *ion_heap_freelist_reuse(struct ion_heap *heap, size_t len,
+					   unsigned long align,
+					   unsigned long flags)
+{
+	struct ion_buffer *buffer, *found = NULL;
+	int scanned = 0;
+
+	if (align > PAGE_SIZE || (flags & ION_FLAG_SECURE))
+		return NULL;
+
+	rt_mutex_lock(&heap->lock);
+	list_for_each_entry_reverse(buffer, &heap->free_list, list) {
+		if (++scanned > ION_HEAP_FREELIST_SCAN)
+			break;
+		if (buffer->size != len || buffer->flags != flags)
+			continue;
+		list_del(&buffer->list);
+		heap->free_list_size -= buffer->size;
+		found = buffer;
+		break;
+	}
+	if (found)
+		heap->free_list_hits++;
+	else
+		heap->free_list_misses++;
+	rt_mutex_unlock(&heap->lock);
+
+	if (!found)
+		return NULL;
+
+	/* the previous owner's data must not leak to the new one */
+	if (ion_heap_buffer_zero(found)) {
+		ion_buffer_destroy(found);
+		return NULL;
+	}
+	return found;
 }
 
 size_t ion_heap_freelist_size(struct ion_heap *heap)
@@ -313,10 +379,29 @@ size_t ion_heap_freelist_size(struct ion_heap *heap)
 	return size;
 }
 
+void ion_heap_freelist_debug_show(struct ion_heap *heap, struct seq_file *s)
+{
+	unsigned long hits, misses;
+
+	rt_mutex_lock(&heap->lock);
+	hits = heap->free_list_hits;
+	misses = heap->free_list_misses;
+	seq_printf(s, "freelist: %u bytes, max %u bytes\n",
+		   heap->free_list_size, heap->free_list_max);
+	seq_printf(s, "freelist reuse: %lu hits %lu misses (%lu%%)\n",
+		   hits, misses,
+		   hits + misses ? hits * 100 / (hits + misses) : 0);
+	seq_printf(s, "freelist drained: %llu bytes by thread, "
+		   "%llu throttled, %llu shrunk\n",
+		   heap->free_list_drained, heap->free_list_throttled,
+		   heap->free_list_shrunk);
+	rt_mutex_unlock(&heap->lock);
+}
+
 static size_t _ion_heap_freelist_drain(struct ion_heap *heap, size_t size,
-				bool skip_pools)
+				bool skip_pools, u64 *stat)
 {
-	struct ion_buffer *buffer, *tmp;
+	struct ion_buffer *buffer;
 	size_t total_drained = 0;
 
 	if (ion_heap_freelist_size(heap) == 0)
@@ -326,15 +411,23 @@ static size_t _ion_heap_freelist_drain(struct ion_heap *heap, size_t size,
 	if (size == 0)
 		size = heap->free_list_size;
 
-	list_for_each_entry_safe(buffer, tmp, &heap->free_list, list) {
-		if (total_drained >= size)
-			break;
+	/*
+	 * Destroying a buffer can allocate and so enter reclaim, and with
+	 * it the ion shrinker, which takes heap->lock: unlink under the
+	 * lock but destroy without it, as the deferred free thread does.
+	 */
+	while (total_drained < size && !list_empty(&heap->free_list)) {
+		buffer = list_first_entry(&heap->free_list, struct ion_buffer,
+					  list);
 		list_del(&buffer->list);
 		heap->free_list_size -= buffer->size;
 		if (skip_pools)
 			buffer->flags |= ION_FLAG_FREED_FROM_SHRINKER;
 		total_drained += buffer->size;
+		*stat += buffer->size;
+		rt_mutex_unlock(&heap->lock);
 		ion_buffer_destroy(buffer);
+		rt_mutex_lock(&heap->lock);
 	}
 	rt_mutex_unlock(&heap->lock);
 
@@ -343,12 +436,14 @@ static size_t _ion_heap_freelist_drain(struct ion_heap *heap, size_t size,
 
 size_t ion_heap_freelist_drain(struct ion_heap *heap, size_t size)
 {
-	return _ion_heap_freelist_drain(heap, size, false);
+	return _ion_heap_freelist_drain(heap, size, false,
+					&heap->free_list_shrunk);
 }
 
 size_t ion_heap_freelist_drain_from_shrinker(struct ion_heap *heap, size_t size)
 {
-	return _ion_heap_freelist_drain(heap, size, true);
+	return _ion_heap_freelist_drain(heap, size, true,
+					&heap->free_list_shrunk);
 }
 
 int ion_heap_deferred_free(void *data)
@@ -370,6 +465,7 @@ int ion_heap_deferred_free(void *data)
 					  list);
 		list_del(&buffer->list);
 		heap->free_list_size -= buffer->size;
+		heap->free_list_drained += buffer->size;
 		rt_mutex_unlock(&heap->lock);
 		ion_buffer_destroy(buffer);
 	}
@@ -383,6 +479,9 @@ int ion_heap_init_deferred_free(struct ion_heap *heap)
 
 	INIT_LIST_HEAD(&heap->free_list);
 	heap->free_list_size = 0;
+	/* heaps may set their own cap before being added to the device */
+	if (!heap->free_list_max)
+		heap->free_list_max = (totalram_pages / 16) << PAGE_SHIFT;
 	rt_mutex_init(&heap->lock);
 	init_waitqueue_head(&heap->waitqueue);
 	heap->task = kthread_run(ion_heap_deferred_free, heap,
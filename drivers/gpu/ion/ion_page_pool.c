@@ -20,7 +20,9 @@
 #include <linux/fs.h>
 #include <linux/list.h>
 #include <linux/module.h>
+#include <linux/percpu.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/vmalloc.h>
 #include "ion_priv.h"
 
@@ -60,7 +62,29 @@ static void ion_page_pool_free_pages(struct ion_page_pool *pool,
 	__free_pages(page, pool->order);
 }
 
-static int ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
+static void ion_page_pool_list_item(struct ion_page_pool *pool,
+				    struct ion_page_pool_item *item,
+				    bool zeroed)
+{
+	bool high = PageHighMem(item->page);
+
+	if (zeroed && high) {
+		list_add_tail(&item->list, &pool->high_items);
+		pool->high_count++;
+	} else if (zeroed) {
+		list_add_tail(&item->list, &pool->low_items);
+		pool->low_count++;
+	} else if (high) {
+		list_add_tail(&item->list, &pool->dirty_high_items);
+		pool->dirty_high_count++;
+	} else {
+		list_add_tail(&item->list, &pool->dirty_low_items);
+		pool->dirty_low_count++;
+	}
+}
+
+static int ion_page_pool_add(struct ion_page_pool *pool, struct page *page,
+			     bool zeroed)
 {
 	struct ion_page_pool_item *item;
 
@@ -68,55 +92,351 @@ static int ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
 	if (!item)
 		return -ENOMEM;
 
+	/* pools that never hand out zeroed memory have no dirty state */
+	if (!(pool->gfp_mask & __GFP_ZERO))
+		zeroed = true;
+
 	mutex_lock(&pool->mutex);
 	item->page = page;
-	if (PageHighMem(page)) {
-		list_add_tail(&item->list, &pool->high_items);
-		pool->high_count++;
-	} else {
-		list_add_tail(&item->list, &pool->low_items);
-		pool->low_count++;
-	}
+	ion_page_pool_list_item(pool, item, zeroed);
 	mutex_unlock(&pool->mutex);
 	return 0;
 }
 
-static struct page *ion_page_pool_remove(struct ion_page_pool *pool, bool high)
+/* must be called with pool->mutex held */
+static struct ion_page_pool_item *ion_page_pool_remove_item(
+					struct ion_page_pool *pool,
+					bool high, bool zeroed)
 {
 	struct ion_page_pool_item *item;
-	struct page *page;
 
-	if (high) {
+	if (zeroed && high) {
 		BUG_ON(!pool->high_count);
 		item = list_first_entry(&pool->high_items,
 					struct ion_page_pool_item, list);
 		pool->high_count--;
-	} else {
+	} else if (zeroed) {
 		BUG_ON(!pool->low_count);
 		item = list_first_entry(&pool->low_items,
 					struct ion_page_pool_item, list);
 		pool->low_count--;
+	} else if (high) {
+		BUG_ON(!pool->dirty_high_count);
+		item = list_first_entry(&pool->dirty_high_items,
+					struct ion_page_pool_item, list);
+		pool->dirty_high_count--;
+	} else {
+		BUG_ON(!pool->dirty_low_count);
+		item = list_first_entry(&pool->dirty_low_items,
+					struct ion_page_pool_item, list);
+		pool->dirty_low_count--;
 	}
 
 	list_del(&item->list);
+	return item;
+}
+
+static struct page *ion_page_pool_remove(struct ion_page_pool *pool, bool high,
+					 bool zeroed)
+{
+	struct ion_page_pool_item *item;
+	struct page *page;
+
+	item = ion_page_pool_remove_item(pool, high, zeroed);
 	page = item->page;
 	kfree(item);
 	return page;
 }
 
+static void ion_page_pool_free_zeroed(struct ion_page_pool *pool,
+				      struct page *page)
+{
+	int ret;
+
+	ret = ion_page_pool_add(pool, page, true);
+	if (ret)
+		ion_page_pool_free_pages(pool, page);
+}
+
+/*
+ * Per-cpu magazines sit in front of the zeroed lists. They only ever
+ * hold zeroed pages and are refilled and flushed in batches so that the
+ * pool mutex is taken once per batch rather than once per page.  The
+ * magazine spinlock is almost always uncontended; it exists so the
+ * shrinker can empty magazines belonging to other cpus.
+ */
+static struct ion_page_pool_mag *ion_page_pool_this_mag(
+					struct ion_page_pool *pool)
+{
+	return per_cpu_ptr(pool->mags, raw_smp_processor_id());
+}
+
+static struct page *ion_page_pool_mag_pop(struct ion_page_pool *pool)
+{
+	struct ion_page_pool_mag *mag;
+	struct page *page = NULL;
+
+	if (!pool->mag_size)
+		return NULL;
+
+	mag = ion_page_pool_this_mag(pool);
+	spin_lock(&mag->lock);
+	if (mag->count) {
+		page = mag->pages[--mag->count];
+		mag->nr_hits++;
+	}
+	spin_unlock(&mag->lock);
+	return page;
+}
+
+static bool ion_page_pool_mag_push(struct ion_page_pool *pool,
+				   struct page *page)
+{
+	struct ion_page_pool_mag *mag;
+	bool pushed = false;
+
+	if (!pool->mag_size)
+		return false;
+
+	mag = ion_page_pool_this_mag(pool);
+	spin_lock(&mag->lock);
+	if (mag->count < pool->mag_size) {
+		mag->pages[mag->count++] = page;
+		pushed = true;
+	}
+	spin_unlock(&mag->lock);
+	return pushed;
+}
+
+/* moves up to half a magazine worth of zeroed items into this cpu's mag */
+static void ion_page_pool_mag_refill(struct ion_page_pool *pool)
+{
+	struct page *pages[ION_PAGE_POOL_MAG_SIZE];
+	int nr = 0, batch = max(pool->mag_size / 2, 1);
+
+	mutex_lock(&pool->mutex);
+	while (nr < batch && (pool->high_count || pool->low_count))
+		pages[nr++] = ion_page_pool_remove(pool, pool->high_count != 0,
+						   true);
+	mutex_unlock(&pool->mutex);
+
+	while (nr) {
+		if (!ion_page_pool_mag_push(pool, pages[nr - 1]))
+			break;
+		nr--;
+	}
+	/* we may have migrated to a cpu with a fuller magazine */
+	while (nr)
+		ion_page_pool_free_zeroed(pool, pages[--nr]);
+}
+
+/* moves half of this cpu's magazine back to the zeroed lists */
+static void ion_page_pool_mag_flush(struct ion_page_pool *pool)
+{
+	struct ion_page_pool_mag *mag;
+	struct page *pages[ION_PAGE_POOL_MAG_SIZE];
+	int nr = 0, batch = max(pool->mag_size / 2, 1);
+
+	mag = ion_page_pool_this_mag(pool);
+	spin_lock(&mag->lock);
+	while (nr < batch && mag->count)
+		pages[nr++] = mag->pages[--mag->count];
+	spin_unlock(&mag->lock);
+
+	while (nr)
+		ion_page_pool_free_zeroed(pool, pages[--nr]);
+}
+
+static int ion_page_pool_mag_total(struct ion_page_pool *pool)
+{
+	int cpu, total = 0;
+
+	if (!pool->mag_size)
+		return 0;
+
+	for_each_possible_cpu(cpu)
+		total += ACCESS_ONCE(per_cpu_ptr(pool->mags, cpu)->count);
+	return total;
+}
+
+/*
+ * The magazines don't sort their pages by zone, so a shrink that may not
+ * free highmem has to leave them alone unless the pool never gets any.
+ */
+static bool ion_page_pool_mag_shrinkable(struct ion_page_pool *pool,
+					 bool high)
+{
+	return high || !(pool->gfp_mask & __GFP_HIGHMEM);
+}
+
+static int ion_page_pool_mag_drain(struct ion_page_pool *pool,
+				   int nr_to_scan)
+{
+	int cpu, nr_freed = 0;
+
+	if (!pool->mag_size)
+		return 0;
+
+	for_each_possible_cpu(cpu) {
+		struct ion_page_pool_mag *mag = per_cpu_ptr(pool->mags, cpu);
+
+		while (nr_freed < nr_to_scan) {
+			struct page *page = NULL;
+
+			spin_lock(&mag->lock);
+			if (mag->count)
+				page = mag->pages[--mag->count];
+			spin_unlock(&mag->lock);
+			if (!page)
+				break;
+			ion_page_pool_free_pages(pool, page);
+			nr_freed += (1 << pool->order);
+		}
+	}
+	return nr_freed;
+}
+
+int ion_page_pool_mag_count(struct ion_page_pool *pool)
+{
+	return ion_page_pool_mag_total(pool);
+}
+
+unsigned long ion_page_pool_mag_hits(struct ion_page_pool *pool)
+{
+	unsigned long hits = 0;
+	int cpu;
+
+	if (!pool->mag_size)
+		return 0;
+
+	for_each_possible_cpu(cpu)
+		hits += ACCESS_ONCE(per_cpu_ptr(pool->mags, cpu)->nr_hits);
+	return hits;
+}
+
+int ion_page_pool_alloc_batch(struct ion_page_pool *pool,
+			      struct list_head *pages, int nr)
+{
+	struct ion_page_pool_item *item, *tmp;
+	struct page *page;
+	LIST_HEAD(dirty);
+	int count = 0, fresh = 0;
+
+	BUG_ON(!pool);
+
+	while (count < nr && (page = ion_page_pool_mag_pop(pool))) {
+		list_add_tail(&page->lru, pages);
+		count++;
+	}
+
+	/* small tails are served from a refilled magazine */
+	if (count < nr && nr - count < pool->mag_size) {
+		ion_page_pool_mag_refill(pool);
+		while (count < nr && (page = ion_page_pool_mag_pop(pool))) {
+			list_add_tail(&page->lru, pages);
+			count++;
+		}
+	}
+
+	if (count < nr) {
+		mutex_lock(&pool->mutex);
+		while (count < nr && (pool->high_count || pool->low_count)) {
+			page = ion_page_pool_remove(pool,
+						    pool->high_count != 0,
+						    true);
+			list_add_tail(&page->lru, pages);
+			pool->nr_zeroed_hits++;
+			count++;
+		}
+		while (count < nr &&
+		       (pool->dirty_high_count || pool->dirty_low_count)) {
+			item = ion_page_pool_remove_item(pool,
+						pool->dirty_high_count != 0,
+						false);
+			list_add_tail(&item->list, &dirty);
+			pool->nr_dirty_hits++;
+			count++;
+		}
+		mutex_unlock(&pool->mutex);
+	}
+
+	list_for_each_entry_safe(item, tmp, &dirty, list) {
+		list_del(&item->list);
+		page = item->page;
+		kfree(item);
+		if (ion_heap_high_order_page_zero(page, pool->order)) {
+			ion_page_pool_free_pages(pool, page);
+			count--;
+			continue;
+		}
+		list_add_tail(&page->lru, pages);
+	}
+
+	while (count < nr) {
+		page = ion_page_pool_alloc_pages(pool);
+		if (!page)
+			break;
+		list_add_tail(&page->lru, pages);
+		count++;
+		fresh++;
+	}
+
+	if (fresh) {
+		mutex_lock(&pool->mutex);
+		pool->nr_fresh += fresh;
+		mutex_unlock(&pool->mutex);
+	}
+
+	return count;
+}
+
 void *ion_page_pool_alloc(struct ion_page_pool *pool)
 {
 	struct page *page = NULL;
+	bool zeroed = true;
 
 	BUG_ON(!pool);
 
+	page = ion_page_pool_mag_pop(pool);
+	if (!page && pool->mag_size) {
+		ion_page_pool_mag_refill(pool);
+		page = ion_page_pool_mag_pop(pool);
+	}
+	if (page)
+		return page;
+
 	mutex_lock(&pool->mutex);
-	if (pool->high_count)
-		page = ion_page_pool_remove(pool, true);
-	else if (pool->low_count)
-		page = ion_page_pool_remove(pool, false);
+	if (pool->high_count) {
+		page = ion_page_pool_remove(pool, true, true);
+	} else if (pool->low_count) {
+		page = ion_page_pool_remove(pool, false, true);
+	} else if (pool->dirty_high_count) {
+		page = ion_page_pool_remove(pool, true, false);
+		zeroed = false;
+	} else if (pool->dirty_low_count) {
+		page = ion_page_pool_remove(pool, false, false);
+		zeroed = false;
+	}
+
+	if (!page)
+		pool->nr_fresh++;
+	else if (zeroed)
+		pool->nr_zeroed_hits++;
+	else
+		pool->nr_dirty_hits++;
 	mutex_unlock(&pool->mutex);
 
+	/*
+	 * The background zeroing thread hasn't caught up with this page
+	 * yet, so pay for clearing it here rather than going back to the
+	 * page allocator.
+	 */
+	if (page && !zeroed &&
+	    ion_heap_high_order_page_zero(page, pool->order)) {
+		ion_page_pool_free_pages(pool, page);
+		page = NULL;
+	}
+
 	if (!page)
 		page = ion_page_pool_alloc_pages(pool);
 
@@ -124,21 +444,112 @@ void *ion_page_pool_alloc(struct ion_page_pool *pool)
 }
 
 void ion_page_pool_free(struct ion_page_pool *pool, struct page* page)
+{
+	if (ion_page_pool_mag_push(pool, page))
+		return;
+
+	if (pool->mag_size) {
+		ion_page_pool_mag_flush(pool);
+		if (ion_page_pool_mag_push(pool, page))
+			return;
+	}
+
+	ion_page_pool_free_zeroed(pool, page);
+}
+
+void ion_page_pool_free_dirty(struct ion_page_pool *pool, struct page *page)
 {
 	int ret;
 
-	ret = ion_page_pool_add(pool, page);
+	ret = ion_page_pool_add(pool, page, false);
 	if (ret)
 		ion_page_pool_free_pages(pool, page);
 }
 
+void ion_page_pool_free_dirty_list(struct ion_page_pool *pool,
+				   struct list_head *pages)
+{
+	struct ion_page_pool_item *item, *tmp;
+	struct page *page, *tmp_page;
+	LIST_HEAD(items);
+
+	list_for_each_entry_safe(page, tmp_page, pages, lru) {
+		list_del(&page->lru);
+		item = kmalloc(sizeof(struct ion_page_pool_item), GFP_KERNEL);
+		if (!item) {
+			ion_page_pool_free_pages(pool, page);
+			continue;
+		}
+		item->page = page;
+		list_add_tail(&item->list, &items);
+	}
+
+	mutex_lock(&pool->mutex);
+	list_for_each_entry_safe(item, tmp, &items, list) {
+		list_del(&item->list);
+		ion_page_pool_list_item(pool, item,
+					!(pool->gfp_mask & __GFP_ZERO));
+	}
+	mutex_unlock(&pool->mutex);
+}
+
+int ion_page_pool_dirty_count(struct ion_page_pool *pool)
+{
+	return ACCESS_ONCE(pool->dirty_high_count) +
+		ACCESS_ONCE(pool->dirty_low_count);
+}
+
+int ion_page_pool_zero_dirty(struct ion_page_pool *pool, int nr_to_zero)
+{
+	struct ion_page_pool_item *item;
+	int nr_zeroed = 0;
+	int ret;
+
+	while (nr_zeroed < nr_to_zero) {
+		mutex_lock(&pool->mutex);
+		if (pool->dirty_high_count) {
+			item = ion_page_pool_remove_item(pool, true, false);
+		} else if (pool->dirty_low_count) {
+			item = ion_page_pool_remove_item(pool, false, false);
+		} else {
+			mutex_unlock(&pool->mutex);
+			break;
+		}
+		mutex_unlock(&pool->mutex);
+
+		/*
+		 * The page is off every list while it is being cleared so
+		 * allocators and the shrinker never see it half zeroed.
+		 */
+		ret = ion_heap_high_order_page_zero(item->page, pool->order);
+		if (ret) {
+			mutex_lock(&pool->mutex);
+			ion_page_pool_list_item(pool, item, false);
+			mutex_unlock(&pool->mutex);
+			return nr_zeroed ? nr_zeroed : ret;
+		}
+
+		mutex_lock(&pool->mutex);
+		ion_page_pool_list_item(pool, item, true);
+		mutex_unlock(&pool->mutex);
+		nr_zeroed++;
+	}
+
+	return nr_zeroed;
+}
+
 static int ion_page_pool_total(struct ion_page_pool *pool, bool high)
 {
 	int total = 0;
 
-	total += high ? (pool->high_count + pool->low_count) *
+	if (ion_page_pool_mag_shrinkable(pool, high))
+		total = ion_page_pool_mag_total(pool) * (1 << pool->order);
+
+	total += high ? (pool->high_count + pool->low_count +
+			 pool->dirty_high_count + pool->dirty_low_count) *
 		(1 << pool->order) :
-			pool->low_count * (1 << pool->order);
+			(pool->low_count + pool->dirty_low_count) *
+			(1 << pool->order);
 	return total;
 }
 
@@ -157,11 +568,16 @@ int ion_page_pool_shrink(struct ion_page_pool *pool, gfp_t gfp_mask,
 	for (i = 0; i < nr_to_scan; i++) {
 		struct page *page;
 
+		/* no point in zeroing pages we are about to give back */
 		mutex_lock(&pool->mutex);
-		if (high && pool->high_count) {
-			page = ion_page_pool_remove(pool, true);
+		if (high && pool->dirty_high_count) {
+			page = ion_page_pool_remove(pool, true, false);
+		} else if (pool->dirty_low_count) {
+			page = ion_page_pool_remove(pool, false, false);
+		} else if (high && pool->high_count) {
+			page = ion_page_pool_remove(pool, true, true);
 		} else if (pool->low_count) {
-			page = ion_page_pool_remove(pool, false);
+			page = ion_page_pool_remove(pool, false, true);
 		} else {
 			mutex_unlock(&pool->mutex);
 			break;
@@ -171,6 +587,11 @@ int ion_page_pool_shrink(struct ion_page_pool *pool, gfp_t gfp_mask,
 		nr_freed += (1 << pool->order);
 	}
 
+	/* the per-cpu magazines are the last thing to go */
+	if (nr_freed < nr_to_scan && ion_page_pool_mag_shrinkable(pool, high))
+		nr_freed += ion_page_pool_mag_drain(pool,
+						    nr_to_scan - nr_freed);
+
 	return nr_freed;
 }
 
@@ -178,12 +599,43 @@ struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
 {
 	struct ion_page_pool *pool = kmalloc(sizeof(struct ion_page_pool),
 					     GFP_KERNEL);
+	int cpu;
+
 	if (!pool)
 		return NULL;
+
+	/*
+	 * Magazines are sized in pages, so the large orders (which are
+	 * only ever allocated a handful at a time) don't get one at all.
+	 */
+	pool->mag_size = ION_PAGE_POOL_MAG_SIZE >> order;
+	pool->mags = NULL;
+	if (pool->mag_size) {
+		pool->mags = alloc_percpu(struct ion_page_pool_mag);
+		if (!pool->mags) {
+			kfree(pool);
+			return NULL;
+		}
+		for_each_possible_cpu(cpu) {
+			struct ion_page_pool_mag *mag =
+				per_cpu_ptr(pool->mags, cpu);
+
+			spin_lock_init(&mag->lock);
+			mag->count = 0;
+			mag->nr_hits = 0;
+		}
+	}
 	pool->high_count = 0;
 	pool->low_count = 0;
+	pool->dirty_high_count = 0;
+	pool->dirty_low_count = 0;
+	pool->nr_zeroed_hits = 0;
+	pool->nr_dirty_hits = 0;
+	pool->nr_fresh = 0;
 	INIT_LIST_HEAD(&pool->low_items);
 	INIT_LIST_HEAD(&pool->high_items);
+	INIT_LIST_HEAD(&pool->dirty_low_items);
+	INIT_LIST_HEAD(&pool->dirty_high_items);
 	pool->gfp_mask = gfp_mask;
 	pool->order = order;
 	mutex_init(&pool->mutex);
@@ -194,6 +646,10 @@ struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
 
 void ion_page_pool_destroy(struct ion_page_pool *pool)
 {
+	if (pool->mags) {
+		ion_page_pool_mag_drain(pool, INT_MAX);
+		free_percpu(pool->mags);
+	}
 	kfree(pool);
 }
 
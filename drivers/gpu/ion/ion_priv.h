@@ -18,6 +18,7 @@
 #ifndef _ION_PRIV_H
 #define _ION_PRIV_H
 
+#include <linux/dma-direction.h>
 #include <linux/ion.h>
 #include <linux/kref.h>
 #include <linux/mm_types.h>
@@ -28,6 +29,7 @@
 #include "msm_ion_priv.h"
 #include <linux/sched.h>
 #include <linux/shrinker.h>
+#include <linux/spinlock.h>
 #include <linux/types.h>
 
 struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
@@ -35,7 +37,7 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
 /**
  * struct ion_buffer - metadata for a particular buffer
  * @ref:		refernce count
- * @node:		node in the ion_device buffers tree
+ * @node:		node in the ion_device buffers hash
  * @dev:		back pointer to the ion_device
  * @heap:		back pointer to the heap the buffer came from
  * @flags:		buffer specific flags
@@ -50,8 +52,8 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
  * @dmap_cnt:		number of times the buffer is mapped for dma
  * @sg_table:		the sg table for the buffer if dmap_cnt is not zero
  * @dirty:		bitmask representing which pages of this buffer have
- *			been dirtied by the cpu and need cache maintenance
- *			before dma
+ *			been written by the cpu through a user mapping and
+ *			need cache maintenance before dma
  * @vmas:		list of vma's mapping this buffer
  * @handle_count:	count of handles referencing this buffer
  * @task_comm:		taskcomm of last client to reference this buffer in a
@@ -62,7 +64,7 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
 struct ion_buffer {
 	struct kref ref;
 	union {
-		struct rb_node node;
+		struct hlist_node node;
 		struct list_head list;
 	};
 	struct ion_device *dev;
@@ -151,7 +153,15 @@ struct ion_heap_ops {
  * @priv:		private heap data
  * @free_list:		free list head if deferred free is used
  * @free_list_size	size of the deferred free list in bytes
- * @lock:		protects the free list
+ * @free_list_max:	cap on @free_list_size, once exceeded the freeing
+ *			task drains the oldest buffers itself
+ * @free_list_hits:	allocations satisfied by reusing a freelist buffer
+ * @free_list_misses:	allocations that had to go to the heap
+ * @free_list_drained:	bytes freed by the deferred free thread
+ * @free_list_throttled:	bytes freed synchronously because the freelist
+ *			went over @free_list_max
+ * @free_list_shrunk:	bytes freed by explicit drains and the shrinker
+ * @lock:		protects the free list and its statistics
  * @waitqueue:		queue to wait on from deferred free thread
  * @task:		task struct of deferred free thread
  * @debug_show:		called when heap debug file is read to add any
@@ -174,6 +184,12 @@ struct ion_heap {
 	void *priv;
 	struct list_head free_list;
 	size_t free_list_size;
+	size_t free_list_max;
+	unsigned long free_list_hits;
+	unsigned long free_list_misses;
+	u64 free_list_drained;
+	u64 free_list_throttled;
+	u64 free_list_shrunk;
 	struct rt_mutex lock;
 	wait_queue_head_t waitqueue;
 	struct task_struct *task;
@@ -257,6 +273,21 @@ int ion_heap_init_deferred_free(struct ion_heap *heap);
  */
 void ion_heap_freelist_add(struct ion_heap *heap, struct ion_buffer *buffer);
 
+/**
+ * ion_heap_freelist_reuse - take a buffer back off the deferred free list
+ * @heap:		the heap
+ * @len:		size of the allocation
+ * @align:		alignment of the allocation
+ * @flags:		flags of the allocation
+ *
+ * Looks for a buffer of exactly @len bytes allocated with the same @flags
+ * on the freelist and returns it zeroed, or NULL if there is none.  The
+ * caller must reinitialize the buffer's bookkeeping before handing it out.
+ */
+struct ion_buffer *ion_heap_freelist_reuse(struct ion_heap *heap, size_t len,
+					   unsigned long align,
+					   unsigned long flags);
+
 /**
  * ion_heap_freelist_drain - drain the deferred free list
  * @heap:		the heap
@@ -298,6 +329,13 @@ size_t ion_heap_freelist_drain_from_shrinker(struct ion_heap *heap,
  */
 size_t ion_heap_freelist_size(struct ion_heap *heap);
 
+/**
+ * ion_heap_freelist_debug_show - print freelist statistics
+ * @heap:		the heap
+ * @s:			seq_file to print to
+ */
+void ion_heap_freelist_debug_show(struct ion_heap *heap, struct seq_file *s);
+
 
 /**
  * functions for creating and destroying the built in ion heaps.
@@ -339,12 +377,33 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
  * invalidated from the cache, provides a significant peformance benefit on
  * many systems */
 
+/* per-cpu magazine capacity, in pages; scaled down by the pool order */
+#define ION_PAGE_POOL_MAG_SIZE	64
+
+/**
+ * struct ion_page_pool_mag - per-cpu cache of zeroed pool items
+ * @lock:		protects the magazine against the shrinker
+ * @count:		number of items in @pages
+ * @nr_hits:		allocations satisfied from this magazine
+ * @pages:		the cached items
+ */
+struct ion_page_pool_mag {
+	spinlock_t lock;
+	int count;
+	unsigned long nr_hits;
+	struct page *pages[ION_PAGE_POOL_MAG_SIZE];
+};
+
 /**
  * struct ion_page_pool - pagepool struct
- * @high_count:		number of highmem items in the pool
- * @low_count:		number of lowmem items in the pool
- * @high_items:		list of highmem items
- * @low_items:		list of lowmem items
+ * @high_count:		number of zeroed highmem items in the pool
+ * @low_count:		number of zeroed lowmem items in the pool
+ * @dirty_high_count:	number of highmem items still waiting to be zeroed
+ * @dirty_low_count:	number of lowmem items still waiting to be zeroed
+ * @high_items:		list of zeroed highmem items
+ * @low_items:		list of zeroed lowmem items
+ * @dirty_high_items:	list of highmem items that must be zeroed before use
+ * @dirty_low_items:	list of lowmem items that must be zeroed before use
  * @shrinker:		a shrinker for the items
  * @mutex:		lock protecting this struct and especially the count
  *			item list
@@ -355,6 +414,12 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
  * @gfp_mask:		gfp_mask to use from alloc
  * @order:		order of pages in the pool
  * @list:		plist node for list of pools
+ * @nr_zeroed_hits:	allocations satisfied from the zeroed lists
+ * @nr_dirty_hits:	allocations that had to zero a dirty item inline
+ * @nr_fresh:		allocations that went back to the page allocator
+ * @mag_size:		capacity of each per-cpu magazine, 0 if the pool
+ *			has no magazines
+ * @mags:		per-cpu caches of zeroed items in front of the lists
  *
  * Allows you to keep a pool of pre allocated pages to use from your heap.
  * Keeping a pool of pages that is ready for dma, ie any cached mapping have
@@ -364,12 +429,21 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
 struct ion_page_pool {
 	int high_count;
 	int low_count;
+	int dirty_high_count;
+	int dirty_low_count;
 	struct list_head high_items;
 	struct list_head low_items;
+	struct list_head dirty_high_items;
+	struct list_head dirty_low_items;
 	struct mutex mutex;
 	gfp_t gfp_mask;
 	unsigned int order;
 	struct plist_node list;
+	unsigned long nr_zeroed_hits;
+	unsigned long nr_dirty_hits;
+	unsigned long nr_fresh;
+	int mag_size;
+	struct ion_page_pool_mag __percpu *mags;
 };
 
 struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order);
@@ -377,6 +451,72 @@ void ion_page_pool_destroy(struct ion_page_pool *);
 void *ion_page_pool_alloc(struct ion_page_pool *);
 void ion_page_pool_free(struct ion_page_pool *, struct page *);
 
+/**
+ * ion_page_pool_alloc_batch - allocate several items with one lock round trip
+ * @pool:		the pool
+ * @pages:		list to add the allocated pages to, linked through
+ *			page->lru
+ * @nr:			number of items wanted
+ *
+ * Returns the number of items added to @pages, which is less than @nr
+ * only when the page allocator could not satisfy the remainder. Every
+ * returned page is zeroed when the pool was created with __GFP_ZERO.
+ */
+int ion_page_pool_alloc_batch(struct ion_page_pool *pool,
+			      struct list_head *pages, int nr);
+
+/**
+ * ion_page_pool_free_dirty_list - return a list of pages needing zeroing
+ * @pool:		the pool
+ * @pages:		pages linked through page->lru, emptied on return
+ *
+ * Batched form of ion_page_pool_free_dirty.
+ */
+void ion_page_pool_free_dirty_list(struct ion_page_pool *pool,
+				   struct list_head *pages);
+
+/**
+ * ion_page_pool_mag_count - number of items held in per-cpu magazines
+ * @pool:		the pool
+ */
+int ion_page_pool_mag_count(struct ion_page_pool *pool);
+
+/**
+ * ion_page_pool_mag_hits - allocations satisfied from per-cpu magazines
+ * @pool:		the pool
+ */
+unsigned long ion_page_pool_mag_hits(struct ion_page_pool *pool);
+
+/**
+ * ion_page_pool_free_dirty - return a page that still holds user data
+ * @pool:		the pool
+ * @page:		the page
+ *
+ * The page is parked on the dirty lists and is only handed out again
+ * after it has been zeroed, either by ion_page_pool_zero_dirty or inline
+ * by ion_page_pool_alloc when no zeroed page is available.
+ */
+void ion_page_pool_free_dirty(struct ion_page_pool *pool, struct page *page);
+
+/**
+ * ion_page_pool_zero_dirty - zero items on the dirty lists
+ * @pool:		the pool
+ * @nr_to_zero:		maximum number of items to zero
+ *
+ * Moves up to @nr_to_zero items from the dirty lists to the zeroed lists.
+ * May sleep. Returns the number of items zeroed, or a negative errno if
+ * clearing failed before any item was zeroed.
+ */
+int ion_page_pool_zero_dirty(struct ion_page_pool *pool, int nr_to_zero);
+
+/**
+ * ion_page_pool_dirty_count - number of items waiting to be zeroed
+ * @pool:		the pool
+ *
+ * Read without the pool lock, so only suitable as a hint.
+ */
+int ion_page_pool_dirty_count(struct ion_page_pool *pool);
+
 /** ion_page_pool_shrink - shrinks the size of the memory cached in the pool
  * @pool:		the pool
  * @gfp_mask:		the memory type to reclaim
@@ -395,4 +535,16 @@ struct ion_handle *ion_handle_get_by_id(struct ion_client *client,
 
 int ion_handle_put(struct ion_handle *handle);
 
+/**
+ * ion_handle_sync_dirty - sync only the pages written through user mappings
+ * @client:		the client
+ * @handle:		the handle
+ * @dir:		direction of the coming dma
+ *
+ * Returns -EINVAL if the buffer does not track dirty pages, in which case
+ * the caller has to maintain the whole buffer itself.
+ */
+int ion_handle_sync_dirty(struct ion_client *client, struct ion_handle *handle,
+			  enum dma_data_direction dir);
+
 #endif /* _ION_PRIV_H */
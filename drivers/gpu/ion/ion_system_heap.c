@@ -18,8 +18,11 @@
 #include <asm/page.h>
 #include <linux/dma-mapping.h>
 #include <linux/err.h>
+#include <linux/freezer.h>
 #include <linux/highmem.h>
 #include <linux/ion.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
 #include <linux/mm.h>
 #include <linux/scatterlist.h>
 #include <linux/seq_file.h>
@@ -51,45 +54,49 @@ static unsigned int order_to_size(int order)
 	return PAGE_SIZE << order;
 }
 
+/* allocation latency buckets: [0] < 1us, [n] < 2^n us, last is open ended */
+#define ION_SYSTEM_HEAP_LAT_BUCKETS	20
+
 struct ion_system_heap {
 	struct ion_heap heap;
 	struct ion_page_pool **uncached_pools;
 	struct ion_page_pool **cached_pools;
+	struct task_struct *zero_task;
+	wait_queue_head_t zero_wait;
+	atomic_t alloc_lat[ION_SYSTEM_HEAP_LAT_BUCKETS];
 };
 
-struct page_info {
-	struct page *page;
-	unsigned int order;
-	struct list_head list;
-};
+static struct ion_page_pool *buffer_pool(struct ion_system_heap *heap,
+					 struct ion_buffer *buffer,
+					 unsigned int order)
+{
+	if (ion_buffer_cached(buffer))
+		return heap->cached_pools[order_to_index(order)];
+	return heap->uncached_pools[order_to_index(order)];
+}
 
-static struct page *alloc_buffer_page(struct ion_system_heap *heap,
-				      struct ion_buffer *buffer,
-				      unsigned long order)
+static int alloc_buffer_pages(struct ion_system_heap *heap,
+			      struct ion_buffer *buffer,
+			      unsigned int order, int nr,
+			      struct list_head *pages)
 {
-	bool cached = ion_buffer_cached(buffer);
 	bool split_pages = ion_buffer_fault_user_mappings(buffer);
 	struct page *page;
-	struct ion_page_pool *pool;
+	int count;
 
-	if (!cached)
-		pool = heap->uncached_pools[order_to_index(order)];
-	else
-		pool = heap->cached_pools[order_to_index(order)];
-	page = ion_page_pool_alloc(pool);
-	if (!page)
-		return 0;
+	count = ion_page_pool_alloc_batch(buffer_pool(heap, buffer, order),
+					  pages, nr);
 
 	if (split_pages)
-		split_page(page, order);
-	return page;
+		list_for_each_entry(page, pages, lru)
+			split_page(page, order);
+	return count;
 }
 
 static void free_buffer_page(struct ion_system_heap *heap,
 			     struct ion_buffer *buffer, struct page *page,
 			     unsigned int order)
 {
-	bool cached = ion_buffer_cached(buffer);
 	bool split_pages = ion_buffer_fault_user_mappings(buffer);
 	int i;
 
@@ -101,43 +108,20 @@ static void free_buffer_page(struct ion_system_heap *heap,
 			__free_pages(page, order);
 		}
 	} else  {
-		struct ion_page_pool *pool;
-		if (cached)
-			pool = heap->cached_pools[order_to_index(order)];
-		else
-			pool = heap->uncached_pools[order_to_index(order)];
-		ion_page_pool_free(pool, page);
+		ion_page_pool_free_dirty(buffer_pool(heap, buffer, order),
+					 page);
 	}
 }
 
-
-static struct page_info *alloc_largest_available(struct ion_system_heap *heap,
-						 struct ion_buffer *buffer,
-						 unsigned long size,
-						 unsigned int max_order)
+static void ion_system_heap_account_latency(struct ion_system_heap *sys_heap,
+					   ktime_t start)
 {
-	struct page *page;
-	struct page_info *info;
-	int i;
-
-	for (i = 0; i < num_orders; i++) {
-		if (size < order_to_size(orders[i]))
-			continue;
-		if (max_order < orders[i])
-			continue;
-
-		page = alloc_buffer_page(heap, buffer, orders[i]);
-		if (!page)
-			continue;
+	s64 us = ktime_us_delta(ktime_get(), start);
+	int bucket = us > 0 ? fls64(us) : 0;
 
-		info = kmalloc(sizeof(struct page_info), GFP_KERNEL);
-		if (info) {
-			info->page = page;
-			info->order = orders[i];
-		}
-		return info;
-	}
-	return NULL;
+	if (bucket >= ION_SYSTEM_HEAP_LAT_BUCKETS)
+		bucket = ION_SYSTEM_HEAP_LAT_BUCKETS - 1;
+	atomic_inc(&sys_heap->alloc_lat[bucket]);
 }
 
 static int ion_system_heap_allocate(struct ion_heap *heap,
@@ -151,23 +135,32 @@ static int ion_system_heap_allocate(struct ion_heap *heap,
 	struct sg_table *table;
 	struct scatterlist *sg;
 	int ret;
-	struct list_head pages;
-	struct page_info *info, *tmp_info;
-	int i = 0;
+	struct list_head pages[ARRAY_SIZE(orders)];
+	struct page *page, *tmp_page;
+	int i, j, nr_chunks = 0;
 	unsigned long size_remaining = PAGE_ALIGN(size);
-	unsigned int max_order = orders[0];
 	bool split_pages = ion_buffer_fault_user_mappings(buffer);
+	ktime_t start = ktime_get();
+
+	/*
+	 * Grab as many chunks of each order as fit in one go, largest
+	 * first, so each pool lock is taken once per buffer instead of
+	 * once per chunk.
+	 */
+	for (i = 0; i < num_orders; i++) {
+		int nr, count;
 
-	INIT_LIST_HEAD(&pages);
-	while (size_remaining > 0) {
-		info = alloc_largest_available(sys_heap, buffer, size_remaining, max_order);
-		if (!info)
-			goto err;
-		list_add_tail(&info->list, &pages);
-		size_remaining -= (1 << info->order) * PAGE_SIZE;
-		max_order = info->order;
-		i++;
+		INIT_LIST_HEAD(&pages[i]);
+		nr = size_remaining / order_to_size(orders[i]);
+		if (!nr)
+			continue;
+		count = alloc_buffer_pages(sys_heap, buffer, orders[i], nr,
+					   &pages[i]);
+		size_remaining -= count * order_to_size(orders[i]);
+		nr_chunks += count;
 	}
+	if (size_remaining)
+		goto err;
 
 	table = kmalloc(sizeof(struct sg_table), GFP_KERNEL);
 	if (!table)
@@ -177,36 +170,39 @@ static int ion_system_heap_allocate(struct ion_heap *heap,
 		ret = sg_alloc_table(table, PAGE_ALIGN(size) / PAGE_SIZE,
 				     GFP_KERNEL);
 	else
-		ret = sg_alloc_table(table, i, GFP_KERNEL);
+		ret = sg_alloc_table(table, nr_chunks, GFP_KERNEL);
 
 	if (ret)
 		goto err1;
 
 	sg = table->sgl;
-	list_for_each_entry_safe(info, tmp_info, &pages, list) {
-		struct page *page = info->page;
-		if (split_pages) {
-			for (i = 0; i < (1 << info->order); i++) {
-				sg_set_page(sg, page + i, PAGE_SIZE, 0);
+	for (i = 0; i < num_orders; i++) {
+		list_for_each_entry_safe(page, tmp_page, &pages[i], lru) {
+			list_del(&page->lru);
+			if (split_pages) {
+				for (j = 0; j < (1 << orders[i]); j++) {
+					sg_set_page(sg, page + j, PAGE_SIZE, 0);
+					sg = sg_next(sg);
+				}
+			} else {
+				sg_set_page(sg, page, order_to_size(orders[i]),
+					    0);
 				sg = sg_next(sg);
 			}
-		} else {
-			sg_set_page(sg, page, (1 << info->order) * PAGE_SIZE,
-				    0);
-			sg = sg_next(sg);
 		}
-		list_del(&info->list);
-		kfree(info);
 	}
 
 	buffer->priv_virt = table;
+	ion_system_heap_account_latency(sys_heap, start);
 	return 0;
 err1:
 	kfree(table);
 err:
-	list_for_each_entry_safe(info, tmp_info, &pages, list) {
-		free_buffer_page(sys_heap, buffer, info->page, info->order);
-		kfree(info);
+	for (i = 0; i < num_orders; i++) {
+		list_for_each_entry_safe(page, tmp_page, &pages[i], lru) {
+			list_del(&page->lru);
+			free_buffer_page(sys_heap, buffer, page, orders[i]);
+		}
 	}
 	return -ENOMEM;
 }
@@ -219,15 +215,33 @@ void ion_system_heap_free(struct ion_buffer *buffer)
 							heap);
 	struct sg_table *table = buffer->sg_table;
 	struct scatterlist *sg;
-	LIST_HEAD(pages);
+	struct list_head pages[ARRAY_SIZE(orders)];
 	int i;
 
-	if (!(buffer->flags & ION_FLAG_FREED_FROM_SHRINKER))
-		ion_heap_buffer_zero(buffer);
+	if (buffer->flags & ION_FLAG_FREED_FROM_SHRINKER) {
+		for_each_sg(table->sgl, sg, table->nents, i)
+			free_buffer_page(sys_heap, buffer, sg_page(sg),
+					 get_order(sg_dma_len(sg)));
+		goto out;
+	}
+
+	/*
+	 * Pages go back to the pools dirty, one batch per order; the
+	 * zeroing thread clears them when the cpu has nothing better to do.
+	 */
+	for (i = 0; i < num_orders; i++)
+		INIT_LIST_HEAD(&pages[i]);
+	for_each_sg(table->sgl, sg, table->nents, i) {
+		struct page *page = sg_page(sg);
 
-	for_each_sg(table->sgl, sg, table->nents, i)
-		free_buffer_page(sys_heap, buffer, sg_page(sg),
-				get_order(sg_dma_len(sg)));
+		list_add_tail(&page->lru,
+			&pages[order_to_index(get_order(sg_dma_len(sg)))]);
+	}
+	for (i = 0; i < num_orders; i++)
+		ion_page_pool_free_dirty_list(
+			buffer_pool(sys_heap, buffer, orders[i]), &pages[i]);
+	wake_up(&sys_heap->zero_wait);
+out:
 	sg_free_table(table);
 	kfree(table);
 }
@@ -311,7 +325,7 @@ static int ion_system_heap_debug_show(struct ion_heap *heap, struct seq_file *s,
 	struct ion_system_heap *sys_heap = container_of(heap,
 							struct ion_system_heap,
 							heap);
-	int i;
+	int i, hist_max;
 	for (i = 0; i < num_orders; i++) {
 		struct ion_page_pool *pool = sys_heap->uncached_pools[i];
 		seq_printf(s,
@@ -336,6 +350,89 @@ static int ion_system_heap_debug_show(struct ion_heap *heap, struct seq_file *s,
 			(1 << pool->order) * PAGE_SIZE * pool->low_count);
 	}
 
+	for (i = 0; i < num_orders; i++) {
+		struct ion_page_pool *uncached = sys_heap->uncached_pools[i];
+		struct ion_page_pool *cached = sys_heap->cached_pools[i];
+		seq_printf(s,
+			"order %u pages waiting to be zeroed: %d uncached, %d cached\n",
+			uncached->order, ion_page_pool_dirty_count(uncached),
+			ion_page_pool_dirty_count(cached));
+		seq_printf(s,
+			"order %u pages in per-cpu caches: %d uncached, %d cached\n",
+			uncached->order, ion_page_pool_mag_count(uncached),
+			ion_page_pool_mag_count(cached));
+		seq_printf(s,
+			"order %u allocs: %lu per-cpu, %lu zeroed, %lu zeroed inline, %lu from system\n",
+			uncached->order,
+			ion_page_pool_mag_hits(uncached) +
+			ion_page_pool_mag_hits(cached),
+			uncached->nr_zeroed_hits + cached->nr_zeroed_hits,
+			uncached->nr_dirty_hits + cached->nr_dirty_hits,
+			uncached->nr_fresh + cached->nr_fresh);
+	}
+
+	seq_printf(s, "\nallocation latency:\n");
+	for (hist_max = ION_SYSTEM_HEAP_LAT_BUCKETS - 1; hist_max > 0;
+	     hist_max--)
+		if (atomic_read(&sys_heap->alloc_lat[hist_max]))
+			break;
+	for (i = 0; i <= hist_max; i++) {
+		if (i == ION_SYSTEM_HEAP_LAT_BUCKETS - 1)
+			seq_printf(s, "  >= %8lu us: %d\n", 1UL << (i - 1),
+				   atomic_read(&sys_heap->alloc_lat[i]));
+		else
+			seq_printf(s, "  <  %8lu us: %d\n", 1UL << i,
+				   atomic_read(&sys_heap->alloc_lat[i]));
+	}
+
+	return 0;
+}
+
+static bool ion_system_heap_has_dirty(struct ion_system_heap *sys_heap)
+{
+	int i;
+
+	for (i = 0; i < num_orders; i++) {
+		if (ion_page_pool_dirty_count(sys_heap->uncached_pools[i]) ||
+		    ion_page_pool_dirty_count(sys_heap->cached_pools[i]))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Runs at SCHED_IDLE and clears one item per pool per pass, smallest
+ * orders last, so an allocation arriving while we work only ever has to
+ * wait for the page it actually needs.  If clearing fails the dirty items
+ * stay listed, so back off rather than spin on them through every idle
+ * cycle.
+ */
+static int ion_system_heap_zero_thread(void *data)
+{
+	struct ion_system_heap *sys_heap = data;
+	bool failed;
+	int i;
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable(sys_heap->zero_wait,
+				     ion_system_heap_has_dirty(sys_heap) ||
+				     kthread_should_stop());
+
+		failed = false;
+		for (i = 0; i < num_orders; i++) {
+			if (ion_page_pool_zero_dirty(sys_heap->uncached_pools[i],
+						     1) < 0)
+				failed = true;
+			if (ion_page_pool_zero_dirty(sys_heap->cached_pools[i],
+						     1) < 0)
+				failed = true;
+		}
+		if (failed)
+			schedule_timeout_interruptible(HZ / 10);
+		else
+			cond_resched();
+	}
+
 	return 0;
 }
 
@@ -379,6 +476,7 @@ struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 {
 	struct ion_system_heap *heap;
 	int pools_size = sizeof(struct ion_page_pool *) * num_orders;
+	struct sched_param param = { .sched_priority = 0 };
 
 	heap = kzalloc(sizeof(struct ion_system_heap), GFP_KERNEL);
 	if (!heap)
@@ -406,6 +504,17 @@ struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 	heap->heap.shrinker.batch = 0;
 	register_shrinker(&heap->heap.shrinker);
 	heap->heap.debug_show = ion_system_heap_debug_show;
+
+	init_waitqueue_head(&heap->zero_wait);
+	heap->zero_task = kthread_run(ion_system_heap_zero_thread, heap,
+				      "ion_page_zero");
+	if (IS_ERR(heap->zero_task)) {
+		pr_err("%s: creating thread for page zeroing failed\n",
+		       __func__);
+		heap->zero_task = NULL;
+	} else {
+		sched_setscheduler(heap->zero_task, SCHED_IDLE, &param);
+	}
 	return &heap->heap;
 
 err_create_cached_pools:
@@ -425,6 +534,8 @@ void ion_system_heap_destroy(struct ion_heap *heap)
 							struct ion_system_heap,
 							heap);
 
+	if (sys_heap->zero_task)
+		kthread_stop(sys_heap->zero_task);
 	ion_system_heap_destroy_pools(sys_heap->uncached_pools);
 	ion_system_heap_destroy_pools(sys_heap->cached_pools);
 	kfree(sys_heap->uncached_pools);
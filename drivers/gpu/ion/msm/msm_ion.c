@@ -304,6 +304,14 @@ static int ion_pages_cache_ops(struct ion_client *client,
 	void (*outer_cache_op)(phys_addr_t, phys_addr_t);
 	struct sg_table *table = NULL;
 
+	/*
+	 * A whole buffer clean only has to touch the pages that were
+	 * written since the last sync, if the buffer keeps track of them.
+	 */
+	if (cmd == ION_IOC_CLEAN_CACHES && !vaddr &&
+	    !ion_handle_sync_dirty(client, handle, DMA_TO_DEVICE))
+		return 0;
+
 	table = ion_sg_table(client, handle);
 	if (IS_ERR_OR_NULL(table))
 		return PTR_ERR(table);
@@ -954,6 +962,47 @@ int ion_heap_allow_heap_secure(enum ion_heap_type type)
 	return type == ((enum ion_heap_type) ION_HEAP_TYPE_CP);
 }
 
+/* must be called with current->active_mm->mmap_sem held for reading */
+static int msm_ion_flush(struct ion_client *client,
+			 struct ion_flush_data *data, unsigned int cmd)
+{
+	unsigned long start, end;
+	struct ion_handle *handle = NULL;
+	int ret;
+
+	if (data->handle > 0) {
+		handle = ion_handle_get_by_id(client, (int)data->handle);
+		if (IS_ERR(handle)) {
+			pr_info("%s: Could not find handle: %d\n",
+				__func__, (int)data->handle);
+			return PTR_ERR(handle);
+		}
+	} else {
+		handle = ion_import_dma_buf(client, data->fd);
+		if (IS_ERR(handle)) {
+			pr_info("%s: Could not import handle: %p\n",
+				__func__, handle);
+			return -EINVAL;
+		}
+	}
+
+	start = (unsigned long) data->vaddr;
+	end = (unsigned long) data->vaddr + data->length;
+
+	if (start && check_vaddr_bounds(start, end)) {
+		pr_err("%s: virtual address %p is out of bounds\n",
+			__func__, data->vaddr);
+		ret = -EINVAL;
+	} else {
+		ret = ion_do_cache_op(client, handle, data->vaddr,
+				data->offset, data->length, cmd);
+	}
+
+	ion_free(client, handle);
+
+	return ret;
+}
+
 static long msm_ion_custom_ioctl(struct ion_client *client,
 				unsigned int cmd,
 				unsigned long arg)
@@ -964,50 +1013,70 @@ static long msm_ion_custom_ioctl(struct ion_client *client,
 	case ION_IOC_CLEAN_INV_CACHES:
 	{
 		struct ion_flush_data data;
-		unsigned long start, end;
-		struct ion_handle *handle = NULL;
-		int ret;
 		struct mm_struct *mm = current->active_mm;
+		int ret;
 
 		if (copy_from_user(&data, (void __user *)arg,
 					sizeof(struct ion_flush_data)))
 			return -EFAULT;
 
-		if (data.handle > 0) {
-			handle = ion_handle_get_by_id(client, (int)data.handle);
-			if (IS_ERR(handle)) {
-				pr_info("%s: Could not find handle: %d\n",
-					__func__, (int)data.handle);
-				return PTR_ERR(handle);
-			}
-		} else {
-			handle = ion_import_dma_buf(client, data.fd);
-			if (IS_ERR(handle)) {
-				pr_info("%s: Could not import handle: %p\n",
-					__func__, handle);
-				return -EINVAL;
-			}
-		}
-
 		down_read(&mm->mmap_sem);
+		ret = msm_ion_flush(client, &data, cmd);
+		up_read(&mm->mmap_sem);
 
-		start = (unsigned long) data.vaddr;
-		end = (unsigned long) data.vaddr + data.length;
+		if (ret < 0)
+			return ret;
+		break;
+	}
+	case ION_IOC_FLUSH_BATCH:
+	{
+		struct ion_flush_batch_data batch;
+		struct ion_flush_data *entries;
+		struct mm_struct *mm = current->active_mm;
+		unsigned int done;
+		int ret = 0;
 
-		if (start && check_vaddr_bounds(start, end)) {
-			pr_err("%s: virtual address %p is out of bounds\n",
-				__func__, data.vaddr);
-			ret = -EINVAL;
-		} else {
-			ret = ion_do_cache_op(client, handle, data.vaddr,
-					data.offset, data.length, cmd);
+		if (copy_from_user(&batch, (void __user *)arg,
+					sizeof(struct ion_flush_batch_data)))
+			return -EFAULT;
+
+		switch (batch.cmd) {
+		case ION_IOC_CLEAN_CACHES:
+		case ION_IOC_INV_CACHES:
+		case ION_IOC_CLEAN_INV_CACHES:
+			break;
+		default:
+			return -EINVAL;
 		}
-		up_read(&mm->mmap_sem);
+		if (!batch.count || batch.count > ION_FLUSH_BATCH_MAX)
+			return -EINVAL;
 
-		ion_free(client, handle);
+		entries = kmalloc(batch.count * sizeof(*entries), GFP_KERNEL);
+		if (!entries)
+			return -ENOMEM;
+		if (copy_from_user(entries, (void __user *)batch.entries,
+				   batch.count * sizeof(*entries))) {
+			kfree(entries);
+			return -EFAULT;
+		}
 
-		if (ret < 0)
+		/* one mmap_sem round trip for the whole batch */
+		down_read(&mm->mmap_sem);
+		for (done = 0; done < batch.count; done++) {
+			ret = msm_ion_flush(client, &entries[done], batch.cmd);
+			if (ret < 0)
+				break;
+		}
+		up_read(&mm->mmap_sem);
+		kfree(entries);
+
+		if (ret < 0) {
+			batch.count = done;
+			if (copy_to_user((void __user *)arg, &batch,
+					sizeof(struct ion_flush_batch_data)))
+				return -EFAULT;
 			return ret;
+		}
 		break;
 	}
 	case ION_IOC_PREFETCH:
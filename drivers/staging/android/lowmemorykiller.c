@@ -319,7 +319,9 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			task_unlock(p);
 			continue;
 		}
-		tasksize = get_mm_rss(p->mm);
+		/* ion buffers it allocated are freed with it, too */
+		tasksize = get_mm_rss(p->mm) +
+			   get_mm_counter(p->mm, MM_IONPAGES);
 		task_unlock(p);
 		if (tasksize <= 0)
 			continue;
@@ -36,6 +36,8 @@
 #include <linux/blkdev.h>
 #include <linux/compat.h>
 #include <linux/personality.h>
+#include <linux/pagemap.h>
+#include <linux/sysctl.h>
 
 #include <asm/kmap_types.h>
 #include <asm/uaccess.h>
@@ -57,6 +59,17 @@ static struct kmem_cache	*kioctx_cachep;
 
 static struct workqueue_struct *aio_wq;
 
+/*
+ * Buffered reads that are going to have to wait for the page cache to be
+ * filled are handed to this pool instead of blocking io_submit().  The
+ * sysctl bounds how many run at once; 0 runs them all inline as before.
+ */
+static struct workqueue_struct *aio_read_wq;
+int aio_read_workers;
+
+/* Reads spanning more pages than this are punted without looking */
+#define AIO_READ_PROBE_PAGES	32
+
 /* Used for rare fput completion. */
 static void aio_fput_routine(struct work_struct *);
 static DECLARE_WORK(fput_work, aio_fput_routine);
@@ -79,6 +92,10 @@ static int __init aio_setup(void)
 	aio_wq = alloc_workqueue("aio", 0, 1);	/* used to limit concurrency */
 	BUG_ON(!aio_wq);
 
+	aio_read_workers = min_t(int, 4 * num_possible_cpus(), WQ_MAX_ACTIVE);
+	aio_read_wq = alloc_workqueue("aio_read", WQ_UNBOUND, aio_read_workers);
+	BUG_ON(!aio_read_wq);
+
 	pr_debug("aio_setup: sizeof(struct page) = %d\n", (int)sizeof(struct page));
 
 	return 0;
@@ -102,15 +119,47 @@ static void aio_free_ring(struct kioctx *ctx)
 		kfree(info->ring_pages);
 	info->ring_pages = NULL;
 	info->nr = 0;
+	info->sq_nr = 0;
+}
+
+/*
+ * The ring pages are pinned and used by the kernel directly, so they must
+ * stay the ones the process sees.  A private mapping inherited over fork
+ * would be copy-on-write and the parent would get new pages on its next
+ * write to the submission ring; keep the mapping out of the child.
+ * Called with mmap_sem held for writing.
+ */
+static int aio_ring_dontcopy(struct mm_struct *mm, unsigned long start,
+			     unsigned long size)
+{
+	struct vm_area_struct *vma = find_vma(mm, start);
+	int err;
+
+	if (!vma || vma->vm_start > start)
+		return -ENOMEM;
+	/* do_mmap() may have merged the ring into a neighbouring mapping */
+	if (vma->vm_start < start) {
+		err = split_vma(mm, vma, start, 1);
+		if (err)
+			return err;
+	}
+	if (vma->vm_end > start + size) {
+		err = split_vma(mm, vma, start + size, 0);
+		if (err)
+			return err;
+	}
+	vma->vm_flags |= VM_DONTCOPY;
+	return 0;
 }
 
-static int aio_setup_ring(struct kioctx *ctx)
+static int aio_setup_ring(struct kioctx *ctx, unsigned flags)
 {
 	struct aio_ring *ring;
+	struct aio_sq_ring *sq;
 	struct aio_ring_info *info = &ctx->ring_info;
 	unsigned nr_events = ctx->max_reqs;
 	unsigned long size;
-	int nr_pages;
+	int nr_pages, sq_pages = 0;
 
 	if (current->personality & READ_IMPLIES_EXEC)
 		return -EPERM;
@@ -127,6 +176,15 @@ static int aio_setup_ring(struct kioctx *ctx)
 
 	nr_events = (PAGE_SIZE * nr_pages - sizeof(struct aio_ring)) / sizeof(struct io_event);
 
+	/* The submission ring follows, one slot always left empty */
+	if (flags & IOCTX_FLAG_SQRING) {
+		size = sizeof(struct aio_sq_ring);
+		size += sizeof(struct iocb) * (ctx->max_reqs + 1);
+		sq_pages = (size + PAGE_SIZE-1) >> PAGE_SHIFT;
+		info->sq_page = nr_pages;
+		nr_pages += sq_pages;
+	}
+
 	info->nr = 0;
 	info->ring_pages = info->internal_pages;
 	if (nr_pages > AIO_RING_PAGES) {
@@ -148,6 +206,12 @@ static int aio_setup_ring(struct kioctx *ctx)
 		return -EAGAIN;
 	}
 
+	if (aio_ring_dontcopy(ctx->mm, info->mmap_base, info->mmap_size)) {
+		up_write(&ctx->mm->mmap_sem);
+		aio_free_ring(ctx);
+		return -EAGAIN;
+	}
+
 	dprintk("mmap address: 0x%08lx\n", info->mmap_base);
 	info->nr_pages = get_user_pages(current, ctx->mm,
 					info->mmap_base, nr_pages, 
@@ -169,10 +233,22 @@ static int aio_setup_ring(struct kioctx *ctx)
 	ring->head = ring->tail = 0;
 	ring->magic = AIO_RING_MAGIC;
 	ring->compat_features = AIO_RING_COMPAT_FEATURES;
+	if (sq_pages)
+		ring->compat_features |= AIO_RING_COMPAT_SQRING;
 	ring->incompat_features = AIO_RING_INCOMPAT_FEATURES;
 	ring->header_length = sizeof(struct aio_ring);
 	kunmap_atomic(ring);
 
+	if (sq_pages) {
+		info->sq_nr = ctx->max_reqs + 1;
+		info->sq_head = 0;
+
+		sq = kmap_atomic(info->ring_pages[info->sq_page]);
+		sq->head = sq->tail = 0;
+		sq->nr = info->sq_nr;
+		kunmap_atomic(sq);
+	}
+
 	return 0;
 }
 
@@ -199,6 +275,31 @@ static int aio_setup_ring(struct kioctx *ctx)
 	kunmap_atomic((void *)((unsigned long)__event & PAGE_MASK)); \
 } while(0)
 
+/* The same for the submission ring, whose 64 byte header takes the place
+ * of the first iocb.
+ */
+#define AIO_SQES_PER_PAGE	(PAGE_SIZE / sizeof(struct iocb))
+
+static struct iocb *aio_sq_entry(struct aio_ring_info *info, unsigned nr)
+{
+	unsigned pos = nr + 1;
+	struct iocb *sqe;
+
+	sqe = kmap_atomic(info->ring_pages[info->sq_page + pos / AIO_SQES_PER_PAGE]);
+	return sqe + pos % AIO_SQES_PER_PAGE;
+}
+
+static struct iocb __user *aio_sq_user_entry(struct kioctx *ctx, unsigned nr)
+{
+	struct aio_ring_info *info = &ctx->ring_info;
+
+	return (struct iocb __user *)(info->mmap_base + info->sq_page * PAGE_SIZE +
+				      sizeof(struct aio_sq_ring)) + nr;
+}
+
+#define put_aio_sq_entry(sqe) \
+	kunmap_atomic((void *)((unsigned long)(sqe) & PAGE_MASK))
+
 static void ctx_rcu_free(struct rcu_head *head)
 {
 	struct kioctx *ctx = container_of(head, struct kioctx, rcu_head);
@@ -243,7 +344,7 @@ static inline void put_ioctx(struct kioctx *kioctx)
 /* ioctx_alloc
  *	Allocates and initializes an ioctx.  Returns an ERR_PTR if it failed.
  */
-static struct kioctx *ioctx_alloc(unsigned nr_events)
+static struct kioctx *ioctx_alloc(unsigned nr_events, unsigned flags)
 {
 	struct mm_struct *mm;
 	struct kioctx *ctx;
@@ -270,13 +371,14 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 	atomic_set(&ctx->users, 2);
 	spin_lock_init(&ctx->ctx_lock);
 	spin_lock_init(&ctx->ring_info.ring_lock);
+	mutex_init(&ctx->ring_info.sq_mutex);
 	init_waitqueue_head(&ctx->wait);
 
 	INIT_LIST_HEAD(&ctx->active_reqs);
 	INIT_LIST_HEAD(&ctx->run_list);
 	INIT_DELAYED_WORK(&ctx->wq, aio_kick_handler);
 
-	if (aio_setup_ring(ctx) < 0)
+	if (aio_setup_ring(ctx, flags) < 0)
 		goto out_freectx;
 
 	/* limit the number of system wide aios */
@@ -1297,14 +1399,19 @@ static void io_destroy(struct kioctx *ioctx)
  *	of available events.  May fail with -ENOMEM if insufficient kernel
  *	resources are available.  May fail with -EFAULT if an invalid
  *	pointer is passed for ctxp.  Will fail with -ENOSYS if not
- *	implemented.
+ *	implemented.  If nr_events has IOCTX_FLAG_SQRING set, a submission
+ *	ring is mapped after the completion ring (see struct aio_sq_ring).
+ *	The rings are not inherited by a child process on fork.
  */
 SYSCALL_DEFINE2(io_setup, unsigned, nr_events, aio_context_t __user *, ctxp)
 {
 	struct kioctx *ioctx = NULL;
+	unsigned flags = nr_events & IOCTX_FLAG_SQRING;
 	unsigned long ctx;
 	long ret;
 
+	nr_events &= ~IOCTX_FLAG_SQRING;
+
 	ret = get_user(ctx, ctxp);
 	if (unlikely(ret))
 		goto out;
@@ -1316,7 +1423,7 @@ SYSCALL_DEFINE2(io_setup, unsigned, nr_events, aio_context_t __user *, ctxp)
 		goto out;
 	}
 
-	ioctx = ioctx_alloc(nr_events);
+	ioctx = ioctx_alloc(nr_events, flags);
 	ret = PTR_ERR(ioctx);
 	if (!IS_ERR(ioctx)) {
 		ret = put_user(ioctx->user_id, ctxp);
@@ -1580,12 +1687,92 @@ static ssize_t aio_setup_iocb(struct kiocb *kiocb, bool compat)
 	return 0;
 }
 
+/*
+ * aio_read_would_block:
+ *	Would a buffered read of this kiocb have to wait for the page cache
+ *	to be filled?  Only looks for uptodate pages, so readahead in
+ *	flight counts as blocking, as does anything too long to check.
+ */
+static bool aio_read_would_block(struct kiocb *iocb)
+{
+	struct file *file = iocb->ki_filp;
+	struct address_space *mapping = file->f_mapping;
+	struct inode *inode = mapping->host;
+	pgoff_t index, end;
+	loff_t isize;
+
+	if (iocb->ki_opcode != IOCB_CMD_PREAD &&
+	    iocb->ki_opcode != IOCB_CMD_PREADV)
+		return false;
+	/* direct I/O already completes asynchronously */
+	if (file->f_flags & O_DIRECT)
+		return false;
+	if (!S_ISREG(inode->i_mode) && !S_ISBLK(inode->i_mode))
+		return false;
+
+	isize = i_size_read(inode);
+	if (!iocb->ki_left || iocb->ki_pos >= isize)
+		return false;
+
+	index = iocb->ki_pos >> PAGE_CACHE_SHIFT;
+	end = (min_t(loff_t, iocb->ki_pos + iocb->ki_left, isize) - 1) >> PAGE_CACHE_SHIFT;
+	if (end - index >= AIO_READ_PROBE_PAGES)
+		return true;
+
+	for (; index <= end; index++) {
+		struct page *page = find_get_page(mapping, index);
+		bool uptodate;
+
+		if (!page)
+			return true;
+		uptodate = PageUptodate(page);
+		page_cache_release(page);
+		if (!uptodate)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * aio_read_work:
+ *	Runs a punted read on aio_read_wq, in the submitter's mm like
+ *	aio_kick_handler.  Drops the reference io_submit_one() took for us.
+ */
+static void aio_read_work(struct work_struct *work)
+{
+	struct kiocb *iocb = container_of(work, struct kiocb, ki_work);
+	struct kioctx *ctx = iocb->ki_ctx;
+	mm_segment_t oldfs = get_fs();
+	struct mm_struct *mm = ctx->mm;
+
+	set_fs(USER_DS);
+	use_mm(mm);
+	spin_lock_irq(&ctx->ctx_lock);
+	aio_run_iocb(iocb);
+	__aio_put_req(ctx, iocb);
+	spin_unlock_irq(&ctx->ctx_lock);
+	unuse_mm(mm);
+	set_fs(oldfs);
+}
+
+int aio_read_workers_sysctl(struct ctl_table *table, int write,
+			    void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, buffer, lenp, ppos);
+	if (!ret && write && aio_read_workers)
+		workqueue_set_max_active(aio_read_wq, aio_read_workers);
+	return ret;
+}
+
 static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 			 struct iocb *iocb, struct kiocb_batch *batch,
 			 bool compat)
 {
 	struct kiocb *req;
 	struct file *file;
+	bool punt;
 	ssize_t ret;
 
 	/* enforce forwards compatibility on users */
@@ -1648,6 +1835,9 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	if (ret)
 		goto out_put_req;
 
+	/* probe the page cache before ctx_lock, it is taken with irqs off */
+	punt = aio_read_workers && aio_read_would_block(req);
+
 	spin_lock_irq(&ctx->ctx_lock);
 	/*
 	 * We could have raced with io_destroy() and are currently holding a
@@ -1666,6 +1856,15 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 		ret = -EINVAL;
 		goto out_put_req;
 	}
+	if (punt) {
+		/* extra reference for aio_read_work() */
+		req->ki_users++;
+		spin_unlock_irq(&ctx->ctx_lock);
+		INIT_WORK(&req->ki_work, aio_read_work);
+		queue_work(aio_read_wq, &req->ki_work);
+		aio_put_req(req);	/* drop extra ref to req */
+		return 0;
+	}
 	aio_run_iocb(req);
 	if (!list_empty(&ctx->run_list)) {
 		/* drain the run list */
@@ -1683,6 +1882,63 @@ out_put_req:
 	return ret;
 }
 
+/*
+ * aio_submit_sq:
+ *	Submit up to nr iocbs queued on the context's submission ring.
+ *	Returns the number submitted like do_io_submit(); an iocb that
+ *	fails is consumed, unless it was for lack of resources, and then
+ *	only if it is the first one, so its error gets reported.
+ */
+static long aio_submit_sq(struct kioctx *ctx, long nr,
+			  struct kiocb_batch *batch, bool compat)
+{
+	struct aio_ring_info *info = &ctx->ring_info;
+	struct aio_sq_ring *sq;
+	unsigned head, tail;
+	long i = 0;
+	int ret = 0;
+
+	mutex_lock(&info->sq_mutex);
+
+	sq = kmap_atomic(info->ring_pages[info->sq_page]);
+	tail = ACCESS_ONCE(sq->tail);
+	kunmap_atomic(sq);
+	if (unlikely(tail >= info->sq_nr)) {
+		pr_debug("EINVAL: io_submit: bad sq tail %u\n", tail);
+		ret = -EINVAL;
+		goto out;
+	}
+	smp_rmb();	/* read the iocbs only after the tail */
+
+	head = info->sq_head;
+	while (i < nr && head != tail) {
+		struct iocb *sqe, tmp;
+
+		sqe = aio_sq_entry(info, head);
+		tmp = *sqe;
+		put_aio_sq_entry(sqe);
+
+		ret = io_submit_one(ctx, aio_sq_user_entry(ctx, head), &tmp,
+				    batch, compat);
+		if (ret && (i || ret == -EAGAIN))
+			break;
+		if (++head >= info->sq_nr)
+			head = 0;
+		if (ret)
+			break;
+		i++;
+	}
+
+	info->sq_head = head;
+	sq = kmap_atomic(info->ring_pages[info->sq_page]);
+	smp_mb();	/* finish reading the iocbs before updating the head */
+	sq->head = head;
+	kunmap_atomic(sq);
+out:
+	mutex_unlock(&info->sq_mutex);
+	return i ? i : ret;
+}
+
 long do_io_submit(aio_context_t ctx_id, long nr,
 		  struct iocb __user *__user *iocbpp, bool compat)
 {
@@ -1711,6 +1967,11 @@ long do_io_submit(aio_context_t ctx_id, long nr,
 
 	blk_start_plug(&plug);
 
+	if (!iocbpp && ctx->ring_info.sq_nr) {
+		ret = aio_submit_sq(ctx, nr, &batch, compat);
+		goto out;
+	}
+
 	/*
 	 * AKPM: should this return a partial result if some of the IOs were
 	 * successfully submitted?
@@ -1733,11 +1994,14 @@ long do_io_submit(aio_context_t ctx_id, long nr,
 		if (ret)
 			break;
 	}
+	if (i)
+		ret = i;
+out:
 	blk_finish_plug(&plug);
 
 	kiocb_batch_free(ctx, &batch);
 	put_ioctx(ctx);
-	return i ? i : ret;
+	return ret;
 }
 
 /* sys_io_submit:
@@ -1750,7 +2014,8 @@ long do_io_submit(aio_context_t ctx_id, long nr,
  *	fail with -EBADF if the file descriptor specified in the first
  *	iocb is invalid.  May fail with -EAGAIN if insufficient resources
  *	are available to queue any iocbs.  Will return 0 if nr is 0.  Will
- *	fail with -ENOSYS if not implemented.
+ *	fail with -ENOSYS if not implemented.  With a NULL iocbpp, the iocbs
+ *	are taken from the context's submission ring instead.
  */
 SYSCALL_DEFINE3(io_submit, aio_context_t, ctx_id, long, nr,
 		struct iocb __user * __user *, iocbpp)
@@ -40,22 +40,22 @@
 
 /*
  * LOCKING:
- * There are three level of locking required by epoll :
+ * There are two level of locking required by epoll :
  *
  * 1) epmutex (mutex)
  * 2) ep->mtx (mutex)
- * 3) ep->lock (spinlock)
  *
- * The acquire order is the one listed above, from 1 to 3.
- * We need a spinlock (ep->lock) because we manipulate objects
- * from inside the poll callback, that might be triggered from
- * a wake_up() that in turn might be called from IRQ context.
- * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
- * user space) we could end up sleeping due a copy_to_user(), so
- * we need a lock that will allow us to sleep. This lock is a
- * mutex (ep->mtx). It is acquired during the event transfer loop,
- * during epoll_ctl(EPOLL_CTL_DEL) and during eventpoll_release_file().
+ * The acquire order is the one listed above, from 1 to 2.
+ * The poll callback, that might be triggered from a wake_up() that in
+ * turn might be called from IRQ context, takes no lock at all. It
+ * pushes the item on the ep->pending chain with cmpxchg(), and the
+ * chain is moved onto the ready list by whoever holds "ep->mtx" next.
+ * The ready list itself is only touched with "ep->mtx" held. During
+ * the event transfer loop (from kernel to user space) we could end up
+ * sleeping due a copy_to_user(), so we need a lock that will allow us
+ * to sleep. This lock is a mutex (ep->mtx). It is acquired during the
+ * event transfer loop, during epoll_ctl() and during
+ * eventpoll_release_file().
  * Then we also need a global mutex to serialize eventpoll_release_file()
  * and ep_free().
  * This mutex is acquired by ep_free() during the epoll file
@@ -79,15 +79,24 @@
  * of epoll file descriptors, we use the current recursion depth as
  * the lockdep subkey.
  * It is possible to drop the "ep->mtx" and to use the global
- * mutex "epmutex" (together with "ep->lock") to have it working,
- * but having "ep->mtx" will make the interface more scalable.
+ * mutex "epmutex" to have it working, but having "ep->mtx" will
+ * make the interface more scalable.
  * Events that require holding "epmutex" are very rare, while for
  * normal operations the epoll private "ep->mtx" will guarantee
  * a better scalability.
+ * Tasks sleeping in epoll_wait() are queued on ep->wq under its own
+ * lock, and a wake up is only issued by the poll callback that finds
+ * ep->pending empty: later events join the batch the woken task is
+ * about to collect.
  */
 
 /* Epoll private bits inside the event mask */
-#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET)
+#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET | EPOLLEXCLUSIVE)
+
+#define EPOLLINOUT_BITS (POLLIN | POLLOUT)
+
+#define EPOLLEXCLUSIVE_OK_BITS (EPOLLINOUT_BITS | POLLERR | POLLHUP | \
+				EPOLLET | EPOLLEXCLUSIVE)
 
 /* Maximum number of nesting allowed inside epoll sets */
 #define EP_MAX_NESTS 4
@@ -134,8 +143,8 @@ struct epitem {
 	struct list_head rdllink;
 
 	/*
-	 * Works together "struct eventpoll"->ovflist in keeping the
-	 * single linked chain of items.
+	 * Links the item on the "struct eventpoll"->pending chain. It is
+	 * EP_UNACTIVE_PTR while the item is not queued there.
 	 */
 	struct epitem *next;
 
@@ -164,14 +173,11 @@ struct epitem {
  * interface.
  */
 struct eventpoll {
-	/* Protect the access to this structure */
-	spinlock_t lock;
-
 	/*
 	 * This mutex is used to ensure that files are not removed
 	 * while epoll is using them. This is held during the event
 	 * collection loop, the file cleanup path, the epoll file exit
-	 * code and the ctl operations.
+	 * code and the ctl operations. It also protects the ready list.
 	 */
 	struct mutex mtx;
 
@@ -188,11 +194,12 @@ struct eventpoll {
 	struct rb_root rbr;
 
 	/*
-	 * This is a single linked list that chains all the "struct epitem" that
-	 * happened while transferring ready events to userspace w/out
-	 * holding ->lock.
+	 * This is a single linked list, newest first, that chains all the
+	 * "struct epitem" the poll callback reported ready since the last
+	 * time "mtx" was taken to look at them. Pushed to with cmpxchg()
+	 * and emptied with xchg(), so the callback needs no lock.
 	 */
-	struct epitem *ovflist;
+	struct epitem *pending;
 
 	/* The user that created the eventpoll descriptor */
 	struct user_struct *user;
@@ -359,7 +366,7 @@ static void ep_nested_calls_init(struct nested_calls *ncalls)
  */
 static inline int ep_events_available(struct eventpoll *ep)
 {
-	return !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
+	return !list_empty(&ep->rdllist) || ACCESS_ONCE(ep->pending) != NULL;
 }
 
 /**
@@ -527,6 +534,60 @@ static void ep_unregister_pollwait(struct eventpoll *ep, struct epitem *epi)
 	}
 }
 
+/*
+ * Moves the items queued by the poll callback onto @head, in the order
+ * they were reported, skipping those already linked on the ready list or
+ * on a transfer list. Must be called with "mtx" held.
+ */
+static void ep_drain_pending(struct eventpoll *ep, struct list_head *head)
+{
+	struct epitem *epi, *nepi, *rev = NULL;
+
+	/* The chain is newest first, reverse it */
+	for (nepi = xchg(&ep->pending, NULL); (epi = nepi) != NULL; rev = epi) {
+		nepi = epi->next;
+		epi->next = rev;
+	}
+
+	for (nepi = rev; (epi = nepi) != NULL;) {
+		nepi = epi->next;
+		/* From here on the poll callback can queue the item again */
+		epi->next = EP_UNACTIVE_PTR;
+		if (!ep_is_linked(&epi->rdllink))
+			list_add_tail(&epi->rdllink, head);
+	}
+}
+
+/*
+ * Takes an item off the ready list, and off the pending chain if the poll
+ * callback queued it there. Its poll hooks must have been unregistered
+ * already, so the callback cannot queue it again. Must be called with
+ * "mtx" held (or "epmutex" if called from ep_free).
+ */
+static void ep_unqueue(struct eventpoll *ep, struct epitem *epi)
+{
+	/* Pairs with the barrier before a POLLFREE callback clears ->whead */
+	smp_rmb();
+	if (epi->next != EP_UNACTIVE_PTR)
+		ep_drain_pending(ep, &ep->rdllist);
+	if (ep_is_linked(&epi->rdllink))
+		list_del_init(&epi->rdllink);
+}
+
+/*
+ * Wakes up a task waiting in epoll_wait() after an item has been put on
+ * the ready list, and tells if the ->poll() wait list needs a wake up
+ * too (which has to be done after "mtx" is released).
+ */
+static int ep_ready_wakeup(struct eventpoll *ep)
+{
+	/* Pairs with set_current_state() in ep_poll() */
+	smp_mb();
+	if (waitqueue_active(&ep->wq))
+		wake_up(&ep->wq);
+	return waitqueue_active(&ep->poll_wait);
+}
+
 /**
  * ep_scan_ready_list - Scans the ready list in a way that makes possible for
  *                      the scan code, to call f_op->poll(). Also allows for
@@ -546,8 +607,6 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 			      int depth)
 {
 	int error, pwake = 0;
-	unsigned long flags;
-	struct epitem *epi, *nepi;
 	LIST_HEAD(txlist);
 
 	/*
@@ -557,63 +616,39 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 	mutex_lock_nested(&ep->mtx, depth);
 
 	/*
-	 * Steal the ready list, and re-init the original one to the
-	 * empty list. Also, set ep->ovflist to NULL so that events
-	 * happening while looping w/out locks, are not lost. We cannot
-	 * have the poll callback to queue directly on ep->rdllist,
-	 * because we want the "sproc" callback to be able to do it
-	 * in a lockless way.
+	 * Steal the ready list, together with what the poll callback queued
+	 * since the last scan, and re-init the original one to the empty
+	 * list. Events happening while looping are queued on ep->pending,
+	 * so they are not lost and the "sproc" callback owns the list.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
 	list_splice_init(&ep->rdllist, &txlist);
-	ep->ovflist = NULL;
-	spin_unlock_irqrestore(&ep->lock, flags);
+	ep_drain_pending(ep, &txlist);
 
 	/*
 	 * Now call the callback function.
 	 */
 	error = (*sproc)(ep, &txlist, priv);
 
-	spin_lock_irqsave(&ep->lock, flags);
 	/*
 	 * During the time we spent inside the "sproc" callback, some
 	 * other events might have been queued by the poll callback.
-	 * We re-insert them inside the main ready-list here.
+	 * We insert them inside the main ready-list here. Items still
+	 * on "txlist" are skipped, the list_splice() below takes care
+	 * of them.
 	 */
-	for (nepi = ep->ovflist; (epi = nepi) != NULL;
-	     nepi = epi->next, epi->next = EP_UNACTIVE_PTR) {
-		/*
-		 * We need to check if the item is already in the list.
-		 * During the "sproc" callback execution time, items are
-		 * queued into ->ovflist but the "txlist" might already
-		 * contain them, and the list_splice() below takes care of them.
-		 */
-		if (!ep_is_linked(&epi->rdllink))
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-	}
-	/*
-	 * We need to set back ep->ovflist to EP_UNACTIVE_PTR, so that after
-	 * releasing the lock, events will be queued in the normal way inside
-	 * ep->rdllist.
-	 */
-	ep->ovflist = EP_UNACTIVE_PTR;
+	ep_drain_pending(ep, &ep->rdllist);
 
 	/*
 	 * Quickly re-inject items left on "txlist".
 	 */
 	list_splice(&txlist, &ep->rdllist);
 
-	if (!list_empty(&ep->rdllist)) {
-		/*
-		 * Wake up (if active) both the eventpoll wait list and
-		 * the ->poll() wait list (delayed after we release the lock).
-		 */
-		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
-		if (waitqueue_active(&ep->poll_wait))
-			pwake++;
-	}
-	spin_unlock_irqrestore(&ep->lock, flags);
+	/*
+	 * Wake up (if active) both the eventpoll wait list and
+	 * the ->poll() wait list (delayed after we release the mutex).
+	 */
+	if (!list_empty(&ep->rdllist))
+		pwake = ep_ready_wakeup(ep);
 
 	mutex_unlock(&ep->mtx);
 
@@ -630,16 +665,13 @@ static int ep_scan_ready_list(struct eventpoll *ep,
  */
 static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 {
-	unsigned long flags;
 	struct file *file = epi->ffd.file;
 
 	/*
-	 * Removes poll wait queue hooks. We _have_ to do this without holding
-	 * the "ep->lock" otherwise a deadlock might occur. This because of the
-	 * sequence of the lock acquisition. Here we do "ep->lock" then the wait
-	 * queue head lock when unregistering the wait queue. The wakeup callback
-	 * will run by holding the wait queue head lock and will call our callback
-	 * that will try to get "ep->lock".
+	 * Removes poll wait queue hooks. Once this is done the poll callback
+	 * cannot be running for this item anymore, since it runs with the
+	 * wait queue head lock held, so the item can be taken off the
+	 * pending chain.
 	 */
 	ep_unregister_pollwait(ep, epi);
 
@@ -651,10 +683,7 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 
 	rb_erase(&epi->rbn, &ep->rbr);
 
-	spin_lock_irqsave(&ep->lock, flags);
-	if (ep_is_linked(&epi->rdllink))
-		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	ep_unqueue(ep, epi);
 
 	/* At this point it is safe to free the eventpoll item */
 	kmem_cache_free(epi_cache, epi);
@@ -696,7 +725,7 @@ static void ep_free(struct eventpoll *ep)
 	 * Walks through the whole tree by freeing each "struct epitem". At this
 	 * point we are sure no poll callbacks will be lingering around, and also by
 	 * holding "epmutex" we can be sure that no file cleanup code will hit
-	 * us during this operation. So we can avoid the lock on "ep->lock".
+	 * us during this operation. So we can avoid the lock on "ep->mtx".
 	 */
 	while ((rbp = rb_first(&ep->rbr)) != NULL) {
 		epi = rb_entry(rbp, struct epitem, rbn);
@@ -827,13 +856,12 @@ static int ep_alloc(struct eventpoll **pep)
 	if (unlikely(!ep))
 		goto free_uid;
 
-	spin_lock_init(&ep->lock);
 	mutex_init(&ep->mtx);
 	init_waitqueue_head(&ep->wq);
 	init_waitqueue_head(&ep->poll_wait);
 	INIT_LIST_HEAD(&ep->rdllist);
 	ep->rbr = RB_ROOT;
-	ep->ovflist = EP_UNACTIVE_PTR;
+	ep->pending = NULL;
 	ep->user = user;
 
 	*pep = ep;
@@ -877,27 +905,18 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
 /*
  * This is the callback that is passed to the wait queue wakeup
  * mechanism. It is called by the stored file descriptors when they
- * have events to report.
+ * have events to report. It takes no lock: the item is pushed on
+ * ep->pending and only the callback that finds the chain empty wakes
+ * up a waiter, which then collects the whole batch.
  */
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
-	int pwake = 0;
-	unsigned long flags;
+	int pwake = 0, ewake = 0, wake = 0;
+	unsigned long pollflags = (unsigned long)key;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
-
-	if ((unsigned long)key & POLLFREE) {
-		ep_pwq_from_wait(wait)->whead = NULL;
-		/*
-		 * whead = NULL above can race with ep_remove_wait_queue()
-		 * which can do another remove_wait_queue() after us, so we
-		 * can't use __remove_wait_queue(). whead->lock is held by
-		 * the caller.
-		 */
-		list_del_init(&wait->task_list);
-	}
-
-	spin_lock_irqsave(&ep->lock, flags);
+	unsigned int events = ACCESS_ONCE(epi->event.events);
+	struct epitem *first;
 
 	/*
 	 * If the event mask does not contain any poll(2) event, we consider the
@@ -905,8 +924,8 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * EPOLLONESHOT bit that disables the descriptor when an event is received,
 	 * until the next EPOLL_CTL_MOD will be issued.
 	 */
-	if (!(epi->event.events & ~EP_PRIVATE_BITS))
-		goto out_unlock;
+	if (!(events & ~EP_PRIVATE_BITS))
+		goto out;
 
 	/*
 	 * Check the events coming with the callback. At this stage, not
@@ -914,44 +933,78 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * callback. We need to be able to handle both cases here, hence the
 	 * test for "key" != NULL before the event match test.
 	 */
-	if (key && !((unsigned long) key & epi->event.events))
-		goto out_unlock;
+	if (pollflags && !(pollflags & events))
+		goto out;
 
 	/*
-	 * If we are transferring events to userspace, we can hold no locks
-	 * (because we're accessing user memory, and because of linux f_op->poll()
-	 * semantics). All the events that happen during that period of time are
-	 * chained in ep->ovflist and requeued later on.
+	 * Claim the item by moving its ->next off EP_UNACTIVE_PTR, so that it
+	 * is chained only once. If it is queued already, the event will be
+	 * seen when the chain is collected.
 	 */
-	if (unlikely(ep->ovflist != EP_UNACTIVE_PTR)) {
-		if (epi->next == EP_UNACTIVE_PTR) {
-			epi->next = ep->ovflist;
-			ep->ovflist = epi;
-		}
-		goto out_unlock;
+	if (cmpxchg(&epi->next, EP_UNACTIVE_PTR, NULL) == EP_UNACTIVE_PTR) {
+		do {
+			first = ACCESS_ONCE(ep->pending);
+			epi->next = first;
+		} while (cmpxchg(&ep->pending, first, epi) != first);
+
+		/* Whoever made the chain non-empty has woken up a waiter */
+		wake = !first;
 	}
 
-	/* If this file is already in the ready list we exit soon */
-	if (!ep_is_linked(&epi->rdllink))
-		list_add_tail(&epi->rdllink, &ep->rdllist);
-
 	/*
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
-	 * wait list.
+	 * wait list. The cmpxchg() above orders the queueing against the
+	 * waitqueue_active() checks.
 	 */
-	if (waitqueue_active(&ep->wq))
-		wake_up_locked(&ep->wq);
-	if (waitqueue_active(&ep->poll_wait))
+	if (waitqueue_active(&ep->wq)) {
+		if ((events & EPOLLEXCLUSIVE) && !(pollflags & POLLFREE)) {
+			switch (pollflags & EPOLLINOUT_BITS) {
+			case POLLIN:
+				if (events & POLLIN)
+					ewake = 1;
+				break;
+			case POLLOUT:
+				if (events & POLLOUT)
+					ewake = 1;
+				break;
+			case 0:
+				ewake = 1;
+				break;
+			}
+		}
+		if (wake)
+			wake_up(&ep->wq);
+	}
+	if (wake && waitqueue_active(&ep->poll_wait))
 		pwake++;
 
-out_unlock:
-	spin_unlock_irqrestore(&ep->lock, flags);
-
-	/* We have to call this outside the lock */
+out:
 	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
 
-	return 1;
+	if (!(events & EPOLLEXCLUSIVE))
+		ewake = 1;
+
+	if (pollflags & POLLFREE) {
+		/*
+		 * whead = NULL below can race with ep_remove_wait_queue()
+		 * which can do another remove_wait_queue() after us, so we
+		 * can't use __remove_wait_queue(). whead->lock is held by
+		 * the caller. Once whead is NULL, ep_remove() will not wait
+		 * for us anymore and may free the item, so this must come
+		 * last.
+		 */
+		list_del_init(&wait->task_list);
+		smp_mb();
+		ep_pwq_from_wait(wait)->whead = NULL;
+	}
+
+	/*
+	 * An exclusive wait entry tells the waker whether it found a task
+	 * to hand the event to, so that it moves on to the next epoll set
+	 * otherwise.
+	 */
+	return ewake;
 }
 
 /*
@@ -968,7 +1021,10 @@ static void ep_ptable_queue_proc(struct file *file, wait_queue_head_t *whead,
 		init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
 		pwq->whead = whead;
 		pwq->base = epi;
-		add_wait_queue(whead, &pwq->wait);
+		if (epi->event.events & EPOLLEXCLUSIVE)
+			add_wait_queue_exclusive(whead, &pwq->wait);
+		else
+			add_wait_queue(whead, &pwq->wait);
 		list_add_tail(&pwq->llink, &epi->pwqlist);
 		epi->nwait++;
 	} else {
@@ -1098,7 +1154,6 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 		     struct file *tfile, int fd)
 {
 	int error, revents, pwake = 0;
-	unsigned long flags;
 	long user_watches;
 	struct epitem *epi;
 	struct ep_pqueue epq;
@@ -1158,22 +1213,14 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	if (reverse_path_check())
 		goto error_remove_epi;
 
-	/* We have to drop the new item inside our item list to keep track of it */
-	spin_lock_irqsave(&ep->lock, flags);
-
 	/* If the file is already "ready" we drop it inside the ready list */
 	if ((revents & event->events) && !ep_is_linked(&epi->rdllink)) {
 		list_add_tail(&epi->rdllink, &ep->rdllist);
 
 		/* Notify waiting tasks that events are available */
-		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
-		if (waitqueue_active(&ep->poll_wait))
-			pwake++;
+		pwake = ep_ready_wakeup(ep);
 	}
 
-	spin_unlock_irqrestore(&ep->lock, flags);
-
 	atomic_long_inc(&ep->user->epoll_watches);
 
 	/* We have to call this outside the lock */
@@ -1195,14 +1242,9 @@ error_unregister:
 
 	/*
 	 * We need to do this because an event could have been arrived on some
-	 * allocated wait queue. Note that we don't care about the ep->ovflist
-	 * list, since that is used/cleaned only inside a section bound by "mtx".
-	 * And ep_insert() is called with "mtx" held.
+	 * allocated wait queue, and the poll callback queued the item.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
-	if (ep_is_linked(&epi->rdllink))
-		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	ep_unqueue(ep, epi);
 
 	kmem_cache_free(epi_cache, epi);
 
@@ -1240,18 +1282,11 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 * If the item is "hot" and it is not registered inside the ready
 	 * list, push it inside.
 	 */
-	if (revents & event->events) {
-		spin_lock_irq(&ep->lock);
-		if (!ep_is_linked(&epi->rdllink)) {
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-
-			/* Notify waiting tasks that events are available */
-			if (waitqueue_active(&ep->wq))
-				wake_up_locked(&ep->wq);
-			if (waitqueue_active(&ep->poll_wait))
-				pwake++;
-		}
-		spin_unlock_irq(&ep->lock);
+	if ((revents & event->events) && !ep_is_linked(&epi->rdllink)) {
+		list_add_tail(&epi->rdllink, &ep->rdllist);
+
+		/* Notify waiting tasks that events are available */
+		pwake = ep_ready_wakeup(ep);
 	}
 
 	/* We have to call this outside the lock */
@@ -1314,7 +1349,7 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 				 * into ep->rdllist besides us. The epoll_ctl()
 				 * callers are locked out by
 				 * ep_scan_ready_list() holding "mtx" and the
-				 * poll callback will queue them in ep->ovflist.
+				 * poll callback will queue them in ep->pending.
 				 */
 				list_add_tail(&epi->rdllink, &ep->rdllist);
 			}
@@ -1367,7 +1402,6 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		   int maxevents, long timeout)
 {
 	int res = 0, eavail, timed_out = 0;
-	unsigned long flags;
 	long slack = 0;
 	wait_queue_t wait;
 	ktime_t expires, *to = NULL;
@@ -1384,21 +1418,19 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		 * caller specified a non blocking operation.
 		 */
 		timed_out = 1;
-		spin_lock_irqsave(&ep->lock, flags);
 		goto check_events;
 	}
 
 fetch_events:
-	spin_lock_irqsave(&ep->lock, flags);
-
 	if (!ep_events_available(ep)) {
 		/*
 		 * We don't have any available event to return to the caller.
 		 * We need to sleep here, and we will be wake up by
 		 * ep_poll_callback() when events will become available.
+		 * The wait is exclusive, a batch of events wakes up one task.
 		 */
 		init_waitqueue_entry(&wait, current);
-		__add_wait_queue_exclusive(&ep->wq, &wait);
+		add_wait_queue_exclusive(&ep->wq, &wait);
 
 		for (;;) {
 			/*
@@ -1414,13 +1446,10 @@ fetch_events:
 				break;
 			}
 
-			spin_unlock_irqrestore(&ep->lock, flags);
 			if (!schedule_hrtimeout_range(to, slack, HRTIMER_MODE_ABS))
 				timed_out = 1;
-
-			spin_lock_irqsave(&ep->lock, flags);
 		}
-		__remove_wait_queue(&ep->wq, &wait);
+		remove_wait_queue(&ep->wq, &wait);
 
 		set_current_state(TASK_RUNNING);
 	}
@@ -1428,8 +1457,6 @@ check_events:
 	/* Is it worth to try to dig for events ? */
 	eavail = ep_events_available(ep);
 
-	spin_unlock_irqrestore(&ep->lock, flags);
-
 	/*
 	 * Try to transfer events to user space. In case we get 0 events and
 	 * there's still timeout left over, we go trying again in search of
@@ -1638,6 +1665,19 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 	if (file == tfile || !is_file_epoll(file))
 		goto error_tgt_fput;
 
+	/*
+	 * epoll adds to the wakeup queue at EPOLL_CTL_ADD time only, so
+	 * EPOLLEXCLUSIVE is not allowed for a EPOLL_CTL_MOD operation.
+	 * Also, we do not currently support nested exclusive wakeups.
+	 */
+	if (ep_op_has_event(op) && (epds.events & EPOLLEXCLUSIVE)) {
+		if (op == EPOLL_CTL_MOD)
+			goto error_tgt_fput;
+		if (is_file_epoll(tfile) ||
+		    (epds.events & ~EPOLLEXCLUSIVE_OK_BITS))
+			goto error_tgt_fput;
+	}
+
 	/*
 	 * At this point it is safe to assume that the "private_data" contains
 	 * our own data structure.
@@ -1698,8 +1738,10 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 		break;
 	case EPOLL_CTL_MOD:
 		if (epi) {
-			epds.events |= POLLERR | POLLHUP;
-			error = ep_modify(ep, epi, &epds);
+			if (!(epi->event.events & EPOLLEXCLUSIVE)) {
+				epds.events |= POLLERR | POLLHUP;
+				error = ep_modify(ep, epi, &epds);
+			}
 		} else
 			error = -ENOENT;
 		break;
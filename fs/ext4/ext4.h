@@ -380,6 +380,7 @@ struct flex_groups {
 #define EXT4_EXTENTS_FL			0x00080000 /* Inode uses extents */
 #define EXT4_EA_INODE_FL	        0x00200000 /* Inode used for large EA */
 #define EXT4_EOFBLOCKS_FL		0x00400000 /* Blocks allocated beyond EOF */
+#define EXT4_INLINE_DATA_FL		0x10000000 /* Inode has inline data */
 #define EXT4_RESERVED_FL		0x80000000 /* reserved for ext4 lib */
 
 #define EXT4_FL_USER_VISIBLE		0x004BDFFF /* User visible flags */
@@ -436,6 +437,7 @@ enum {
 	EXT4_INODE_EXTENTS	= 19,	/* Inode uses extents */
 	EXT4_INODE_EA_INODE	= 21,	/* Inode used for large EA */
 	EXT4_INODE_EOFBLOCKS	= 22,	/* Blocks allocated beyond EOF */
+	EXT4_INODE_INLINE_DATA	= 28,	/* Data in inode */
 	EXT4_INODE_RESERVED	= 31,	/* reserved for ext4 lib */
 };
 
@@ -482,6 +484,7 @@ static inline void ext4_check_flag_values(void)
 	CHECK_FLAG_VALUE(EXTENTS);
 	CHECK_FLAG_VALUE(EA_INODE);
 	CHECK_FLAG_VALUE(EOFBLOCKS);
+	CHECK_FLAG_VALUE(INLINE_DATA);
 	CHECK_FLAG_VALUE(RESERVED);
 }
 
@@ -859,6 +862,11 @@ struct ext4_inode_info {
 	 * by other means, so we have i_data_sem.
 	 */
 	struct rw_semaphore i_data_sem;
+	/*
+	 * Held for writing while entries are added to or removed from a
+	 * directory, and for reading by lookups that run without i_mutex.
+	 */
+	struct rw_semaphore i_dir_rwsem;
 	struct inode vfs_inode;
 	struct jbd2_inode *jinode;
 
@@ -908,6 +916,16 @@ struct ext4_inode_info {
 	 */
 	tid_t i_sync_tid;
 	tid_t i_datasync_tid;
+
+	/*
+	 * Data I/O submissions for the inode, and the count already known
+	 * to be behind a completed cache flush.  fsync skips the flush
+	 * while the two are equal.  Concurrent fsyncs may store the flushed
+	 * count out of order; any value stored was flushed, so a stale one
+	 * only costs an extra flush.
+	 */
+	atomic_t i_wb_seq;
+	unsigned int i_flushed_seq;
 };
 
 /*
@@ -1126,6 +1144,23 @@ struct ext4_super_block {
 #define EXT4_MF_MNTDIR_SAMPLED	0x0001
 #define EXT4_MF_FS_ABORTED	0x0002	/* Fatal error detected */
 
+/*
+ * fsync statistics, reported in /proc/fs/ext4/<dev>/fsync_stats
+ */
+#define EXT4_FSYNC_HIST_BUCKETS	6	/* <100us, <1ms, ... <1s, slower */
+
+struct ext4_fsync_stats {
+	u64 calls;		/* ext4_sync_file() invocations */
+	u64 commits;		/* waited for a journal commit */
+	u64 batched;		/* delayed the commit to let others join */
+	u64 flushes;		/* cache flushes issued */
+	u64 flushes_shared;	/* covered by another caller's flush */
+	u64 flushes_skipped;	/* no data written since the last flush */
+	u64 total_ns;
+	u64 max_ns;
+	u64 hist[EXT4_FSYNC_HIST_BUCKETS];
+};
+
 /*
  * fourth extended-fs super-block data in memory
  */
@@ -1266,6 +1301,15 @@ struct ext4_sb_info {
 
 	/* record the last minlen when FITRIM is called. */
 	atomic_t s_last_trim_minblks;
+
+	/* fsync cache flush batching and statistics, under s_fsync_lock */
+	spinlock_t s_fsync_lock;
+	wait_queue_head_t s_flush_wait;
+	unsigned int s_flush_started;
+	unsigned int s_flush_done;
+	int s_flush_err;
+	int s_flush_running;
+	struct ext4_fsync_stats s_fsync_stats;
 };
 
 static inline struct ext4_sb_info *EXT4_SB(struct super_block *sb)
@@ -1314,6 +1358,7 @@ enum {
 	EXT4_STATE_DIO_UNWRITTEN,	/* need convert on dio done*/
 	EXT4_STATE_NEWENTRY,		/* File just added to dir */
 	EXT4_STATE_DELALLOC_RESERVED,	/* blks already reserved for delalloc */
+	EXT4_STATE_MAY_INLINE_DATA,	/* may have in-inode data */
 };
 
 #define EXT4_INODE_BIT_FNS(name, field, offset)				\
@@ -1346,6 +1391,11 @@ static inline void ext4_clear_state_flags(struct ext4_inode_info *ei)
 	/* We depend on the fact that callers will set i_flags */
 }
 #endif
+
+static inline int ext4_has_inline_data(struct inode *inode)
+{
+	return ext4_test_inode_flag(inode, EXT4_INODE_INLINE_DATA);
+}
 #else
 /* Assume that user mode programs are passing in an ext4fs superblock, not
  * a kernel struct super_block.  This will allow us to call the feature-test
@@ -1453,7 +1503,8 @@ static inline void ext4_clear_state_flags(struct ext4_inode_info *ei)
 					 EXT4_FEATURE_INCOMPAT_EXTENTS| \
 					 EXT4_FEATURE_INCOMPAT_64BIT| \
 					 EXT4_FEATURE_INCOMPAT_FLEX_BG| \
-					 EXT4_FEATURE_INCOMPAT_MMP)
+					 EXT4_FEATURE_INCOMPAT_MMP | \
+					 EXT4_FEATURE_INCOMPAT_INLINEDATA)
 #define EXT4_FEATURE_RO_COMPAT_SUPP	(EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER| \
 					 EXT4_FEATURE_RO_COMPAT_LARGE_FILE| \
 					 EXT4_FEATURE_RO_COMPAT_GDT_CSUM| \
@@ -1552,6 +1603,14 @@ struct ext4_dir_entry_2 {
 					 ~EXT4_DIR_ROUND)
 #define EXT4_MAX_REC_LEN		((1<<16)-1)
 
+/*
+ * Inline data lives in i_block and continues in the "system.data"
+ * in-inode extended attribute.  An inline directory starts with the
+ * parent's inode number in place of the "." and ".." entries.
+ */
+#define EXT4_MIN_INLINE_DATA_SIZE	((sizeof(__le32) * EXT4_N_BLOCKS))
+#define EXT4_INLINE_DOTDOT_SIZE		4
+
 /*
  * If we ever get support for fs block sizes > page_size, we'll need
  * to remove the #if statements in the next two functions...
@@ -1589,6 +1648,37 @@ static inline __le16 ext4_rec_len_to_disk(unsigned len, unsigned blocksize)
 #endif
 }
 
+static inline unsigned char get_dtype(struct super_block *sb, int filetype)
+{
+	static const unsigned char ext4_filetype_table[] = {
+		DT_UNKNOWN, DT_REG, DT_DIR, DT_CHR, DT_BLK, DT_FIFO, DT_SOCK,
+		DT_LNK
+	};
+
+	if (!EXT4_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_FILETYPE) ||
+	    (filetype >= EXT4_FT_MAX))
+		return DT_UNKNOWN;
+
+	return (ext4_filetype_table[filetype]);
+}
+
+/*
+ * p is at least 6 bytes before the end of page
+ */
+static inline struct ext4_dir_entry_2 *
+ext4_next_entry(struct ext4_dir_entry_2 *p, unsigned long blocksize)
+{
+	return (struct ext4_dir_entry_2 *)((char *)p +
+		ext4_rec_len_from_disk(p->rec_len, blocksize));
+}
+
+static inline void ext4_update_dx_flag(struct inode *inode)
+{
+	if (!EXT4_HAS_COMPAT_FEATURE(inode->i_sb,
+				     EXT4_FEATURE_COMPAT_DIR_INDEX))
+		ext4_clear_inode_flag(inode, EXT4_INODE_INDEX);
+}
+
 /*
  * Hash Tree Directory indexing
  * (c) Daniel Phillips, 2001
@@ -1830,10 +1920,11 @@ ext4_fsblk_t ext4_inode_to_goal_block(struct inode *);
 extern int __ext4_check_dir_entry(const char *, unsigned int, struct inode *,
 				  struct file *,
 				  struct ext4_dir_entry_2 *,
-				  struct buffer_head *, unsigned int);
-#define ext4_check_dir_entry(dir, filp, de, bh, offset)			\
+				  struct buffer_head *, char *, int,
+				  unsigned int);
+#define ext4_check_dir_entry(dir, filp, de, bh, buf, size, offset)	\
 	unlikely(__ext4_check_dir_entry(__func__, __LINE__, (dir), (filp), \
-					(de), (bh), (offset)))
+					(de), (bh), (buf), (size), (offset)))
 extern int ext4_htree_store_dirent(struct file *dir_file, __u32 hash,
 				    __u32 minor_hash,
 				    struct ext4_dir_entry_2 *dirent);
@@ -1842,6 +1933,16 @@ extern void ext4_htree_free_dir_info(struct dir_private_info *p);
 /* fsync.c */
 extern int ext4_sync_file(struct file *, loff_t, loff_t, int);
 extern int ext4_flush_completed_IO(struct inode *);
+extern const struct file_operations ext4_fsync_stats_fops;
+
+/*
+ * Called once data I/O for the inode has been submitted, i.e. after
+ * the pages involved are under writeback.
+ */
+static inline void ext4_data_written(struct inode *inode)
+{
+	atomic_inc(&EXT4_I(inode)->i_wb_seq);
+}
 
 /* hash.c */
 extern int ext4fs_dirhash(const char *name, int len, struct
@@ -1914,6 +2015,8 @@ extern int ext4_discard_partial_page_buffers(handle_t *handle,
 		struct address_space *mapping, loff_t from,
 		loff_t length, int flags);
 extern int ext4_page_mkwrite(struct vm_area_struct *vma, struct vm_fault *vmf);
+extern int ext4_convert_page_to_blocks(handle_t *handle, struct inode *inode,
+				       struct page *page, unsigned len);
 extern qsize_t *ext4_get_reserved_space(struct inode *inode);
 extern void ext4_da_update_reserve_space(struct inode *inode,
 					int used, int quota_claim);
@@ -1940,6 +2043,26 @@ extern int ext4_orphan_add(handle_t *, struct inode *);
 extern int ext4_orphan_del(handle_t *, struct inode *);
 extern int ext4_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 				__u32 start_minor_hash, __u32 *next_hash);
+extern int ext4_search_dir(struct buffer_head *bh, char *search_buf,
+			   int buf_size, struct inode *dir,
+			   const struct qstr *d_name, unsigned int offset,
+			   struct ext4_dir_entry_2 **res_dir);
+extern int ext4_find_dest_de(struct inode *dir, struct inode *inode,
+			     struct buffer_head *bh, void *buf, int buf_size,
+			     const char *name, int namelen,
+			     struct ext4_dir_entry_2 **dest_de);
+extern void ext4_insert_dentry(struct inode *inode,
+			       struct ext4_dir_entry_2 *de, int buf_size,
+			       const char *name, int namelen);
+extern int ext4_generic_delete_entry(struct inode *dir,
+				     struct ext4_dir_entry_2 *de_del,
+				     struct buffer_head *bh, void *entry_buf,
+				     int buf_size);
+extern struct ext4_dir_entry_2 *ext4_init_dot_dotdot(struct inode *inode,
+						     struct ext4_dir_entry_2 *de,
+						     int blocksize,
+						     __u32 parent_ino,
+						     int dotdot_real_len);
 
 /* resize.c */
 extern int ext4_group_add(struct super_block *sb,
@@ -41,6 +41,7 @@
 #include <asm/uaccess.h>
 #include <linux/fiemap.h>
 #include "ext4_jbd2.h"
+#include "xattr.h"
 
 #include <trace/events/ext4.h>
 
@@ -4279,6 +4280,15 @@ long ext4_fallocate(struct file *file, int mode, loff_t offset, loff_t len)
 	struct ext4_map_blocks map;
 	unsigned int credits, blkbits = inode->i_blkbits;
 
+	/* inline data has to move out to a block before any allocation */
+	if (ext4_has_inline_data(inode)) {
+		mutex_lock(&inode->i_mutex);
+		ret = ext4_convert_inline_data(inode);
+		mutex_unlock(&inode->i_mutex);
+		if (ret)
+			return ret;
+	}
+
 	/*
 	 * currently supporting (pre)allocate mode for extent-based
 	 * files _only_
@@ -4834,6 +4844,16 @@ int ext4_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo,
 	ext4_lblk_t start_blk;
 	int error = 0;
 
+	if (ext4_has_inline_data(inode)) {
+		int has_inline = 1;
+
+		if (fiemap_check_flags(fieinfo, EXT4_FIEMAP_FLAGS))
+			return -EBADR;
+		error = ext4_inline_data_fiemap(inode, fieinfo, &has_inline);
+		if (has_inline)
+			return error;
+	}
+
 	/* fallback to generic here if not in extents fmt */
 	if (!(ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)))
 		return generic_block_fiemap(inode, fieinfo, start, len,
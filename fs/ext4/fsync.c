@@ -24,10 +24,14 @@
 
 #include <linux/time.h>
 #include <linux/fs.h>
+#include <linux/module.h>
 #include <linux/sched.h>
 #include <linux/writeback.h>
 #include <linux/jbd2.h>
 #include <linux/blkdev.h>
+#include <linux/hrtimer.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 
 #include "ext4.h"
 #include "ext4_jbd2.h"
@@ -191,6 +195,185 @@ static int __sync_inode(struct inode *inode, int datasync)
 	return ret;
 }
 
+/*
+ * Issue a cache flush that starts after the caller's data has reached the
+ * device.  Only one flush per filesystem is in flight at a time: callers
+ * that arrive while it runs wait for it to finish and then share the next
+ * one, so a burst of concurrent fsyncs costs two flushes instead of one
+ * each.
+ */
+static int ext4_flush_device(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	unsigned int target, seq;
+	int err, shared = 1;
+	DEFINE_WAIT(wait);
+
+	spin_lock(&sbi->s_fsync_lock);
+	target = sbi->s_flush_started + 1;
+	for (;;) {
+		if ((int)(sbi->s_flush_done - target) >= 0) {
+			err = sbi->s_flush_err;
+			break;
+		}
+		if (!sbi->s_flush_running) {
+			sbi->s_flush_running = 1;
+			seq = ++sbi->s_flush_started;
+			spin_unlock(&sbi->s_fsync_lock);
+
+			err = blkdev_issue_flush(sb->s_bdev, GFP_KERNEL, NULL);
+
+			spin_lock(&sbi->s_fsync_lock);
+			sbi->s_flush_running = 0;
+			sbi->s_flush_done = seq;
+			sbi->s_flush_err = err;
+			sbi->s_fsync_stats.flushes++;
+			wake_up_all(&sbi->s_flush_wait);
+			shared = 0;
+			break;
+		}
+		prepare_to_wait(&sbi->s_flush_wait, &wait,
+				TASK_UNINTERRUPTIBLE);
+		spin_unlock(&sbi->s_fsync_lock);
+		schedule();
+		finish_wait(&sbi->s_flush_wait, &wait);
+		spin_lock(&sbi->s_fsync_lock);
+	}
+	if (shared)
+		sbi->s_fsync_stats.flushes_shared++;
+	spin_unlock(&sbi->s_fsync_lock);
+	return err;
+}
+
+/*
+ * Give fsyncs from other tasks a chance to join the running transaction
+ * before its commit is kicked off, the same way jbd2_journal_stop()
+ * batches synchronous handles.  A task that keeps fsyncing on its own is
+ * never delayed.  Must be called without i_mutex, so that the inode's
+ * writers are not held off while we wait.
+ */
+static int ext4_fsync_batch(journal_t *journal, tid_t tid)
+{
+	transaction_t *transaction;
+	u64 commit_time, trans_time;
+	pid_t pid = current->pid;
+	ktime_t expires;
+
+	write_lock(&journal->j_state_lock);
+	if (journal->j_last_sync_writer == pid) {
+		write_unlock(&journal->j_state_lock);
+		return 0;
+	}
+	journal->j_last_sync_writer = pid;
+
+	transaction = journal->j_running_transaction;
+	if (!transaction || transaction->t_tid != tid) {
+		write_unlock(&journal->j_state_lock);
+		return 0;
+	}
+	commit_time = journal->j_average_commit_time;
+	trans_time = ktime_to_ns(ktime_sub(ktime_get(),
+					   transaction->t_start_time));
+	write_unlock(&journal->j_state_lock);
+
+	commit_time = max_t(u64, commit_time, 1000*journal->j_min_batch_time);
+	commit_time = min_t(u64, commit_time, 1000*journal->j_max_batch_time);
+	if (trans_time >= commit_time)
+		return 0;
+
+	expires = ktime_add_ns(ktime_get(), commit_time);
+	set_current_state(TASK_UNINTERRUPTIBLE);
+	schedule_hrtimeout(&expires, HRTIMER_MODE_ABS);
+	return 1;
+}
+
+static void ext4_fsync_account(struct super_block *sb, ktime_t start,
+			       int commit, int batched, int skipped)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fsync_stats *st = &sbi->s_fsync_stats;
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	u64 limit = 100 * NSEC_PER_USEC;
+	int i = 0;
+
+	while (i < EXT4_FSYNC_HIST_BUCKETS - 1 && ns >= limit) {
+		limit *= 10;
+		i++;
+	}
+
+	spin_lock(&sbi->s_fsync_lock);
+	st->calls++;
+	st->commits += commit;
+	st->batched += batched;
+	st->flushes_skipped += skipped;
+	st->total_ns += ns;
+	if (ns > st->max_ns)
+		st->max_ns = ns;
+	st->hist[i]++;
+	spin_unlock(&sbi->s_fsync_lock);
+}
+
+static int ext4_fsync_stats_show(struct seq_file *seq, void *v)
+{
+	struct super_block *sb = seq->private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	static const char * const bucket[EXT4_FSYNC_HIST_BUCKETS] = {
+		"<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s"
+	};
+	struct ext4_fsync_stats st;
+	u64 avg = 0;
+	int i;
+
+	spin_lock(&sbi->s_fsync_lock);
+	st = sbi->s_fsync_stats;
+	spin_unlock(&sbi->s_fsync_lock);
+
+	if (st.calls)
+		avg = div64_u64(st.total_ns, st.calls);
+
+	seq_printf(seq, "calls:           %llu\n", st.calls);
+	seq_printf(seq, "commits:         %llu\n", st.commits);
+	seq_printf(seq, "batched commits: %llu\n", st.batched);
+	seq_printf(seq, "flushes:         %llu\n", st.flushes);
+	seq_printf(seq, "shared flushes:  %llu\n", st.flushes_shared);
+	seq_printf(seq, "skipped flushes: %llu\n", st.flushes_skipped);
+	seq_printf(seq, "avg latency us:  %llu\n", div_u64(avg, NSEC_PER_USEC));
+	seq_printf(seq, "max latency us:  %llu\n",
+		   div_u64(st.max_ns, NSEC_PER_USEC));
+	seq_puts(seq, "latency histogram:\n");
+	for (i = 0; i < EXT4_FSYNC_HIST_BUCKETS; i++)
+		seq_printf(seq, "  %-7s %llu\n", bucket[i], st.hist[i]);
+	return 0;
+}
+
+static int ext4_fsync_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ext4_fsync_stats_show, PDE(inode)->data);
+}
+
+/* Any write resets the counters */
+static ssize_t ext4_fsync_stats_write(struct file *file,
+				      const char __user *buf,
+				      size_t count, loff_t *ppos)
+{
+	struct super_block *sb = ((struct seq_file *)file->private_data)->private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	spin_lock(&sbi->s_fsync_lock);
+	memset(&sbi->s_fsync_stats, 0, sizeof(sbi->s_fsync_stats));
+	spin_unlock(&sbi->s_fsync_lock);
+	return count;
+}
+
+const struct file_operations ext4_fsync_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= ext4_fsync_stats_open,
+	.read		= seq_read,
+	.write		= ext4_fsync_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 /*
  * akpm: A new design for ext4_sync_file().
  *
@@ -200,9 +383,12 @@ static int __sync_inode(struct inode *inode, int datasync)
  * state in the journalling system.
  *
  * What we do is just kick off a commit and wait on it.  This will snapshot the
- * inode to disk.
+ * inode to disk.  A commit is only waited for if the inode's transaction
+ * has not committed yet, and the cache flush is skipped if no data of the
+ * inode was written since the last one.
  *
- * i_mutex lock is held when entering and exiting this function
+ * i_mutex is taken to flush completed I/O and pick the transaction, and
+ * dropped again before waiting on the journal and the device.
  */
 
 int ext4_sync_file(struct file *file, loff_t start, loff_t end, int datasync)
@@ -210,15 +396,26 @@ int ext4_sync_file(struct file *file, loff_t start, loff_t end, int datasync)
 	struct inode *inode = file->f_mapping->host;
 	struct ext4_inode_info *ei = EXT4_I(inode);
 	journal_t *journal = EXT4_SB(inode->i_sb)->s_journal;
+	ktime_t start_time = ktime_get();
 	int ret;
 	tid_t commit_tid;
+	unsigned int wb_seq;
 	bool needs_barrier = false;
+	int need_commit = 0, batched = 0, skipped = 0;
 
 	J_ASSERT(ext4_journal_current_handle() == NULL);
 
 	trace_ext4_sync_file_enter(file, datasync);
 
-	ret = filemap_write_and_wait_range(inode->i_mapping, start, end);
+	/*
+	 * Data I/O counted in i_wb_seq by now has its pages under
+	 * writeback, so the wait below covers it when the whole file is
+	 * synced.  See ext4_data_written().
+	 */
+	ret = filemap_fdatawrite_range(inode->i_mapping, start, end);
+	wb_seq = atomic_read(&ei->i_wb_seq);
+	if (!ret)
+		ret = filemap_fdatawait_range(inode->i_mapping, start, end);
 	if (ret)
 		return ret;
 	mutex_lock(&inode->i_mutex);
@@ -257,15 +454,44 @@ int ext4_sync_file(struct file *file, loff_t start, loff_t end, int datasync)
 	}
 
 	commit_tid = datasync ? ei->i_datasync_tid : ei->i_sync_tid;
+	read_lock(&journal->j_state_lock);
+	need_commit = !tid_geq(journal->j_commit_sequence, commit_tid);
+	read_unlock(&journal->j_state_lock);
+
 	if (journal->j_flags & JBD2_BARRIER &&
 	    !jbd2_trans_will_send_data_barrier(journal, commit_tid))
 		needs_barrier = true;
+	mutex_unlock(&inode->i_mutex);
+
+	if (need_commit)
+		batched = ext4_fsync_batch(journal, commit_tid);
 	jbd2_log_start_commit(journal, commit_tid);
 	ret = jbd2_log_wait_commit(journal, commit_tid);
-	if (needs_barrier)
-		blkdev_issue_flush(inode->i_sb->s_bdev, GFP_KERNEL, NULL);
+
+	/* nothing written since a flush that is known to have completed */
+	if (needs_barrier &&
+	    ACCESS_ONCE(ei->i_flushed_seq) == atomic_read(&ei->i_wb_seq)) {
+		needs_barrier = false;
+		skipped = 1;
+	}
+	/* a failed flush is not reported, but must not be relied upon */
+	if (needs_barrier && ext4_flush_device(inode->i_sb))
+		goto out_unlocked;
+
+	/*
+	 * Whatever was counted before the snapshot is stable now, unless
+	 * only part of the file was synced or AIO DIO is still in flight.
+	 */
+	if (!ret && journal->j_flags & JBD2_BARRIER &&
+	    start == 0 && end == LLONG_MAX &&
+	    !atomic_read(&inode->i_dio_count))
+		ACCESS_ONCE_RW(ei->i_flushed_seq) = wb_seq;
+	goto out_unlocked;
  out:
 	mutex_unlock(&inode->i_mutex);
+ out_unlocked:
+	ext4_fsync_account(inode->i_sb, start_time, need_commit, batched,
+			   skipped);
 	trace_ext4_sync_file_exit(inode, ret);
 	return ret;
 }
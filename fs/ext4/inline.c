@@ -0,0 +1,1406 @@
+/*
+ *  linux/fs/ext4/inline.c
+ *
+ * Small files and directories stored in the inode itself.
+ *
+ * The first EXT4_MIN_INLINE_DATA_SIZE bytes of an inline inode live in
+ * i_block, where the block map or extent tree would otherwise be, and
+ * anything beyond that in the value of the "system.data" extended
+ * attribute in the inode body.  The attribute is always present on an
+ * inline inode, if only with an empty value, and every byte of inline
+ * storage past i_size is kept zero.
+ *
+ * An inline directory keeps the parent's inode number in the first four
+ * bytes of i_block instead of "." and ".." entries; the rest of i_block
+ * and the attribute value each hold an independent run of ordinary
+ * directory entries.
+ *
+ * A write that no longer fits, an mmap write or fallocate moves the data
+ * of a file out to a block with ext4_convert_inline_data().  O_DIRECT
+ * does not convert: ext4_direct_IO() declines inline inodes, so the VFS
+ * falls back to buffered I/O, and the data only moves out once such a
+ * write outgrows the inode.
+ *
+ * All of it is protected by xattr_sem, since any change to the in-inode
+ * attributes can move the value around.
+ */
+
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <linux/pagemap.h>
+#include <linux/slab.h>
+
+#include "ext4_jbd2.h"
+#include "ext4.h"
+#include "xattr.h"
+
+/*
+ * Look up the system.data attribute in the inode table buffer of @iloc.
+ * Returns NULL if the inode has none, or it is not where it should be.
+ */
+static struct ext4_xattr_entry *ext4_inline_xattr(struct inode *inode,
+						  struct ext4_iloc *iloc)
+{
+	struct ext4_xattr_info i = {
+		.name_index = EXT4_XATTR_INDEX_SYSTEM,
+		.name = EXT4_XATTR_SYSTEM_DATA,
+	};
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+		.iloc = *iloc,
+	};
+	struct ext4_xattr_entry *entry;
+
+	if (ext4_xattr_ibody_find(inode, &i, &is) || is.s.not_found)
+		return NULL;
+	entry = is.s.here;
+	if (entry->e_value_block)
+		return NULL;
+	if (entry->e_value_size &&
+	    le16_to_cpu(entry->e_value_offs) +
+	    le32_to_cpu(entry->e_value_size) > is.s.end - is.s.base)
+		return NULL;
+	return entry;
+}
+
+static void *ext4_inline_value(struct inode *inode, struct ext4_iloc *iloc,
+			       struct ext4_xattr_entry *entry)
+{
+	struct ext4_xattr_ibody_header *header;
+
+	header = IHDR(inode, ext4_raw_inode(iloc));
+	return (void *)IFIRST(header) + le16_to_cpu(entry->e_value_offs);
+}
+
+/* Bytes of inline storage the inode has now, or -EIO */
+static int ext4_get_inline_size_nolock(struct inode *inode,
+				       struct ext4_iloc *iloc)
+{
+	struct ext4_xattr_entry *entry;
+
+	entry = ext4_inline_xattr(inode, iloc);
+	if (!entry) {
+		EXT4_ERROR_INODE(inode, "inline data attribute missing");
+		return -EIO;
+	}
+	return EXT4_MIN_INLINE_DATA_SIZE + le32_to_cpu(entry->e_value_size);
+}
+
+/*
+ * How big the system.data value could grow if it were given all of the
+ * free space in the inode body.
+ */
+static int ext4_max_inline_value_size(struct inode *inode,
+				      struct ext4_iloc *iloc)
+{
+	struct ext4_xattr_ibody_header *header;
+	struct ext4_xattr_entry *entry, *data;
+	int free, min_offs;
+
+	min_offs = EXT4_SB(inode->i_sb)->s_inode_size -
+		   EXT4_GOOD_OLD_INODE_SIZE - EXT4_I(inode)->i_extra_isize -
+		   sizeof(struct ext4_xattr_ibody_header);
+
+	if (!ext4_test_inode_state(inode, EXT4_STATE_XATTR)) {
+		free = min_offs - sizeof(__u32);
+		data = NULL;
+	} else {
+		header = IHDR(inode, ext4_raw_inode(iloc));
+		entry = IFIRST(header);
+		for (; !IS_LAST_ENTRY(entry); entry = EXT4_XATTR_NEXT(entry)) {
+			if (!entry->e_value_block && entry->e_value_size) {
+				int offs = le16_to_cpu(entry->e_value_offs);
+
+				if (offs < min_offs)
+					min_offs = offs;
+			}
+		}
+		free = min_offs - ((void *)entry - (void *)IFIRST(header)) -
+		       sizeof(__u32);
+		data = ext4_inline_xattr(inode, iloc);
+	}
+
+	if (data)
+		free += EXT4_XATTR_SIZE(le32_to_cpu(data->e_value_size));
+	else
+		free -= EXT4_XATTR_LEN(strlen(EXT4_XATTR_SYSTEM_DATA));
+	if (free < 0)
+		return 0;
+	return free & ~EXT4_XATTR_ROUND;
+}
+
+static int ext4_get_max_inline_size_nolock(struct inode *inode,
+					   struct ext4_iloc *iloc)
+{
+	if (!EXT4_I(inode)->i_extra_isize)
+		return 0;
+	return EXT4_MIN_INLINE_DATA_SIZE +
+	       ext4_max_inline_value_size(inode, iloc);
+}
+
+/*
+ * The most data @inode could keep inline, given what else is stored in
+ * its body.
+ */
+int ext4_get_max_inline_size(struct inode *inode)
+{
+	struct ext4_iloc iloc;
+	int size;
+
+	if (!EXT4_I(inode)->i_extra_isize)
+		return 0;
+	if (ext4_get_inode_loc(inode, &iloc))
+		return 0;
+	down_read(&EXT4_I(inode)->xattr_sem);
+	size = ext4_get_max_inline_size_nolock(inode, &iloc);
+	up_read(&EXT4_I(inode)->xattr_sem);
+	brelse(iloc.bh);
+	return size;
+}
+
+/*
+ * Make sure an inode read from disk with the inline data flag really
+ * has somewhere to keep it.
+ */
+int ext4_check_inline_data(struct inode *inode, struct ext4_iloc *iloc)
+{
+	if (!EXT4_I(inode)->i_extra_isize ||
+	    !ext4_test_inode_state(inode, EXT4_STATE_XATTR) ||
+	    !ext4_inline_xattr(inode, iloc))
+		return -EIO;
+	return 0;
+}
+
+/* Copy up to @len bytes of inline data to @buffer, return bytes copied */
+static int ext4_read_inline_data(struct inode *inode, void *buffer,
+				 unsigned int len, struct ext4_iloc *iloc)
+{
+	struct ext4_xattr_entry *entry;
+	unsigned int cp_len, copied;
+
+	cp_len = min_t(unsigned int, len, EXT4_MIN_INLINE_DATA_SIZE);
+	memcpy(buffer, ext4_raw_inode(iloc)->i_block, cp_len);
+	copied = cp_len;
+	len -= cp_len;
+	if (!len)
+		return copied;
+
+	entry = ext4_inline_xattr(inode, iloc);
+	if (!entry)
+		return -EIO;
+	cp_len = min_t(unsigned int, len, le32_to_cpu(entry->e_value_size));
+	memcpy(buffer + copied, ext4_inline_value(inode, iloc, entry), cp_len);
+	return copied + cp_len;
+}
+
+/*
+ * Store @len bytes at @pos of the inline data.  The space must already
+ * be there, and the caller must have write access to @iloc.
+ */
+static void ext4_write_inline_data(struct inode *inode, struct ext4_iloc *iloc,
+				   void *buffer, loff_t pos, unsigned int len)
+{
+	struct ext4_xattr_entry *entry;
+	unsigned int cp_len;
+
+	if (pos < EXT4_MIN_INLINE_DATA_SIZE) {
+		cp_len = min_t(unsigned int, len,
+			       EXT4_MIN_INLINE_DATA_SIZE - pos);
+		memcpy((void *)ext4_raw_inode(iloc)->i_block + pos,
+		       buffer, cp_len);
+		buffer += cp_len;
+		pos += cp_len;
+		len -= cp_len;
+	}
+	if (!len)
+		return;
+
+	pos -= EXT4_MIN_INLINE_DATA_SIZE;
+	entry = ext4_inline_xattr(inode, iloc);
+	BUG_ON(!entry || pos + len > le32_to_cpu(entry->e_value_size));
+	memcpy(ext4_inline_value(inode, iloc, entry) + pos, buffer, len);
+}
+
+/*
+ * Resize the system.data value to @value_len bytes, keeping the data
+ * that still fits and zero filling any new space.
+ */
+static int ext4_set_inline_value_size(handle_t *handle, struct inode *inode,
+				      struct ext4_iloc *iloc,
+				      unsigned int value_len)
+{
+	struct ext4_xattr_info i = {
+		.name_index = EXT4_XATTR_INDEX_SYSTEM,
+		.name = EXT4_XATTR_SYSTEM_DATA,
+		.value = "",
+		.value_len = value_len,
+	};
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+		.iloc = *iloc,
+	};
+	void *value = NULL;
+	unsigned int old_len;
+	int error;
+
+	error = ext4_xattr_ibody_find(inode, &i, &is);
+	if (error)
+		return error;
+	if (is.s.not_found)
+		return -EIO;
+	old_len = le32_to_cpu(is.s.here->e_value_size);
+	if (old_len == value_len)
+		return 0;
+
+	if (value_len) {
+		value = kzalloc(value_len, GFP_NOFS);
+		if (!value)
+			return -ENOMEM;
+		memcpy(value, ext4_inline_value(inode, iloc, is.s.here),
+		       min(old_len, value_len));
+		i.value = value;
+	}
+	error = ext4_xattr_ibody_set(handle, inode, &i, &is);
+	kfree(value);
+	return error;
+}
+
+/*
+ * Turn @inode into an inline inode with @len bytes of zeroes.  The
+ * caller holds xattr_sem and write access to @iloc, and must mark the
+ * inode dirty afterwards.
+ */
+static int ext4_create_inline_data(handle_t *handle, struct inode *inode,
+				   struct ext4_iloc *iloc, unsigned int len)
+{
+	struct ext4_xattr_info i = {
+		.name_index = EXT4_XATTR_INDEX_SYSTEM,
+		.name = EXT4_XATTR_SYSTEM_DATA,
+		.value = "",
+		.value_len = 0,
+	};
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+		.iloc = *iloc,
+	};
+	struct ext4_inode *raw_inode = ext4_raw_inode(iloc);
+	void *value = NULL;
+	int error;
+
+	if (!EXT4_I(inode)->i_extra_isize)
+		return -ENOSPC;
+
+	if (ext4_test_inode_state(inode, EXT4_STATE_NEW)) {
+		memset(raw_inode, 0, EXT4_SB(inode->i_sb)->s_inode_size);
+		ext4_clear_inode_state(inode, EXT4_STATE_NEW);
+	}
+
+	if (len > EXT4_MIN_INLINE_DATA_SIZE) {
+		i.value_len = len - EXT4_MIN_INLINE_DATA_SIZE;
+		value = kzalloc(i.value_len, GFP_NOFS);
+		if (!value)
+			return -ENOMEM;
+		i.value = value;
+	}
+
+	error = ext4_xattr_ibody_find(inode, &i, &is);
+	if (!error)
+		error = ext4_xattr_ibody_set(handle, inode, &i, &is);
+	kfree(value);
+	if (error)
+		return error;
+
+	memset(raw_inode->i_block, 0, EXT4_MIN_INLINE_DATA_SIZE);
+	memset(EXT4_I(inode)->i_data, 0, EXT4_MIN_INLINE_DATA_SIZE);
+	ext4_clear_inode_flag(inode, EXT4_INODE_EXTENTS);
+	ext4_set_inode_flag(inode, EXT4_INODE_INLINE_DATA);
+	return 0;
+}
+
+/*
+ * Drop the inline data and give the inode an empty block map or extent
+ * tree.  Same locking as ext4_create_inline_data().
+ */
+static int ext4_destroy_inline_data_nolock(handle_t *handle,
+					   struct inode *inode,
+					   struct ext4_iloc *iloc)
+{
+	struct ext4_xattr_info i = {
+		.name_index = EXT4_XATTR_INDEX_SYSTEM,
+		.name = EXT4_XATTR_SYSTEM_DATA,
+		.value = NULL,
+		.value_len = 0,
+	};
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+		.iloc = *iloc,
+	};
+	int error;
+
+	error = ext4_xattr_ibody_find(inode, &i, &is);
+	if (error)
+		return error;
+	if (!is.s.not_found) {
+		error = ext4_xattr_ibody_set(handle, inode, &i, &is);
+		if (error)
+			return error;
+	}
+
+	memset(ext4_raw_inode(iloc)->i_block, 0, EXT4_MIN_INLINE_DATA_SIZE);
+	memset(EXT4_I(inode)->i_data, 0, EXT4_MIN_INLINE_DATA_SIZE);
+	ext4_clear_inode_flag(inode, EXT4_INODE_INLINE_DATA);
+	ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+	if (EXT4_HAS_INCOMPAT_FEATURE(inode->i_sb,
+				      EXT4_FEATURE_INCOMPAT_EXTENTS)) {
+		ext4_set_inode_flag(inode, EXT4_INODE_EXTENTS);
+		ext4_ext_tree_init(handle, inode);
+	}
+	return 0;
+}
+
+/* Put back what ext4_destroy_inline_data_nolock() took away */
+static void ext4_restore_inline_data(handle_t *handle, struct inode *inode,
+				     struct ext4_iloc *iloc,
+				     void *buf, int inline_size)
+{
+	if (ext4_create_inline_data(handle, inode, iloc, inline_size)) {
+		EXT4_ERROR_INODE(inode, "unable to restore inline data");
+		return;
+	}
+	ext4_write_inline_data(inode, iloc, buf, 0, inline_size);
+	ext4_set_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+}
+
+/*
+ * Fill locked page 0 from the inline data.  Caller holds xattr_sem.
+ * Returns the number of bytes read or an error.
+ */
+static int ext4_read_inline_page(struct inode *inode, struct page *page)
+{
+	struct ext4_iloc iloc;
+	void *kaddr;
+	int ret, len;
+
+	BUG_ON(!PageLocked(page));
+	BUG_ON(page->index);
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		return ret;
+
+	len = ext4_get_inline_size_nolock(inode, &iloc);
+	if (len < 0) {
+		ret = len;
+		goto out;
+	}
+	len = min_t(loff_t, len, i_size_read(inode));
+	kaddr = kmap_atomic(page);
+	ret = ext4_read_inline_data(inode, kaddr, len, &iloc);
+	kunmap_atomic(kaddr);
+	if (ret < 0)
+		goto out;
+	zero_user_segment(page, ret, PAGE_CACHE_SIZE);
+	flush_dcache_page(page);
+	SetPageUptodate(page);
+out:
+	brelse(iloc.bh);
+	return ret;
+}
+
+/*
+ * ->readpage for an inline file.  Returns -EAGAIN, with the page still
+ * locked, if the data has moved out to blocks in the meantime.
+ */
+int ext4_readpage_inline(struct inode *inode, struct page *page)
+{
+	int ret = 0;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		up_read(&EXT4_I(inode)->xattr_sem);
+		return -EAGAIN;
+	}
+
+	if (!page->index)
+		ret = ext4_read_inline_page(inode, page);
+	else if (!PageUptodate(page)) {
+		zero_user_segment(page, 0, PAGE_CACHE_SIZE);
+		SetPageUptodate(page);
+	}
+	up_read(&EXT4_I(inode)->xattr_sem);
+
+	unlock_page(page);
+	return ret >= 0 ? 0 : ret;
+}
+
+/*
+ * Make room for @len bytes of inline data, turning an empty inode into
+ * an inline one first if needed.  -ENOSPC means the data has to go to
+ * blocks.
+ */
+static int ext4_prepare_inline_data(handle_t *handle, struct inode *inode,
+				    unsigned int len)
+{
+	struct ext4_xattr_entry *entry;
+	struct ext4_iloc iloc;
+	int ret, no_expand;
+
+	ret = ext4_reserve_inode_write(handle, inode, &iloc);
+	if (ret)
+		return ret;
+
+	ext4_write_lock_xattr(inode, &no_expand);
+	if (ext4_has_inline_data(inode)) {
+		entry = ext4_inline_xattr(inode, &iloc);
+		if (!entry)
+			ret = -EIO;
+		else if (len > EXT4_MIN_INLINE_DATA_SIZE &&
+			 len - EXT4_MIN_INLINE_DATA_SIZE >
+			 le32_to_cpu(entry->e_value_size))
+			ret = ext4_set_inline_value_size(handle, inode, &iloc,
+					len - EXT4_MIN_INLINE_DATA_SIZE);
+	} else if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA)) {
+		ret = ext4_create_inline_data(handle, inode, &iloc, len);
+	} else {
+		/* converted under us by page_mkwrite */
+		ret = -ENOSPC;
+	}
+	ext4_write_unlock_xattr(inode, &no_expand);
+
+	if (ret) {
+		brelse(iloc.bh);
+		return ret;
+	}
+	return ext4_mark_iloc_dirty(handle, inode, &iloc);
+}
+
+/*
+ * ->write_begin for an inode that may keep its data inline.  Returns 1
+ * with page 0 locked and a handle running if the write can go to the
+ * inode, 0 if it has to take the block path, or an error.
+ */
+int ext4_try_to_write_inline_data(struct address_space *mapping,
+				  struct inode *inode,
+				  loff_t pos, unsigned len,
+				  unsigned flags,
+				  struct page **pagep)
+{
+	handle_t *handle;
+	struct page *page;
+	int ret;
+
+	if (!ext4_has_inline_data(inode) &&
+	    (inode->i_size || inode->i_blocks)) {
+		/* only a file that starts out empty goes inline */
+		ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+		return 0;
+	}
+
+	if (pos + len > ext4_get_max_inline_size(inode))
+		goto convert;
+
+	handle = ext4_journal_start(inode, 1);
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	ret = ext4_prepare_inline_data(handle, inode, pos + len);
+	if (ret) {
+		ext4_journal_stop(handle);
+		if (ret == -ENOSPC)
+			goto convert;
+		return ret;
+	}
+
+	/* We cannot recurse into the filesystem as the transaction is already
+	 * started */
+	flags |= AOP_FLAG_NOFS;
+
+	page = grab_cache_page_write_begin(mapping, 0, flags);
+	if (!page) {
+		ext4_journal_stop(handle);
+		return -ENOMEM;
+	}
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		ret = 0;
+		goto out_page;
+	}
+	if (!PageUptodate(page)) {
+		ret = ext4_read_inline_page(inode, page);
+		if (ret < 0)
+			goto out_page;
+	}
+	up_read(&EXT4_I(inode)->xattr_sem);
+
+	*pagep = page;
+	return 1;
+
+out_page:
+	up_read(&EXT4_I(inode)->xattr_sem);
+	unlock_page(page);
+	page_cache_release(page);
+	ext4_journal_stop(handle);
+	return ret;
+
+convert:
+	return ext4_convert_inline_data(inode);
+}
+
+/*
+ * ->write_end for a write that ext4_try_to_write_inline_data() let
+ * into the inode.  The page is only a cache of the inline data, so it
+ * is never dirtied.
+ */
+int ext4_write_inline_data_end(struct inode *inode, loff_t pos, unsigned len,
+			       unsigned copied, struct page *page)
+{
+	handle_t *handle = ext4_journal_current_handle();
+	struct ext4_iloc iloc;
+	void *kaddr;
+	int ret, ret2, no_expand;
+
+	ret = ext4_reserve_inode_write(handle, inode, &iloc);
+	if (ret)
+		goto out;
+
+	ext4_write_lock_xattr(inode, &no_expand);
+	BUG_ON(!ext4_has_inline_data(inode));
+	kaddr = kmap_atomic(page);
+	ext4_write_inline_data(inode, &iloc, kaddr + pos, pos, copied);
+	kunmap_atomic(kaddr);
+	ext4_write_unlock_xattr(inode, &no_expand);
+
+	if (pos + copied > inode->i_size)
+		i_size_write(inode, pos + copied);
+	if (pos + copied > EXT4_I(inode)->i_disksize)
+		EXT4_I(inode)->i_disksize = pos + copied;
+	ret = ext4_mark_iloc_dirty(handle, inode, &iloc);
+	ext4_update_inode_fsync_trans(handle, inode, 1);
+out:
+	unlock_page(page);
+	page_cache_release(page);
+
+	ret2 = ext4_journal_stop(handle);
+	if (!ret)
+		ret = ret2;
+	/* without a journal, let writeback push the inode out */
+	if (!ret && !EXT4_SB(inode->i_sb)->s_journal)
+		mark_inode_dirty(inode);
+	return ret ? ret : copied;
+}
+
+/*
+ * Move the data of an inline file to a block of its own, before a
+ * write, mmap write or fallocate that won't fit in the inode.  The
+ * caller holds i_mutex or, for page_mkwrite, the file's mmap_sem.
+ */
+int ext4_convert_inline_data(struct inode *inode)
+{
+	handle_t *handle;
+	struct page *page;
+	struct ext4_iloc iloc;
+	void *buf = NULL, *kaddr;
+	int ret, ret2, size, no_expand;
+
+	if (!ext4_has_inline_data(inode)) {
+		ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+		return 0;
+	}
+
+	handle = ext4_journal_start(inode,
+				    ext4_writepage_trans_blocks(inode) + 1);
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	page = grab_cache_page_write_begin(inode->i_mapping, 0, AOP_FLAG_NOFS);
+	if (!page) {
+		ret = -ENOMEM;
+		goto out_stop;
+	}
+
+	ret = ext4_reserve_inode_write(handle, inode, &iloc);
+	if (ret)
+		goto out_page;
+
+	ext4_write_lock_xattr(inode, &no_expand);
+	if (!ext4_has_inline_data(inode)) {
+		ext4_write_unlock_xattr(inode, &no_expand);
+		brelse(iloc.bh);
+		goto out_page;
+	}
+
+	size = ext4_get_inline_size_nolock(inode, &iloc);
+	if (size >= 0) {
+		size = min_t(loff_t, size, i_size_read(inode));
+		buf = kmalloc(size, GFP_NOFS);
+		if (!buf)
+			size = -ENOMEM;
+	}
+	if (size >= 0)
+		size = ext4_read_inline_data(inode, buf, size, &iloc);
+	if (size < 0) {
+		ret = size;
+		ext4_write_unlock_xattr(inode, &no_expand);
+		brelse(iloc.bh);
+		goto out_page;
+	}
+
+	if (!PageUptodate(page)) {
+		kaddr = kmap_atomic(page);
+		memcpy(kaddr, buf, size);
+		kunmap_atomic(kaddr);
+		zero_user_segment(page, size, PAGE_CACHE_SIZE);
+		flush_dcache_page(page);
+		SetPageUptodate(page);
+	}
+
+	ret = ext4_destroy_inline_data_nolock(handle, inode, &iloc);
+	ext4_write_unlock_xattr(inode, &no_expand);
+	if (!ret)
+		ret = ext4_convert_page_to_blocks(handle, inode, page, size);
+	if (ret) {
+		ext4_write_lock_xattr(inode, &no_expand);
+		ext4_restore_inline_data(handle, inode, &iloc, buf, size);
+		ext4_write_unlock_xattr(inode, &no_expand);
+	}
+	ret2 = ext4_mark_iloc_dirty(handle, inode, &iloc);
+	if (!ret)
+		ret = ret2;
+
+out_page:
+	unlock_page(page);
+	page_cache_release(page);
+out_stop:
+	ret2 = ext4_journal_stop(handle);
+	if (!ret)
+		ret = ret2;
+	kfree(buf);
+	return ret;
+}
+
+/*
+ * Truncate an inline inode down to its new i_size: zero the tail and
+ * give back the attribute space that is no longer needed.
+ */
+void ext4_inline_data_truncate(struct inode *inode, int *has_inline)
+{
+	handle_t *handle;
+	struct ext4_iloc iloc;
+	struct ext4_inode *raw_inode;
+	loff_t i_size = inode->i_size;
+	int inline_size, err, no_expand;
+
+	/* the inode, and the superblock and a neighbour for the orphan list */
+	handle = ext4_journal_start(inode, 3);
+	if (IS_ERR(handle))
+		return;
+
+	err = ext4_reserve_inode_write(handle, inode, &iloc);
+	if (err)
+		goto out_stop;
+
+	ext4_write_lock_xattr(inode, &no_expand);
+	if (!ext4_has_inline_data(inode)) {
+		*has_inline = 0;
+		ext4_write_unlock_xattr(inode, &no_expand);
+		brelse(iloc.bh);
+		goto out_stop;
+	}
+
+	inline_size = ext4_get_inline_size_nolock(inode, &iloc);
+	if (inline_size >= 0 && i_size < inline_size) {
+		raw_inode = ext4_raw_inode(&iloc);
+		if (i_size < EXT4_MIN_INLINE_DATA_SIZE) {
+			memset((void *)raw_inode->i_block + i_size, 0,
+			       EXT4_MIN_INLINE_DATA_SIZE - i_size);
+			err = ext4_set_inline_value_size(handle, inode,
+							 &iloc, 0);
+		} else
+			err = ext4_set_inline_value_size(handle, inode, &iloc,
+					i_size - EXT4_MIN_INLINE_DATA_SIZE);
+		if (err)
+			ext4_std_error(inode->i_sb, err);
+	}
+	ext4_write_unlock_xattr(inode, &no_expand);
+
+	EXT4_I(inode)->i_disksize = i_size;
+	inode->i_mtime = inode->i_ctime = ext4_current_time(inode);
+	ext4_mark_iloc_dirty(handle, inode, &iloc);
+	if (IS_SYNC(inode))
+		ext4_handle_sync(handle);
+
+	/*
+	 * If this was a simple ftruncate() and the file will remain alive,
+	 * then we need to clear up the orphan record which we created above.
+	 * However, if this was a real unlink then we were called by
+	 * ext4_delete_inode(), and we allow that function to clean up the
+	 * orphan info for us.
+	 */
+	if (inode->i_nlink)
+		ext4_orphan_del(handle, inode);
+out_stop:
+	ext4_journal_stop(handle);
+}
+
+int ext4_inline_data_fiemap(struct inode *inode,
+			    struct fiemap_extent_info *fieinfo,
+			    int *has_inline)
+{
+	struct ext4_iloc iloc;
+	__u64 physical;
+	int error;
+
+	error = ext4_get_inode_loc(inode, &iloc);
+	if (error)
+		return error;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		*has_inline = 0;
+		goto out;
+	}
+	if (!i_size_read(inode))
+		goto out;
+
+	physical = (__u64)iloc.bh->b_blocknr << inode->i_sb->s_blocksize_bits;
+	physical += (char *)ext4_raw_inode(&iloc) - iloc.bh->b_data;
+	physical += offsetof(struct ext4_inode, i_block);
+	error = fiemap_fill_next_extent(fieinfo, 0, physical,
+					i_size_read(inode),
+					FIEMAP_EXTENT_DATA_INLINE |
+					FIEMAP_EXTENT_LAST);
+out:
+	up_read(&EXT4_I(inode)->xattr_sem);
+	brelse(iloc.bh);
+	return error < 0 ? error : 0;
+}
+
+/*
+ * Directories
+ */
+
+/*
+ * Find the run of directory entries that inline offset @offset falls
+ * in, and return the entry there.
+ */
+static struct ext4_dir_entry_2 *
+ext4_get_inline_entry(struct inode *dir, struct ext4_iloc *iloc,
+		      unsigned int offset, void **inline_start,
+		      int *inline_size)
+{
+	struct ext4_xattr_entry *entry;
+	void *i_block = ext4_raw_inode(iloc)->i_block;
+
+	if (offset < EXT4_MIN_INLINE_DATA_SIZE) {
+		*inline_start = i_block + EXT4_INLINE_DOTDOT_SIZE;
+		*inline_size = EXT4_MIN_INLINE_DATA_SIZE -
+			       EXT4_INLINE_DOTDOT_SIZE;
+		return i_block + offset;
+	}
+
+	entry = ext4_inline_xattr(dir, iloc);
+	if (!entry)
+		return NULL;
+	*inline_start = ext4_inline_value(dir, iloc, entry);
+	*inline_size = le32_to_cpu(entry->e_value_size);
+	return *inline_start + offset - EXT4_MIN_INLINE_DATA_SIZE;
+}
+
+/*
+ * Set up a new directory inside the inode: the parent in place of ".."
+ * and one empty entry covering the rest of i_block.  On -ENOSPC the
+ * inode is left as it was, for the caller to give it a block instead.
+ */
+int ext4_try_create_inline_dir(handle_t *handle, struct inode *parent,
+			       struct inode *inode)
+{
+	struct ext4_dir_entry_2 *de;
+	struct ext4_inode *raw_inode;
+	struct ext4_iloc iloc;
+	int ret, no_expand;
+	int size = EXT4_MIN_INLINE_DATA_SIZE - EXT4_INLINE_DOTDOT_SIZE;
+
+	ret = ext4_reserve_inode_write(handle, inode, &iloc);
+	if (ret)
+		return ret;
+
+	ext4_write_lock_xattr(inode, &no_expand);
+	ret = ext4_create_inline_data(handle, inode, &iloc,
+				      EXT4_MIN_INLINE_DATA_SIZE);
+	if (ret) {
+		ext4_write_unlock_xattr(inode, &no_expand);
+		brelse(iloc.bh);
+		if (ret == -ENOSPC)
+			ext4_clear_inode_state(inode,
+					       EXT4_STATE_MAY_INLINE_DATA);
+		return ret;
+	}
+
+	raw_inode = ext4_raw_inode(&iloc);
+	raw_inode->i_block[0] = cpu_to_le32(parent->i_ino);
+	de = (struct ext4_dir_entry_2 *)
+		((void *)raw_inode->i_block + EXT4_INLINE_DOTDOT_SIZE);
+	de->inode = 0;
+	de->rec_len = ext4_rec_len_to_disk(size, size);
+	ext4_write_unlock_xattr(inode, &no_expand);
+
+	inode->i_size = EXT4_I(inode)->i_disksize = EXT4_MIN_INLINE_DATA_SIZE;
+	return ext4_mark_iloc_dirty(handle, inode, &iloc);
+}
+
+/*
+ * Look for @d_name in both runs of entries.  As for ext4_find_entry(),
+ * the buffer returned holds @res_dir, here the inode table block.
+ */
+struct buffer_head *ext4_find_inline_entry(struct inode *dir,
+					   const struct qstr *d_name,
+					   struct ext4_dir_entry_2 **res_dir,
+					   int *has_inline_data)
+{
+	struct ext4_xattr_entry *entry;
+	struct ext4_iloc iloc;
+	void *inline_start;
+	int ret;
+
+	if (ext4_get_inode_loc(dir, &iloc))
+		return NULL;
+
+	down_read(&EXT4_I(dir)->xattr_sem);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+
+	inline_start = (void *)ext4_raw_inode(&iloc)->i_block +
+		       EXT4_INLINE_DOTDOT_SIZE;
+	ret = ext4_search_dir(iloc.bh, inline_start,
+			      EXT4_MIN_INLINE_DATA_SIZE -
+			      EXT4_INLINE_DOTDOT_SIZE,
+			      dir, d_name, 0, res_dir);
+	if (ret == 1)
+		goto out_find;
+	if (ret < 0)
+		goto out;
+
+	entry = ext4_inline_xattr(dir, &iloc);
+	if (!entry || !entry->e_value_size)
+		goto out;
+	ret = ext4_search_dir(iloc.bh, ext4_inline_value(dir, &iloc, entry),
+			      le32_to_cpu(entry->e_value_size),
+			      dir, d_name, 0, res_dir);
+	if (ret == 1)
+		goto out_find;
+out:
+	brelse(iloc.bh);
+	iloc.bh = NULL;
+out_find:
+	up_read(&EXT4_I(dir)->xattr_sem);
+	return iloc.bh;
+}
+
+static int ext4_add_dirent_to_inline(handle_t *handle,
+				     struct dentry *dentry,
+				     struct inode *inode,
+				     struct ext4_iloc *iloc,
+				     void *inline_start, int inline_size)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	const char *name = dentry->d_name.name;
+	int namelen = dentry->d_name.len;
+	struct ext4_dir_entry_2 *de;
+	int err;
+
+	/* the caller already has write access to the inode */
+	err = ext4_find_dest_de(dir, inode, iloc->bh, inline_start,
+				inline_size, name, namelen, &de);
+	if (err)
+		return err;
+	ext4_insert_dentry(inode, de, inline_size, name, namelen);
+
+	/*
+	 * XXX shouldn't update any times until successful
+	 * completion of syscall, but too many callers depend
+	 * on this.
+	 *
+	 * XXX similarly, too many callers depend on
+	 * ext4_new_inode() setting the times, but error
+	 * recovery deletes the inode, so the worst that can
+	 * happen is that the times are slightly out of date
+	 * and/or different from the directory change time.
+	 */
+	dir->i_mtime = dir->i_ctime = ext4_current_time(dir);
+	ext4_update_dx_flag(dir);
+	dir->i_version++;
+	return 0;
+}
+
+/*
+ * Give the second run of entries room for one more of @namelen bytes,
+ * by growing its last entry or starting it off with an empty one.
+ */
+static int ext4_grow_inline_dir(handle_t *handle, struct inode *dir,
+				struct ext4_iloc *iloc, int namelen)
+{
+	struct ext4_xattr_entry *entry;
+	struct ext4_dir_entry_2 *de, *last = NULL;
+	void *start, *limit;
+	int old_size, new_size, err;
+
+	entry = ext4_inline_xattr(dir, iloc);
+	if (!entry)
+		return -EIO;
+	old_size = le32_to_cpu(entry->e_value_size);
+	new_size = old_size + EXT4_DIR_REC_LEN(namelen);
+
+	err = ext4_set_inline_value_size(handle, dir, iloc, new_size);
+	if (err)
+		return err;
+
+	/* the value has moved */
+	entry = ext4_inline_xattr(dir, iloc);
+	if (!entry)
+		return -EIO;
+	start = ext4_inline_value(dir, iloc, entry);
+	limit = start + old_size;
+	de = start;
+	while ((void *)de < limit) {
+		if (ext4_check_dir_entry(dir, NULL, de, iloc->bh,
+					 start, old_size,
+					 (void *)de - start +
+					 EXT4_MIN_INLINE_DATA_SIZE))
+			return -EIO;
+		last = de;
+		de = ext4_next_entry(de, old_size);
+	}
+
+	if (last)
+		last->rec_len = ext4_rec_len_to_disk(new_size -
+						     ((void *)last - start),
+						     new_size);
+	else {
+		de = start;
+		de->inode = 0;
+		de->rec_len = ext4_rec_len_to_disk(new_size, new_size);
+	}
+
+	dir->i_size = EXT4_I(dir)->i_disksize =
+		EXT4_MIN_INLINE_DATA_SIZE + new_size;
+	return 0;
+}
+
+/*
+ * Lay the inline directory out as a first directory block: "." and ".."
+ * at their usual places, then both runs of entries back to back, which
+ * keeps every readdir position valid.
+ */
+static int ext4_finish_convert_inline_dir(struct inode *dir,
+					  struct buffer_head *bh,
+					  void *buf, int inline_size)
+{
+	struct ext4_dir_entry_2 *de, *last = NULL;
+	unsigned int blocksize = dir->i_sb->s_blocksize;
+	void *block = bh->b_data;
+	void *start, *limit;
+
+	de = ext4_init_dot_dotdot(dir, block, blocksize,
+				  le32_to_cpu(*(__le32 *)buf), 1);
+	start = de;
+	memcpy(start, buf + EXT4_INLINE_DOTDOT_SIZE,
+	       inline_size - EXT4_INLINE_DOTDOT_SIZE);
+	limit = start + inline_size - EXT4_INLINE_DOTDOT_SIZE;
+	while ((void *)de < limit) {
+		if (ext4_check_dir_entry(dir, NULL, de, bh, start,
+					 limit - start, (void *)de - block))
+			return -EIO;
+		last = de;
+		de = ext4_next_entry(de, blocksize);
+	}
+	if (!last)
+		return -EIO;
+	last->rec_len = ext4_rec_len_to_disk(blocksize - ((void *)last - block),
+					     blocksize);
+	return 0;
+}
+
+/* Move a full inline directory out to block 0 */
+static int ext4_convert_inline_dir(handle_t *handle, struct inode *dir,
+				   struct ext4_iloc *iloc)
+{
+	struct buffer_head *bh;
+	void *buf;
+	int inline_size, ret;
+
+	inline_size = ext4_get_inline_size_nolock(dir, iloc);
+	if (inline_size < 0)
+		return inline_size;
+	buf = kmalloc(inline_size, GFP_NOFS);
+	if (!buf)
+		return -ENOMEM;
+	ret = ext4_read_inline_data(dir, buf, inline_size, iloc);
+	if (ret < 0)
+		goto out;
+
+	ret = ext4_destroy_inline_data_nolock(handle, dir, iloc);
+	if (ret)
+		goto out;
+
+	bh = ext4_bread(handle, dir, 0, 1, &ret);
+	if (!bh)
+		goto out_restore;
+	BUFFER_TRACE(bh, "get_write_access");
+	ret = ext4_journal_get_write_access(handle, bh);
+	if (!ret)
+		ret = ext4_finish_convert_inline_dir(dir, bh, buf,
+						     inline_size);
+	if (!ret) {
+		BUFFER_TRACE(bh, "call ext4_handle_dirty_metadata");
+		ret = ext4_handle_dirty_metadata(handle, dir, bh);
+	}
+	brelse(bh);
+	if (!ret) {
+		dir->i_size = EXT4_I(dir)->i_disksize = dir->i_sb->s_blocksize;
+		goto out;
+	}
+out_restore:
+	ext4_restore_inline_data(handle, dir, iloc, buf, inline_size);
+out:
+	kfree(buf);
+	return ret;
+}
+
+/*
+ * Add @dentry to an inline directory.  Returns 0 if it went in, 1 if
+ * the directory is (now) kept in blocks and the caller has to add it
+ * there, or an error.
+ */
+int ext4_try_add_inline_entry(handle_t *handle, struct dentry *dentry,
+			      struct inode *inode)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	struct ext4_xattr_entry *entry;
+	struct ext4_iloc iloc;
+	int ret, ret2, no_expand;
+
+	ret = ext4_reserve_inode_write(handle, dir, &iloc);
+	if (ret)
+		return ret;
+
+	ext4_write_lock_xattr(dir, &no_expand);
+	if (!ext4_has_inline_data(dir)) {
+		ret = 1;
+		goto out;
+	}
+
+	ret = ext4_add_dirent_to_inline(handle, dentry, inode, &iloc,
+			(void *)ext4_raw_inode(&iloc)->i_block +
+			EXT4_INLINE_DOTDOT_SIZE,
+			EXT4_MIN_INLINE_DATA_SIZE - EXT4_INLINE_DOTDOT_SIZE);
+	if (ret != -ENOSPC)
+		goto out;
+
+	entry = ext4_inline_xattr(dir, &iloc);
+	if (!entry) {
+		ret = -EIO;
+		goto out;
+	}
+	if (entry->e_value_size) {
+		ret = ext4_add_dirent_to_inline(handle, dentry, inode, &iloc,
+				ext4_inline_value(dir, &iloc, entry),
+				le32_to_cpu(entry->e_value_size));
+		if (ret != -ENOSPC)
+			goto out;
+	}
+
+	ret = ext4_grow_inline_dir(handle, dir, &iloc, dentry->d_name.len);
+	if (!ret) {
+		entry = ext4_inline_xattr(dir, &iloc);
+		if (!entry)
+			ret = -EIO;
+		else
+			ret = ext4_add_dirent_to_inline(handle, dentry, inode,
+					&iloc, ext4_inline_value(dir, &iloc, entry),
+					le32_to_cpu(entry->e_value_size));
+	} else if (ret == -ENOSPC) {
+		ret = ext4_convert_inline_dir(handle, dir, &iloc);
+		if (!ret)
+			ret = 1;
+	}
+out:
+	ext4_write_unlock_xattr(dir, &no_expand);
+	ret2 = ext4_mark_iloc_dirty(handle, dir, &iloc);
+	if (ret >= 0 && ret2)
+		ret = ret2;
+	return ret;
+}
+
+int ext4_delete_inline_entry(handle_t *handle, struct inode *dir,
+			     struct ext4_dir_entry_2 *de_del,
+			     struct buffer_head *bh, int *has_inline_data)
+{
+	struct ext4_iloc iloc;
+	void *inline_start;
+	int inline_size, err, no_expand;
+
+	err = ext4_reserve_inode_write(handle, dir, &iloc);
+	if (err)
+		return err;
+
+	ext4_write_lock_xattr(dir, &no_expand);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		ext4_write_unlock_xattr(dir, &no_expand);
+		brelse(iloc.bh);
+		return 0;
+	}
+
+	if (!ext4_get_inline_entry(dir, &iloc,
+				   (void *)de_del -
+				   (void *)ext4_raw_inode(&iloc)->i_block,
+				   &inline_start, &inline_size))
+		err = -EIO;
+	else
+		err = ext4_generic_delete_entry(dir, de_del, bh,
+						inline_start, inline_size);
+	ext4_write_unlock_xattr(dir, &no_expand);
+
+	if (err) {
+		brelse(iloc.bh);
+		return err;
+	}
+	err = ext4_mark_iloc_dirty(handle, dir, &iloc);
+	if (unlikely(err))
+		ext4_std_error(dir->i_sb, err);
+	return err;
+}
+
+/*
+ * Returns 1 if the inline directory has nothing but "." and "..", as
+ * empty_dir() does for one in blocks.
+ */
+int empty_inline_dir(struct inode *dir, int *has_inline_data)
+{
+	struct ext4_dir_entry_2 *de;
+	struct ext4_iloc iloc;
+	void *inline_start;
+	unsigned int offset;
+	int inline_size, size, err, ret = 1;
+
+	err = ext4_get_inode_loc(dir, &iloc);
+	if (err) {
+		EXT4_ERROR_INODE(dir, "error %d getting inode %lu block",
+				 err, dir->i_ino);
+		return 1;
+	}
+
+	down_read(&EXT4_I(dir)->xattr_sem);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+
+	if (!le32_to_cpu(ext4_raw_inode(&iloc)->i_block[0])) {
+		ext4_warning(dir->i_sb,
+			     "bad inline directory (dir #%lu) - no `..'",
+			     dir->i_ino);
+		goto out;
+	}
+
+	size = ext4_get_inline_size_nolock(dir, &iloc);
+	offset = EXT4_INLINE_DOTDOT_SIZE;
+	while (offset < size) {
+		de = ext4_get_inline_entry(dir, &iloc, offset,
+					   &inline_start, &inline_size);
+		if (!de || ext4_check_dir_entry(dir, NULL, de, iloc.bh,
+						inline_start, inline_size,
+						offset)) {
+			ext4_warning(dir->i_sb,
+				     "bad inline directory (dir #%lu) - "
+				     "inode %u, rec_len %u, name_len %d, "
+				     "inline size %d", dir->i_ino,
+				     de ? le32_to_cpu(de->inode) : 0,
+				     de ? le16_to_cpu(de->rec_len) : 0,
+				     de ? de->name_len : 0, inline_size);
+			goto out;
+		}
+		if (le32_to_cpu(de->inode)) {
+			ret = 0;
+			goto out;
+		}
+		offset += ext4_rec_len_from_disk(de->rec_len, inline_size);
+	}
+out:
+	up_read(&EXT4_I(dir)->xattr_sem);
+	brelse(iloc.bh);
+	return ret;
+}
+
+/*
+ * readdir of an inline directory.  Positions are those the entries will
+ * have once the directory is moved out to a block: "." at 0, ".." just
+ * after it, and an entry at inline offset N at N + extra_offset.
+ */
+int ext4_read_inline_dir(struct file *filp, void *dirent, filldir_t filldir,
+			 int *has_inline_data)
+{
+	struct inode *inode = filp->f_path.dentry->d_inode;
+	struct super_block *sb = inode->i_sb;
+	struct ext4_dir_entry_2 *de;
+	struct ext4_iloc iloc;
+	unsigned int offset;
+	int dotdot_offset = EXT4_DIR_REC_LEN(1);
+	int dotdot_size = dotdot_offset + EXT4_DIR_REC_LEN(2);
+	int extra_offset = dotdot_size - EXT4_INLINE_DOTDOT_SIZE;
+	int i, inline_size, extra_size, ret, error = 0;
+	void *dir_buf = NULL;
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		return ret;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		up_read(&EXT4_I(inode)->xattr_sem);
+		*has_inline_data = 0;
+		goto out;
+	}
+
+	inline_size = ext4_get_inline_size_nolock(inode, &iloc);
+	if (inline_size >= 0) {
+		dir_buf = kmalloc(inline_size, GFP_NOFS);
+		if (!dir_buf)
+			inline_size = -ENOMEM;
+	}
+	if (inline_size >= 0)
+		inline_size = ext4_read_inline_data(inode, dir_buf,
+						    inline_size, &iloc);
+	up_read(&EXT4_I(inode)->xattr_sem);
+	if (inline_size < 0) {
+		ret = inline_size;
+		goto out;
+	}
+
+	extra_size = inline_size + extra_offset;
+	offset = filp->f_pos;
+
+revalidate:
+	/* If the directory has changed since the last call to readdir(2),
+	 * we might be pointing to an invalid dirent right now.  Scan from
+	 * the start to make sure. */
+	if (filp->f_version != inode->i_version) {
+		for (i = 0; i < extra_size && i < offset; ) {
+			if (!i) {
+				i = dotdot_offset;
+				continue;
+			} else if (i == dotdot_offset) {
+				i = dotdot_size;
+				continue;
+			}
+			de = (struct ext4_dir_entry_2 *)
+				(dir_buf + i - extra_offset);
+			if (ext4_rec_len_from_disk(de->rec_len, extra_size) <
+			    EXT4_DIR_REC_LEN(1))
+				break;
+			i += ext4_rec_len_from_disk(de->rec_len, extra_size);
+		}
+		offset = i;
+		filp->f_pos = offset;
+		filp->f_version = inode->i_version;
+	}
+
+	while (!error && filp->f_pos < extra_size) {
+		if (filp->f_pos == 0) {
+			error = filldir(dirent, ".", 1, 0, inode->i_ino,
+					DT_DIR);
+			if (error)
+				break;
+			filp->f_pos = dotdot_offset;
+			continue;
+		}
+
+		if (filp->f_pos == dotdot_offset) {
+			error = filldir(dirent, "..", 2, dotdot_offset,
+					le32_to_cpu(*(__le32 *)dir_buf),
+					DT_DIR);
+			if (error)
+				break;
+			filp->f_pos = dotdot_size;
+			continue;
+		}
+
+		de = (struct ext4_dir_entry_2 *)
+			(dir_buf + filp->f_pos - extra_offset);
+		if (ext4_check_dir_entry(inode, filp, de, iloc.bh, dir_buf,
+					 inline_size,
+					 filp->f_pos - extra_offset))
+			goto out;
+		if (le32_to_cpu(de->inode)) {
+			/* We might block in the next section
+			 * if the data destination is
+			 * currently swapped out.  So, use a
+			 * version stamp to detect whether or
+			 * not the directory has been modified
+			 * during the copy operation.
+			 */
+			u64 version = filp->f_version;
+
+			error = filldir(dirent, de->name, de->name_len,
+					filp->f_pos, le32_to_cpu(de->inode),
+					get_dtype(sb, de->file_type));
+			if (error)
+				break;
+			if (version != filp->f_version)
+				goto revalidate;
+		}
+		filp->f_pos += ext4_rec_len_from_disk(de->rec_len, extra_size);
+	}
+out:
+	kfree(dir_buf);
+	brelse(iloc.bh);
+	return ret;
+}
+
+/*
+ * Read or set the parent of an inline directory.  Both return 1 if the
+ * directory is no longer inline, for the caller to use block 0.
+ */
+int ext4_inline_dir_parent(struct inode *dir, __u32 *parent_ino)
+{
+	struct ext4_iloc iloc;
+	int ret = 0;
+
+	ret = ext4_get_inode_loc(dir, &iloc);
+	if (ret)
+		return ret;
+
+	down_read(&EXT4_I(dir)->xattr_sem);
+	if (ext4_has_inline_data(dir))
+		*parent_ino = le32_to_cpu(ext4_raw_inode(&iloc)->i_block[0]);
+	else
+		ret = 1;
+	up_read(&EXT4_I(dir)->xattr_sem);
+	brelse(iloc.bh);
+	return ret;
+}
+
+int ext4_inline_dir_set_parent(handle_t *handle, struct inode *dir,
+			       __u32 parent_ino)
+{
+	struct ext4_iloc iloc;
+	int ret, no_expand;
+
+	ret = ext4_reserve_inode_write(handle, dir, &iloc);
+	if (ret)
+		return ret;
+
+	ext4_write_lock_xattr(dir, &no_expand);
+	if (!ext4_has_inline_data(dir)) {
+		ext4_write_unlock_xattr(dir, &no_expand);
+		brelse(iloc.bh);
+		return 1;
+	}
+	ext4_raw_inode(&iloc)->i_block[0] = cpu_to_le32(parent_ino);
+	ext4_write_unlock_xattr(dir, &no_expand);
+
+	return ext4_mark_iloc_dirty(handle, dir, &iloc);
+}
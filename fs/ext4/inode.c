@@ -473,6 +473,10 @@ int ext4_map_blocks(handle_t *handle, struct inode *inode,
 	ext_debug("ext4_map_blocks(): inode %lu, flag %d, max_blocks %u,"
 		  "logical block %lu\n", inode->i_ino, flags, map->m_len,
 		  (unsigned long) map->m_lblk);
+
+	/* The data of an inline inode is all in the inode itself */
+	if (unlikely(ext4_has_inline_data(inode)))
+		return (flags & EXT4_GET_BLOCKS_CREATE) ? -EIO : 0;
 	/*
 	 * Try to see if we can get the block without requesting a new
 	 * file system block.
@@ -814,6 +818,18 @@ static int ext4_write_begin(struct file *file, struct address_space *mapping,
 	from = pos & (PAGE_CACHE_SIZE - 1);
 	to = from + len;
 
+	if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA) ||
+	    ext4_has_inline_data(inode)) {
+		ret = ext4_try_to_write_inline_data(mapping, inode, pos, len,
+						    flags, pagep);
+		if (ret < 0)
+			goto out;
+		if (ret == 1) {
+			ret = 0;
+			goto out;
+		}
+	}
+
 retry:
 	handle = ext4_journal_start(inode, needed_blocks);
 	if (IS_ERR(handle)) {
@@ -886,6 +902,44 @@ static int write_end_fn(handle_t *handle, struct buffer_head *bh)
 	return ext4_handle_dirty_metadata(handle, NULL, bh);
 }
 
+/*
+ * Give the first @len bytes of locked, uptodate @page blocks of their
+ * own and dirty them, as a write_begin/write_end pair would, when inline
+ * data moves out of the inode.  The blocks are allocated right away even
+ * with delalloc, so that the data is ordered before the commit that
+ * drops the inline copy.
+ */
+int ext4_convert_page_to_blocks(handle_t *handle, struct inode *inode,
+				struct page *page, unsigned len)
+{
+	int ret;
+
+	if (!len)
+		return 0;
+
+	ret = __block_write_begin(page, 0, len, ext4_get_block);
+	if (ret)
+		return ret;
+
+	if (ext4_should_journal_data(inode)) {
+		ret = walk_page_buffers(handle, page_buffers(page), 0, len,
+					NULL, do_journal_get_write_access);
+		if (!ret)
+			ret = walk_page_buffers(handle, page_buffers(page),
+						0, len, NULL, write_end_fn);
+		ext4_set_inode_state(inode, EXT4_STATE_JDATA);
+		return ret;
+	}
+
+	if (ext4_should_order_data(inode)) {
+		ret = ext4_jbd2_file_inode(handle, inode);
+		if (ret)
+			return ret;
+	}
+	block_commit_write(page, 0, len);
+	return 0;
+}
+
 static int ext4_generic_write_end(struct file *file,
 				  struct address_space *mapping,
 				  loff_t pos, unsigned len, unsigned copied,
@@ -949,6 +1003,10 @@ static int ext4_ordered_write_end(struct file *file,
 	int ret = 0, ret2;
 
 	trace_ext4_ordered_write_end(inode, pos, len, copied);
+
+	if (ext4_has_inline_data(inode))
+		return ext4_write_inline_data_end(inode, pos, len, copied,
+						  page);
 	ret = ext4_jbd2_file_inode(handle, inode);
 
 	if (ret == 0) {
@@ -997,6 +1055,10 @@ static int ext4_writeback_write_end(struct file *file,
 	int ret = 0, ret2;
 
 	trace_ext4_writeback_write_end(inode, pos, len, copied);
+
+	if (ext4_has_inline_data(inode))
+		return ext4_write_inline_data_end(inode, pos, len, copied,
+						  page);
 	ret2 = ext4_generic_write_end(file, mapping, pos, len, copied,
 							page, fsdata);
 	copied = ret2;
@@ -1041,6 +1103,10 @@ static int ext4_journalled_write_end(struct file *file,
 	loff_t new_i_size;
 
 	trace_ext4_journalled_write_end(inode, pos, len, copied);
+
+	if (ext4_has_inline_data(inode))
+		return ext4_write_inline_data_end(inode, pos, len, copied,
+						  page);
 	from = pos & (PAGE_CACHE_SIZE - 1);
 	to = from + len;
 
@@ -1966,6 +2032,7 @@ static int ext4_writepage(struct page *page,
 	} else
 		ret = block_write_full_page(page, noalloc_get_block_write,
 					    wbc);
+	ext4_data_written(inode);
 
 	return ret;
 }
@@ -2344,6 +2411,7 @@ retry:
 		mapping->writeback_index = done_index;
 
 out_writepages:
+	ext4_data_written(inode);
 	wbc->nr_to_write -= nr_to_writebump;
 	wbc->range_start = range_start;
 	trace_ext4_da_writepages_result(inode, wbc, ret, pages_written);
@@ -2404,6 +2472,18 @@ static int ext4_da_write_begin(struct file *file, struct address_space *mapping,
 	}
 	*fsdata = (void *)0;
 	trace_ext4_da_write_begin(inode, pos, len, flags);
+
+	if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA) ||
+	    ext4_has_inline_data(inode)) {
+		ret = ext4_try_to_write_inline_data(mapping, inode, pos, len,
+						    flags, pagep);
+		if (ret < 0)
+			goto out;
+		if (ret == 1) {
+			ret = 0;
+			goto out;
+		}
+	}
 retry:
 	/*
 	 * With delayed allocation, we don't log the i_disksize update
@@ -2497,6 +2577,10 @@ static int ext4_da_write_end(struct file *file,
 	}
 
 	trace_ext4_da_write_end(inode, pos, len, copied);
+
+	if (ext4_has_inline_data(inode))
+		return ext4_write_inline_data_end(inode, pos, len, copied,
+						  page);
 	start = pos & (PAGE_CACHE_SIZE - 1);
 	end = start + copied - 1;
 
@@ -2623,6 +2707,10 @@ static sector_t ext4_bmap(struct address_space *mapping, sector_t block)
 	journal_t *journal;
 	int err;
 
+	/* inline data has no block number */
+	if (ext4_has_inline_data(inode))
+		return 0;
+
 	if (mapping_tagged(mapping, PAGECACHE_TAG_DIRTY) &&
 			test_opt(inode->i_sb, DELALLOC)) {
 		/*
@@ -2668,14 +2756,30 @@ static sector_t ext4_bmap(struct address_space *mapping, sector_t block)
 
 static int ext4_readpage(struct file *file, struct page *page)
 {
+	struct inode *inode = page->mapping->host;
+	int ret = -EAGAIN;
+
 	trace_ext4_readpage(page);
-	return mpage_readpage(page, ext4_get_block);
+
+	if (ext4_has_inline_data(inode))
+		ret = ext4_readpage_inline(inode, page);
+
+	if (ret == -EAGAIN)
+		return mpage_readpage(page, ext4_get_block);
+
+	return ret;
 }
 
 static int
 ext4_readpages(struct file *file, struct address_space *mapping,
 		struct list_head *pages, unsigned nr_pages)
 {
+	struct inode *inode = mapping->host;
+
+	/* If the file has inline data, no need to do readpages. */
+	if (ext4_has_inline_data(inode))
+		return 0;
+
 	return mpage_readpages(mapping, pages, nr_pages, ext4_get_block);
 }
 
@@ -2998,11 +3102,22 @@ static ssize_t ext4_direct_IO(int rw, struct kiocb *iocb,
 	if (ext4_should_journal_data(inode))
 		return 0;
 
+	/*
+	 * Inline data is not converted here: returning 0 makes the VFS
+	 * fall back to buffered I/O through the page cache.  A file that
+	 * was not inline yet is kept from starting out inline.
+	 */
+	if (ext4_has_inline_data(inode))
+		return 0;
+	ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+
 	trace_ext4_direct_IO_enter(inode, offset, iov_length(iov, nr_segs), rw);
 	if (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS))
 		ret = ext4_ext_direct_IO(rw, iocb, iov, offset, nr_segs);
 	else
 		ret = ext4_ind_direct_IO(rw, iocb, iov, offset, nr_segs);
+	if (rw & WRITE)
+		ext4_data_written(inode);
 	trace_ext4_direct_IO_exit(inode, offset,
 				iov_length(iov, nr_segs), rw, ret);
 	return ret;
@@ -3402,6 +3517,16 @@ void ext4_truncate(struct inode *inode)
 	if (inode->i_size == 0 && !test_opt(inode->i_sb, NO_AUTO_DA_ALLOC))
 		ext4_set_inode_state(inode, EXT4_STATE_DA_ALLOC_CLOSE);
 
+	if (ext4_has_inline_data(inode)) {
+		int has_inline = 1;
+
+		ext4_inline_data_truncate(inode, &has_inline);
+		if (has_inline) {
+			trace_ext4_truncate_exit(inode);
+			return;
+		}
+	}
+
 	if (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS))
 		ext4_ext_truncate(inode);
 	else
@@ -3767,6 +3892,15 @@ struct inode *ext4_iget(struct super_block *sb, unsigned long ino)
 				 ei->i_file_acl);
 		ret = -EIO;
 		goto bad_inode;
+	} else if (ext4_has_inline_data(inode)) {
+		/* i_block holds data, not a block map or extent tree */
+		ret = ext4_check_inline_data(inode, &iloc);
+		if (ret)
+			EXT4_ERROR_INODE(inode, "bad inline data");
+		else {
+			memset(ei->i_data, 0, sizeof(ei->i_data));
+			ext4_set_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+		}
 	} else if (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)) {
 		if (S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode) ||
 		    (S_ISLNK(inode->i_mode) &&
@@ -3958,9 +4092,10 @@ static int ext4_do_update_inode(handle_t *handle,
 				cpu_to_le32(new_encode_dev(inode->i_rdev));
 			raw_inode->i_block[2] = 0;
 		}
-	} else
+	} else if (!ext4_has_inline_data(inode)) {
 		for (block = 0; block < EXT4_N_BLOCKS; block++)
 			raw_inode->i_block[block] = ei->i_data[block];
+	}
 
 	raw_inode->i_disk_version = cpu_to_le32(inode->i_version);
 	if (ei->i_extra_isize) {
@@ -4428,9 +4563,11 @@ int ext4_mark_inode_dirty(handle_t *handle, struct inode *inode)
 	might_sleep();
 	trace_ext4_mark_inode_dirty(inode, _RET_IP_);
 	err = ext4_reserve_inode_write(handle, inode, &iloc);
+	/* expanding could push the inline data out of the inode body */
 	if (ext4_handle_valid(handle) &&
 	    EXT4_I(inode)->i_extra_isize < sbi->s_want_extra_isize &&
-	    !ext4_test_inode_state(inode, EXT4_STATE_NO_EXPAND)) {
+	    !ext4_test_inode_state(inode, EXT4_STATE_NO_EXPAND) &&
+	    !ext4_has_inline_data(inode)) {
 		/*
 		 * We need extra buffer credits since we may write into EA block
 		 * with this same handle. If journal_extend fails, then it will
@@ -4612,6 +4749,14 @@ int ext4_page_mkwrite(struct vm_area_struct *vma, struct vm_fault *vmf)
 	 * __block_page_mkwrite() to do a reliable check.
 	 */
 	vfs_check_frozen(inode->i_sb, SB_FREEZE_WRITE);
+
+	/* A page mapped for writing must be backed by a real block */
+	if (ext4_has_inline_data(inode)) {
+		ret = ext4_convert_inline_data(inode);
+		if (ret)
+			goto out_ret;
+	}
+
 	/* Delalloc case is easy... */
 	if (test_opt(inode->i_sb, DELALLOC) &&
 	    !ext4_should_journal_data(inode) &&
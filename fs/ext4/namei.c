@@ -180,16 +180,6 @@ static struct buffer_head * ext4_dx_find_entry(struct inode *dir,
 static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
 			     struct inode *inode);
 
-/*
- * p is at least 6 bytes before the end of page
- */
-static inline struct ext4_dir_entry_2 *
-ext4_next_entry(struct ext4_dir_entry_2 *p, unsigned long blocksize)
-{
-	return (struct ext4_dir_entry_2 *)((char *)p +
-		ext4_rec_len_from_disk(p->rec_len, blocksize));
-}
-
 /*
  * Future: use high four bits of block for coalesce-on-delete flags
  * Mask them off for now.
@@ -583,6 +573,7 @@ static int htree_dirblock_to_tree(struct file *dir_file,
 					   EXT4_DIR_REC_LEN(0));
 	for (; de < top; de = ext4_next_entry(de, dir->i_sb->s_blocksize)) {
 		if (ext4_check_dir_entry(dir, NULL, de, bh,
+				bh->b_data, bh->b_size,
 				(block<<EXT4_BLOCK_SIZE_BITS(dir->i_sb))
 					 + ((char *)de - bh->b_data))) {
 			/* On error, skip the f_pos to the next block. */
@@ -774,13 +765,6 @@ static void dx_insert_block(struct dx_frame *frame, u32 hash, ext4_lblk_t block)
 	dx_set_count(entries, count + 1);
 }
 
-static void ext4_update_dx_flag(struct inode *inode)
-{
-	if (!EXT4_HAS_COMPAT_FEATURE(inode->i_sb,
-				     EXT4_FEATURE_COMPAT_DIR_INDEX))
-		ext4_clear_inode_flag(inode, EXT4_INODE_INDEX);
-}
-
 /*
  * NOTE! unlike strncmp, ext4_match returns 1 for success, 0 for failure.
  *
@@ -798,13 +782,12 @@ static inline int ext4_match (int len, const char * const name,
 }
 
 /*
- * Returns 0 if not found, -1 on failure, and 1 on success
+ * Search @buf_size bytes of directory entries at @search_buf, which
+ * belong to @bh.  Returns 0 if not found, -1 on failure, and 1 on success
  */
-static inline int search_dirblock(struct buffer_head *bh,
-				  struct inode *dir,
-				  const struct qstr *d_name,
-				  unsigned int offset,
-				  struct ext4_dir_entry_2 ** res_dir)
+int ext4_search_dir(struct buffer_head *bh, char *search_buf, int buf_size,
+		    struct inode *dir, const struct qstr *d_name,
+		    unsigned int offset, struct ext4_dir_entry_2 **res_dir)
 {
 	struct ext4_dir_entry_2 * de;
 	char * dlimit;
@@ -812,8 +795,8 @@ static inline int search_dirblock(struct buffer_head *bh,
 	const char *name = d_name->name;
 	int namelen = d_name->len;
 
-	de = (struct ext4_dir_entry_2 *) bh->b_data;
-	dlimit = bh->b_data + dir->i_sb->s_blocksize;
+	de = (struct ext4_dir_entry_2 *) search_buf;
+	dlimit = search_buf + buf_size;
 	while ((char *) de < dlimit) {
 		/* this code is executed quadratically often */
 		/* do minimal checking `by hand' */
@@ -821,7 +804,8 @@ static inline int search_dirblock(struct buffer_head *bh,
 		if ((char *) de + namelen <= dlimit &&
 		    ext4_match (namelen, name, de)) {
 			/* found a match - just to be sure, do a full check */
-			if (ext4_check_dir_entry(dir, NULL, de, bh, offset))
+			if (ext4_check_dir_entry(dir, NULL, de, bh,
+						 search_buf, buf_size, offset))
 				return -1;
 			*res_dir = de;
 			return 1;
@@ -837,6 +821,16 @@ static inline int search_dirblock(struct buffer_head *bh,
 	return 0;
 }
 
+static inline int search_dirblock(struct buffer_head *bh,
+				  struct inode *dir,
+				  const struct qstr *d_name,
+				  unsigned int offset,
+				  struct ext4_dir_entry_2 **res_dir)
+{
+	return ext4_search_dir(bh, bh->b_data, dir->i_sb->s_blocksize, dir,
+			       d_name, offset, res_dir);
+}
+
 
 /*
  *	ext4_find_entry()
@@ -872,6 +866,16 @@ static struct buffer_head * ext4_find_entry (struct inode *dir,
 	namelen = d_name->len;
 	if (namelen > EXT4_NAME_LEN)
 		return NULL;
+
+	if (ext4_has_inline_data(dir)) {
+		int has_inline_data = 1;
+
+		ret = ext4_find_inline_entry(dir, d_name, res_dir,
+					     &has_inline_data);
+		if (has_inline_data)
+			return ret;
+	}
+
 	if ((namelen <= 2) && (name[0] == '.') &&
 	    (name[1] == '.' || name[1] == '\0')) {
 		/*
@@ -895,7 +899,8 @@ static struct buffer_head * ext4_find_entry (struct inode *dir,
 			       "falling back\n"));
 	}
 	nblocks = dir->i_size >> EXT4_BLOCK_SIZE_BITS(sb);
-	start = EXT4_I(dir)->i_dir_start_lookup;
+	/* only a hint, which parallel lookups may update under us */
+	start = ACCESS_ONCE(EXT4_I(dir)->i_dir_start_lookup);
 	if (start >= nblocks)
 		start = 0;
 	block = start;
@@ -1048,6 +1053,41 @@ static struct dentry *ext4_lookup(struct inode *dir, struct dentry *dentry, stru
 	return d_splice_alias(inode, dentry);
 }
 
+/*
+ * Lookup without the directory's i_mutex.  Entries are only added and
+ * removed with i_dir_rwsem held for writing, so holding it for reading
+ * gives a consistent view of the directory blocks and htree index.
+ *
+ * Once it is dropped, the entry may be removed and its inode freed
+ * before ext4_iget() gets to it.  The VFS finds out and retries with
+ * ->lookup(), so errors are left for that to report.
+ */
+static struct inode *ext4_lookup_shared(struct inode *dir,
+					struct dentry *dentry,
+					struct nameidata *nd)
+{
+	struct ext4_dir_entry_2 *de;
+	struct buffer_head *bh;
+	__u32 ino = 0;
+
+	if (dentry->d_name.len > EXT4_NAME_LEN)
+		return ERR_PTR(-ENAMETOOLONG);
+
+	down_read(&EXT4_I(dir)->i_dir_rwsem);
+	bh = ext4_find_entry(dir, &dentry->d_name, &de);
+	if (bh) {
+		ino = le32_to_cpu(de->inode);
+		brelse(bh);
+	}
+	up_read(&EXT4_I(dir)->i_dir_rwsem);
+
+	if (!ino)
+		return NULL;
+	if (!ext4_valid_inum(dir->i_sb, ino))
+		return ERR_PTR(-EIO);
+	return ext4_iget(dir->i_sb, ino);
+}
+
 
 struct dentry *ext4_get_parent(struct dentry *child)
 {
@@ -1058,12 +1098,20 @@ struct dentry *ext4_get_parent(struct dentry *child)
 	};
 	struct ext4_dir_entry_2 * de;
 	struct buffer_head *bh;
+	int err = 1;
 
-	bh = ext4_find_entry(child->d_inode, &dotdot, &de);
-	if (!bh)
-		return ERR_PTR(-ENOENT);
-	ino = le32_to_cpu(de->inode);
-	brelse(bh);
+	if (ext4_has_inline_data(child->d_inode)) {
+		err = ext4_inline_dir_parent(child->d_inode, &ino);
+		if (err < 0)
+			return ERR_PTR(err);
+	}
+	if (err) {
+		bh = ext4_find_entry(child->d_inode, &dotdot, &de);
+		if (!bh)
+			return ERR_PTR(-ENOENT);
+		ino = le32_to_cpu(de->inode);
+		brelse(bh);
+	}
 
 	if (!ext4_valid_inum(child->d_inode->i_sb, ino)) {
 		EXT4_ERROR_INODE(child->d_inode,
@@ -1249,6 +1297,72 @@ errout:
  * space.  It will return -ENOSPC if no space is available, and -EIO
  * and -EEXIST if directory entry already exists.
  */
+/*
+ * Find room for a @namelen long entry in the @buf_size bytes of
+ * directory entries at @buf.  Returns 0 and the entry to split or reuse
+ * in @dest_de, or -ENOSPC, -EEXIST or -EIO.
+ */
+int ext4_find_dest_de(struct inode *dir, struct inode *inode,
+		      struct buffer_head *bh, void *buf, int buf_size,
+		      const char *name, int namelen,
+		      struct ext4_dir_entry_2 **dest_de)
+{
+	struct ext4_dir_entry_2 *de;
+	unsigned short reclen = EXT4_DIR_REC_LEN(namelen);
+	unsigned int offset = 0;
+	int nlen, rlen;
+	char *top;
+
+	de = (struct ext4_dir_entry_2 *)buf;
+	top = buf + buf_size - reclen;
+	while ((char *) de <= top) {
+		if (ext4_check_dir_entry(dir, NULL, de, bh,
+					 buf, buf_size, offset))
+			return -EIO;
+		if (ext4_match(namelen, name, de))
+			return -EEXIST;
+		nlen = EXT4_DIR_REC_LEN(de->name_len);
+		rlen = ext4_rec_len_from_disk(de->rec_len, buf_size);
+		if ((de->inode? rlen - nlen: rlen) >= reclen)
+			break;
+		de = (struct ext4_dir_entry_2 *)((char *)de + rlen);
+		offset += rlen;
+	}
+	if ((char *) de > top)
+		return -ENOSPC;
+
+	*dest_de = de;
+	return 0;
+}
+
+/*
+ * Fill in the entry found by ext4_find_dest_de(), splitting it first if
+ * it is in use.  The caller must already have write access to it.
+ */
+void ext4_insert_dentry(struct inode *inode,
+			struct ext4_dir_entry_2 *de, int buf_size,
+			const char *name, int namelen)
+{
+	int nlen, rlen;
+
+	nlen = EXT4_DIR_REC_LEN(de->name_len);
+	rlen = ext4_rec_len_from_disk(de->rec_len, buf_size);
+	if (de->inode) {
+		struct ext4_dir_entry_2 *de1 = (struct ext4_dir_entry_2 *)((char *)de + nlen);
+		de1->rec_len = ext4_rec_len_to_disk(rlen - nlen, buf_size);
+		de->rec_len = ext4_rec_len_to_disk(nlen, buf_size);
+		de = de1;
+	}
+	de->file_type = EXT4_FT_UNKNOWN;
+	if (inode) {
+		de->inode = cpu_to_le32(inode->i_ino);
+		ext4_set_de_type(inode->i_sb, de, inode->i_mode);
+	} else
+		de->inode = 0;
+	de->name_len = namelen;
+	memcpy(de->name, name, namelen);
+}
+
 static int add_dirent_to_buf(handle_t *handle, struct dentry *dentry,
 			     struct inode *inode, struct ext4_dir_entry_2 *de,
 			     struct buffer_head *bh)
@@ -1256,30 +1370,14 @@ static int add_dirent_to_buf(handle_t *handle, struct dentry *dentry,
 	struct inode	*dir = dentry->d_parent->d_inode;
 	const char	*name = dentry->d_name.name;
 	int		namelen = dentry->d_name.len;
-	unsigned int	offset = 0;
 	unsigned int	blocksize = dir->i_sb->s_blocksize;
-	unsigned short	reclen;
-	int		nlen, rlen, err;
-	char		*top;
+	int		err;
 
-	reclen = EXT4_DIR_REC_LEN(namelen);
 	if (!de) {
-		de = (struct ext4_dir_entry_2 *)bh->b_data;
-		top = bh->b_data + blocksize - reclen;
-		while ((char *) de <= top) {
-			if (ext4_check_dir_entry(dir, NULL, de, bh, offset))
-				return -EIO;
-			if (ext4_match(namelen, name, de))
-				return -EEXIST;
-			nlen = EXT4_DIR_REC_LEN(de->name_len);
-			rlen = ext4_rec_len_from_disk(de->rec_len, blocksize);
-			if ((de->inode? rlen - nlen: rlen) >= reclen)
-				break;
-			de = (struct ext4_dir_entry_2 *)((char *)de + rlen);
-			offset += rlen;
-		}
-		if ((char *) de > top)
-			return -ENOSPC;
+		err = ext4_find_dest_de(dir, inode, bh, bh->b_data, blocksize,
+					name, namelen, &de);
+		if (err)
+			return err;
 	}
 	BUFFER_TRACE(bh, "get_write_access");
 	err = ext4_journal_get_write_access(handle, bh);
@@ -1289,22 +1387,7 @@ static int add_dirent_to_buf(handle_t *handle, struct dentry *dentry,
 	}
 
 	/* By now the buffer is marked for journaling */
-	nlen = EXT4_DIR_REC_LEN(de->name_len);
-	rlen = ext4_rec_len_from_disk(de->rec_len, blocksize);
-	if (de->inode) {
-		struct ext4_dir_entry_2 *de1 = (struct ext4_dir_entry_2 *)((char *)de + nlen);
-		de1->rec_len = ext4_rec_len_to_disk(rlen - nlen, blocksize);
-		de->rec_len = ext4_rec_len_to_disk(nlen, blocksize);
-		de = de1;
-	}
-	de->file_type = EXT4_FT_UNKNOWN;
-	if (inode) {
-		de->inode = cpu_to_le32(inode->i_ino);
-		ext4_set_de_type(dir->i_sb, de, inode->i_mode);
-	} else
-		de->inode = 0;
-	de->name_len = namelen;
-	memcpy(de->name, name, namelen);
+	ext4_insert_dentry(inode, de, blocksize, name, namelen);
 	/*
 	 * XXX shouldn't update any times until successful
 	 * completion of syscall, but too many callers depend
@@ -1442,8 +1525,8 @@ static int make_indexed_dir(handle_t *handle, struct dentry *dentry,
  * may not sleep between calling this and putting something into
  * the entry, as someone else might have used it while you slept.
  */
-static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
-			  struct inode *inode)
+static int __ext4_add_entry(handle_t *handle, struct dentry *dentry,
+			    struct inode *inode)
 {
 	struct inode *dir = dentry->d_parent->d_inode;
 	struct buffer_head *bh;
@@ -1458,6 +1541,18 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 	blocksize = sb->s_blocksize;
 	if (!dentry->d_name.len)
 		return -EINVAL;
+
+	if (ext4_has_inline_data(dir)) {
+		retval = ext4_try_add_inline_entry(handle, dentry, inode);
+		if (retval < 0)
+			return retval;
+		if (retval == 0) {
+			ext4_set_inode_state(inode, EXT4_STATE_NEWENTRY);
+			return 0;
+		}
+		/* the directory has just been moved out to block 0 */
+	}
+
 	if (is_dx(dir)) {
 		retval = ext4_dx_add_entry(handle, dentry, inode);
 		if (!retval || (retval != ERR_BAD_DX_DIR))
@@ -1495,6 +1590,18 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 	return retval;
 }
 
+static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
+			  struct inode *inode)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	int retval;
+
+	down_write(&EXT4_I(dir)->i_dir_rwsem);
+	retval = __ext4_add_entry(handle, dentry, inode);
+	up_write(&EXT4_I(dir)->i_dir_rwsem);
+	return retval;
+}
+
 /*
  * Returns 0 for success, or a negative error value
  */
@@ -1634,31 +1741,27 @@ cleanup:
 }
 
 /*
- * ext4_delete_entry deletes a directory entry by merging it with the
- * previous entry
+ * ext4_generic_delete_entry deletes a directory entry from the @buf_size
+ * bytes at @entry_buf by merging it with the previous entry.  The caller
+ * must already have write access to @bh.
  */
-static int ext4_delete_entry(handle_t *handle,
-			     struct inode *dir,
-			     struct ext4_dir_entry_2 *de_del,
-			     struct buffer_head *bh)
+int ext4_generic_delete_entry(struct inode *dir,
+			      struct ext4_dir_entry_2 *de_del,
+			      struct buffer_head *bh, void *entry_buf,
+			      int buf_size)
 {
 	struct ext4_dir_entry_2 *de, *pde;
 	unsigned int blocksize = dir->i_sb->s_blocksize;
-	int i, err;
+	int i;
 
 	i = 0;
 	pde = NULL;
-	de = (struct ext4_dir_entry_2 *) bh->b_data;
-	while (i < bh->b_size) {
-		if (ext4_check_dir_entry(dir, NULL, de, bh, i))
+	de = (struct ext4_dir_entry_2 *) entry_buf;
+	while (i < buf_size) {
+		if (ext4_check_dir_entry(dir, NULL, de, bh,
+					 entry_buf, buf_size, i))
 			return -EIO;
 		if (de == de_del)  {
-			BUFFER_TRACE(bh, "get_write_access");
-			err = ext4_journal_get_write_access(handle, bh);
-			if (unlikely(err)) {
-				ext4_std_error(dir->i_sb, err);
-				return err;
-			}
 			if (pde)
 				pde->rec_len = ext4_rec_len_to_disk(
 					ext4_rec_len_from_disk(pde->rec_len,
@@ -1669,12 +1772,6 @@ static int ext4_delete_entry(handle_t *handle,
 			else
 				de->inode = 0;
 			dir->i_version++;
-			BUFFER_TRACE(bh, "call ext4_handle_dirty_metadata");
-			err = ext4_handle_dirty_metadata(handle, dir, bh);
-			if (unlikely(err)) {
-				ext4_std_error(dir->i_sb, err);
-				return err;
-			}
 			return 0;
 		}
 		i += ext4_rec_len_from_disk(de->rec_len, blocksize);
@@ -1684,6 +1781,58 @@ static int ext4_delete_entry(handle_t *handle,
 	return -ENOENT;
 }
 
+/*
+ * ext4_delete_entry deletes a directory entry by merging it with the
+ * previous entry
+ */
+static int __ext4_delete_entry(handle_t *handle,
+			       struct inode *dir,
+			       struct ext4_dir_entry_2 *de_del,
+			       struct buffer_head *bh)
+{
+	int err;
+
+	if (ext4_has_inline_data(dir)) {
+		int has_inline_data = 1;
+
+		err = ext4_delete_inline_entry(handle, dir, de_del, bh,
+					       &has_inline_data);
+		if (has_inline_data)
+			return err;
+	}
+
+	BUFFER_TRACE(bh, "get_write_access");
+	err = ext4_journal_get_write_access(handle, bh);
+	if (unlikely(err)) {
+		ext4_std_error(dir->i_sb, err);
+		return err;
+	}
+	err = ext4_generic_delete_entry(dir, de_del, bh, bh->b_data,
+					dir->i_sb->s_blocksize);
+	if (err)
+		return err;
+	BUFFER_TRACE(bh, "call ext4_handle_dirty_metadata");
+	err = ext4_handle_dirty_metadata(handle, dir, bh);
+	if (unlikely(err)) {
+		ext4_std_error(dir->i_sb, err);
+		return err;
+	}
+	return 0;
+}
+
+static int ext4_delete_entry(handle_t *handle,
+			     struct inode *dir,
+			     struct ext4_dir_entry_2 *de_del,
+			     struct buffer_head *bh)
+{
+	int err;
+
+	down_write(&EXT4_I(dir)->i_dir_rwsem);
+	err = __ext4_delete_entry(handle, dir, de_del, bh);
+	up_write(&EXT4_I(dir)->i_dir_rwsem);
+	return err;
+}
+
 /*
  * DIR_NLINK feature is set if 1) nlinks > EXT4_LINK_MAX or 2) nlinks == 2,
  * since this indicates that nlinks count was previously 1.
@@ -1806,13 +1955,80 @@ retry:
 	return err;
 }
 
+/*
+ * Fill in the "." and ".." entries at @de.  With @dotdot_real_len the
+ * ".." entry keeps its own length so that more entries can follow it,
+ * otherwise it covers the rest of the block.  Returns the entry after "..".
+ */
+struct ext4_dir_entry_2 *ext4_init_dot_dotdot(struct inode *inode,
+					      struct ext4_dir_entry_2 *de,
+					      int blocksize,
+					      __u32 parent_ino,
+					      int dotdot_real_len)
+{
+	de->inode = cpu_to_le32(inode->i_ino);
+	de->name_len = 1;
+	de->rec_len = ext4_rec_len_to_disk(EXT4_DIR_REC_LEN(de->name_len),
+					   blocksize);
+	strcpy(de->name, ".");
+	ext4_set_de_type(inode->i_sb, de, S_IFDIR);
+
+	de = ext4_next_entry(de, blocksize);
+	de->inode = cpu_to_le32(parent_ino);
+	de->name_len = 2;
+	if (!dotdot_real_len)
+		de->rec_len = ext4_rec_len_to_disk(blocksize -
+						   EXT4_DIR_REC_LEN(1),
+						   blocksize);
+	else
+		de->rec_len = ext4_rec_len_to_disk(
+				EXT4_DIR_REC_LEN(de->name_len), blocksize);
+	strcpy(de->name, "..");
+	ext4_set_de_type(inode->i_sb, de, S_IFDIR);
+
+	return ext4_next_entry(de, blocksize);
+}
+
+/*
+ * Give a new directory its "." and ".." entries, inside the inode if
+ * the filesystem allows it and in a first block otherwise.
+ */
+static int ext4_init_new_dir(handle_t *handle, struct inode *dir,
+			     struct inode *inode)
+{
+	struct buffer_head *dir_block;
+	unsigned int blocksize = dir->i_sb->s_blocksize;
+	int err;
+
+	if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA)) {
+		err = ext4_try_create_inline_dir(handle, dir, inode);
+		if (err < 0 && err != -ENOSPC)
+			return err;
+		if (!err)
+			return 0;
+	}
+
+	inode->i_size = EXT4_I(inode)->i_disksize = blocksize;
+	dir_block = ext4_bread(handle, inode, 0, 1, &err);
+	if (!dir_block)
+		return err;
+	BUFFER_TRACE(dir_block, "get_write_access");
+	err = ext4_journal_get_write_access(handle, dir_block);
+	if (err)
+		goto out;
+	ext4_init_dot_dotdot(inode, (struct ext4_dir_entry_2 *)
+			     dir_block->b_data, blocksize, dir->i_ino, 0);
+	BUFFER_TRACE(dir_block, "call ext4_handle_dirty_metadata");
+	err = ext4_handle_dirty_metadata(handle, inode, dir_block);
+out:
+	brelse(dir_block);
+	return err;
+}
+
 static int ext4_mkdir(struct inode *dir, struct dentry *dentry, umode_t mode)
 {
 	handle_t *handle;
 	struct inode *inode;
-	struct buffer_head *dir_block = NULL;
-	struct ext4_dir_entry_2 *de;
-	unsigned int blocksize = dir->i_sb->s_blocksize;
 	int err, retries = 0;
 
 	if (EXT4_DIR_LINK_MAX(dir))
@@ -1838,33 +2054,10 @@ retry:
 
 	inode->i_op = &ext4_dir_inode_operations;
 	inode->i_fop = &ext4_dir_operations;
-	inode->i_size = EXT4_I(inode)->i_disksize = inode->i_sb->s_blocksize;
-	dir_block = ext4_bread(handle, inode, 0, 1, &err);
-	if (!dir_block)
-		goto out_clear_inode;
-	BUFFER_TRACE(dir_block, "get_write_access");
-	err = ext4_journal_get_write_access(handle, dir_block);
+	err = ext4_init_new_dir(handle, dir, inode);
 	if (err)
 		goto out_clear_inode;
-	de = (struct ext4_dir_entry_2 *) dir_block->b_data;
-	de->inode = cpu_to_le32(inode->i_ino);
-	de->name_len = 1;
-	de->rec_len = ext4_rec_len_to_disk(EXT4_DIR_REC_LEN(de->name_len),
-					   blocksize);
-	strcpy(de->name, ".");
-	ext4_set_de_type(dir->i_sb, de, S_IFDIR);
-	de = ext4_next_entry(de, blocksize);
-	de->inode = cpu_to_le32(dir->i_ino);
-	de->rec_len = ext4_rec_len_to_disk(blocksize - EXT4_DIR_REC_LEN(1),
-					   blocksize);
-	de->name_len = 2;
-	strcpy(de->name, "..");
-	ext4_set_de_type(dir->i_sb, de, S_IFDIR);
 	set_nlink(inode, 2);
-	BUFFER_TRACE(dir_block, "call ext4_handle_dirty_metadata");
-	err = ext4_handle_dirty_metadata(handle, inode, dir_block);
-	if (err)
-		goto out_clear_inode;
 	err = ext4_mark_inode_dirty(handle, inode);
 	if (!err)
 		err = ext4_add_entry(handle, dentry, inode);
@@ -1884,7 +2077,6 @@ out_clear_inode:
 	d_instantiate(dentry, inode);
 	unlock_new_inode(inode);
 out_stop:
-	brelse(dir_block);
 	ext4_journal_stop(handle);
 	if (err == -ENOSPC && ext4_should_retry_alloc(dir->i_sb, &retries))
 		goto retry;
@@ -1902,6 +2094,14 @@ static int empty_dir(struct inode *inode)
 	struct super_block *sb;
 	int err = 0;
 
+	if (ext4_has_inline_data(inode)) {
+		int has_inline_data = 1;
+
+		err = empty_inline_dir(inode, &has_inline_data);
+		if (has_inline_data)
+			return err;
+	}
+
 	sb = inode->i_sb;
 	if (inode->i_size < EXT4_DIR_REC_LEN(1) + EXT4_DIR_REC_LEN(2) ||
 	    !(bh = ext4_bread(NULL, inode, 0, 0, &err))) {
@@ -1947,7 +2147,8 @@ static int empty_dir(struct inode *inode)
 			}
 			de = (struct ext4_dir_entry_2 *) bh->b_data;
 		}
-		if (ext4_check_dir_entry(inode, NULL, de, bh, offset)) {
+		if (ext4_check_dir_entry(inode, NULL, de, bh,
+					 bh->b_data, bh->b_size, offset)) {
 			de = (struct ext4_dir_entry_2 *)(bh->b_data +
 							 sb->s_blocksize);
 			offset = (offset | (sb->s_blocksize - 1)) + 1;
@@ -2383,6 +2584,55 @@ retry:
 #define PARENT_INO(buffer, size) \
 	(ext4_next_entry((struct ext4_dir_entry_2 *)(buffer), size)->inode)
 
+/*
+ * The directory being moved by a rename is not locked, so an inline one
+ * may be pushed out to a block between reading and updating "..".
+ */
+static int ext4_read_dotdot(struct inode *inode, __u32 *parent_ino)
+{
+	struct buffer_head *bh;
+	int err = 1;
+
+	if (ext4_has_inline_data(inode)) {
+		err = ext4_inline_dir_parent(inode, parent_ino);
+		if (err <= 0)
+			return err;
+	}
+	bh = ext4_bread(NULL, inode, 0, 0, &err);
+	if (!bh)
+		return err ? err : -EIO;
+	*parent_ino = le32_to_cpu(PARENT_INO(bh->b_data,
+					     inode->i_sb->s_blocksize));
+	brelse(bh);
+	return 0;
+}
+
+static int ext4_update_dotdot(handle_t *handle, struct inode *inode,
+			      __u32 parent_ino)
+{
+	struct buffer_head *bh;
+	int err = 1;
+
+	if (ext4_has_inline_data(inode)) {
+		err = ext4_inline_dir_set_parent(handle, inode, parent_ino);
+		if (err <= 0)
+			return err;
+	}
+	bh = ext4_bread(handle, inode, 0, 0, &err);
+	if (!bh)
+		return err ? err : -EIO;
+	BUFFER_TRACE(bh, "get_write_access");
+	err = ext4_journal_get_write_access(handle, bh);
+	if (!err) {
+		PARENT_INO(bh->b_data, inode->i_sb->s_blocksize) =
+						cpu_to_le32(parent_ino);
+		BUFFER_TRACE(bh, "call ext4_handle_dirty_metadata");
+		err = ext4_handle_dirty_metadata(handle, inode, bh);
+	}
+	brelse(bh);
+	return err;
+}
+
 /*
  * Anybody can rename anything with this: the permission checks are left to the
  * higher-level routines.
@@ -2392,14 +2642,15 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 {
 	handle_t *handle;
 	struct inode *old_inode, *new_inode;
-	struct buffer_head *old_bh, *new_bh, *dir_bh;
+	struct buffer_head *old_bh, *new_bh;
 	struct ext4_dir_entry_2 *old_de, *new_de;
-	int retval, force_da_alloc = 0;
+	int retval, force_da_alloc = 0, is_dir = 0;
+	__u32 parent_ino;
 
 	dquot_initialize(old_dir);
 	dquot_initialize(new_dir);
 
-	old_bh = new_bh = dir_bh = NULL;
+	old_bh = new_bh = NULL;
 
 	/* Initialize quotas before so that eventual writes go
 	 * in separate transaction */
@@ -2440,21 +2691,17 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 			if (!empty_dir(new_inode))
 				goto end_rename;
 		}
-		retval = -EIO;
-		dir_bh = ext4_bread(handle, old_inode, 0, 0, &retval);
-		if (!dir_bh)
+		retval = ext4_read_dotdot(old_inode, &parent_ino);
+		if (retval)
 			goto end_rename;
-		if (le32_to_cpu(PARENT_INO(dir_bh->b_data,
-				old_dir->i_sb->s_blocksize)) != old_dir->i_ino)
+		retval = -EIO;
+		if (parent_ino != old_dir->i_ino)
 			goto end_rename;
 		retval = -EMLINK;
 		if (!new_inode && new_dir != old_dir &&
 		    EXT4_DIR_LINK_MAX(new_dir))
 			goto end_rename;
-		BUFFER_TRACE(dir_bh, "get_write_access");
-		retval = ext4_journal_get_write_access(handle, dir_bh);
-		if (retval)
-			goto end_rename;
+		is_dir = 1;
 	}
 	if (!new_bh) {
 		retval = ext4_add_entry(handle, new_dentry, old_inode);
@@ -2465,10 +2712,12 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 		retval = ext4_journal_get_write_access(handle, new_bh);
 		if (retval)
 			goto end_rename;
+		down_write(&EXT4_I(new_dir)->i_dir_rwsem);
 		new_de->inode = cpu_to_le32(old_inode->i_ino);
 		if (EXT4_HAS_INCOMPAT_FEATURE(new_dir->i_sb,
 					      EXT4_FEATURE_INCOMPAT_FILETYPE))
 			new_de->file_type = old_de->file_type;
+		up_write(&EXT4_I(new_dir)->i_dir_rwsem);
 		new_dir->i_version++;
 		new_dir->i_ctime = new_dir->i_mtime =
 					ext4_current_time(new_dir);
@@ -2524,11 +2773,8 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 	}
 	old_dir->i_ctime = old_dir->i_mtime = ext4_current_time(old_dir);
 	ext4_update_dx_flag(old_dir);
-	if (dir_bh) {
-		PARENT_INO(dir_bh->b_data, new_dir->i_sb->s_blocksize) =
-						cpu_to_le32(new_dir->i_ino);
-		BUFFER_TRACE(dir_bh, "call ext4_handle_dirty_metadata");
-		retval = ext4_handle_dirty_metadata(handle, old_inode, dir_bh);
+	if (is_dir) {
+		retval = ext4_update_dotdot(handle, old_inode, new_dir->i_ino);
 		if (retval) {
 			ext4_std_error(old_dir->i_sb, retval);
 			goto end_rename;
@@ -2555,7 +2801,6 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 	retval = 0;
 
 end_rename:
-	brelse(dir_bh);
 	brelse(old_bh);
 	brelse(new_bh);
 	ext4_journal_stop(handle);
@@ -2570,6 +2815,7 @@ end_rename:
 const struct inode_operations ext4_dir_inode_operations = {
 	.create		= ext4_create,
 	.lookup		= ext4_lookup,
+	.lookup_shared	= ext4_lookup_shared,
 	.link		= ext4_link,
 	.unlink		= ext4_unlink,
 	.symlink	= ext4_symlink,
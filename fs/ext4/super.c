@@ -862,6 +862,7 @@ static void ext4_put_super(struct super_block *sb)
 
 	if (sbi->s_proc) {
 		remove_proc_entry("options", sbi->s_proc);
+		remove_proc_entry("fsync_stats", sbi->s_proc);
 		remove_proc_entry(sb->s_id, ext4_proc_root);
 	}
 	kobject_del(&sbi->s_kobj);
@@ -945,6 +946,9 @@ static struct inode *ext4_alloc_inode(struct super_block *sb)
 	ei->cur_aio_dio = NULL;
 	ei->i_sync_tid = 0;
 	ei->i_datasync_tid = 0;
+	/* nothing is known to be flushed until the first fsync */
+	atomic_set(&ei->i_wb_seq, 0);
+	ei->i_flushed_seq = -1;
 	atomic_set(&ei->i_ioend_count, 0);
 	atomic_set(&ei->i_aiodio_unwritten, 0);
 
@@ -988,6 +992,7 @@ static void init_once(void *foo)
 	init_rwsem(&ei->xattr_sem);
 #endif
 	init_rwsem(&ei->i_data_sem);
+	init_rwsem(&ei->i_dir_rwsem);
 	inode_init_once(&ei->vfs_inode);
 }
 
@@ -2531,6 +2536,14 @@ static int ext4_feature_set_ok(struct super_block *sb, int readonly)
 		return 0;
 	}
 
+	if (EXT4_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_INLINEDATA) &&
+	    !IS_ENABLED(CONFIG_EXT4_FS_XATTR)) {
+		ext4_msg(sb, KERN_ERR,
+			 "Can't support inline_data feature without "
+			 "CONFIG_EXT4_FS_XATTR");
+		return 0;
+	}
+
 	if (readonly)
 		return 1;
 
@@ -3394,12 +3407,18 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 		goto failed_mount;
 	}
 
+	spin_lock_init(&sbi->s_fsync_lock);
+	init_waitqueue_head(&sbi->s_flush_wait);
+
 	if (ext4_proc_root)
 		sbi->s_proc = proc_mkdir(sb->s_id, ext4_proc_root);
 
-	if (sbi->s_proc)
+	if (sbi->s_proc) {
 		proc_create_data("options", S_IRUGO, sbi->s_proc,
 				 &ext4_seq_options_fops, sb);
+		proc_create_data("fsync_stats", S_IRUGO | S_IWUSR, sbi->s_proc,
+				 &ext4_fsync_stats_fops, sb);
+	}
 
 	bgl_lock_init(sbi->s_blockgroup_lock);
 
@@ -3725,6 +3744,7 @@ failed_mount2:
 failed_mount:
 	if (sbi->s_proc) {
 		remove_proc_entry("options", sbi->s_proc);
+		remove_proc_entry("fsync_stats", sbi->s_proc);
 		remove_proc_entry(sb->s_id, ext4_proc_root);
 	}
 #ifdef CONFIG_QUOTA
@@ -61,6 +61,49 @@ static ssize_t fuse_conn_waiting_read(struct file *file, char __user *buf,
 	return simple_read_from_buffer(buf, len, ppos, tmp, size);
 }
 
+static ssize_t fuse_conn_counter_read(struct file *file, char __user *buf,
+				      size_t len, loff_t *ppos,
+				      unsigned long val)
+{
+	char tmp[32];
+	size_t size = sprintf(tmp, "%lu\n", val);
+
+	return simple_read_from_buffer(buf, len, ppos, tmp, size);
+}
+
+static ssize_t fuse_conn_pages_moved_read(struct file *file, char __user *buf,
+					  size_t len, loff_t *ppos)
+{
+	struct fuse_conn *fc;
+	unsigned long val;
+
+	fc = fuse_ctl_file_conn_get(file);
+	if (!fc)
+		return 0;
+
+	val = atomic_long_read(&fc->pages_moved);
+	fuse_conn_put(fc);
+
+	return fuse_conn_counter_read(file, buf, len, ppos, val);
+}
+
+static ssize_t fuse_conn_pages_copied_read(struct file *file,
+					   char __user *buf, size_t len,
+					   loff_t *ppos)
+{
+	struct fuse_conn *fc;
+	unsigned long val;
+
+	fc = fuse_ctl_file_conn_get(file);
+	if (!fc)
+		return 0;
+
+	val = atomic_long_read(&fc->pages_copied);
+	fuse_conn_put(fc);
+
+	return fuse_conn_counter_read(file, buf, len, ppos, val);
+}
+
 static ssize_t fuse_conn_limit_read(struct file *file, char __user *buf,
 				    size_t len, loff_t *ppos, unsigned val)
 {
@@ -188,6 +231,18 @@ static const struct file_operations fuse_ctl_waiting_ops = {
 	.llseek = no_llseek,
 };
 
+static const struct file_operations fuse_conn_pages_moved_ops = {
+	.open = nonseekable_open,
+	.read = fuse_conn_pages_moved_read,
+	.llseek = no_llseek,
+};
+
+static const struct file_operations fuse_conn_pages_copied_ops = {
+	.open = nonseekable_open,
+	.read = fuse_conn_pages_copied_read,
+	.llseek = no_llseek,
+};
+
 static const struct file_operations fuse_conn_max_background_ops = {
 	.open = nonseekable_open,
 	.read = fuse_conn_max_background_read,
@@ -266,7 +321,11 @@ int fuse_ctl_add_conn(struct fuse_conn *fc)
 				 1, NULL, &fuse_conn_max_background_ops) ||
 	    !fuse_ctl_add_dentry(parent, fc, "congestion_threshold",
 				 S_IFREG | 0600, 1, NULL,
-				 &fuse_conn_congestion_threshold_ops))
+				 &fuse_conn_congestion_threshold_ops) ||
+	    !fuse_ctl_add_dentry(parent, fc, "pages_moved", S_IFREG | 0400, 1,
+				 NULL, &fuse_conn_pages_moved_ops) ||
+	    !fuse_ctl_add_dentry(parent, fc, "pages_copied", S_IFREG | 0400,
+				 1, NULL, &fuse_conn_pages_copied_ops))
 		goto err;
 
 	return 0;
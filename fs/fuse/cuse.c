@@ -479,6 +479,7 @@ static void cuse_fc_release(struct fuse_conn *fc)
 static int cuse_channel_open(struct inode *inode, struct file *file)
 {
 	struct cuse_conn *cc;
+	struct fuse_chan *ch;
 	int rc;
 
 	/* set up cuse_conn */
@@ -491,14 +492,21 @@ static int cuse_channel_open(struct inode *inode, struct file *file)
 	INIT_LIST_HEAD(&cc->list);
 	cc->fc.release = cuse_fc_release;
 
+	ch = fuse_chan_alloc(&cc->fc);
+	if (!ch) {
+		fuse_conn_put(&cc->fc);
+		return -ENOMEM;
+	}
+
 	cc->fc.connected = 1;
 	cc->fc.blocked = 0;
 	rc = cuse_send_init(cc);
 	if (rc) {
+		fuse_chan_free(ch);
 		fuse_conn_put(&cc->fc);
 		return rc;
 	}
-	file->private_data = &cc->fc;	/* channel owns base reference to cc */
+	file->private_data = ch;	/* channel owns base reference to cc */
 
 	return 0;
 }
@@ -516,7 +524,8 @@ static int cuse_channel_open(struct inode *inode, struct file *file)
  */
 static int cuse_channel_release(struct inode *inode, struct file *file)
 {
-	struct cuse_conn *cc = fc_to_cc(file->private_data);
+	struct fuse_chan *ch = file->private_data;
+	struct cuse_conn *cc = fc_to_cc(ch->fc);
 	int rc;
 
 	/* remove from the conntbl, no more access from this point on */
@@ -26,15 +26,171 @@ MODULE_ALIAS("devname:fuse");
 
 static struct kmem_cache *fuse_req_cachep;
 
-static struct fuse_conn *fuse_get_conn(struct file *file)
+static struct fuse_chan *fuse_get_chan(struct file *file)
 {
 	/*
 	 * Lockless access is OK, because file->private data is set
-	 * once during mount and is valid until the file is released.
+	 * once during mount or clone and is valid until the file is
+	 * released.
 	 */
 	return file->private_data;
 }
 
+/*
+ * Recompute which channel serves each CPU.  A channel bound to a CPU
+ * serves that CPU alone, the rest of the CPUs are spread over the
+ * unbound channels, or over all of them if every channel is bound.
+ *
+ * Submitters read the table without fc->lock, so every entry goes
+ * straight from its old channel to its new one.
+ *
+ * Called with fc->lock held
+ */
+static void fuse_chan_route(struct fuse_conn *fc)
+{
+	struct fuse_chan *ch, *next = NULL;
+	bool unbound = false;
+	int cpu;
+
+	list_for_each_entry(ch, &fc->chans, entry) {
+		if (ch->cpu < 0)
+			unbound = true;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct fuse_chan *found = NULL;
+
+		list_for_each_entry(ch, &fc->chans, entry) {
+			if (ch->cpu == cpu) {
+				found = ch;
+				break;
+			}
+		}
+		if (!found && !list_empty(&fc->chans)) {
+			do {
+				if (!next ||
+				    list_is_last(&next->entry, &fc->chans))
+					next = list_first_entry(&fc->chans,
+							struct fuse_chan,
+							entry);
+				else
+					next = list_entry(next->entry.next,
+							  struct fuse_chan,
+							  entry);
+			} while (unbound && next->cpu >= 0);
+			found = next;
+		}
+		rcu_assign_pointer(fc->cpu_chan[cpu], found);
+	}
+}
+
+/*
+ * Lock the channel serving this CPU, or return NULL if the connection
+ * has gone away.  A channel being released is taken out of the routing
+ * table before it stops accepting requests, so looking again finds the
+ * channel that replaced it.
+ */
+static struct fuse_chan *fuse_chan_lock_cpu(struct fuse_conn *fc)
+{
+	struct fuse_chan *ch;
+
+	rcu_read_lock();
+	for (;;) {
+		ch = NULL;
+		if (!ACCESS_ONCE(fc->connected))
+			break;
+		ch = rcu_dereference(fc->cpu_chan[raw_smp_processor_id()]);
+		if (!ch)
+			break;
+		spin_lock(&ch->lock);
+		if (ch->connected)
+			break;
+		spin_unlock(&ch->lock);
+	}
+	rcu_read_unlock();
+
+	return ch;
+}
+
+/*
+ * Lock the channel @req is queued on.  Returns NULL if it is on no
+ * channel, because it has finished or has been taken off to be ended.
+ */
+static struct fuse_chan *lock_req_chan(struct fuse_req *req)
+{
+	struct fuse_chan *ch;
+
+	rcu_read_lock();
+	for (;;) {
+		ch = ACCESS_ONCE(req->chan);
+		if (!ch)
+			break;
+		spin_lock(&ch->lock);
+		if (req->chan == ch)
+			break;
+		spin_unlock(&ch->lock);
+	}
+	rcu_read_unlock();
+
+	/* see the flags and state written before req->chan was cleared */
+	if (!ch)
+		smp_rmb();
+
+	return ch;
+}
+
+struct fuse_chan *fuse_chan_alloc(struct fuse_conn *fc)
+{
+	struct fuse_chan *ch;
+
+	ch = kzalloc(sizeof(*ch), GFP_KERNEL);
+	if (!ch)
+		return NULL;
+
+	/*
+	 * The first channel is set up before the connection is visible
+	 * to anybody else, so the routing table needs no locking here.
+	 */
+	if (!fc->cpu_chan) {
+		fc->cpu_chan = kcalloc(nr_cpu_ids, sizeof(*fc->cpu_chan),
+				       GFP_KERNEL);
+		if (!fc->cpu_chan) {
+			kfree(ch);
+			return NULL;
+		}
+	}
+
+	ch->fc = fc;
+	ch->cpu = -1;
+	spin_lock_init(&ch->lock);
+	ch->connected = 1;
+	init_waitqueue_head(&ch->waitq);
+	INIT_LIST_HEAD(&ch->pending);
+	INIT_LIST_HEAD(&ch->processing);
+	INIT_LIST_HEAD(&ch->io);
+	INIT_LIST_HEAD(&ch->interrupts);
+
+	spin_lock(&fc->lock);
+	list_add_tail(&ch->entry, &fc->chans);
+	fuse_chan_route(fc);
+	spin_unlock(&fc->lock);
+
+	return ch;
+}
+EXPORT_SYMBOL_GPL(fuse_chan_alloc);
+
+void fuse_chan_free(struct fuse_chan *ch)
+{
+	struct fuse_conn *fc = ch->fc;
+
+	spin_lock(&fc->lock);
+	list_del(&ch->entry);
+	fuse_chan_route(fc);
+	spin_unlock(&fc->lock);
+	kfree_rcu(ch, rcu);
+}
+EXPORT_SYMBOL_GPL(fuse_chan_free);
+
 static void fuse_request_init(struct fuse_req *req)
 {
 	memset(req, 0, sizeof(*req));
@@ -209,6 +365,10 @@ void fuse_put_request(struct fuse_conn *fc, struct fuse_req *req)
 		if (req->waiting)
 			atomic_dec(&fc->num_waiting);
 
+		/* an open reply nobody picked up */
+		if (req->passthrough)
+			fput(req->passthrough);
+
 		if (req->stolen_file)
 			put_reserved_req(fc, req);
 		else
@@ -228,28 +388,28 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 	return nbytes;
 }
 
+/* Unique across all channels; zero is special, and 64 bits don't wrap */
 static u64 fuse_get_unique(struct fuse_conn *fc)
 {
-	fc->reqctr++;
-	/* zero is special */
-	if (fc->reqctr == 0)
-		fc->reqctr = 1;
-
-	return fc->reqctr;
+	return atomic64_inc_return(&fc->reqctr);
 }
 
-static void queue_request(struct fuse_conn *fc, struct fuse_req *req)
+/*
+ * Called with ch->lock held
+ */
+static void queue_request(struct fuse_chan *ch, struct fuse_req *req)
 {
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
-	list_add_tail(&req->list, &fc->pending);
-	req->state = FUSE_REQ_PENDING;
 	if (!req->waiting) {
 		req->waiting = 1;
-		atomic_inc(&fc->num_waiting);
+		atomic_inc(&ch->fc->num_waiting);
 	}
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	list_add_tail(&req->list, &ch->pending);
+	req->chan = ch;
+	req->state = FUSE_REQ_PENDING;
+	wake_up(&ch->waitq);
+	kill_fasync(&ch->fasync, SIGIO, POLL_IN);
 }
 
 void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
@@ -260,27 +420,42 @@ void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 
 	spin_lock(&fc->lock);
 	if (fc->connected) {
+		/* forgets may be read from any channel */
+		struct fuse_chan *ch = fc->cpu_chan[smp_processor_id()];
+
 		fc->forget_list_tail->next = forget;
 		fc->forget_list_tail = forget;
-		wake_up(&fc->waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+		/* readers look for forgets under the channel's lock */
+		spin_lock(&ch->lock);
+		wake_up(&ch->waitq);
+		kill_fasync(&ch->fasync, SIGIO, POLL_IN);
+		spin_unlock(&ch->lock);
 	} else {
 		kfree(forget);
 	}
 	spin_unlock(&fc->lock);
 }
 
+/*
+ * Called with fc->lock held
+ */
 static void flush_bg_queue(struct fuse_conn *fc)
 {
 	while (fc->active_background < fc->max_background &&
 	       !list_empty(&fc->bg_queue)) {
+		struct fuse_chan *ch;
 		struct fuse_req *req;
 
+		/* disconnected, fuse_abort_conn() ends the bg_queue */
+		ch = fuse_chan_lock_cpu(fc);
+		if (!ch)
+			break;
 		req = list_entry(fc->bg_queue.next, struct fuse_req, list);
 		list_del(&req->list);
 		fc->active_background++;
 		req->in.h.unique = fuse_get_unique(fc);
-		queue_request(fc, req);
+		queue_request(ch, req);
+		spin_unlock(&ch->lock);
 	}
 }
 
@@ -292,17 +467,32 @@ static void flush_bg_queue(struct fuse_conn *fc)
  * the 'end' callback is called if given, else the reference to the
  * request is released
  *
- * Called with fc->lock, unlocks it
+ * Called with the lock of req->chan held if the request is on a
+ * channel, unlocks it.  A request that is on no channel has been taken
+ * off its list by whoever is ending it.
  */
 static void request_end(struct fuse_conn *fc, struct fuse_req *req)
-__releases(fc->lock)
 {
-	void (*end) (struct fuse_conn *, struct fuse_req *) = req->end;
-	req->end = NULL;
-	list_del(&req->list);
-	list_del(&req->intr_entry);
+	struct fuse_chan *ch = req->chan;
+	void (*end) (struct fuse_conn *, struct fuse_req *) = NULL;
+
+	/* fuse_abort_conn() calls the end of an aborted request itself */
+	if (!test_bit(FR_ABORTED, &req->flags)) {
+		end = req->end;
+		req->end = NULL;
+	}
+	if (ch) {
+		list_del(&req->list);
+		list_del(&req->intr_entry);
+		req->chan = NULL;
+	}
+	/* the reply must be visible before the requester sees FINISHED */
+	smp_wmb();
 	req->state = FUSE_REQ_FINISHED;
+	if (ch)
+		spin_unlock(&ch->lock);
 	if (req->background) {
+		spin_lock(&fc->lock);
 		if (fc->num_background == fc->max_background) {
 			fc->blocked = 0;
 			wake_up_all(&fc->blocked_waitq);
@@ -315,50 +505,54 @@ __releases(fc->lock)
 		fc->num_background--;
 		fc->active_background--;
 		flush_bg_queue(fc);
+		spin_unlock(&fc->lock);
 	}
-	spin_unlock(&fc->lock);
 	wake_up(&req->waitq);
 	if (end)
 		end(fc, req);
 	fuse_put_request(fc, req);
 }
 
-static void wait_answer_interruptible(struct fuse_conn *fc,
-				      struct fuse_req *req)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void wait_answer_interruptible(struct fuse_req *req)
 {
 	if (signal_pending(current))
 		return;
 
-	spin_unlock(&fc->lock);
 	wait_event_interruptible(req->waitq, req->state == FUSE_REQ_FINISHED);
-	spin_lock(&fc->lock);
 }
 
-static void queue_interrupt(struct fuse_conn *fc, struct fuse_req *req)
+/*
+ * Called with ch->lock held
+ */
+static void queue_interrupt(struct fuse_chan *ch, struct fuse_req *req)
 {
-	list_add_tail(&req->intr_entry, &fc->interrupts);
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	list_add_tail(&req->intr_entry, &ch->interrupts);
+	wake_up(&ch->waitq);
+	kill_fasync(&ch->fasync, SIGIO, POLL_IN);
 }
 
 static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
-__releases(fc->lock)
-__acquires(fc->lock)
 {
+	struct fuse_chan *ch;
+
 	if (!fc->no_interrupt) {
 		/* Any signal may interrupt this */
-		wait_answer_interruptible(fc, req);
+		wait_answer_interruptible(req);
 
-		if (req->aborted)
-			goto aborted;
+		ch = lock_req_chan(req);
 		if (req->state == FUSE_REQ_FINISHED)
-			return;
-
-		req->interrupted = 1;
-		if (req->state == FUSE_REQ_SENT)
-			queue_interrupt(fc, req);
+			goto finished;
+
+		/*
+		 * Off its channel the request is about to be ended,
+		 * there is nobody left to send the interrupt to.
+		 */
+		set_bit(FR_INTERRUPTED, &req->flags);
+		if (ch) {
+			if (req->state == FUSE_REQ_SENT)
+				queue_interrupt(ch, req);
+			spin_unlock(&ch->lock);
+		}
 	}
 
 	if (!req->force) {
@@ -366,69 +560,71 @@ __acquires(fc->lock)
 
 		/* Only fatal signals may interrupt this */
 		block_sigs(&oldset);
-		wait_answer_interruptible(fc, req);
+		wait_answer_interruptible(req);
 		restore_sigs(&oldset);
 
-		if (req->aborted)
-			goto aborted;
+		ch = lock_req_chan(req);
 		if (req->state == FUSE_REQ_FINISHED)
-			return;
+			goto finished;
 
 		/* Request is not yet in userspace, bail out */
-		if (req->state == FUSE_REQ_PENDING) {
+		if (ch && req->state == FUSE_REQ_PENDING) {
 			list_del(&req->list);
+			req->chan = NULL;
+			spin_unlock(&ch->lock);
 			__fuse_put_request(req);
 			req->out.h.error = -EINTR;
 			return;
 		}
+		if (ch)
+			spin_unlock(&ch->lock);
 	}
 
 	/*
 	 * Either request is already in userspace, or it was forced.
 	 * Wait it out.
 	 */
-	spin_unlock(&fc->lock);
-
 	while (req->state != FUSE_REQ_FINISHED)
 		wait_event_freezable(req->waitq,
 				     req->state == FUSE_REQ_FINISHED);
-	spin_lock(&fc->lock);
-
-	if (!req->aborted)
-		return;
-
- aborted:
-	BUG_ON(req->state != FUSE_REQ_FINISHED);
-	if (req->locked) {
+	/* pairs with the barrier in request_end() and abort_io_requests() */
+	smp_rmb();
+	ch = NULL;
+
+ finished:
+	if (ch)
+		spin_unlock(&ch->lock);
+	if (test_bit(FR_ABORTED, &req->flags)) {
 		/* This is uninterruptible sleep, because data is
 		   being copied to/from the buffers of req.  During
 		   locked state, there mustn't be any filesystem
 		   operation (e.g. page fault), since that could lead
 		   to deadlock */
-		spin_unlock(&fc->lock);
-		wait_event(req->waitq, !req->locked);
-		spin_lock(&fc->lock);
+		wait_event(req->waitq, !test_bit(FR_LOCKED, &req->flags));
 	}
 }
 
 void fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
 {
+	struct fuse_chan *ch;
+
 	req->isreply = 1;
-	spin_lock(&fc->lock);
-	if (!fc->connected)
+	ch = fuse_chan_lock_cpu(fc);
+	if (!ch)
 		req->out.h.error = -ENOTCONN;
-	else if (fc->conn_error)
+	else if (fc->conn_error) {
+		spin_unlock(&ch->lock);
 		req->out.h.error = -ECONNREFUSED;
-	else {
+	} else {
 		req->in.h.unique = fuse_get_unique(fc);
-		queue_request(fc, req);
+		queue_request(ch, req);
 		/* acquire extra reference, since request is still needed
 		   after request_end() */
 		__fuse_get_request(req);
+		spin_unlock(&ch->lock);
 
 		request_wait_answer(fc, req);
 	}
-	spin_unlock(&fc->lock);
 }
 EXPORT_SYMBOL_GPL(fuse_request_send);
 
@@ -455,6 +651,7 @@ static void fuse_request_send_nowait(struct fuse_conn *fc, struct fuse_req *req)
 		fuse_request_send_nowait_locked(fc, req);
 		spin_unlock(&fc->lock);
 	} else {
+		spin_unlock(&fc->lock);
 		req->out.h.error = -ENOTCONN;
 		request_end(fc, req);
 	}
@@ -470,16 +667,17 @@ EXPORT_SYMBOL_GPL(fuse_request_send_background);
 static int fuse_request_send_notify_reply(struct fuse_conn *fc,
 					  struct fuse_req *req, u64 unique)
 {
+	struct fuse_chan *ch;
 	int err = -ENODEV;
 
 	req->isreply = 0;
 	req->in.h.unique = unique;
-	spin_lock(&fc->lock);
-	if (fc->connected) {
-		queue_request(fc, req);
+	ch = fuse_chan_lock_cpu(fc);
+	if (ch) {
+		queue_request(ch, req);
+		spin_unlock(&ch->lock);
 		err = 0;
 	}
-	spin_unlock(&fc->lock);
 
 	return err;
 }
@@ -505,12 +703,15 @@ static int lock_request(struct fuse_conn *fc, struct fuse_req *req)
 {
 	int err = 0;
 	if (req) {
-		spin_lock(&fc->lock);
-		if (req->aborted)
+		/* an aborted request has been taken off its channel */
+		struct fuse_chan *ch = lock_req_chan(req);
+
+		if (!ch)
 			err = -ENOENT;
-		else
-			req->locked = 1;
-		spin_unlock(&fc->lock);
+		else {
+			set_bit(FR_LOCKED, &req->flags);
+			spin_unlock(&ch->lock);
+		}
 	}
 	return err;
 }
@@ -523,11 +724,11 @@ static int lock_request(struct fuse_conn *fc, struct fuse_req *req)
 static void unlock_request(struct fuse_conn *fc, struct fuse_req *req)
 {
 	if (req) {
-		spin_lock(&fc->lock);
-		req->locked = 0;
-		if (req->aborted)
+		clear_bit(FR_LOCKED, &req->flags);
+		/* pairs with the abort, which sets FR_ABORTED, then waits */
+		smp_mb__after_clear_bit();
+		if (test_bit(FR_ABORTED, &req->flags))
 			wake_up(&req->waitq);
-		spin_unlock(&fc->lock);
 	}
 }
 
@@ -547,6 +748,7 @@ struct fuse_copy_state {
 	void *buf;
 	unsigned len;
 	unsigned move_pages:1;
+	unsigned lru_drained:1;
 };
 
 static void fuse_copy_init(struct fuse_copy_state *cs, struct fuse_conn *fc,
@@ -698,6 +900,7 @@ static int fuse_try_move_page(struct fuse_copy_state *cs, struct page **pagep)
 	struct page *newpage;
 	struct pipe_buffer *buf = cs->pipebufs;
 	struct address_space *mapping;
+	struct fuse_chan *ch;
 	pgoff_t index;
 
 	unlock_request(cs->fc, cs->req);
@@ -716,9 +919,29 @@ static int fuse_try_move_page(struct fuse_copy_state *cs, struct page **pagep)
 	if (cs->len != PAGE_SIZE)
 		goto out_fallback;
 
-	if (buf->ops->steal(cs->pipe, buf) != 0)
+	/*
+	 * Stealing takes the page out of the mapping it was spliced from.
+	 * Don't do that to a shmem page, it would be refused below and
+	 * the data would be gone from the backing file.
+	 */
+	if (PageSwapBacked(buf->page))
 		goto out_fallback;
 
+	if (buf->ops->steal(cs->pipe, buf) != 0) {
+		/*
+		 * A page the daemon has just read in is usually still
+		 * held by this CPU's LRU add vector, which keeps it from
+		 * being removed from its mapping.  Drain once per reply
+		 * and try again.
+		 */
+		if (cs->lru_drained)
+			goto out_fallback;
+		cs->lru_drained = 1;
+		lru_add_drain();
+		if (buf->ops->steal(cs->pipe, buf) != 0)
+			goto out_fallback;
+	}
+
 	newpage = buf->page;
 
 	if (WARN_ON(!PageUptodate(newpage)))
@@ -757,12 +980,13 @@ static int fuse_try_move_page(struct fuse_copy_state *cs, struct page **pagep)
 		lru_cache_add_file(newpage);
 
 	err = 0;
-	spin_lock(&cs->fc->lock);
-	if (cs->req->aborted)
+	ch = lock_req_chan(cs->req);
+	if (!ch)
 		err = -ENOENT;
-	else
+	else {
 		*pagep = newpage;
-	spin_unlock(&cs->fc->lock);
+		spin_unlock(&ch->lock);
+	}
 
 	if (err) {
 		unlock_page(newpage);
@@ -773,12 +997,14 @@ static int fuse_try_move_page(struct fuse_copy_state *cs, struct page **pagep)
 	unlock_page(oldpage);
 	page_cache_release(oldpage);
 	cs->len = 0;
+	atomic_long_inc(&cs->fc->pages_moved);
 
 	return 0;
 
 out_fallback_unlock:
 	unlock_page(newpage);
 out_fallback:
+	atomic_long_inc(&cs->fc->pages_copied);
 	cs->mapaddr = buf->ops->map(cs->pipe, buf, 1);
 	cs->buf = cs->mapaddr + buf->offset;
 
@@ -910,36 +1136,49 @@ static int fuse_copy_args(struct fuse_copy_state *cs, unsigned numargs,
 	return err;
 }
 
+/* Only a hint without fc->lock, the forgets are rechecked under it */
 static int forget_pending(struct fuse_conn *fc)
 {
-	return fc->forget_list_head.next != NULL;
+	return ACCESS_ONCE(fc->forget_list_head.next) != NULL;
+}
+
+/*
+ * Called with ch->lock held
+ */
+static int request_pending(struct fuse_chan *ch)
+{
+	return !list_empty(&ch->pending) || !list_empty(&ch->interrupts) ||
+		forget_pending(ch->fc);
 }
 
-static int request_pending(struct fuse_conn *fc)
+/*
+ * The connection may be killed without the channel being told, see
+ * fuse_conn_kill().  Called with ch->lock held.
+ */
+static int chan_connected(struct fuse_chan *ch)
 {
-	return !list_empty(&fc->pending) || !list_empty(&fc->interrupts) ||
-		forget_pending(fc);
+	return ch->connected && ACCESS_ONCE(ch->fc->connected);
 }
 
 /* Wait until a request is available on the pending list */
-static void request_wait(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void request_wait(struct fuse_chan *ch)
+__releases(ch->lock)
+__acquires(ch->lock)
 {
 	DECLARE_WAITQUEUE(wait, current);
 
-	add_wait_queue_exclusive(&fc->waitq, &wait);
-	while (fc->connected && !request_pending(fc)) {
+	add_wait_queue_exclusive(&ch->waitq, &wait);
+	while (chan_connected(ch) && !request_pending(ch)) {
 		set_current_state(TASK_INTERRUPTIBLE);
 		if (signal_pending(current))
 			break;
 
-		spin_unlock(&fc->lock);
+		spin_unlock(&ch->lock);
 		schedule();
-		spin_lock(&fc->lock);
+		spin_lock(&ch->lock);
 	}
 	set_current_state(TASK_RUNNING);
-	remove_wait_queue(&fc->waitq, &wait);
+	remove_wait_queue(&ch->waitq, &wait);
 }
 
 /*
@@ -948,11 +1187,11 @@ __acquires(fc->lock)
  * Unlike other requests this is assembled on demand, without a need
  * to allocate a separate fuse_req structure.
  *
- * Called with fc->lock held, releases it
+ * Called with ch->lock held, releases it
  */
-static int fuse_read_interrupt(struct fuse_conn *fc, struct fuse_copy_state *cs,
+static int fuse_read_interrupt(struct fuse_chan *ch, struct fuse_copy_state *cs,
 			       size_t nbytes, struct fuse_req *req)
-__releases(fc->lock)
+__releases(ch->lock)
 {
 	struct fuse_in_header ih;
 	struct fuse_interrupt_in arg;
@@ -960,7 +1199,7 @@ __releases(fc->lock)
 	int err;
 
 	list_del_init(&req->intr_entry);
-	req->intr_unique = fuse_get_unique(fc);
+	req->intr_unique = fuse_get_unique(ch->fc);
 	memset(&ih, 0, sizeof(ih));
 	memset(&arg, 0, sizeof(arg));
 	ih.len = reqsize;
@@ -968,7 +1207,7 @@ __releases(fc->lock)
 	ih.unique = req->intr_unique;
 	arg.unique = req->in.h.unique;
 
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
 	if (nbytes < reqsize)
 		return -EINVAL;
 
@@ -1103,46 +1342,55 @@ __releases(fc->lock)
  * request_end().  Otherwise add it to the processing list, and set
  * the 'sent' flag.
  */
-static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
+static ssize_t fuse_dev_do_read(struct fuse_chan *ch, struct file *file,
 				struct fuse_copy_state *cs, size_t nbytes)
 {
 	int err;
+	struct fuse_conn *fc = ch->fc;
 	struct fuse_req *req;
 	struct fuse_in *in;
 	unsigned reqsize;
 
  restart:
-	spin_lock(&fc->lock);
+	spin_lock(&ch->lock);
 	err = -EAGAIN;
-	if ((file->f_flags & O_NONBLOCK) && fc->connected &&
-	    !request_pending(fc))
+	if ((file->f_flags & O_NONBLOCK) && chan_connected(ch) &&
+	    !request_pending(ch))
 		goto err_unlock;
 
-	request_wait(fc);
+	request_wait(ch);
 	err = -ENODEV;
-	if (!fc->connected)
+	if (!chan_connected(ch))
 		goto err_unlock;
 	err = -ERESTARTSYS;
-	if (!request_pending(fc))
+	if (!request_pending(ch))
 		goto err_unlock;
 
-	if (!list_empty(&fc->interrupts)) {
-		req = list_entry(fc->interrupts.next, struct fuse_req,
+	if (!list_empty(&ch->interrupts)) {
+		req = list_entry(ch->interrupts.next, struct fuse_req,
 				 intr_entry);
-		return fuse_read_interrupt(fc, cs, nbytes, req);
+		return fuse_read_interrupt(ch, cs, nbytes, req);
 	}
 
 	if (forget_pending(fc)) {
-		if (list_empty(&fc->pending) || fc->forget_batch-- > 0)
+		if (list_empty(&ch->pending) || ch->forget_batch-- > 0) {
+			/* the forgets are shared by all the channels */
+			spin_unlock(&ch->lock);
+			spin_lock(&fc->lock);
+			if (fc->forget_list_head.next == NULL) {
+				spin_unlock(&fc->lock);
+				goto restart;
+			}
 			return fuse_read_forget(fc, cs, nbytes);
+		}
 
-		if (fc->forget_batch <= -8)
-			fc->forget_batch = 16;
+		if (ch->forget_batch <= -8)
+			ch->forget_batch = 16;
 	}
 
-	req = list_entry(fc->pending.next, struct fuse_req, list);
+	req = list_entry(ch->pending.next, struct fuse_req, list);
 	req->state = FUSE_REQ_READING;
-	list_move(&req->list, &fc->io);
+	list_move(&req->list, &ch->io);
 
 	in = &req->in;
 	reqsize = in->h.len;
@@ -1155,16 +1403,16 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		request_end(fc, req);
 		goto restart;
 	}
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
 	cs->req = req;
 	err = fuse_copy_one(cs, &in->h, sizeof(in->h));
 	if (!err)
 		err = fuse_copy_args(cs, in->numargs, in->argpages,
 				     (struct fuse_arg *) in->args, 0);
 	fuse_copy_finish(cs);
-	spin_lock(&fc->lock);
-	req->locked = 0;
-	if (req->aborted) {
+	/* an aborted request has been taken off the channel */
+	ch = lock_req_chan(req);
+	if (!ch) {
 		request_end(fc, req);
 		return -ENODEV;
 	}
@@ -1177,15 +1425,15 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		request_end(fc, req);
 	else {
 		req->state = FUSE_REQ_SENT;
-		list_move_tail(&req->list, &fc->processing);
-		if (req->interrupted)
-			queue_interrupt(fc, req);
-		spin_unlock(&fc->lock);
+		list_move_tail(&req->list, &ch->processing);
+		if (test_bit(FR_INTERRUPTED, &req->flags))
+			queue_interrupt(ch, req);
+		spin_unlock(&ch->lock);
 	}
 	return reqsize;
 
  err_unlock:
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
 	return err;
 }
 
@@ -1194,13 +1442,13 @@ static ssize_t fuse_dev_read(struct kiocb *iocb, const struct iovec *iov,
 {
 	struct fuse_copy_state cs;
 	struct file *file = iocb->ki_filp;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(file);
+	if (!ch)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 1, iov, nr_segs);
+	fuse_copy_init(&cs, ch->fc, 1, iov, nr_segs);
 
-	return fuse_dev_do_read(fc, file, &cs, iov_length(iov, nr_segs));
+	return fuse_dev_do_read(ch, file, &cs, iov_length(iov, nr_segs));
 }
 
 static int fuse_dev_pipe_buf_steal(struct pipe_inode_info *pipe,
@@ -1228,18 +1476,18 @@ static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
 	int do_wakeup = 0;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(in);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(in);
+	if (!ch)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
 	if (!bufs)
 		return -ENOMEM;
 
-	fuse_copy_init(&cs, fc, 1, NULL, 0);
+	fuse_copy_init(&cs, ch->fc, 1, NULL, 0);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
-	ret = fuse_dev_do_read(fc, in, &cs, len);
+	ret = fuse_dev_do_read(ch, in, &cs, len);
 	if (ret < 0)
 		goto out;
 
@@ -1663,11 +1911,11 @@ static int fuse_notify(struct fuse_conn *fc, enum fuse_notify_code code,
 }
 
 /* Look up request on processing list by unique ID */
-static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
+static struct fuse_req *request_find(struct fuse_chan *ch, u64 unique)
 {
 	struct list_head *entry;
 
-	list_for_each(entry, &fc->processing) {
+	list_for_each(entry, &ch->processing) {
 		struct fuse_req *req;
 		req = list_entry(entry, struct fuse_req, list);
 		if (req->in.h.unique == unique || req->intr_unique == unique)
@@ -1706,10 +1954,11 @@ static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
  * it from the list and copy the rest of the buffer to the request.
  * The request is finished by calling request_end()
  */
-static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
+static ssize_t fuse_dev_do_write(struct fuse_chan *ch,
 				 struct fuse_copy_state *cs, size_t nbytes)
 {
 	int err;
+	struct fuse_conn *fc = ch->fc;
 	struct fuse_req *req;
 	struct fuse_out_header oh;
 
@@ -1737,22 +1986,16 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	if (oh.error <= -1000 || oh.error > 0)
 		goto err_finish;
 
-	spin_lock(&fc->lock);
+	spin_lock(&ch->lock);
 	err = -ENOENT;
-	if (!fc->connected)
+	if (!chan_connected(ch))
 		goto err_unlock;
 
-	req = request_find(fc, oh.unique);
+	/* aborted requests are no longer on the processing list */
+	req = request_find(ch, oh.unique);
 	if (!req)
 		goto err_unlock;
 
-	if (req->aborted) {
-		spin_unlock(&fc->lock);
-		fuse_copy_finish(cs);
-		spin_lock(&fc->lock);
-		request_end(fc, req);
-		return -ENOENT;
-	}
 	/* Is it an interrupt reply? */
 	if (req->intr_unique == oh.unique) {
 		err = -EINVAL;
@@ -1762,38 +2005,41 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 		if (oh.error == -ENOSYS)
 			fc->no_interrupt = 1;
 		else if (oh.error == -EAGAIN)
-			queue_interrupt(fc, req);
+			queue_interrupt(ch, req);
 
-		spin_unlock(&fc->lock);
+		spin_unlock(&ch->lock);
 		fuse_copy_finish(cs);
 		return nbytes;
 	}
 
 	req->state = FUSE_REQ_WRITING;
-	list_move(&req->list, &fc->io);
+	list_move(&req->list, &ch->io);
 	req->out.h = oh;
-	req->locked = 1;
+	set_bit(FR_LOCKED, &req->flags);
 	cs->req = req;
 	if (!req->out.page_replace)
 		cs->move_pages = 0;
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
 
 	err = copy_out_args(cs, &req->out, nbytes);
 	fuse_copy_finish(cs);
+	if (!err)
+		fuse_passthrough_setup(fc, req);
 
-	spin_lock(&fc->lock);
-	req->locked = 0;
-	if (!err) {
-		if (req->aborted)
+	unlock_request(fc, req);
+	/* an aborted request has been taken off the channel */
+	ch = lock_req_chan(req);
+	if (!ch) {
+		if (!err)
 			err = -ENOENT;
-	} else if (!req->aborted)
+	} else if (err)
 		req->out.h.error = -EIO;
 	request_end(fc, req);
 
 	return err ? err : nbytes;
 
  err_unlock:
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
  err_finish:
 	fuse_copy_finish(cs);
 	return err;
@@ -1803,13 +2049,13 @@ static ssize_t fuse_dev_write(struct kiocb *iocb, const struct iovec *iov,
 			      unsigned long nr_segs, loff_t pos)
 {
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(iocb->ki_filp);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(iocb->ki_filp);
+	if (!ch)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 0, iov, nr_segs);
+	fuse_copy_init(&cs, ch->fc, 0, iov, nr_segs);
 
-	return fuse_dev_do_write(fc, &cs, iov_length(iov, nr_segs));
+	return fuse_dev_do_write(ch, &cs, iov_length(iov, nr_segs));
 }
 
 static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
@@ -1820,12 +2066,12 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	unsigned idx;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc;
+	struct fuse_chan *ch;
 	size_t rem;
 	ssize_t ret;
 
-	fc = fuse_get_conn(out);
-	if (!fc)
+	ch = fuse_get_chan(out);
+	if (!ch)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
@@ -1872,14 +2118,14 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	}
 	pipe_unlock(pipe);
 
-	fuse_copy_init(&cs, fc, 0, NULL, nbuf);
+	fuse_copy_init(&cs, ch->fc, 0, NULL, nbuf);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
 
 	if (flags & SPLICE_F_MOVE)
 		cs.move_pages = 1;
 
-	ret = fuse_dev_do_write(fc, &cs, len);
+	ret = fuse_dev_do_write(ch, &cs, len);
 
 	for (idx = 0; idx < nbuf; idx++) {
 		struct pipe_buffer *buf = &bufs[idx];
@@ -1893,37 +2139,53 @@ out:
 static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(file);
+	if (!ch)
 		return POLLERR;
 
-	poll_wait(file, &fc->waitq, wait);
+	poll_wait(file, &ch->waitq, wait);
 
-	spin_lock(&fc->lock);
-	if (!fc->connected)
+	spin_lock(&ch->lock);
+	if (!chan_connected(ch))
 		mask = POLLERR;
-	else if (request_pending(fc))
+	else if (request_pending(ch))
 		mask |= POLLIN | POLLRDNORM;
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
 
 	return mask;
 }
 
+/*
+ * Take the requests on a channel list over to @head, so that they can
+ * be ended without the channel having to stay around.
+ *
+ * Called with ch->lock held
+ */
+static void chan_splice_requests(struct list_head *list,
+				 struct list_head *head)
+{
+	struct fuse_req *req;
+
+	list_for_each_entry(req, list, list) {
+		list_del_init(&req->intr_entry);
+		req->chan = NULL;
+	}
+	list_splice_tail_init(list, head);
+}
+
 /*
  * Abort all requests on the given list (pending or processing)
  *
- * This function releases and reacquires fc->lock
+ * Called without any locks held
  */
 static void end_requests(struct fuse_conn *fc, struct list_head *head)
-__releases(fc->lock)
-__acquires(fc->lock)
 {
 	while (!list_empty(head)) {
 		struct fuse_req *req;
 		req = list_entry(head->next, struct fuse_req, list);
+		list_del_init(&req->list);
 		req->out.h.error = -ECONNABORTED;
 		request_end(fc, req);
-		spin_lock(&fc->lock);
 	}
 }
 
@@ -1932,47 +2194,72 @@ __acquires(fc->lock)
  *
  * The requests are set to aborted and finished, and the request
  * waiter is woken up.  This will make request_wait_answer() wait
- * until the request is unlocked and then return.
+ * until the request is unlocked and then return.  The reader or
+ * writer of the request finds it off the channel once it is done
+ * copying, and ends it.
  *
  * If the request is asynchronous, then the end function needs to be
  * called after waiting for the request to be unlocked (if it was
- * locked).
+ * locked), so such requests are moved to @head for end_io_requests().
+ *
+ * Called with ch->lock held
  */
-static void end_io_requests(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void abort_io_requests(struct fuse_chan *ch, struct list_head *head)
 {
-	while (!list_empty(&fc->io)) {
-		struct fuse_req *req =
-			list_entry(fc->io.next, struct fuse_req, list);
-		void (*end) (struct fuse_conn *, struct fuse_req *) = req->end;
+	struct fuse_req *req, *next;
 
-		req->aborted = 1;
+	list_for_each_entry_safe(req, next, &ch->io, list) {
+		set_bit(FR_ABORTED, &req->flags);
 		req->out.h.error = -ECONNABORTED;
-		req->state = FUSE_REQ_FINISHED;
 		list_del_init(&req->list);
-		wake_up(&req->waitq);
-		if (end) {
-			req->end = NULL;
+		list_del_init(&req->intr_entry);
+		if (req->end) {
 			__fuse_get_request(req);
-			spin_unlock(&fc->lock);
-			wait_event(req->waitq, !req->locked);
-			end(fc, req);
-			fuse_put_request(fc, req);
-			spin_lock(&fc->lock);
+			list_add_tail(&req->list, head);
 		}
+		/* pairs with the barrier in lock_req_chan() */
+		smp_wmb();
+		req->chan = NULL;
+		req->state = FUSE_REQ_FINISHED;
+		wake_up(&req->waitq);
 	}
 }
 
-static void end_queued_requests(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+/*
+ * Call the end functions of the requests taken by abort_io_requests()
+ *
+ * Called without any locks held
+ */
+static void end_io_requests(struct fuse_conn *fc, struct list_head *head)
+{
+	while (!list_empty(head)) {
+		struct fuse_req *req =
+			list_entry(head->next, struct fuse_req, list);
+		void (*end) (struct fuse_conn *, struct fuse_req *) = req->end;
+
+		list_del_init(&req->list);
+		req->end = NULL;
+		wait_event(req->waitq, !test_bit(FR_LOCKED, &req->flags));
+		end(fc, req);
+		fuse_put_request(fc, req);
+	}
+}
+
+/*
+ * Move the background requests that never made it onto a channel over
+ * to @head to be ended, and drop the forgets.
+ *
+ * Called with fc->lock held
+ */
+static void abort_queued_requests(struct fuse_conn *fc, struct list_head *head)
 {
+	struct fuse_req *req;
+
 	fc->max_background = UINT_MAX;
-	flush_bg_queue(fc);
-	end_requests(fc, &fc->pending);
-	end_requests(fc, &fc->processing);
-	while (forget_pending(fc))
+	list_for_each_entry(req, &fc->bg_queue, list)
+		fc->active_background++;
+	list_splice_tail_init(&fc->bg_queue, head);
+	while (fc->forget_list_head.next != NULL)
 		kfree(dequeue_forget(fc, 1, NULL));
 }
 
@@ -2004,40 +2291,96 @@ static void end_polls(struct fuse_conn *fc)
  *
  * During the aborting, progression of requests from the pending and
  * processing lists onto the io list, and progression of new requests
- * onto the pending list is prevented by req->connected being false.
+ * onto the pending list is prevented by ch->connected being false.
  *
  * Progression of requests under I/O to the processing list is
- * prevented by the req->aborted flag being true for these requests.
- * For this reason requests on the io list must be aborted first.
+ * prevented by these requests being taken off their channel, which
+ * the reader or writer checks for once it is done copying.  For this
+ * reason requests on the io list are aborted together with the rest
+ * under ch->lock.
  */
 void fuse_abort_conn(struct fuse_conn *fc)
 {
+	struct fuse_chan *ch;
+	LIST_HEAD(to_abort);
+	LIST_HEAD(to_end);
+
 	spin_lock(&fc->lock);
-	if (fc->connected) {
-		fc->connected = 0;
-		fc->blocked = 0;
-		end_io_requests(fc);
-		end_queued_requests(fc);
-		end_polls(fc);
-		wake_up_all(&fc->waitq);
-		wake_up_all(&fc->blocked_waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	if (!fc->connected) {
+		spin_unlock(&fc->lock);
+		return;
 	}
+	fc->connected = 0;
+	fc->blocked = 0;
+	list_for_each_entry(ch, &fc->chans, entry) {
+		spin_lock(&ch->lock);
+		ch->connected = 0;
+		abort_io_requests(ch, &to_abort);
+		chan_splice_requests(&ch->pending, &to_end);
+		chan_splice_requests(&ch->processing, &to_end);
+		spin_unlock(&ch->lock);
+		wake_up_all(&ch->waitq);
+		kill_fasync(&ch->fasync, SIGIO, POLL_IN);
+	}
+	abort_queued_requests(fc, &to_end);
+	end_polls(fc);
 	spin_unlock(&fc->lock);
+	wake_up_all(&fc->blocked_waitq);
+
+	end_io_requests(fc, &to_abort);
+	end_requests(fc, &to_end);
 }
 EXPORT_SYMBOL_GPL(fuse_abort_conn);
 
+/*
+ * Closing a channel ends the requests read from it, since they can
+ * no longer be answered.  Requests not yet read are handed over to
+ * another channel.  Closing the last channel disconnects the
+ * filesystem.
+ */
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (fc) {
+	struct fuse_chan *ch = fuse_get_chan(file);
+	if (ch) {
+		struct fuse_conn *fc = ch->fc;
+		LIST_HEAD(to_end);
+
 		spin_lock(&fc->lock);
-		fc->connected = 0;
-		fc->blocked = 0;
-		end_queued_requests(fc);
-		end_polls(fc);
-		wake_up_all(&fc->blocked_waitq);
+		list_del(&ch->entry);
+		fuse_chan_route(fc);
+		spin_lock(&ch->lock);
+		ch->connected = 0;
+		chan_splice_requests(&ch->processing, &to_end);
+		if (fc->connected && !list_empty(&fc->chans)) {
+			struct fuse_chan *next;
+			struct fuse_req *req;
+
+			next = list_first_entry(&fc->chans, struct fuse_chan,
+						entry);
+			spin_lock_nested(&next->lock, SINGLE_DEPTH_NESTING);
+			list_for_each_entry(req, &ch->pending, list)
+				req->chan = next;
+			if (!list_empty(&ch->pending)) {
+				list_splice_tail_init(&ch->pending,
+						      &next->pending);
+				wake_up(&next->waitq);
+				kill_fasync(&next->fasync, SIGIO, POLL_IN);
+			}
+			spin_unlock(&next->lock);
+			spin_unlock(&ch->lock);
+		} else {
+			fc->connected = 0;
+			fc->blocked = 0;
+			chan_splice_requests(&ch->pending, &to_end);
+			spin_unlock(&ch->lock);
+			abort_queued_requests(fc, &to_end);
+			end_polls(fc);
+			wake_up_all(&fc->blocked_waitq);
+		}
 		spin_unlock(&fc->lock);
+		end_requests(fc, &to_end);
+		/* submitters may still be looking at it under RCU */
+		kfree_rcu(ch, rcu);
 		fuse_conn_put(fc);
 	}
 
@@ -2047,12 +2390,113 @@ EXPORT_SYMBOL_GPL(fuse_dev_release);
 
 static int fuse_dev_fasync(int fd, struct file *file, int on)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(file);
+	if (!ch)
 		return -EPERM;
 
 	/* No locking - fasync_helper does its own locking */
-	return fasync_helper(fd, file, on, &fc->fasync);
+	return fasync_helper(fd, file, on, &ch->fasync);
+}
+
+/*
+ * Attach @file, a newly opened /dev/fuse, as another channel of the
+ * connection that the device file descriptor at @argp belongs to.
+ */
+static long fuse_dev_clone(struct file *file, u32 __user *argp)
+{
+	struct fuse_chan *ch;
+	struct file *old;
+	u32 oldfd;
+	long err;
+
+	if (get_user(oldfd, argp))
+		return -EFAULT;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EBADF;
+
+	/*
+	 * CUSE channels are not cloneable, opening /dev/cuse always
+	 * creates a new device.
+	 */
+	err = -EINVAL;
+	if (old->f_op != &fuse_dev_operations ||
+	    file->f_op != &fuse_dev_operations)
+		goto out_fput;
+
+	mutex_lock(&fuse_mutex);
+	if (file->private_data || !fuse_get_chan(old))
+		goto out_unlock;
+
+	err = -ENOMEM;
+	ch = fuse_chan_alloc(fuse_get_chan(old)->fc);
+	if (!ch)
+		goto out_unlock;
+
+	fuse_conn_get(ch->fc);
+	file->private_data = ch;
+	err = 0;
+
+ out_unlock:
+	mutex_unlock(&fuse_mutex);
+ out_fput:
+	fput(old);
+	return err;
+}
+
+/*
+ * Have the channel serve the requests submitted on one CPU, or go
+ * back to serving whatever CPUs are left over if given -1.
+ */
+static long fuse_dev_bind_cpu(struct file *file, s32 __user *argp)
+{
+	struct fuse_chan *ch = fuse_get_chan(file);
+	struct fuse_chan *pos;
+	struct fuse_conn *fc;
+	s32 cpu;
+	long err = 0;
+
+	if (!ch)
+		return -EPERM;
+	if (get_user(cpu, argp))
+		return -EFAULT;
+	if (cpu < -1 || cpu >= (s32) nr_cpu_ids ||
+	    (cpu >= 0 && !cpu_possible(cpu)))
+		return -EINVAL;
+
+	fc = ch->fc;
+	spin_lock(&fc->lock);
+	if (cpu >= 0) {
+		list_for_each_entry(pos, &fc->chans, entry) {
+			if (pos != ch && pos->cpu == cpu) {
+				err = -EBUSY;
+				break;
+			}
+		}
+	}
+	if (!err) {
+		ch->cpu = cpu;
+		fuse_chan_route(fc);
+	}
+	spin_unlock(&fc->lock);
+
+	return err;
+}
+
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	switch (cmd) {
+	case FUSE_DEV_IOC_CLONE:
+		return fuse_dev_clone(file, (u32 __user *) arg);
+
+	case FUSE_DEV_IOC_BIND_CPU:
+		return fuse_dev_bind_cpu(file, (s32 __user *) arg);
+
+	default:
+		return -ENOTTY;
+	}
 }
 
 const struct file_operations fuse_dev_operations = {
@@ -2067,6 +2511,8 @@ const struct file_operations fuse_dev_operations = {
 	.poll		= fuse_dev_poll,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
+	.unlocked_ioctl	= fuse_dev_ioctl,
+	.compat_ioctl	= fuse_dev_ioctl,
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
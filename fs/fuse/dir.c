@@ -428,6 +428,8 @@ static int fuse_create_open(struct inode *dir, struct dentry *entry,
 	req->out.args[1].value = &outopen;
 	fuse_request_send(fc, req);
 	err = req->out.h.error;
+	ff->passthrough = req->passthrough;
+	req->passthrough = NULL;
 	if (err) {
 		if (err == -ENOSYS)
 			fc->no_create = 1;
@@ -791,6 +793,13 @@ static void fuse_fillattr(struct inode *inode, struct fuse_attr *attr,
 	stat->size = attr->size;
 	stat->blocks = attr->blocks;
 	stat->blksize = (1 << inode->i_blkbits);
+
+	/* see the comment in fuse_change_attributes() */
+	if (get_fuse_conn(inode)->writeback_cache && S_ISREG(inode->i_mode)) {
+		stat->size = i_size_read(inode);
+		stat->mtime = inode->i_mtime;
+		stat->ctime = inode->i_ctime;
+	}
 }
 
 static int fuse_do_getattr(struct inode *inode, struct kstat *stat,
@@ -1338,10 +1347,12 @@ static int fuse_do_setattr(struct dentry *entry, struct iattr *attr,
 {
 	struct inode *inode = entry->d_inode;
 	struct fuse_conn *fc = get_fuse_conn(inode);
+	struct fuse_inode *fi = get_fuse_inode(inode);
 	struct fuse_req *req;
 	struct fuse_setattr_in inarg;
 	struct fuse_attr_out outarg;
 	bool is_truncate = false;
+	bool is_wb = fc->writeback_cache && S_ISREG(inode->i_mode);
 	loff_t oldsize;
 	int err;
 
@@ -1411,10 +1422,15 @@ static int fuse_do_setattr(struct dentry *entry, struct iattr *attr,
 	}
 
 	spin_lock(&fc->lock);
+	/* the new mtime was sent along, take what the fs made of it */
+	if (attr->ia_valid & ATTR_MTIME)
+		clear_bit(FUSE_I_MTIME_DIRTY, &fi->state);
 	fuse_change_attributes_common(inode, &outarg.attr,
 				      attr_timeout(&outarg));
 	oldsize = inode->i_size;
-	i_size_write(inode, outarg.attr.size);
+	/* see the comment in fuse_change_attributes() */
+	if (!is_wb || is_truncate)
+		i_size_write(inode, outarg.attr.size);
 
 	if (is_truncate) {
 		/* NOTE: this may release/reacquire fc->lock */
@@ -1426,7 +1442,8 @@ static int fuse_do_setattr(struct dentry *entry, struct iattr *attr,
 	 * Only call invalidate_inode_pages2() after removing
 	 * FUSE_NOWRITE, otherwise fuse_launder_page() would deadlock.
 	 */
-	if (S_ISREG(inode->i_mode) && oldsize != outarg.attr.size) {
+	if ((!is_wb || is_truncate) &&
+	    S_ISREG(inode->i_mode) && oldsize != outarg.attr.size) {
 		truncate_pagecache(inode, oldsize, outarg.attr.size);
 		invalidate_inode_pages2(inode->i_mapping);
 	}
@@ -1440,6 +1457,56 @@ error:
 	return err;
 }
 
+int fuse_flush_mtime(struct file *file, bool nofail)
+{
+	struct inode *inode = file->f_mapping->host;
+	struct fuse_conn *fc = get_fuse_conn(inode);
+	struct fuse_inode *fi = get_fuse_inode(inode);
+	struct fuse_file *ff = file->private_data;
+	struct fuse_req *req;
+	struct fuse_setattr_in inarg;
+	struct fuse_attr_out outarg;
+	int err;
+
+	if (!test_and_clear_bit(FUSE_I_MTIME_DIRTY, &fi->state))
+		return 0;
+
+	if (nofail) {
+		req = fuse_get_req_nofail(fc, file);
+	} else {
+		req = fuse_get_req(fc);
+		if (IS_ERR(req)) {
+			set_bit(FUSE_I_MTIME_DIRTY, &fi->state);
+			return PTR_ERR(req);
+		}
+	}
+
+	memset(&inarg, 0, sizeof(inarg));
+	memset(&outarg, 0, sizeof(outarg));
+	inarg.valid = FATTR_MTIME | FATTR_FH;
+	inarg.fh = ff->fh;
+	inarg.mtime = inode->i_mtime.tv_sec;
+	inarg.mtimensec = inode->i_mtime.tv_nsec;
+	req->in.h.opcode = FUSE_SETATTR;
+	req->in.h.nodeid = get_node_id(inode);
+	req->in.numargs = 1;
+	req->in.args[0].size = sizeof(inarg);
+	req->in.args[0].value = &inarg;
+	req->out.numargs = 1;
+	if (fc->minor < 9)
+		req->out.args[0].size = FUSE_COMPAT_ATTR_OUT_SIZE;
+	else
+		req->out.args[0].size = sizeof(outarg);
+	req->out.args[0].value = &outarg;
+	fuse_request_send(fc, req);
+	err = req->out.h.error;
+	fuse_put_request(fc, req);
+	if (err)
+		set_bit(FUSE_I_MTIME_DIRTY, &fi->state);
+
+	return err;
+}
+
 static int fuse_setattr(struct dentry *entry, struct iattr *attr)
 {
 	if (attr->ia_valid & ATTR_FILE)
@@ -1460,6 +1527,27 @@ static int fuse_getattr(struct vfsmount *mnt, struct dentry *entry,
 	return fuse_update_attributes(inode, stat, NULL, NULL);
 }
 
+/*
+ * Only reached for regular files in writeback_cache mode, everything
+ * else has S_NOCMTIME set.  The new mtime is sent to the filesystem
+ * on flush, fsync or the next setattr.
+ */
+static int fuse_update_time(struct inode *inode, struct timespec *now,
+			    int flags)
+{
+	struct fuse_inode *fi = get_fuse_inode(inode);
+
+	if (flags & S_VERSION)
+		inode_inc_iversion(inode);
+	if (flags & S_CTIME)
+		inode->i_ctime = *now;
+	if (flags & S_MTIME) {
+		inode->i_mtime = *now;
+		set_bit(FUSE_I_MTIME_DIRTY, &fi->state);
+	}
+	return 0;
+}
+
 static int fuse_setxattr(struct dentry *entry, const char *name,
 			 const void *value, size_t size, int flags)
 {
@@ -1665,6 +1753,7 @@ static const struct inode_operations fuse_common_inode_operations = {
 	.getxattr	= fuse_getxattr,
 	.listxattr	= fuse_listxattr,
 	.removexattr	= fuse_removexattr,
+	.update_time	= fuse_update_time,
 };
 
 static const struct inode_operations fuse_symlink_inode_operations = {
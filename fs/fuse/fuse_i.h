@@ -32,8 +32,11 @@
 /** It could be as large as PATH_MAX, but would that have any uses? */
 #define FUSE_NAME_MAX 1024
 
+/** Magic number of fuse superblocks */
+#define FUSE_SUPER_MAGIC 0x65735546
+
 /** Number of dentries for each connection in the control filesystem */
-#define FUSE_CTL_NUM_DENTRIES 5
+#define FUSE_CTL_NUM_DENTRIES 7
 
 /** If the FUSE_DEFAULT_PERMISSIONS flag is given, the filesystem
     module will check permissions based on the file mode.  Otherwise no
@@ -100,6 +103,15 @@ struct fuse_inode {
 
 	/** List of writepage requestst (pending or sent) */
 	struct list_head writepages;
+
+	/** Miscellaneous bits describing inode state */
+	unsigned long state;
+};
+
+/** FUSE inode state bits */
+enum {
+	/** i_mtime has been updated locally and not yet sent to the fs */
+	FUSE_I_MTIME_DIRTY,
 };
 
 struct fuse_conn;
@@ -138,6 +150,9 @@ struct fuse_file {
 
 	/** Has flock been performed on this file? */
 	bool flock:1;
+
+	/** Backing file that read, write and mmap are passed to */
+	struct file *passthrough;
 };
 
 /** One input argument of a request */
@@ -207,12 +222,27 @@ enum fuse_req_state {
 	FUSE_REQ_FINISHED
 };
 
+/**
+ * Request flags that change while the request is in flight.  They are
+ * set and tested atomically, because once a request has been taken off
+ * its channel to be ended they are written without any common lock.
+ *
+ * FR_ABORTED:		the request was aborted
+ * FR_INTERRUPTED:	the request has been interrupted
+ * FR_LOCKED:		data is being copied to/from the request
+ */
+enum fuse_req_flag {
+	FR_ABORTED,
+	FR_INTERRUPTED,
+	FR_LOCKED,
+};
+
 /**
  * A request to the client
  */
 struct fuse_req {
 	/** This can be on either pending processing or io lists in
-	    fuse_conn */
+	    fuse_chan */
 	struct list_head list;
 
 	/** Entry on the interrupts list  */
@@ -225,9 +255,8 @@ struct fuse_req {
 	u64 intr_unique;
 
 	/*
-	 * The following bitfields are either set once before the
-	 * request is queued or setting/clearing them is protected by
-	 * fuse_conn->lock
+	 * The following bitfields are set before the request is
+	 * queued, while nothing else can see it yet
 	 */
 
 	/** True if the request has reply */
@@ -236,22 +265,16 @@ struct fuse_req {
 	/** Force sending of the request even if interrupted */
 	unsigned force:1;
 
-	/** The request was aborted */
-	unsigned aborted:1;
-
 	/** Request is sent in the background */
 	unsigned background:1;
 
-	/** The request has been interrupted */
-	unsigned interrupted:1;
-
-	/** Data is being copied to/from the request */
-	unsigned locked:1;
-
 	/** Request is counted as "waiting" */
 	unsigned waiting:1;
 
-	/** State of the request */
+	/** FR_* flags */
+	unsigned long flags;
+
+	/** State of the request, changed under the channel's lock */
 	enum fuse_req_state state;
 
 	/** The request input */
@@ -310,6 +333,69 @@ struct fuse_req {
 
 	/** Request is stolen from fuse_file->reserved_req */
 	struct file *stolen_file;
+
+	/** Backing file of an OPEN or CREATE reply */
+	struct file *passthrough;
+
+	/** Channel the request is queued on, NULL once it is taken
+	    off to be ended.  Changed under the channel's lock */
+	struct fuse_chan *chan;
+};
+
+/**
+ * A channel of a fuse connection.
+ *
+ * Every open /dev/fuse file attached to a connection is a channel:
+ * the one passed to mount, and any cloned from it with
+ * FUSE_DEV_IOC_CLONE.  Requests are queued on the channel serving the
+ * CPU they were submitted on, and must be answered through the
+ * channel they were read from.
+ *
+ * The lists, and the state of the requests on them, are protected by
+ * the channel's own lock, so that channels don't contend with each
+ * other.  fc->lock is only needed for connection wide state; when both
+ * are taken, fc->lock nests outside.
+ */
+struct fuse_chan {
+	/** The connection this channel belongs to */
+	struct fuse_conn *fc;
+
+	/** Entry on fc->chans, protected by fc->lock */
+	struct list_head entry;
+
+	/** CPU this channel is bound to, or -1.  Protected by fc->lock */
+	int cpu;
+
+	/** Lock protecting the rest of this structure */
+	spinlock_t lock;
+
+	/** Requests may be queued here; cleared when the channel is
+	    released or the connection aborted */
+	unsigned connected;
+
+	/** Batching of FORGET requests (positive indicates FORGET batch) */
+	int forget_batch;
+
+	/** Readers of the channel are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** The list of pending requests */
+	struct list_head pending;
+
+	/** The list of requests being processed */
+	struct list_head processing;
+
+	/** The list of requests under I/O */
+	struct list_head io;
+
+	/** Pending interrupts */
+	struct list_head interrupts;
+
+	/** O_ASYNC requests */
+	struct fasync_struct *fasync;
+
+	/** Submitters look channels up under RCU */
+	struct rcu_head rcu;
 };
 
 /**
@@ -344,17 +430,12 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
-	/** Readers of the connection are waiting on this */
-	wait_queue_head_t waitq;
-
-	/** The list of pending requests */
-	struct list_head pending;
+	/** Channels attached to this connection */
+	struct list_head chans;
 
-	/** The list of requests being processed */
-	struct list_head processing;
-
-	/** The list of requests under I/O */
-	struct list_head io;
+	/** Channel serving each CPU, indexed by CPU number.  Updated
+	    under fc->lock, read under RCU */
+	struct fuse_chan **cpu_chan;
 
 	/** The next unique kernel file handle */
 	u64 khctr;
@@ -377,16 +458,10 @@ struct fuse_conn {
 	/** The list of background requests set aside for later queuing */
 	struct list_head bg_queue;
 
-	/** Pending interrupts */
-	struct list_head interrupts;
-
 	/** Queue of pending forgets */
 	struct fuse_forget_link forget_list_head;
 	struct fuse_forget_link *forget_list_tail;
 
-	/** Batching of FORGET requests (positive indicates FORGET batch) */
-	int forget_batch;
-
 	/** Flag indicating if connection is blocked.  This will be
 	    the case before the INIT reply is received, and if there
 	    are too many outstading backgrounds requests */
@@ -398,8 +473,8 @@ struct fuse_conn {
 	/** waitq for reserved requests */
 	wait_queue_head_t reserved_req_waitq;
 
-	/** The next unique request id */
-	u64 reqctr;
+	/** The last unique request id handed out */
+	atomic64_t reqctr;
 
 	/** Connection established, cleared on umount, connection
 	    abort and device release */
@@ -475,12 +550,25 @@ struct fuse_conn {
 	/** Don't apply umask to creation modes */
 	unsigned dont_mask:1;
 
+	/** Buffer writes in the page cache, the kernel owns i_size
+	    and i_mtime of regular files.  Only set in INIT */
+	unsigned writeback_cache:1;
+
+	/** Open replies may pass files through.  Only set in INIT */
+	unsigned passthrough:1;
+
 	/** Are BSD file locking primitives not implemented by fs? */
 	unsigned no_flock:1;
 
 	/** The number of requests waiting for completion */
 	atomic_t num_waiting;
 
+	/** Pages of spliced replies moved into the page cache */
+	atomic_long_t pages_moved;
+
+	/** Pages of spliced replies that had to be copied instead */
+	atomic_long_t pages_copied;
+
 	/** Negotiated minor version */
 	unsigned minor;
 
@@ -499,9 +587,6 @@ struct fuse_conn {
 	/** number of dentries used in the above array */
 	int ctl_ndents;
 
-	/** O_ASYNC requests */
-	struct fasync_struct *fasync;
-
 	/** Key for lock owner ID scrambling */
 	u32 scramble_key[4];
 
@@ -744,6 +829,72 @@ void fuse_flush_writepages(struct inode *inode);
 void fuse_set_nowrite(struct inode *inode);
 void fuse_release_nowrite(struct inode *inode);
 
+/**
+ * Send a locally updated mtime to the filesystem
+ */
+int fuse_flush_mtime(struct file *file, bool nofail);
+
+/**
+ * Passthrough of file I/O to a backing file
+ */
+#ifdef CONFIG_FUSE_PASSTHROUGH
+void fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_req *req);
+void fuse_passthrough_open(struct file *file);
+void fuse_passthrough_release(struct fuse_file *ff);
+ssize_t fuse_passthrough_aio_read(struct kiocb *iocb, const struct iovec *iov,
+				  unsigned long nr_segs, loff_t pos);
+ssize_t fuse_passthrough_aio_write(struct kiocb *iocb, const struct iovec *iov,
+				   unsigned long nr_segs, loff_t pos);
+ssize_t fuse_passthrough_splice_read(struct file *in, loff_t *ppos,
+				     struct pipe_inode_info *pipe, size_t len,
+				     unsigned int flags);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+#else
+static inline void fuse_passthrough_setup(struct fuse_conn *fc,
+					  struct fuse_req *req)
+{
+}
+
+static inline void fuse_passthrough_open(struct file *file)
+{
+}
+
+static inline void fuse_passthrough_release(struct fuse_file *ff)
+{
+}
+
+static inline ssize_t fuse_passthrough_aio_read(struct kiocb *iocb,
+						const struct iovec *iov,
+						unsigned long nr_segs,
+						loff_t pos)
+{
+	return -EINVAL;
+}
+
+static inline ssize_t fuse_passthrough_aio_write(struct kiocb *iocb,
+						 const struct iovec *iov,
+						 unsigned long nr_segs,
+						 loff_t pos)
+{
+	return -EINVAL;
+}
+
+static inline ssize_t fuse_passthrough_splice_read(struct file *in,
+						   loff_t *ppos,
+						   struct pipe_inode_info *pipe,
+						   size_t len,
+						   unsigned int flags)
+{
+	return -EINVAL;
+}
+
+static inline int fuse_passthrough_mmap(struct file *file,
+					struct vm_area_struct *vma)
+{
+	return -EINVAL;
+}
+#endif
+
 u64 fuse_get_attr_version(struct fuse_conn *fc);
 
 /**
@@ -776,6 +927,16 @@ long fuse_ioctl_common(struct file *file, unsigned int cmd,
 unsigned fuse_file_poll(struct file *file, poll_table *wait);
 int fuse_dev_release(struct inode *inode, struct file *file);
 
+/**
+ * Attach a new channel to the connection
+ */
+struct fuse_chan *fuse_chan_alloc(struct fuse_conn *fc);
+
+/**
+ * Detach a channel that never had requests queued on it
+ */
+void fuse_chan_free(struct fuse_chan *ch);
+
 void fuse_write_update_size(struct inode *inode, loff_t pos);
 
 #endif /* _FS_FUSE_I_H */
@@ -0,0 +1,215 @@
+/*
+  FUSE: Filesystem in Userspace
+  Passthrough of file I/O to a backing file
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+/*
+ * A daemon that serves a file straight from another filesystem can
+ * answer OPEN or CREATE with FOPEN_PASSTHROUGH and a descriptor of that
+ * file in passthrough_fd.  The file is looked up in the daemon's file
+ * table while the reply is being written, and from then on read, write,
+ * splice_read and mmap of the fuse file are handed to it.  Everything
+ * else, including all metadata operations, still goes to the daemon.
+ */
+
+#include "fuse_i.h"
+
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/fsnotify.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/ratelimit.h>
+#include <linux/aio.h>
+#include <linux/uio.h>
+
+/*
+ * Called in the context of the daemon writing the reply to an OPEN or
+ * CREATE request.  The backing file is parked on the request until
+ * the opener picks it up.
+ */
+void fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_req *req)
+{
+	struct fuse_open_out *outarg;
+	struct file *backing;
+	struct inode *inode;
+
+	if (!fc->passthrough || req->out.h.error)
+		return;
+	if (req->in.h.opcode != FUSE_OPEN && req->in.h.opcode != FUSE_CREATE)
+		return;
+
+	/* fuse_open_out is the last argument of both replies */
+	outarg = req->out.args[req->out.numargs - 1].value;
+	if (!(outarg->open_flags & FOPEN_PASSTHROUGH))
+		return;
+
+	backing = fget(outarg->passthrough_fd);
+	if (!backing)
+		goto fail;
+
+	inode = backing->f_path.dentry->d_inode;
+	if (!S_ISREG(inode->i_mode) ||
+	    !backing->f_op->aio_read || !backing->f_op->aio_write) {
+		fput(backing);
+		goto fail;
+	}
+
+	/* don't let the stack of fuse mounts grow behind our back */
+	if (inode->i_sb->s_magic == FUSE_SUPER_MAGIC) {
+		fput(backing);
+		goto fail;
+	}
+
+	req->passthrough = backing;
+	return;
+
+fail:
+	printk_ratelimited(KERN_WARNING "fuse: invalid passthrough fd %u\n",
+			   outarg->passthrough_fd);
+	outarg->open_flags &= ~FOPEN_PASSTHROUGH;
+}
+
+/*
+ * The backing file must allow whatever the fuse file allows, otherwise
+ * the open falls back to going through the daemon.
+ */
+void fuse_passthrough_open(struct file *file)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *backing = ff->passthrough;
+
+	if (!backing)
+		return;
+
+	if (((file->f_mode & FMODE_READ) && !(backing->f_mode & FMODE_READ)) ||
+	    ((file->f_mode & FMODE_WRITE) &&
+	     !(backing->f_mode & FMODE_WRITE)) ||
+	    ((file->f_flags & O_APPEND) && !(backing->f_flags & O_APPEND))) {
+		fuse_passthrough_release(ff);
+		ff->open_flags &= ~FOPEN_PASSTHROUGH;
+	}
+}
+
+void fuse_passthrough_release(struct fuse_file *ff)
+{
+	if (ff->passthrough) {
+		fput(ff->passthrough);
+		ff->passthrough = NULL;
+	}
+}
+
+static ssize_t fuse_passthrough_rw(struct kiocb *iocb,
+				   const struct iovec *iov,
+				   unsigned long nr_segs, loff_t pos, int rw)
+{
+	struct fuse_file *ff = iocb->ki_filp->private_data;
+	struct file *backing = ff->passthrough;
+	size_t count = iov_length(iov, nr_segs);
+	struct kiocb kiocb;
+	ssize_t ret;
+
+	/*
+	 * The vfs only checked the fuse file; the backing file has its
+	 * own mandatory locks, LSM labels and watchers.
+	 */
+	ret = rw_verify_area(rw, backing, &pos, count);
+	if (ret < 0)
+		return ret;
+
+	init_sync_kiocb(&kiocb, backing);
+	kiocb.ki_pos = pos;
+	kiocb.ki_left = count;
+	kiocb.ki_nbytes = count;
+
+	if (rw == READ)
+		ret = backing->f_op->aio_read(&kiocb, iov, nr_segs, pos);
+	else
+		ret = backing->f_op->aio_write(&kiocb, iov, nr_segs, pos);
+	if (ret == -EIOCBQUEUED)
+		ret = wait_on_sync_kiocb(&kiocb);
+	if (ret > 0) {
+		if (rw == READ)
+			fsnotify_access(backing);
+		else
+			fsnotify_modify(backing);
+	}
+
+	iocb->ki_pos = kiocb.ki_pos;
+	return ret;
+}
+
+ssize_t fuse_passthrough_aio_read(struct kiocb *iocb, const struct iovec *iov,
+				  unsigned long nr_segs, loff_t pos)
+{
+	return fuse_passthrough_rw(iocb, iov, nr_segs, pos, READ);
+}
+
+ssize_t fuse_passthrough_aio_write(struct kiocb *iocb, const struct iovec *iov,
+				   unsigned long nr_segs, loff_t pos)
+{
+	struct inode *inode = iocb->ki_filp->f_mapping->host;
+	ssize_t ret;
+
+	ret = fuse_passthrough_rw(iocb, iov, nr_segs, pos, WRITE);
+	if (ret > 0) {
+		fuse_write_update_size(inode, iocb->ki_pos);
+		/* other opens of the file may have cached the old data */
+		if (inode->i_mapping->nrpages)
+			invalidate_inode_pages2_range(inode->i_mapping,
+					pos >> PAGE_CACHE_SHIFT,
+					(iocb->ki_pos - 1) >> PAGE_CACHE_SHIFT);
+	}
+	fuse_invalidate_attr(inode);
+
+	return ret;
+}
+
+ssize_t fuse_passthrough_splice_read(struct file *in, loff_t *ppos,
+				     struct pipe_inode_info *pipe, size_t len,
+				     unsigned int flags)
+{
+	struct fuse_file *ff = in->private_data;
+	struct file *backing = ff->passthrough;
+	int ret;
+
+	ret = rw_verify_area(READ, backing, ppos, len);
+	if (ret < 0)
+		return ret;
+
+	if (!backing->f_op->splice_read)
+		return default_file_splice_read(backing, ppos, pipe, len,
+						flags);
+
+	return backing->f_op->splice_read(backing, ppos, pipe, len, flags);
+}
+
+/*
+ * Map the backing file itself, so that faults, writeback and the
+ * lifetime of the mapping are entirely up to the lower filesystem.
+ */
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *backing = ff->passthrough;
+	int err;
+
+	if (!backing->f_op->mmap)
+		return -ENODEV;
+
+	get_file(backing);
+	vma->vm_file = backing;
+	err = backing->f_op->mmap(backing, vma);
+	if (err) {
+		/* mmap_region() drops the reference it holds on @file */
+		vma->vm_file = file;
+		fput(backing);
+		return err;
+	}
+
+	fput(file);
+	return 0;
+}
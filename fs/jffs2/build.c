@@ -16,6 +16,7 @@
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/ktime.h>
 #include <linux/mtd/mtd.h>
 #include "nodelist.h"
 
@@ -87,6 +88,23 @@ static void jffs2_build_inode_pass1(struct jffs2_sb_info *c,
 	}
 }
 
+static void jffs2_report_mount_time(struct jffs2_sb_info *c, struct jffs2_scan_stats *st,
+				    ktime_t start, ktime_t scanned)
+{
+	ktime_t now = ktime_get();
+
+	pr_info("mtd%d: %u eraseblocks scanned in %lld ms, built in %lld ms\n",
+		c->mtd->index, c->nr_blocks,
+		ktime_to_ms(ktime_sub(scanned, start)),
+		ktime_to_ms(ktime_sub(now, scanned)));
+	if (st->readers)
+		pr_info("mtd%d: %u read-ahead threads: %u full and %u partial blocks, read %llu ms, summary crc %llu ms, scan waited %llu ms\n",
+			c->mtd->index, st->readers, st->full_reads, st->part_reads,
+			div_u64(st->read_ns, NSEC_PER_MSEC),
+			div_u64(st->verify_ns, NSEC_PER_MSEC),
+			div_u64(st->stall_ns, NSEC_PER_MSEC));
+}
+
 /* Scan plan:
  - Scan physical nodes. Build map of inodes/dirents. Allocate inocaches as we go
  - Scan directory tree from top down, setting nlink in inocaches
@@ -99,17 +117,22 @@ static int jffs2_build_filesystem(struct jffs2_sb_info *c)
 	struct jffs2_inode_cache *ic;
 	struct jffs2_full_dirent *fd;
 	struct jffs2_full_dirent *dead_fds = NULL;
+	struct jffs2_scan_stats st;
+	ktime_t start, scanned;
 
 	dbg_fsbuild("build FS data structures\n");
 
 	/* First, scan the medium and build all the inode caches with
 	   lists of physical nodes */
 
+	memset(&st, 0, sizeof(st));
+	start = ktime_get();
 	c->flags |= JFFS2_SB_FLAG_SCANNING;
-	ret = jffs2_scan_medium(c);
+	ret = jffs2_scan_medium(c, &st);
 	c->flags &= ~JFFS2_SB_FLAG_SCANNING;
 	if (ret)
 		goto exit;
+	scanned = ktime_get();
 
 	dbg_fsbuild("scanned flash completely\n");
 	jffs2_dbg_dump_block_lists_nolock(c);
@@ -175,6 +198,7 @@ static int jffs2_build_filesystem(struct jffs2_sb_info *c)
 	/* Rotate the lists by some number to ensure wear levelling */
 	jffs2_rotate_lists(c);
 
+	jffs2_report_mount_time(c, &st, start, scanned);
 	ret = 0;
 
 exit:
@@ -454,7 +454,20 @@ int jffs2_read_inode_range(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 char *jffs2_getlink(struct jffs2_sb_info *c, struct jffs2_inode_info *f);
 
 /* scan.c */
-int jffs2_scan_medium(struct jffs2_sb_info *c);
+
+/* Where the time went while scanning the medium at mount. The read and
+   summary times are summed over all the read-ahead threads, so with more
+   than one of them they can add up to more than the scan itself took. */
+struct jffs2_scan_stats {
+	unsigned int readers;	/* read-ahead threads, 0 for a plain scan */
+	uint32_t full_reads;	/* blocks read ahead in full */
+	uint32_t part_reads;	/* blocks where head/summary was enough */
+	u64 read_ns;
+	u64 verify_ns;		/* summary CRCs checked by the readers */
+	u64 stall_ns;		/* scan waiting for a block to be read */
+};
+
+int jffs2_scan_medium(struct jffs2_sb_info *c, struct jffs2_scan_stats *st);
 void jffs2_rotate_lists(struct jffs2_sb_info *c);
 struct jffs2_inode_cache *jffs2_scan_make_ino_cache(struct jffs2_sb_info *c, uint32_t ino);
 int jffs2_scan_classify_jeb(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb);
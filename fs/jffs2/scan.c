@@ -12,12 +12,17 @@
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
 #include <linux/kernel.h>
+#include <linux/module.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/mtd/mtd.h>
 #include <linux/pagemap.h>
 #include <linux/crc32.h>
 #include <linux/compiler.h>
+#include <linux/cpumask.h>
+#include <linux/ktime.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 #include "nodelist.h"
 #include "summary.h"
 #include "debug.h"
@@ -36,8 +41,60 @@ do {									\
 
 static uint32_t pseudo_random;
 
+/* Number of threads reading eraseblocks ahead of the scan at mount time.
+   0 picks one per online CPU (at least two, so that the reads overlap
+   with processing the nodes even on UP), 1 scans without read-ahead. */
+#define JFFS2_SCAN_MAX_READERS 8
+
+static unsigned int scan_threads;
+module_param(scan_threads, uint, 0644);
+MODULE_PARM_DESC(scan_threads, "Threads reading eraseblocks ahead of the mount scan (0 = auto, 1 = none)");
+
+/* An eraseblock read ahead into memory. Only the parts the scan is
+   expected to look at are read: the start of the block, and the tail
+   where the summary lives. A full block has head_len == sector_size. */
+struct jffs2_scan_slot {
+	uint32_t block;
+	uint32_t offset;	/* flash offset of the block */
+	uint32_t head_len;	/* valid from the start of the block */
+	uint32_t tail_ofs;	/* valid from here to the end of the block */
+	uint32_t sum_len;	/* summary of this size passed its CRCs */
+	int ready;
+	unsigned char *buf;
+};
+
+struct jffs2_scan_readahead;
+
+struct jffs2_scan_reader {
+	struct work_struct work;
+	struct jffs2_scan_readahead *ra;
+};
+
+/* Readers claim blocks in order and fill the slot for block i at
+   slots[i % nr_slots], which is free again once the scan is done with
+   block i - nr_slots. The scan itself still handles the blocks strictly
+   in order, so everything it builds up looks exactly as it would without
+   read-ahead; only the flash reads and the summary CRCs move to the
+   readers. */
+struct jffs2_scan_readahead {
+	struct jffs2_sb_info *c;
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	uint32_t next_block;	/* next block for a reader to claim */
+	uint32_t consumed;	/* blocks the scan has finished with */
+	int abort;
+	int nr_slots;
+	struct jffs2_scan_slot *slots;
+	int nr_readers;
+	struct jffs2_scan_reader readers[JFFS2_SCAN_MAX_READERS];
+	struct jffs2_scan_stats *st;
+};
+
+static int jffs2_fill_scan_buf(struct jffs2_sb_info *c, struct jffs2_scan_slot *slot,
+			       void *buf, uint32_t ofs, uint32_t len);
 static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
-				  unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s);
+				  unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s,
+				  struct jffs2_scan_slot *slot);
 
 /* These helper functions _must_ increase ofs and also do the dirty/used space accounting.
  * Returning an error will abort the mount - bad checksums etc. should just mark the space
@@ -88,13 +145,261 @@ static int file_dirty(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb)
 	return 0;
 }
 
-int jffs2_scan_medium(struct jffs2_sb_info *c)
+static int jffs2_scan_ra_claim(struct jffs2_scan_readahead *ra, uint32_t *block)
+{
+	int ret = 0;
+
+	spin_lock(&ra->lock);
+	if (ra->abort || ra->next_block >= ra->c->nr_blocks) {
+		ret = -1;
+	} else if (ra->next_block < ra->consumed + ra->nr_slots) {
+		*block = ra->next_block++;
+		ret = 1;
+	}
+	spin_unlock(&ra->lock);
+	return ret;
+}
+
+static int jffs2_scan_ra_all_ff(unsigned char *buf, uint32_t ofs, uint32_t end)
+{
+	for (; ofs < end; ofs += 4)
+		if (*(uint32_t *)&buf[ofs] != 0xFFFFFFFF)
+			return 0;
+	return 1;
+}
+
+/* Read what jffs2_scan_eraseblock() is going to want from this block.
+   Any read error just leaves that part out; the scan then reads it
+   again itself and deals with the error the usual way. */
+static void jffs2_scan_ra_fill(struct jffs2_scan_readahead *ra,
+			       struct jffs2_scan_slot *slot, u64 *read_ns, u64 *verify_ns)
+{
+	struct jffs2_sb_info *c = ra->c;
+	unsigned char *buf = slot->buf;
+	uint32_t len, head;
+	ktime_t start = ktime_get();
+	int full = 0;
+
+	slot->head_len = 0;
+	slot->tail_ofs = c->sector_size;
+	slot->sum_len = 0;
+
+	if (jffs2_cleanmarker_oob(c) && mtd_block_isbad(c->mtd, slot->offset))
+		goto out;
+
+	if (jffs2_sum_active()) {
+		struct jffs2_sum_marker *sm;
+		uint32_t sum_ofs;
+		ktime_t vstart;
+
+		/* The same tail the scan looks at for the marker */
+		len = c->wbuf_pagesize ? c->wbuf_pagesize : sizeof(*sm);
+		if (jffs2_fill_scan_buf(c, NULL, buf + c->sector_size - len,
+					slot->offset + c->sector_size - len, len))
+			goto out;
+		slot->tail_ofs = c->sector_size - len;
+
+		sm = (void *)buf + c->sector_size - sizeof(*sm);
+		sum_ofs = je32_to_cpu(sm->offset);
+		if (je32_to_cpu(sm->magic) == JFFS2_SUM_MAGIC && sum_ofs < c->sector_size) {
+			if (sum_ofs < slot->tail_ofs) {
+				if (jffs2_fill_scan_buf(c, NULL, buf + sum_ofs, slot->offset + sum_ofs,
+							slot->tail_ofs - sum_ofs))
+					goto out;
+				slot->tail_ofs = sum_ofs;
+			}
+
+			vstart = ktime_get();
+			if (!jffs2_sum_verify_sumnode((void *)buf + sum_ofs,
+						      c->sector_size - sum_ofs))
+				slot->sum_len = c->sector_size - sum_ofs;
+			*verify_ns += ktime_to_ns(ktime_sub(ktime_get(), vstart));
+
+			/* A good summary is all the scan will look at */
+			if (slot->sum_len)
+				goto out;
+		}
+	}
+
+	head = min_t(uint32_t, EMPTY_SCAN_SIZE(c->sector_size), slot->tail_ofs);
+	if (jffs2_fill_scan_buf(c, NULL, buf, slot->offset, head))
+		goto out;
+	slot->head_len = head;
+
+	/* Erased, or nothing but a cleanmarker: the scan stops at the head */
+	if (jffs2_scan_ra_all_ff(buf, 0, head))
+		goto out;
+	if (c->cleanmarker_size && PAD(c->cleanmarker_size) < head &&
+	    je16_to_cpu(((struct jffs2_unknown_node *)buf)->nodetype) == JFFS2_NODETYPE_CLEANMARKER &&
+	    jffs2_scan_ra_all_ff(buf, PAD(c->cleanmarker_size), head))
+		goto out;
+
+	if (head < slot->tail_ofs &&
+	    jffs2_fill_scan_buf(c, NULL, buf + head, slot->offset + head,
+				slot->tail_ofs - head))
+		goto out;
+	slot->head_len = c->sector_size;
+	full = 1;
+ out:
+	*read_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	spin_lock(&ra->lock);
+	if (full)
+		ra->st->full_reads++;
+	else if (slot->head_len || slot->sum_len)
+		ra->st->part_reads++;
+	spin_unlock(&ra->lock);
+}
+
+static void jffs2_scan_ra_worker(struct work_struct *work)
+{
+	struct jffs2_scan_reader *r = container_of(work, struct jffs2_scan_reader, work);
+	struct jffs2_scan_readahead *ra = r->ra;
+	struct jffs2_scan_slot *slot;
+	u64 read_ns = 0, verify_ns = 0;
+	uint32_t block;
+	int ret;
+
+	for (;;) {
+		wait_event(ra->wait, (ret = jffs2_scan_ra_claim(ra, &block)));
+		if (ret < 0)
+			break;
+
+		slot = &ra->slots[block % ra->nr_slots];
+		slot->block = block;
+		slot->offset = ra->c->blocks[block].offset;
+		jffs2_scan_ra_fill(ra, slot, &read_ns, &verify_ns);
+
+		spin_lock(&ra->lock);
+		slot->ready = 1;
+		spin_unlock(&ra->lock);
+		wake_up(&ra->wait);
+	}
+
+	spin_lock(&ra->lock);
+	ra->st->read_ns += read_ns;
+	ra->st->verify_ns += verify_ns;
+	spin_unlock(&ra->lock);
+}
+
+static struct jffs2_scan_readahead *jffs2_scan_ra_start(struct jffs2_sb_info *c,
+							struct jffs2_scan_stats *st)
+{
+	struct jffs2_scan_readahead *ra;
+	unsigned int readers = scan_threads;
+	int i;
+
+	if (!readers)
+		readers = clamp_t(unsigned int, num_online_cpus(), 2, 4);
+	readers = min_t(unsigned int, readers, JFFS2_SCAN_MAX_READERS);
+	if (readers < 2 || c->nr_blocks < 2)
+		return NULL;
+
+	ra = kzalloc(sizeof(*ra), GFP_KERNEL);
+	if (!ra)
+		return NULL;
+	ra->slots = kcalloc(2 * readers, sizeof(*ra->slots), GFP_KERNEL);
+	if (!ra->slots)
+		goto out_ra;
+
+	/* Two blocks in flight per reader, fewer if memory is tight */
+	for (i = 0; i < 2 * readers; i++) {
+		ra->slots[i].buf = kmalloc(c->sector_size, GFP_KERNEL | __GFP_NOWARN | __GFP_NORETRY);
+		if (!ra->slots[i].buf)
+			break;
+	}
+	if (i < 2) {
+		jffs2_dbg(1, "No memory for scan read-ahead, scanning without it\n");
+		goto out_slots;
+	}
+	ra->nr_slots = i;
+	ra->nr_readers = min_t(int, readers, ra->nr_slots);
+
+	ra->c = c;
+	ra->st = st;
+	spin_lock_init(&ra->lock);
+	init_waitqueue_head(&ra->wait);
+
+	st->readers = ra->nr_readers;
+	for (i = 0; i < ra->nr_readers; i++) {
+		ra->readers[i].ra = ra;
+		INIT_WORK(&ra->readers[i].work, jffs2_scan_ra_worker);
+		queue_work(system_unbound_wq, &ra->readers[i].work);
+	}
+	return ra;
+
+ out_slots:
+	while (i--)
+		kfree(ra->slots[i].buf);
+	kfree(ra->slots);
+ out_ra:
+	kfree(ra);
+	return NULL;
+}
+
+static int jffs2_scan_ra_ready(struct jffs2_scan_readahead *ra,
+			       struct jffs2_scan_slot *slot)
+{
+	int ready;
+
+	spin_lock(&ra->lock);
+	ready = slot->ready;
+	spin_unlock(&ra->lock);
+	return ready;
+}
+
+static struct jffs2_scan_slot *jffs2_scan_ra_get(struct jffs2_scan_readahead *ra,
+						 uint32_t block)
+{
+	struct jffs2_scan_slot *slot = &ra->slots[block % ra->nr_slots];
+	ktime_t start;
+
+	if (!jffs2_scan_ra_ready(ra, slot)) {
+		start = ktime_get();
+		wait_event(ra->wait, jffs2_scan_ra_ready(ra, slot));
+		ra->st->stall_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	}
+	BUG_ON(slot->block != block);
+	return slot;
+}
+
+static void jffs2_scan_ra_put(struct jffs2_scan_readahead *ra,
+			      struct jffs2_scan_slot *slot)
+{
+	spin_lock(&ra->lock);
+	slot->ready = 0;
+	ra->consumed++;
+	spin_unlock(&ra->lock);
+	wake_up(&ra->wait);
+}
+
+static void jffs2_scan_ra_stop(struct jffs2_scan_readahead *ra)
+{
+	int i;
+
+	if (!ra)
+		return;
+
+	spin_lock(&ra->lock);
+	ra->abort = 1;
+	spin_unlock(&ra->lock);
+	wake_up_all(&ra->wait);
+
+	for (i = 0; i < ra->nr_readers; i++)
+		flush_work(&ra->readers[i].work);
+	for (i = 0; i < ra->nr_slots; i++)
+		kfree(ra->slots[i].buf);
+	kfree(ra->slots);
+	kfree(ra);
+}
+
+int jffs2_scan_medium(struct jffs2_sb_info *c, struct jffs2_scan_stats *st)
 {
 	int i, ret;
 	uint32_t empty_blocks = 0, bad_blocks = 0;
 	unsigned char *flashbuf = NULL;
 	uint32_t buf_size = 0;
 	struct jffs2_summary *s = NULL; /* summary info collected by the scan process */
+	struct jffs2_scan_readahead *ra = NULL;
 #ifndef __ECOS
 	size_t pointlen, try_size;
 
@@ -140,16 +445,27 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 		}
 	}
 
+	/* Nothing to gain from reading ahead if we can point at the flash */
+	if (buf_size)
+		ra = jffs2_scan_ra_start(c, st);
+
 	for (i=0; i<c->nr_blocks; i++) {
 		struct jffs2_eraseblock *jeb = &c->blocks[i];
+		struct jffs2_scan_slot *slot = NULL;
 
 		cond_resched();
 
 		/* reset summary info for next eraseblock scan */
 		jffs2_sum_reset_collected(s);
 
+		if (ra)
+			slot = jffs2_scan_ra_get(ra, i);
+
 		ret = jffs2_scan_eraseblock(c, jeb, buf_size?flashbuf:(flashbuf+jeb->offset),
-						buf_size, s);
+						buf_size, s, slot);
+
+		if (slot)
+			jffs2_scan_ra_put(ra, slot);
 
 		if (ret < 0)
 			goto out;
@@ -274,6 +590,7 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 	}
 	ret = 0;
  out:
+	jffs2_scan_ra_stop(ra);
 	if (buf_size)
 		kfree(flashbuf);
 #ifndef __ECOS
@@ -284,12 +601,23 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 	return ret;
 }
 
-static int jffs2_fill_scan_buf(struct jffs2_sb_info *c, void *buf,
-			       uint32_t ofs, uint32_t len)
+static int jffs2_fill_scan_buf(struct jffs2_sb_info *c, struct jffs2_scan_slot *slot,
+			       void *buf, uint32_t ofs, uint32_t len)
 {
 	int ret;
 	size_t retlen;
 
+	/* Already read ahead? */
+	if (slot && ofs >= slot->offset) {
+		uint32_t bofs = ofs - slot->offset;
+
+		if (bofs + len <= slot->head_len ||
+		    (bofs >= slot->tail_ofs && bofs + len <= c->sector_size)) {
+			memcpy(buf, slot->buf + bofs, len);
+			return 0;
+		}
+	}
+
 	ret = jffs2_flash_read(c, ofs, len, &retlen, buf);
 	if (ret) {
 		jffs2_dbg(1, "mtd->read(0x%x bytes from 0x%x) returned %d\n",
@@ -440,7 +768,8 @@ static int jffs2_scan_xref_node(struct jffs2_sb_info *c, struct jffs2_eraseblock
 /* Called with 'buf_size == 0' if buf is in fact a pointer _directly_ into
    the flash, XIP-style */
 static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
-				  unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s) {
+				  unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s,
+				  struct jffs2_scan_slot *slot) {
 	struct jffs2_unknown_node *node;
 	struct jffs2_unknown_node crcnode;
 	uint32_t ofs, prevofs, max_ofs;
@@ -499,7 +828,7 @@ static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblo
 				buf_len = sizeof(*sm);
 
 			/* Read as much as we want into the _end_ of the preallocated buffer */
-			err = jffs2_fill_scan_buf(c, buf + buf_size - buf_len, 
+			err = jffs2_fill_scan_buf(c, slot, buf + buf_size - buf_len, 
 						  jeb->offset + c->sector_size - buf_len,
 						  buf_len);				
 			if (err)
@@ -520,7 +849,7 @@ static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblo
 				}
 				if (buf_len < sumlen) {
 					/* Need to read more so that the entire summary node is present */
-					err = jffs2_fill_scan_buf(c, sumptr, 
+					err = jffs2_fill_scan_buf(c, slot, sumptr, 
 								  jeb->offset + c->sector_size - sumlen,
 								  sumlen - buf_len);				
 					if (err)
@@ -531,7 +860,8 @@ static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblo
 		}
 
 		if (sumptr) {
-			err = jffs2_sum_scan_sumnode(c, jeb, sumptr, sumlen, &pseudo_random);
+			err = jffs2_sum_scan_sumnode(c, jeb, sumptr, sumlen, &pseudo_random,
+						     slot && slot->sum_len == sumlen);
 
 			if (buf_size && sumlen > buf_size)
 				kfree(sumptr);
@@ -551,7 +881,7 @@ static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblo
 		buf_len = c->sector_size;
 	} else {
 		buf_len = EMPTY_SCAN_SIZE(c->sector_size);
-		err = jffs2_fill_scan_buf(c, buf, buf_ofs, buf_len);
+		err = jffs2_fill_scan_buf(c, slot, buf, buf_ofs, buf_len);
 		if (err)
 			return err;
 	}
@@ -642,7 +972,7 @@ scan_more:
 			jffs2_dbg(1, "Fewer than %zd bytes (node header) left to end of buf. Reading 0x%x at 0x%08x\n",
 				  sizeof(struct jffs2_unknown_node),
 				  buf_len, ofs);
-			err = jffs2_fill_scan_buf(c, buf, ofs, buf_len);
+			err = jffs2_fill_scan_buf(c, slot, buf, ofs, buf_len);
 			if (err)
 				return err;
 			buf_ofs = ofs;
@@ -703,7 +1033,7 @@ scan_more:
 			scan_end = buf_len;
 			jffs2_dbg(1, "Reading another 0x%x at 0x%08x\n",
 				  buf_len, ofs);
-			err = jffs2_fill_scan_buf(c, buf, ofs, buf_len);
+			err = jffs2_fill_scan_buf(c, slot, buf, ofs, buf_len);
 			if (err)
 				return err;
 			buf_ofs = ofs;
@@ -792,7 +1122,7 @@ scan_more:
 				jffs2_dbg(1, "Fewer than %zd bytes (inode node) left to end of buf. Reading 0x%x at 0x%08x\n",
 					  sizeof(struct jffs2_raw_inode),
 					  buf_len, ofs);
-				err = jffs2_fill_scan_buf(c, buf, ofs, buf_len);
+				err = jffs2_fill_scan_buf(c, slot, buf, ofs, buf_len);
 				if (err)
 					return err;
 				buf_ofs = ofs;
@@ -809,7 +1139,7 @@ scan_more:
 				jffs2_dbg(1, "Fewer than %d bytes (dirent node) left to end of buf. Reading 0x%x at 0x%08x\n",
 					  je32_to_cpu(node->totlen), buf_len,
 					  ofs);
-				err = jffs2_fill_scan_buf(c, buf, ofs, buf_len);
+				err = jffs2_fill_scan_buf(c, slot, buf, ofs, buf_len);
 				if (err)
 					return err;
 				buf_ofs = ofs;
@@ -827,7 +1157,7 @@ scan_more:
 				jffs2_dbg(1, "Fewer than %d bytes (xattr node) left to end of buf. Reading 0x%x at 0x%08x\n",
 					  je32_to_cpu(node->totlen), buf_len,
 					  ofs);
-				err = jffs2_fill_scan_buf(c, buf, ofs, buf_len);
+				err = jffs2_fill_scan_buf(c, slot, buf, ofs, buf_len);
 				if (err)
 					return err;
 				buf_ofs = ofs;
@@ -844,7 +1174,7 @@ scan_more:
 				jffs2_dbg(1, "Fewer than %d bytes (xref node) left to end of buf. Reading 0x%x at 0x%08x\n",
 					  je32_to_cpu(node->totlen), buf_len,
 					  ofs);
-				err = jffs2_fill_scan_buf(c, buf, ofs, buf_len);
+				err = jffs2_fill_scan_buf(c, slot, buf, ofs, buf_len);
 				if (err)
 					return err;
 				buf_ofs = ofs;
@@ -568,21 +568,20 @@ static int jffs2_sum_process_sum_data(struct jffs2_sb_info *c, struct jffs2_eras
 	return 0;
 }
 
-/* Process the summary node - called from jffs2_scan_eraseblock() */
-int jffs2_sum_scan_sumnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
-			   struct jffs2_raw_summary *summary, uint32_t sumsize,
-			   uint32_t *pseudo_random)
+/* Check the CRCs of a summary node found at the end of an eraseblock. This
+   only looks at the node itself, so the mount time read-ahead threads use it
+   to verify summaries before jffs2_sum_scan_sumnode() gets to them. */
+
+int jffs2_sum_verify_sumnode(struct jffs2_raw_summary *summary, uint32_t sumsize)
 {
 	struct jffs2_unknown_node crcnode;
-	int ret, ofs;
 	uint32_t crc;
 
-	ofs = c->sector_size - sumsize;
-
-	dbg_summary("summary found for 0x%08x at 0x%08x (0x%x bytes)\n",
-		    jeb->offset, jeb->offset + ofs, sumsize);
+	if (sumsize < sizeof(struct jffs2_raw_summary)) {
+		dbg_summary("Summary node is too short (0x%x bytes)\n", sumsize);
+		return -EBADMSG;
+	}
 
-	/* OK, now check for node validity and CRC */
 	crcnode.magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
 	crcnode.nodetype = cpu_to_je16(JFFS2_NODETYPE_SUMMARY);
 	crcnode.totlen = summary->totlen;
@@ -591,28 +590,48 @@ int jffs2_sum_scan_sumnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb
 	if (je32_to_cpu(summary->hdr_crc) != crc) {
 		dbg_summary("Summary node header is corrupt (bad CRC or "
 				"no summary at all)\n");
-		goto crc_err;
+		return -EBADMSG;
 	}
 
 	if (je32_to_cpu(summary->totlen) != sumsize) {
 		dbg_summary("Summary node is corrupt (wrong erasesize?)\n");
-		goto crc_err;
+		return -EBADMSG;
 	}
 
 	crc = crc32(0, summary, sizeof(struct jffs2_raw_summary)-8);
 
 	if (je32_to_cpu(summary->node_crc) != crc) {
 		dbg_summary("Summary node is corrupt (bad CRC)\n");
-		goto crc_err;
+		return -EBADMSG;
 	}
 
 	crc = crc32(0, summary->sum, sumsize - sizeof(struct jffs2_raw_summary));
 
 	if (je32_to_cpu(summary->sum_crc) != crc) {
 		dbg_summary("Summary node data is corrupt (bad CRC)\n");
-		goto crc_err;
+		return -EBADMSG;
 	}
 
+	return 0;
+}
+
+/* Process the summary node - called from jffs2_scan_eraseblock() */
+int jffs2_sum_scan_sumnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+			   struct jffs2_raw_summary *summary, uint32_t sumsize,
+			   uint32_t *pseudo_random, int verified)
+{
+	int ret, ofs;
+
+	ofs = c->sector_size - sumsize;
+
+	dbg_summary("summary found for 0x%08x at 0x%08x (0x%x bytes)\n",
+		    jeb->offset, jeb->offset + ofs, sumsize);
+
+	/* OK, now check for node validity and CRC, unless that was
+	   already done while the block was being read ahead */
+	if (!verified && jffs2_sum_verify_sumnode(summary, sumsize))
+		goto crc_err;
+
 	if ( je32_to_cpu(summary->cln_mkr) ) {
 
 		dbg_summary("Summary : CLEANMARKER node \n");
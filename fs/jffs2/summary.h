@@ -186,9 +186,10 @@ int jffs2_sum_add_inode_mem(struct jffs2_summary *s, struct jffs2_raw_inode *ri,
 int jffs2_sum_add_dirent_mem(struct jffs2_summary *s, struct jffs2_raw_dirent *rd, uint32_t ofs);
 int jffs2_sum_add_xattr_mem(struct jffs2_summary *s, struct jffs2_raw_xattr *rx, uint32_t ofs);
 int jffs2_sum_add_xref_mem(struct jffs2_summary *s, struct jffs2_raw_xref *rr, uint32_t ofs);
+int jffs2_sum_verify_sumnode(struct jffs2_raw_summary *summary, uint32_t sumlen);
 int jffs2_sum_scan_sumnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
 			   struct jffs2_raw_summary *summary, uint32_t sumlen,
-			   uint32_t *pseudo_random);
+			   uint32_t *pseudo_random, int verified);
 
 #else				/* SUMMARY DISABLED */
 
@@ -206,7 +207,8 @@ int jffs2_sum_scan_sumnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb
 #define jffs2_sum_add_dirent_mem(a,b,c)
 #define jffs2_sum_add_xattr_mem(a,b,c)
 #define jffs2_sum_add_xref_mem(a,b,c)
-#define jffs2_sum_scan_sumnode(a,b,c,d,e) (0)
+#define jffs2_sum_verify_sumnode(a,b) (-EBADMSG)
+#define jffs2_sum_scan_sumnode(a,b,c,d,e,f) (0)
 
 #endif /* CONFIG_JFFS2_SUMMARY */
 
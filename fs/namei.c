@@ -1159,6 +1159,57 @@ static struct dentry *__lookup_hash(struct qstr *name,
 	return lookup_real(base->d_inode, dentry, nd);
 }
 
+/*
+ * Look up a name in a directory whose filesystem can do so without the
+ * directory's i_mutex, so that lookups in the same directory, including
+ * their disk reads, run in parallel.  i_mutex is only taken to hash the
+ * result, once it is known that no entry of the directory changed in the
+ * meantime; otherwise, and on any error, the lookup is redone the
+ * regular way.
+ */
+static struct dentry *lookup_shared(struct qstr *name, struct dentry *parent,
+				    struct nameidata *nd)
+{
+	struct inode *dir = parent->d_inode;
+	struct dentry *dentry, *old;
+	struct inode *inode;
+	unsigned seq;
+
+	if (unlikely(IS_DEADDIR(dir)))
+		return ERR_PTR(-ENOENT);
+
+	dentry = d_alloc(parent, name);
+	if (unlikely(!dentry))
+		return ERR_PTR(-ENOMEM);
+
+	seq = dir_entries_seq(dir);
+	inode = dir->i_op->lookup_shared(dir, dentry, nd);
+
+	mutex_lock(&dir->i_mutex);
+	if (IS_ERR(inode) || seq != dir->i_dir_seq || IS_DEADDIR(dir)) {
+		old = NULL;
+	} else {
+		old = d_lookup(parent, name);
+		if (!old) {
+			old = d_splice_alias(inode, dentry);
+			mutex_unlock(&dir->i_mutex);
+			if (old) {
+				dput(dentry);
+				dentry = old;
+			}
+			return dentry;
+		}
+	}
+	dput(dentry);
+	if (!IS_ERR_OR_NULL(inode))
+		iput(inode);
+	if (old)
+		dput(old);
+	dentry = __lookup_hash(name, parent, nd);
+	mutex_unlock(&dir->i_mutex);
+	return dentry;
+}
+
 /*
  *  It's more convoluted than I'd like it to be, but... it's still fairly
  *  small and for now I'd prefer to have fast path as straight as possible.
@@ -1250,9 +1301,13 @@ done:
 need_lookup:
 	BUG_ON(nd->inode != parent->d_inode);
 
-	mutex_lock(&parent->d_inode->i_mutex);
-	dentry = __lookup_hash(name, parent, nd);
-	mutex_unlock(&parent->d_inode->i_mutex);
+	if (parent->d_inode->i_op->lookup_shared) {
+		dentry = lookup_shared(name, parent, nd);
+	} else {
+		mutex_lock(&parent->d_inode->i_mutex);
+		dentry = __lookup_hash(name, parent, nd);
+		mutex_unlock(&parent->d_inode->i_mutex);
+	}
 	if (IS_ERR(dentry))
 		return PTR_ERR(dentry);
 	goto done;
@@ -2128,6 +2183,7 @@ int vfs_create(struct inode *dir, struct dentry *dentry, umode_t mode,
 	if (error)
 		return error;
 	error = dir->i_op->create(dir, dentry, mode, nd);
+	dir_entries_changed(dir);
 	if (error)
 		return error;
 
@@ -2693,6 +2749,7 @@ int vfs_mknod(struct inode *dir, struct dentry *dentry, umode_t mode, dev_t dev)
 		return error;
 
 	error = dir->i_op->mknod(dir, dentry, mode, dev);
+	dir_entries_changed(dir);
 	if (error)
 		return error;
 
@@ -2808,6 +2865,7 @@ int vfs_mkdir(struct inode *dir, struct dentry *dentry, umode_t mode)
 		return -EMLINK;
 
 	error = dir->i_op->mkdir(dir, dentry, mode);
+	dir_entries_changed(dir);
 	if (!error)
 		fsnotify_mkdir(dir, dentry);
 	return error;
@@ -2902,6 +2960,7 @@ int vfs_rmdir(struct inode *dir, struct dentry *dentry)
 
 	shrink_dcache_parent(dentry);
 	error = dir->i_op->rmdir(dir, dentry);
+	dir_entries_changed(dir);
 	if (error)
 		goto out;
 
@@ -3004,6 +3063,7 @@ int vfs_unlink(struct inode *dir, struct dentry *dentry)
 		error = security_inode_unlink(dir, dentry);
 		if (!error) {
 			error = dir->i_op->unlink(dir, dentry);
+			dir_entries_changed(dir);
 			if (!error)
 				dont_mount(dentry);
 		}
@@ -3125,6 +3185,7 @@ int vfs_symlink(struct inode *dir, struct dentry *dentry, const char *oldname)
 		return error;
 
 	error = dir->i_op->symlink(dir, dentry, oldname);
+	dir_entries_changed(dir);
 	if (!error)
 		fsnotify_create(dir, dentry);
 	return error;
@@ -3216,6 +3277,7 @@ int vfs_link(struct dentry *old_dentry, struct inode *dir, struct dentry *new_de
 		error = -EMLINK;
 	else
 		error = dir->i_op->link(old_dentry, dir, new_dentry);
+	dir_entries_changed(dir);
 	mutex_unlock(&inode->i_mutex);
 	if (!error)
 		fsnotify_link(dir, inode, new_dentry);
@@ -3373,6 +3435,8 @@ static int vfs_rename_dir(struct inode *old_dir, struct dentry *old_dentry,
 	if (target)
 		shrink_dcache_parent(new_dentry);
 	error = old_dir->i_op->rename(old_dir, old_dentry, new_dir, new_dentry);
+	dir_entries_changed(old_dir);
+	dir_entries_changed(new_dir);
 	if (error)
 		goto out;
 
@@ -3409,6 +3473,8 @@ static int vfs_rename_other(struct inode *old_dir, struct dentry *old_dentry,
 		goto out;
 
 	error = old_dir->i_op->rename(old_dir, old_dentry, new_dir, new_dentry);
+	dir_entries_changed(old_dir);
+	dir_entries_changed(new_dir);
 	if (error)
 		goto out;
 
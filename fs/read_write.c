@@ -324,6 +324,7 @@ int rw_verify_area(int read_write, struct file *file, loff_t *ppos, size_t count
 		return retval;
 	return count > MAX_RW_COUNT ? MAX_RW_COUNT : count;
 }
+EXPORT_SYMBOL_GPL(rw_verify_area);
 
 static void wait_on_retry_sync_kiocb(struct kiocb *iocb)
 {
@@ -46,6 +46,12 @@ static const struct squashfs_decompressor squashfs_lzo_comp_ops = {
 };
 #endif
 
+#ifndef CONFIG_SQUASHFS_LZ4
+static const struct squashfs_decompressor squashfs_lz4_comp_ops = {
+	NULL, NULL, NULL, LZ4_COMPRESSION, "lz4", 0
+};
+#endif
+
 #ifndef CONFIG_SQUASHFS_XZ
 static const struct squashfs_decompressor squashfs_xz_comp_ops = {
 	NULL, NULL, NULL, XZ_COMPRESSION, "xz", 0
@@ -66,6 +72,7 @@ static const struct squashfs_decompressor *decompressor[] = {
 	&squashfs_zlib_comp_ops,
 	&squashfs_lzo_comp_ops,
 	&squashfs_xz_comp_ops,
+	&squashfs_lz4_comp_ops,
 	&squashfs_lzma_unsupported_comp_ops,
 	&squashfs_unknown_comp_ops
 };
@@ -83,11 +90,12 @@ const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
 }
 
 
-void *squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
+int squashfs_decompressor_create(struct super_block *sb, unsigned short flags)
 {
 	struct squashfs_sb_info *msblk = sb->s_fs_info;
-	void *strm, *buffer = NULL;
-	int length = 0;
+	struct squashfs_page_actor *actor;
+	void *buffer = NULL;
+	int err, length = 0;
 
 	/*
 	 * Read decompressor specific options from file system if present
@@ -95,22 +103,32 @@ void *squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
 	if (SQUASHFS_COMP_OPTS(flags)) {
 		buffer = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
 		if (buffer == NULL)
-			return ERR_PTR(-ENOMEM);
+			return -ENOMEM;
+
+		actor = squashfs_page_actor_init(&buffer, 1, 0);
+		if (actor == NULL) {
+			err = -ENOMEM;
+			goto finished;
+		}
 
-		length = squashfs_read_data(sb, &buffer,
-			sizeof(struct squashfs_super_block), 0, NULL,
-			PAGE_CACHE_SIZE, 1);
+		length = squashfs_read_data(sb,
+			sizeof(struct squashfs_super_block), 0, NULL, actor);
+		kfree(actor);
 
 		if (length < 0) {
-			strm = ERR_PTR(length);
+			err = length;
 			goto finished;
 		}
 	}
 
-	strm = msblk->decompressor->init(msblk, buffer, length);
+	/*
+	 * The backend keeps its own copy of the options if it needs to
+	 * create further streams after mount
+	 */
+	err = msblk->backend->create(msblk, buffer, length);
 
 finished:
 	kfree(buffer);
 
-	return strm;
+	return err;
 }
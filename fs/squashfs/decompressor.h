@@ -23,35 +23,64 @@
  * decompressor.h
  */
 
+#include "page_actor.h"
+
 struct squashfs_decompressor {
 	void	*(*init)(struct squashfs_sb_info *, void *, int);
 	void	(*free)(void *);
-	int	(*decompress)(struct squashfs_sb_info *, void **,
-		struct buffer_head **, int, int, int, int, int);
+	int	(*decompress)(struct squashfs_sb_info *, void *,
+		struct buffer_head **, int, int, int,
+		struct squashfs_page_actor *);
 	int	id;
 	char	*name;
 	int	supported;
 };
 
-static inline void squashfs_decompressor_free(struct squashfs_sb_info *msblk,
-	void *s)
+/*
+ * A decompressor backend decides how the streams created by the
+ * decompressor's init function are shared between concurrent readers.
+ * It is chosen at mount time with the threads= option.
+ */
+struct squashfs_decomp_backend {
+	int	(*create)(struct squashfs_sb_info *, void *, int);
+	void	(*destroy)(struct squashfs_sb_info *);
+	int	(*decompress)(struct squashfs_sb_info *, struct buffer_head **,
+		int, int, int, struct squashfs_page_actor *);
+	int	(*max_decompressors)(struct squashfs_sb_info *);
+	char	*name;
+};
+
+extern const struct squashfs_decomp_backend squashfs_decomp_single;
+extern const struct squashfs_decomp_backend squashfs_decomp_multi;
+extern const struct squashfs_decomp_backend squashfs_decomp_percpu;
+
+static inline void squashfs_decompressor_destroy(struct squashfs_sb_info *msblk)
 {
-	if (msblk->decompressor)
-		msblk->decompressor->free(s);
+	if (msblk->backend && msblk->stream)
+		msblk->backend->destroy(msblk);
 }
 
 static inline int squashfs_decompress(struct squashfs_sb_info *msblk,
-	void **buffer, struct buffer_head **bh, int b, int offset, int length,
-	int srclength, int pages)
+	struct buffer_head **bh, int b, int offset, int length,
+	struct squashfs_page_actor *output)
+{
+	return msblk->backend->decompress(msblk, bh, b, offset, length,
+		output);
+}
+
+static inline int squashfs_max_decompressors(struct squashfs_sb_info *msblk)
 {
-	return msblk->decompressor->decompress(msblk, buffer, bh, b, offset,
-		length, srclength, pages);
+	return msblk->backend->max_decompressors(msblk);
 }
 
 #ifdef CONFIG_SQUASHFS_XZ
 extern const struct squashfs_decompressor squashfs_xz_comp_ops;
 #endif
 
+#ifdef CONFIG_SQUASHFS_LZ4
+extern const struct squashfs_decompressor squashfs_lz4_comp_ops;
+#endif
+
 #ifdef CONFIG_SQUASHFS_LZO
 extern const struct squashfs_decompressor squashfs_lzo_comp_ops;
 #endif
@@ -0,0 +1,219 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * decompressor_multi.c
+ */
+
+#include <linux/types.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/buffer_head.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/cpumask.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "decompressor.h"
+#include "squashfs.h"
+
+/*
+ * This file implements the multi decompressor backend: a pool of streams
+ * shared by all readers of the filesystem.  The pool starts with one
+ * stream and grows on demand, when a reader finds every stream busy, up
+ * to the limit given by threads=N (twice the number of online cpus for
+ * threads=multi).  Once the limit is reached readers wait for a stream
+ * to be returned.  Streams are only freed at unmount.
+ */
+
+#define SQUASHFS_MULTI_DEFAULT	(num_online_cpus() * 2)
+
+struct squashfs_stream {
+	void			*comp_opts;
+	int			length;
+	struct list_head	strm_list;
+	struct mutex		mutex;
+	int			avail_decomp;
+	int			max_decomp;
+	wait_queue_head_t	wait;
+};
+
+struct decomp_stream {
+	void			*stream;
+	struct list_head	list;
+};
+
+
+static int squashfs_multi_max_decompressors(struct squashfs_sb_info *msblk)
+{
+	return msblk->threads ? msblk->threads : SQUASHFS_MULTI_DEFAULT;
+}
+
+
+static int squashfs_multi_create(struct squashfs_sb_info *msblk,
+	void *comp_opts, int length)
+{
+	struct squashfs_stream *stream;
+	struct decomp_stream *decomp_strm = NULL;
+	int err = -ENOMEM;
+
+	stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+	if (stream == NULL)
+		goto out;
+
+	/* keep the compressor options for streams created after mount */
+	if (length) {
+		stream->comp_opts = kmemdup(comp_opts, length, GFP_KERNEL);
+		if (stream->comp_opts == NULL)
+			goto out;
+		stream->length = length;
+	}
+
+	INIT_LIST_HEAD(&stream->strm_list);
+	mutex_init(&stream->mutex);
+	init_waitqueue_head(&stream->wait);
+	stream->max_decomp = squashfs_multi_max_decompressors(msblk);
+
+	/*
+	 * Create one stream at mount, so that there is always at least one
+	 * stream for a waiting reader to wait on
+	 */
+	decomp_strm = kmalloc(sizeof(*decomp_strm), GFP_KERNEL);
+	if (decomp_strm == NULL)
+		goto out;
+
+	decomp_strm->stream = msblk->decompressor->init(msblk,
+		stream->comp_opts, stream->length);
+	if (IS_ERR(decomp_strm->stream)) {
+		err = PTR_ERR(decomp_strm->stream);
+		goto out;
+	}
+
+	list_add(&decomp_strm->list, &stream->strm_list);
+	stream->avail_decomp = 1;
+	msblk->stream = stream;
+	return 0;
+
+out:
+	kfree(decomp_strm);
+	if (stream)
+		kfree(stream->comp_opts);
+	kfree(stream);
+	return err;
+}
+
+
+static void squashfs_multi_destroy(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream *stream = msblk->stream;
+	struct decomp_stream *decomp_strm, *next;
+
+	list_for_each_entry_safe(decomp_strm, next, &stream->strm_list, list) {
+		list_del(&decomp_strm->list);
+		msblk->decompressor->free(decomp_strm->stream);
+		kfree(decomp_strm);
+		stream->avail_decomp--;
+	}
+
+	WARN_ON(stream->avail_decomp);
+	kfree(stream->comp_opts);
+	kfree(stream);
+	msblk->stream = NULL;
+}
+
+
+static struct decomp_stream *get_decomp_stream(struct squashfs_sb_info *msblk,
+	struct squashfs_stream *stream)
+{
+	struct decomp_stream *decomp_strm;
+
+	while (1) {
+		mutex_lock(&stream->mutex);
+
+		/* there is an idle stream, take it */
+		if (!list_empty(&stream->strm_list)) {
+			decomp_strm = list_first_entry(&stream->strm_list,
+				struct decomp_stream, list);
+			list_del(&decomp_strm->list);
+			mutex_unlock(&stream->mutex);
+			break;
+		}
+
+		/*
+		 * All streams are busy; add another one unless the pool is
+		 * at its limit.  If allocating it fails just wait for one of
+		 * the existing streams.
+		 */
+		if (stream->avail_decomp >= stream->max_decomp)
+			goto wait;
+
+		decomp_strm = kmalloc(sizeof(*decomp_strm), GFP_KERNEL);
+		if (decomp_strm == NULL)
+			goto wait;
+
+		decomp_strm->stream = msblk->decompressor->init(msblk,
+			stream->comp_opts, stream->length);
+		if (IS_ERR(decomp_strm->stream)) {
+			kfree(decomp_strm);
+			goto wait;
+		}
+
+		stream->avail_decomp++;
+		mutex_unlock(&stream->mutex);
+		break;
+
+wait:
+		mutex_unlock(&stream->mutex);
+		wait_event(stream->wait, !list_empty(&stream->strm_list));
+	}
+
+	return decomp_strm;
+}
+
+
+static void put_decomp_stream(struct decomp_stream *decomp_strm,
+	struct squashfs_stream *stream)
+{
+	mutex_lock(&stream->mutex);
+	list_add(&decomp_strm->list, &stream->strm_list);
+	mutex_unlock(&stream->mutex);
+	wake_up(&stream->wait);
+}
+
+
+static int squashfs_multi_decompress(struct squashfs_sb_info *msblk,
+	struct buffer_head **bh, int b, int offset, int length,
+	struct squashfs_page_actor *output)
+{
+	struct squashfs_stream *stream = msblk->stream;
+	struct decomp_stream *decomp_strm = get_decomp_stream(msblk, stream);
+	int res;
+
+	res = msblk->decompressor->decompress(msblk, decomp_strm->stream,
+		bh, b, offset, length, output);
+	put_decomp_stream(decomp_strm, stream);
+
+	return res;
+}
+
+const struct squashfs_decomp_backend squashfs_decomp_multi = {
+	.create = squashfs_multi_create,
+	.destroy = squashfs_multi_destroy,
+	.decompress = squashfs_multi_decompress,
+	.max_decompressors = squashfs_multi_max_decompressors,
+	.name = "multi"
+};
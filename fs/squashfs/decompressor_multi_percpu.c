@@ -0,0 +1,123 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * decompressor_multi_percpu.c
+ */
+
+#include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/buffer_head.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "decompressor.h"
+#include "squashfs.h"
+
+/*
+ * This file implements the percpu decompressor backend: one stream for
+ * every possible cpu, used with preemption disabled.  Readers never wait
+ * for each other, at the cost of the most memory (the xz dictionary is
+ * allocated per cpu) and of scheduling latency while a block is being
+ * decompressed.
+ */
+
+struct squashfs_stream {
+	void		*stream;
+};
+
+static int squashfs_percpu_create(struct squashfs_sb_info *msblk,
+	void *comp_opts, int length)
+{
+	struct squashfs_stream __percpu *percpu;
+	struct squashfs_stream *stream;
+	int err, cpu;
+
+	percpu = alloc_percpu(struct squashfs_stream);
+	if (percpu == NULL)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		stream = per_cpu_ptr(percpu, cpu);
+		stream->stream = msblk->decompressor->init(msblk, comp_opts,
+			length);
+		if (IS_ERR(stream->stream)) {
+			err = PTR_ERR(stream->stream);
+			stream->stream = NULL;
+			goto out;
+		}
+	}
+
+	msblk->stream = (void __force *) percpu;
+	return 0;
+
+out:
+	for_each_possible_cpu(cpu) {
+		stream = per_cpu_ptr(percpu, cpu);
+		if (stream->stream)
+			msblk->decompressor->free(stream->stream);
+	}
+	free_percpu(percpu);
+	return err;
+}
+
+
+static void squashfs_percpu_destroy(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream __percpu *percpu =
+			(struct squashfs_stream __percpu *) msblk->stream;
+	struct squashfs_stream *stream;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		stream = per_cpu_ptr(percpu, cpu);
+		msblk->decompressor->free(stream->stream);
+	}
+	free_percpu(percpu);
+	msblk->stream = NULL;
+}
+
+
+static int squashfs_percpu_decompress(struct squashfs_sb_info *msblk,
+	struct buffer_head **bh, int b, int offset, int length,
+	struct squashfs_page_actor *output)
+{
+	struct squashfs_stream __percpu *percpu =
+			(struct squashfs_stream __percpu *) msblk->stream;
+	struct squashfs_stream *stream = get_cpu_ptr(percpu);
+	int res;
+
+	res = msblk->decompressor->decompress(msblk, stream->stream,
+		bh, b, offset, length, output);
+	put_cpu_ptr(stream);
+
+	return res;
+}
+
+
+static int squashfs_percpu_max_decompressors(struct squashfs_sb_info *msblk)
+{
+	return num_possible_cpus();
+}
+
+const struct squashfs_decomp_backend squashfs_decomp_percpu = {
+	.create = squashfs_percpu_create,
+	.destroy = squashfs_percpu_destroy,
+	.decompress = squashfs_percpu_decompress,
+	.max_decompressors = squashfs_percpu_max_decompressors,
+	.name = "percpu"
+};
@@ -27,9 +27,11 @@
 
 #define WARNING(s, args...)	pr_warning("SQUASHFS: "s, ## args)
 
+struct squashfs_page_actor;
+
 /* block.c */
-extern int squashfs_read_data(struct super_block *, void **, u64, int, u64 *,
-				int, int);
+extern int squashfs_read_data(struct super_block *, u64, int, u64 *,
+				struct squashfs_page_actor *);
 
 /* cache.c */
 extern struct squashfs_cache *squashfs_cache_init(char *, int, int);
@@ -48,7 +50,7 @@ extern void *squashfs_read_table(struct super_block *, u64, int);
 
 /* decompressor.c */
 extern const struct squashfs_decompressor *squashfs_lookup_decompressor(int);
-extern void *squashfs_decompressor_init(struct super_block *, unsigned short);
+extern int squashfs_decompressor_create(struct super_block *, unsigned short);
 
 /* export.c */
 extern __le64 *squashfs_read_inode_lookup_table(struct super_block *, u64, u64,
@@ -84,6 +86,11 @@ extern const struct export_operations squashfs_export_ops;
 
 /* file.c */
 extern const struct address_space_operations squashfs_aops;
+extern void squashfs_copy_cache(struct page *, struct squashfs_cache_entry *,
+				int, int);
+
+/* file_xxx.c */
+extern int squashfs_readpage_block(struct page *, u64, int);
 
 /* inode.c */
 extern const struct inode_operations squashfs_inode_ops;
@@ -36,6 +36,8 @@
 #include <linux/module.h>
 #include <linux/magic.h>
 #include <linux/xattr.h>
+#include <linux/parser.h>
+#include <linux/seq_file.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -47,6 +49,76 @@
 static struct file_system_type squashfs_fs_type;
 static const struct super_operations squashfs_super_ops;
 
+#if defined(CONFIG_SQUASHFS_DECOMP_MULTI)
+#define SQUASHFS_DECOMP_DEFAULT		(&squashfs_decomp_multi)
+#elif defined(CONFIG_SQUASHFS_DECOMP_MULTI_PERCPU)
+#define SQUASHFS_DECOMP_DEFAULT		(&squashfs_decomp_percpu)
+#else
+#define SQUASHFS_DECOMP_DEFAULT		(&squashfs_decomp_single)
+#endif
+
+enum {
+	Opt_threads, Opt_err
+};
+
+static const match_table_t tokens = {
+	{Opt_threads, "threads=%s"},
+	{Opt_err, NULL}
+};
+
+/*
+ * Parse the mount options.  threads= selects how decompressor streams are
+ * shared: "single" (one stream), "percpu" (one stream per cpu), "multi"
+ * (a pool of up to twice the number of online cpus) or a number, which
+ * is a pool of that many streams.  Options not given are left unchanged.
+ */
+static int squashfs_parse_options(char *options,
+	const struct squashfs_decomp_backend **backend, int *threads)
+{
+	substring_t args[MAX_OPT_ARGS];
+	char *p;
+	int n;
+
+	if (!options)
+		return 0;
+
+	while ((p = strsep(&options, ",")) != NULL) {
+		if (!*p)
+			continue;
+
+		switch (match_token(p, tokens, args)) {
+		case Opt_threads:
+			if (!strcmp(args[0].from, "single")) {
+				*backend = &squashfs_decomp_single;
+				*threads = 0;
+			} else if (!strcmp(args[0].from, "percpu")) {
+				*backend = &squashfs_decomp_percpu;
+				*threads = 0;
+			} else if (!strcmp(args[0].from, "multi")) {
+				*backend = &squashfs_decomp_multi;
+				*threads = 0;
+			} else if (!match_int(&args[0], &n) && n > 0 &&
+					n <= num_possible_cpus() * 2) {
+				*backend = n == 1 ? &squashfs_decomp_single :
+						&squashfs_decomp_multi;
+				*threads = n == 1 ? 0 : n;
+			} else {
+				ERROR("Invalid threads option \"%s\"\n",
+					args[0].from);
+				return -EINVAL;
+			}
+			break;
+		default:
+			ERROR("Unrecognized mount option \"%s\" or missing "
+				"value\n", p);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+
 static const struct squashfs_decompressor *supported_squashfs_filesystem(short
 	major, short minor, short id)
 {
@@ -98,9 +170,13 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 	msblk->devblksize = sb_min_blocksize(sb, SQUASHFS_DEVBLK_SIZE);
 	msblk->devblksize_log2 = ffz(~msblk->devblksize);
 
-	mutex_init(&msblk->read_data_mutex);
 	mutex_init(&msblk->meta_index_mutex);
 
+	msblk->backend = SQUASHFS_DECOMP_DEFAULT;
+	err = squashfs_parse_options(data, &msblk->backend, &msblk->threads);
+	if (err)
+		goto failed_mount;
+
 	/*
 	 * msblk->bytes_used is checked in squashfs_read_table to ensure reads
 	 * are not beyond filesystem end.  But as we're using
@@ -205,19 +281,21 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 	if (msblk->block_cache == NULL)
 		goto failed_mount;
 
-	/* Allocate read_page block */
-	msblk->read_page = squashfs_cache_init("data", 1, msblk->block_size);
+	/*
+	 * Allocate read_page blocks, one per decompressor so that readers
+	 * decompressing different blocks in parallel don't wait for a
+	 * free cache entry
+	 */
+	msblk->read_page = squashfs_cache_init("data",
+		squashfs_max_decompressors(msblk), msblk->block_size);
 	if (msblk->read_page == NULL) {
 		ERROR("Failed to allocate read_page block\n");
 		goto failed_mount;
 	}
 
-	msblk->stream = squashfs_decompressor_init(sb, flags);
-	if (IS_ERR(msblk->stream)) {
-		err = PTR_ERR(msblk->stream);
-		msblk->stream = NULL;
+	err = squashfs_decompressor_create(sb, flags);
+	if (err)
 		goto failed_mount;
-	}
 
 	/* Handle xattrs */
 	sb->s_xattr = squashfs_xattr_handlers;
@@ -336,7 +414,7 @@ failed_mount:
 	squashfs_cache_delete(msblk->block_cache);
 	squashfs_cache_delete(msblk->fragment_cache);
 	squashfs_cache_delete(msblk->read_page);
-	squashfs_decompressor_free(msblk, msblk->stream);
+	squashfs_decompressor_destroy(msblk);
 	kfree(msblk->inode_lookup_table);
 	kfree(msblk->fragment_index);
 	kfree(msblk->id_table);
@@ -371,7 +449,34 @@ static int squashfs_statfs(struct dentry *dentry, struct kstatfs *buf)
 
 static int squashfs_remount(struct super_block *sb, int *flags, char *data)
 {
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	const struct squashfs_decomp_backend *backend = msblk->backend;
+	int threads = msblk->threads, err;
+
 	*flags |= MS_RDONLY;
+
+	/* the decompressor backend can't be changed on a mounted filesystem */
+	err = squashfs_parse_options(data, &backend, &threads);
+	if (err)
+		return err;
+	if (backend != msblk->backend || threads != msblk->threads) {
+		ERROR("threads option cannot be changed on remount\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+
+static int squashfs_show_options(struct seq_file *seq, struct dentry *root)
+{
+	struct squashfs_sb_info *msblk = root->d_sb->s_fs_info;
+
+	if (msblk->threads)
+		seq_printf(seq, ",threads=%d", msblk->threads);
+	else
+		seq_printf(seq, ",threads=%s", msblk->backend->name);
+
 	return 0;
 }
 
@@ -383,7 +488,7 @@ static void squashfs_put_super(struct super_block *sb)
 		squashfs_cache_delete(sbi->block_cache);
 		squashfs_cache_delete(sbi->fragment_cache);
 		squashfs_cache_delete(sbi->read_page);
-		squashfs_decompressor_free(sbi, sbi->stream);
+		squashfs_decompressor_destroy(sbi);
 		kfree(sbi->id_table);
 		kfree(sbi->fragment_index);
 		kfree(sbi->meta_index);
@@ -490,7 +595,8 @@ static const struct super_operations squashfs_super_ops = {
 	.destroy_inode = squashfs_destroy_inode,
 	.statfs = squashfs_statfs,
 	.put_super = squashfs_put_super,
-	.remount_fs = squashfs_remount
+	.remount_fs = squashfs_remount,
+	.show_options = squashfs_show_options
 };
 
 module_init(init_squashfs_fs);
@@ -71,6 +71,22 @@ static struct ubifs_compressor zlib_compr = {
 };
 #endif
 
+#ifdef CONFIG_UBIFS_FS_LZ4
+static DEFINE_MUTEX(lz4_mutex);
+
+static struct ubifs_compressor lz4_compr = {
+	.compr_type = UBIFS_COMPR_LZ4,
+	.comp_mutex = &lz4_mutex,
+	.name = "lz4",
+	.capi_name = "lz4",
+};
+#else
+static struct ubifs_compressor lz4_compr = {
+	.compr_type = UBIFS_COMPR_LZ4,
+	.name = "lz4",
+};
+#endif
+
 /* All UBIFS compressors */
 struct ubifs_compressor *ubifs_compressors[UBIFS_COMPR_TYPES_CNT];
 
@@ -133,6 +149,67 @@ no_compr:
 	*compr_type = UBIFS_COMPR_NONE;
 }
 
+/**
+ * ubifs_compress_inode - compress a data block of an inode.
+ * @ui: the inode the data belongs to
+ * @in_buf: data to compress
+ * @in_len: length of the data to compress
+ * @out_buf: output buffer where compressed data should be stored
+ * @out_len: output buffer length is returned here
+ * @compr_type: type of compression to use on enter, actually used compression
+ *              type on exit
+ *
+ * This is 'ubifs_compress()' for data nodes, which additionally keeps track
+ * of how compressible the inode's data is. Media files and other already
+ * compressed data do not shrink, and compressing them only burns CPU time.
+ * So once %UBIFS_COMPR_GIVE_UP blocks in a row have failed to compress,
+ * further blocks are written uncompressed without trying. Every so often one
+ * is tried again, and the gap between tries doubles each time that fails, up
+ * to %UBIFS_COMPR_MAX_SKIP blocks. One block that does compress resets it.
+ *
+ * The counters are only a hint and may be updated concurrently by writeback
+ * of different pages of the inode without harm.
+ */
+void ubifs_compress_inode(struct ubifs_inode *ui, const void *in_buf,
+			  int in_len, void *out_buf, int *out_len,
+			  int *compr_type)
+{
+	unsigned int fails, skip;
+
+	if (*compr_type == UBIFS_COMPR_NONE || in_len < UBIFS_MIN_COMPR_LEN) {
+		ubifs_compress(in_buf, in_len, out_buf, out_len, compr_type);
+		return;
+	}
+
+	skip = ACCESS_ONCE(ui->compr_skip);
+	if (skip) {
+		ui->compr_skip = skip - 1;
+		*compr_type = UBIFS_COMPR_NONE;
+		ubifs_compress(in_buf, in_len, out_buf, out_len, compr_type);
+		return;
+	}
+
+	ubifs_compress(in_buf, in_len, out_buf, out_len, compr_type);
+
+	if (*compr_type != UBIFS_COMPR_NONE) {
+		ui->compr_fails = 0;
+		return;
+	}
+
+	fails = ACCESS_ONCE(ui->compr_fails) + 1;
+	if (fails < UBIFS_COMPR_GIVE_UP) {
+		ui->compr_fails = fails;
+		return;
+	}
+
+	skip = UBIFS_COMPR_GIVE_UP << (fails - UBIFS_COMPR_GIVE_UP);
+	if (skip >= UBIFS_COMPR_MAX_SKIP)
+		skip = UBIFS_COMPR_MAX_SKIP;
+	else
+		ui->compr_fails = fails;
+	ui->compr_skip = skip;
+}
+
 /**
  * ubifs_decompress - decompress data.
  * @in_buf: data to decompress
@@ -233,9 +310,15 @@ int __init ubifs_compressors_init(void)
 	if (err)
 		goto out_lzo;
 
+	err = compr_init(&lz4_compr);
+	if (err)
+		goto out_zlib;
+
 	ubifs_compressors[UBIFS_COMPR_NONE] = &none_compr;
 	return 0;
 
+out_zlib:
+	compr_exit(&zlib_compr);
 out_lzo:
 	compr_exit(&lzo_compr);
 	return err;
@@ -248,4 +331,5 @@ void ubifs_compressors_exit(void)
 {
 	compr_exit(&lzo_compr);
 	compr_exit(&zlib_compr);
+	compr_exit(&lz4_compr);
 }
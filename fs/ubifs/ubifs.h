@@ -148,6 +148,14 @@
  */
 #define WORST_COMPR_FACTOR 2
 
+/*
+ * After this many data blocks of an inode in a row fail to compress, stop
+ * trying for a while, and never skip more than UBIFS_COMPR_MAX_SKIP blocks
+ * between attempts (see 'ubifs_compress_inode()').
+ */
+#define UBIFS_COMPR_GIVE_UP 4
+#define UBIFS_COMPR_MAX_SKIP 256
+
 /*
  * How much memory is needed for a buffer where we comress a data node.
  */
@@ -357,6 +365,9 @@ struct ubifs_gced_idx_leb {
  * @ui_size: inode size used by UBIFS when writing to flash
  * @flags: inode flags (@UBIFS_COMPR_FL, etc)
  * @compr_type: default compression type used for this inode
+ * @compr_fails: number of data blocks in a row which did not compress
+ * @compr_skip: number of further data blocks to write without trying to
+ *              compress them (see 'ubifs_compress_inode()')
  * @last_page_read: page number of last page read (for bulk read)
  * @read_in_a_row: number of consecutive pages read in a row (for bulk read)
  * @data_len: length of the data attached to the inode
@@ -407,6 +418,8 @@ struct ubifs_inode {
 	loff_t synced_i_size;
 	loff_t ui_size;
 	int flags;
+	unsigned int compr_fails;
+	unsigned int compr_skip;
 	pgoff_t last_page_read;
 	pgoff_t read_in_a_row;
 	int data_len;
@@ -1773,6 +1786,9 @@ int __init ubifs_compressors_init(void);
 void ubifs_compressors_exit(void);
 void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 		    int *compr_type);
+void ubifs_compress_inode(struct ubifs_inode *ui, const void *in_buf,
+			  int in_len, void *out_buf, int *out_len,
+			  int *compr_type);
 int ubifs_decompress(const void *buf, int len, void *out, int *out_len,
 		     int compr_type);
 
@@ -39,6 +39,9 @@
 #define YAFFS_GC_GOOD_ENOUGH 2
 #define YAFFS_GC_PASSIVE_THRESHOLD 4
 
+/* Block ages beyond this many sequence numbers all count as "old" */
+#define YAFFS_GC_MAX_AGE 0x10000
+
 #include "yaffs_ecc.h"
 
 /* Forward declarations */
@@ -1394,20 +1397,84 @@ static int yaffs_change_obj_name(struct yaffs_obj *obj,
  *   In Linux, the page cache provides read buffering and the short op cache 
  *   provides write buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   Lookups go through a small hash table keyed on (object, chunk_id) and
+ *   each object keeps its cached chunks on a list sorted by chunk_id, so
+ *   neither lookups nor per-file flushes have to scan the whole cache.
+ *   Replacement is LRU. When a dirty chunk has to be pushed out, the run of
+ *   dirty chunks adjacent to it in the same file goes out with it, in file
+ *   order, so small sequential writes still land in consecutive NAND pages.
  */
 
-static int yaffs_obj_cache_dirty(struct yaffs_obj *obj)
+static inline struct list_head *yaffs_cache_bucket(struct yaffs_dev *dev,
+						   const struct yaffs_obj *obj,
+						   int chunk_id)
+{
+	return &dev->cache_hash[(obj->obj_id * 31 + chunk_id) &
+				dev->cache_hash_mask];
+}
+
+/* Hook a free cache entry up to (obj, chunk_id) and make it most recent. */
+static void yaffs_cache_attach(struct yaffs_cache *cache,
+			       struct yaffs_obj *obj, int chunk_id)
 {
 	struct yaffs_dev *dev = obj->my_dev;
-	int i;
+	struct list_head *pos;
+
+	cache->object = obj;
+	cache->chunk_id = chunk_id;
+	cache->dirty = 0;
+	cache->locked = 0;
+	cache->n_bytes = 0;
+
+	list_add(&cache->hash_link, yaffs_cache_bucket(dev, obj, chunk_id));
+
+	/* Files are mostly written front to back, so search from the tail. */
+	list_for_each_prev(pos, &obj->cache_list) {
+		if (list_entry(pos, struct yaffs_cache, obj_link)->chunk_id <
+		    chunk_id)
+			break;
+	}
+	list_add(&cache->obj_link, pos);
+
+	list_move_tail(&cache->lru, &dev->cache_lru);
+}
+
+/* Release a cache entry. Free entries go to the head of the LRU. */
+static void yaffs_cache_detach(struct yaffs_dev *dev,
+			       struct yaffs_cache *cache)
+{
+	cache->object = NULL;
+	cache->dirty = 0;
+	list_del_init(&cache->hash_link);
+	list_del_init(&cache->obj_link);
+	list_move(&cache->lru, &dev->cache_lru);
+}
+
+/* Write out a dirty cache entry and free it up. */
+static int yaffs_cache_write_out(struct yaffs_dev *dev,
+				 struct yaffs_cache *cache)
+{
+	int chunk_written;
+
+	chunk_written = yaffs_wr_data_obj(cache->object, cache->chunk_id,
+					  cache->data, cache->n_bytes, 1);
+	if (chunk_written <= 0) {
+		/* Hoosterman, disk full while writing cache out. */
+		yaffs_trace(YAFFS_TRACE_ERROR,
+			"yaffs tragedy: no space during cache write");
+		return 0;
+	}
+
+	yaffs_cache_detach(dev, cache);
+	return 1;
+}
+
+static int yaffs_obj_cache_dirty(struct yaffs_obj *obj)
+{
 	struct yaffs_cache *cache;
-	int n_caches = obj->my_dev->param.n_caches;
 
-	for (i = 0; i < n_caches; i++) {
-		cache = &dev->cache[i];
-		if (cache->object == obj && cache->dirty)
+	list_for_each_entry(cache, &obj->cache_list, obj_link) {
+		if (cache->dirty)
 			return 1;
 	}
 
@@ -1417,50 +1484,24 @@ static int yaffs_obj_cache_dirty(struct yaffs_obj *obj)
 static void yaffs_flush_file_cache(struct yaffs_obj *obj)
 {
 	struct yaffs_dev *dev = obj->my_dev;
-	int lowest = -99;	/* Stop compiler whining. */
-	int i;
 	struct yaffs_cache *cache;
-	int chunk_written = 0;
-	int n_caches = obj->my_dev->param.n_caches;
-
-	if (n_caches > 0) {
-		do {
-			cache = NULL;
-
-			/* Find the dirty cache for this object with the lowest chunk id. */
-			for (i = 0; i < n_caches; i++) {
-				if (dev->cache[i].object == obj &&
-				    dev->cache[i].dirty) {
-					if (!cache
-					    || dev->cache[i].chunk_id <
-					    lowest) {
-						cache = &dev->cache[i];
-						lowest = cache->chunk_id;
-					}
-				}
-			}
+	int found;
 
-			if (cache && !cache->locked) {
-				/* Write it out and free it up */
+	if (dev->param.n_caches < 1)
+		return;
 
-				chunk_written =
-				    yaffs_wr_data_obj(cache->object,
-						      cache->chunk_id,
-						      cache->data,
-						      cache->n_bytes, 1);
-				cache->dirty = 0;
-				cache->object = NULL;
+	/* Write the dirty chunks out lowest chunk id first. Writing can
+	 * kick off garbage collection, so rescan the list after each one.
+	 */
+	do {
+		found = 0;
+		list_for_each_entry(cache, &obj->cache_list, obj_link) {
+			if (cache->dirty && !cache->locked) {
+				found = 1;
+				break;
 			}
-
-		} while (cache && chunk_written > 0);
-
-		if (cache)
-			/* Hoosterman, disk full while writing cache out. */
-			yaffs_trace(YAFFS_TRACE_ERROR,
-				"yaffs tragedy: no space during cache write");
-
-	}
-
+		}
+	} while (found && yaffs_cache_write_out(dev, cache));
 }
 
 /*yaffs_flush_whole_cache(dev)
@@ -1471,95 +1512,123 @@ static void yaffs_flush_file_cache(struct yaffs_obj *obj)
 void yaffs_flush_whole_cache(struct yaffs_dev *dev)
 {
 	struct yaffs_obj *obj;
-	int n_caches = dev->param.n_caches;
-	int i;
+	struct yaffs_cache *cache;
+
+	if (dev->param.n_caches < 1)
+		return;
 
 	/* Find a dirty object in the cache and flush it...
 	 * until there are no further dirty objects.
 	 */
 	do {
 		obj = NULL;
-		for (i = 0; i < n_caches && !obj; i++) {
-			if (dev->cache[i].object && dev->cache[i].dirty)
-				obj = dev->cache[i].object;
-
+		list_for_each_entry(cache, &dev->cache_lru, lru) {
+			if (cache->object && cache->dirty && !cache->locked) {
+				obj = cache->object;
+				break;
+			}
 		}
 		if (obj)
 			yaffs_flush_file_cache(obj);
 
-	} while (obj);
+	} while (obj && yaffs_obj_cache_dirty(obj) == 0);
 
 }
 
-/* Grab us a cache chunk for use.
- * First look for an empty one.
- * Then look for the least recently used non-dirty one.
- * Then look for the least recently used dirty one...., flush and look again.
+/* Push out a dirty cache entry along with the run of dirty chunks either
+ * side of it in the same file, capped at a block's worth, so that they are
+ * written to consecutive pages in file order.
  */
-static struct yaffs_cache *yaffs_grab_chunk_worker(struct yaffs_dev *dev)
-{
-	int i;
-
-	if (dev->param.n_caches > 0) {
-		for (i = 0; i < dev->param.n_caches; i++) {
-			if (!dev->cache[i].object)
-				return &dev->cache[i];
-		}
+static void yaffs_push_out_cache_run(struct yaffs_dev *dev,
+				     struct yaffs_cache *victim)
+{
+	struct yaffs_obj *obj = victim->object;
+	struct yaffs_cache *cache = victim;
+	struct yaffs_cache *next;
+	int n = 1;
+
+	while (n < dev->param.chunks_per_block &&
+	       cache->obj_link.prev != &obj->cache_list) {
+		struct yaffs_cache *prev =
+		    list_entry(cache->obj_link.prev, struct yaffs_cache,
+			       obj_link);
+		if (!prev->dirty || prev->locked ||
+		    prev->chunk_id != cache->chunk_id - 1)
+			break;
+		cache = prev;
+		n++;
 	}
 
-	return NULL;
+	n = 0;
+	do {
+		next = NULL;
+		if (cache->obj_link.next != &obj->cache_list)
+			next = list_entry(cache->obj_link.next,
+					  struct yaffs_cache, obj_link);
+		if (next && (!next->dirty || next->locked ||
+			     next->chunk_id != cache->chunk_id + 1))
+			next = NULL;
+
+		if (!yaffs_cache_write_out(dev, cache))
+			break;
+		dev->cache_pushouts++;
+		if (n++)
+			dev->cache_combined++;
+
+		cache = next;
+	} while (cache && n < dev->param.chunks_per_block);
 }
 
+/* Grab us a cache chunk for use.
+ * First look for an empty one.
+ * Then look for the least recently used non-dirty one.
+ * Then push out the least recently used dirty one (and its neighbours) and
+ * look again.
+ * Returns NULL if there is no unlocked entry or the push out failed.
+ */
 static struct yaffs_cache *yaffs_grab_chunk_cache(struct yaffs_dev *dev)
 {
 	struct yaffs_cache *cache;
-	struct yaffs_obj *the_obj;
-	int usage;
-	int i;
-	int pushout;
+	struct yaffs_cache *victim = NULL;
 
-	if (dev->param.n_caches > 0) {
-		/* Try find a non-dirty one... */
-
-		cache = yaffs_grab_chunk_worker(dev);
+	if (dev->param.n_caches < 1)
+		return NULL;
 
-		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
-			 * NB what's here is not very accurate, we actually flush the object
-			 * the last recently used page.
-			 */
+	/* Free entries sit at the head of the LRU, so this is usually O(1). */
+	list_for_each_entry(cache, &dev->cache_lru, lru) {
+		if (!cache->object)
+			return cache;
+		if (cache->locked)
+			continue;
+		if (!cache->dirty) {
+			yaffs_cache_detach(dev, cache);
+			return cache;
+		}
+		if (!victim)
+			victim = cache;
+	}
 
-			/* With locking we can't assume we can use entry zero */
+	if (!victim)
+		return NULL;
 
-			the_obj = NULL;
-			usage = -1;
-			cache = NULL;
-			pushout = -1;
+	yaffs_push_out_cache_run(dev, victim);
 
-			for (i = 0; i < dev->param.n_caches; i++) {
-				if (dev->cache[i].object &&
-				    !dev->cache[i].locked &&
-				    (dev->cache[i].last_use < usage
-				     || !cache)) {
-					usage = dev->cache[i].last_use;
-					the_obj = dev->cache[i].object;
-					cache = &dev->cache[i];
-					pushout = i;
-				}
-			}
+	cache = list_first_entry(&dev->cache_lru, struct yaffs_cache, lru);
+	return cache->object ? NULL : cache;
+}
 
-			if (!cache || cache->dirty) {
-				/* Flush and try again */
-				yaffs_flush_file_cache(the_obj);
-				cache = yaffs_grab_chunk_worker(dev);
-			}
+static struct yaffs_cache *__yaffs_find_chunk_cache(const struct yaffs_obj *obj,
+						    int chunk_id)
+{
+	struct yaffs_dev *dev = obj->my_dev;
+	struct yaffs_cache *cache;
 
-		}
-		return cache;
-	} else {
-		return NULL;
-        }
+	list_for_each_entry(cache, yaffs_cache_bucket(dev, obj, chunk_id),
+			    hash_link) {
+		if (cache->object == obj && cache->chunk_id == chunk_id)
+			return cache;
+	}
+	return NULL;
 }
 
 /* Find a cached chunk */
@@ -1567,18 +1636,17 @@ static struct yaffs_cache *yaffs_find_chunk_cache(const struct yaffs_obj *obj,
 						  int chunk_id)
 {
 	struct yaffs_dev *dev = obj->my_dev;
-	int i;
-	if (dev->param.n_caches > 0) {
-		for (i = 0; i < dev->param.n_caches; i++) {
-			if (dev->cache[i].object == obj &&
-			    dev->cache[i].chunk_id == chunk_id) {
-				dev->cache_hits++;
+	struct yaffs_cache *cache;
 
-				return &dev->cache[i];
-			}
-		}
-	}
-	return NULL;
+	if (dev->param.n_caches < 1)
+		return NULL;
+
+	cache = __yaffs_find_chunk_cache(obj, chunk_id);
+	if (cache)
+		dev->cache_hits++;
+	else
+		dev->cache_misses++;
+	return cache;
 }
 
 /* Mark the chunk for the least recently used algorithym */
@@ -1587,18 +1655,7 @@ static void yaffs_use_cache(struct yaffs_dev *dev, struct yaffs_cache *cache,
 {
 
 	if (dev->param.n_caches > 0) {
-		if (dev->cache_last_use < 0 || dev->cache_last_use > 100000000) {
-			/* Reset the cache usages */
-			int i;
-			for (i = 1; i < dev->param.n_caches; i++)
-				dev->cache[i].last_use = 0;
-
-			dev->cache_last_use = 0;
-		}
-
-		dev->cache_last_use++;
-
-		cache->last_use = dev->cache_last_use;
+		list_move_tail(&cache->lru, &dev->cache_lru);
 
 		if (is_write)
 			cache->dirty = 1;
@@ -1611,12 +1668,14 @@ static void yaffs_use_cache(struct yaffs_dev *dev, struct yaffs_cache *cache,
  */
 static void yaffs_invalidate_chunk_cache(struct yaffs_obj *object, int chunk_id)
 {
-	if (object->my_dev->param.n_caches > 0) {
+	struct yaffs_dev *dev = object->my_dev;
+
+	if (dev->param.n_caches > 0) {
 		struct yaffs_cache *cache =
-		    yaffs_find_chunk_cache(object, chunk_id);
+		    __yaffs_find_chunk_cache(object, chunk_id);
 
 		if (cache)
-			cache->object = NULL;
+			yaffs_cache_detach(dev, cache);
 	}
 }
 
@@ -1625,16 +1684,13 @@ static void yaffs_invalidate_chunk_cache(struct yaffs_obj *object, int chunk_id)
  */
 static void yaffs_invalidate_whole_cache(struct yaffs_obj *in)
 {
-	int i;
 	struct yaffs_dev *dev = in->my_dev;
 
-	if (dev->param.n_caches > 0) {
-		/* Invalidate it. */
-		for (i = 0; i < dev->param.n_caches; i++) {
-			if (dev->cache[i].object == in)
-				dev->cache[i].object = NULL;
-		}
-	}
+	/* Invalidate it. */
+	while (!list_empty(&in->cache_list))
+		yaffs_cache_detach(dev, list_first_entry(&in->cache_list,
+							 struct yaffs_cache,
+							 obj_link));
 }
 
 static void yaffs_unhash_obj(struct yaffs_obj *obj)
@@ -1673,6 +1729,8 @@ static void yaffs_free_obj(struct yaffs_obj *obj)
 		return;
 	}
 
+	/* Don't leave cache entries pointing at a freed object. */
+	yaffs_invalidate_whole_cache(obj);
 	yaffs_unhash_obj(obj);
 
 	yaffs_free_raw_obj(dev, obj);
@@ -1857,6 +1915,7 @@ static struct yaffs_obj *yaffs_alloc_empty_obj(struct yaffs_dev *dev)
 		INIT_LIST_HEAD(&(obj->hard_links));
 		INIT_LIST_HEAD(&(obj->hash_link));
 		INIT_LIST_HEAD(&obj->siblings);
+		INIT_LIST_HEAD(&obj->cache_list);
 
 		/* Now make the directory sane */
 		if (dev->root_dir) {
@@ -2715,6 +2774,78 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 	return ret_val;
 }
 
+/* Is the background collector allowed to use cost-benefit selection? */
+static int yaffs_gc_cost_benefit(struct yaffs_dev *dev)
+{
+	return dev->param.gc_control &&
+	    (dev->param.gc_control(dev) & YAFFS_GC_CONTROL_COST_BENEFIT);
+}
+
+/*
+ * Cost-benefit block selection, as in the LFS cleaner: score each full
+ * block by the space collecting it frees against the chunks that have to
+ * be copied, weighted by how long ago the block was written. Old blocks
+ * hold cold data which, once copied, will likely stay put, so they are
+ * worth collecting at a higher utilisation than freshly written ones whose
+ * remaining chunks are likely to be overwritten soon anyway.
+ * Only used by background gc, which can afford to look at every block.
+ * The chunks in use in the selected block are returned in *used_out; the
+ * caller decides whether they go into dev->gc_pages_in_use.
+ */
+static unsigned yaffs_find_gc_block_cb(struct yaffs_dev *dev, int max_used,
+				       int *used_out)
+{
+	int i;
+	int used;
+	int cpb = dev->param.chunks_per_block;
+	unsigned selected = 0;
+	u32 age;
+	u32 num;
+	u32 den;
+	u32 best_num = 0;
+	u32 best_den = 1;
+	struct yaffs_block_info *bi = dev->block_info;
+
+	for (i = dev->internal_start_block; i <= dev->internal_end_block;
+	     i++, bi++) {
+		if (bi->block_state != YAFFS_BLOCK_STATE_FULL)
+			continue;
+
+		used = bi->pages_in_use - bi->soft_del_pages;
+		if (used >= cpb || used > max_used ||
+		    !yaffs_block_ok_for_gc(dev, bi))
+			continue;
+
+		/* yaffs1 has no sequence numbers, which makes this greedy */
+		age = dev->seq_number - bi->seq_number + 1;
+		if (age > YAFFS_GC_MAX_AGE)
+			age = YAFFS_GC_MAX_AGE;
+
+		/*
+		 * Score is age * (cpb - used) / (cpb + used).  Compare the
+		 * fractions by cross-multiplying rather than dividing, which
+		 * would round young blocks into a few big ties; an exact tie
+		 * goes to the emptier block.
+		 */
+		num = age * (cpb - used);
+		den = cpb + used;
+		if (!selected ||
+		    (u64) num * best_den > (u64) best_num * den ||
+		    ((u64) num * best_den == (u64) best_num * den &&
+		     used < *used_out)) {
+			selected = i;
+			best_num = num;
+			best_den = den;
+			*used_out = used;
+		}
+	}
+
+	if (selected)
+		dev->gc_cb_selected++;
+
+	return selected;
+}
+
 /*
  * FindBlockForgarbageCollection is used to select the dirtiest block (or close enough)
  * for garbage collection.
@@ -2796,6 +2927,20 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 			iterations = n_blocks / 16 + 1;
 			if (iterations > 100)
 				iterations = 100;
+
+			if (background && yaffs_gc_cost_benefit(dev)) {
+				int used;
+
+				/* Look at every block rather than a window */
+				selected = yaffs_find_gc_block_cb(dev,
+								  threshold,
+								  &used);
+				if (selected) {
+					dev->gc_dirtiest = selected;
+					dev->gc_pages_in_use = used;
+				}
+				iterations = 0;
+			}
 		}
 
 		for (i = 0;
@@ -2822,7 +2967,8 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 			}
 		}
 
-		if (dev->gc_dirtiest > 0 && dev->gc_pages_in_use <= threshold)
+		if (!selected && dev->gc_dirtiest > 0 &&
+		    dev->gc_pages_in_use <= threshold)
 			selected = dev->gc_dirtiest;
 	}
 
@@ -2891,8 +3037,10 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 	int min_erased;
 	int erased_chunks;
 	int checkpt_block_adjust;
+	u32 copies_before = dev->n_gc_copies;
 
-	if (dev->param.gc_control && (dev->param.gc_control(dev) & 1) == 0)
+	if (dev->param.gc_control &&
+	    (dev->param.gc_control(dev) & YAFFS_GC_CONTROL_ENABLE) == 0)
 		return YAFFS_OK;
 
 	if (dev->gc_disable) {
@@ -2971,6 +3119,12 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 	} while ((dev->n_erased_blocks < dev->param.n_reserved_blocks) &&
 		 (dev->gc_block > 0) && (max_tries < 2));
 
+	/* Copies made here on behalf of a writer add to its latency */
+	if (background)
+		dev->bg_gc_copies += dev->n_gc_copies - copies_before;
+	else
+		dev->fg_gc_copies += dev->n_gc_copies - copies_before;
+
 	return aggressive ? gc_ok : YAFFS_OK;
 }
 
@@ -2989,6 +3143,66 @@ int yaffs_bg_gc(struct yaffs_dev *dev, unsigned urgency)
 	return erased_chunks > dev->n_free_chunks / 2;
 }
 
+/*
+ * yaffs_bg_gc_idle()
+ * Collects one whole block, chosen by cost-benefit, so that writers find
+ * erased blocks waiting instead of having to collect them inline. Intended
+ * to be called from a background thread while the device is idle.
+ * Stops once target_pct percent of the free chunks are in erased blocks,
+ * and only takes blocks that are at most max_used_pct percent in use.
+ * Returns non-zero if a block was collected.
+ */
+int yaffs_bg_gc_idle(struct yaffs_dev *dev, unsigned target_pct,
+		     unsigned max_used_pct)
+{
+	int erased_chunks = dev->n_erased_blocks * dev->param.chunks_per_block;
+	u32 copies_before = dev->n_gc_copies;
+	unsigned block;
+	int used;
+
+	if (dev->param.gc_control &&
+	    (dev->param.gc_control(dev) & YAFFS_GC_CONTROL_ENABLE) == 0)
+		return 0;
+
+	if (dev->gc_disable || dev->read_only)
+		return 0;
+
+	if ((u64) erased_chunks * 100 >=
+	    (u64) dev->n_free_chunks * target_pct)
+		return 0;
+
+	/* Finish off any block that is part way through being collected */
+	block = dev->gc_block;
+	if (block < 1) {
+		block = yaffs_find_gc_block_cb(dev,
+				dev->param.chunks_per_block * max_used_pct / 100,
+				&used);
+		if (block < 1)
+			return 0;
+		/*
+		 * gc_dirtiest and gc_pages_in_use belong to the foreground
+		 * search and are left alone; if this block is gc_dirtiest,
+		 * yaffs_block_became_dirty() drops both once it is erased.
+		 */
+		dev->gc_block = block;
+		dev->gc_chunk = 0;
+		dev->n_clean_ups = 0;
+		dev->n_gc_blocks++;
+		dev->bg_gcs++;
+	}
+
+	yaffs_trace(YAFFS_TRACE_BACKGROUND | YAFFS_TRACE_GC,
+		"Idle gc block %u, erased chunks %d free %d",
+		block, erased_chunks, dev->n_free_chunks);
+
+	dev->all_gcs++;
+	dev->bg_gc_idle_blocks++;
+	yaffs_gc_block(dev, block, 1);
+	dev->bg_gc_copies += dev->n_gc_copies - copies_before;
+
+	return 1;
+}
+
 /*-------------------- Data file manipulation -----------------*/
 
 static int yaffs_rd_data_obj(struct yaffs_obj *in, int inode_chunk, u8 * buffer)
@@ -3581,15 +3795,16 @@ int yaffs_file_rd(struct yaffs_obj *in, u8 * buffer, loff_t offset, int n_bytes)
 				if (!cache) {
 					cache =
 					    yaffs_grab_chunk_cache(in->my_dev);
-					cache->object = in;
-					cache->chunk_id = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
-					yaffs_rd_data_obj(in, chunk,
-							  cache->data);
-					cache->n_bytes = 0;
+					if (cache) {
+						yaffs_cache_attach(cache, in,
+								   chunk);
+						yaffs_rd_data_obj(in, chunk,
+								  cache->data);
+					}
 				}
+			}
 
+			if (cache) {
 				yaffs_use_cache(dev, cache, 0);
 
 				cache->locked = 1;
@@ -3707,12 +3922,12 @@ int yaffs_do_file_wr(struct yaffs_obj *in, const u8 * buffer, loff_t offset,
 				if (!cache
 				    && yaffs_check_alloc_available(dev, 1)) {
 					cache = yaffs_grab_chunk_cache(dev);
-					cache->object = in;
-					cache->chunk_id = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
-					yaffs_rd_data_obj(in, chunk,
-							  cache->data);
+					if (cache) {
+						yaffs_cache_attach(cache, in,
+								   chunk);
+						yaffs_rd_data_obj(in, chunk,
+								  cache->data);
+					}
 				} else if (cache &&
 					   !cache->dirty &&
 					   !yaffs_check_alloc_available(dev,
@@ -4916,6 +5131,10 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	dev->passive_gc_count = 0;
 	dev->oldest_dirty_gc_count = 0;
 	dev->bg_gcs = 0;
+	dev->fg_gc_copies = 0;
+	dev->bg_gc_copies = 0;
+	dev->bg_gc_idle_blocks = 0;
+	dev->gc_cb_selected = 0;
 	dev->gc_block_finder = 0;
 	dev->buffered_block = -1;
 	dev->doing_buffered_block_rewrite = 0;
@@ -4939,10 +5158,13 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 		init_failed = 1;
 
 	dev->cache = NULL;
+	dev->cache_hash = NULL;
+	INIT_LIST_HEAD(&dev->cache_lru);
 	dev->gc_cleanup_list = NULL;
 
 	if (!init_failed && dev->param.n_caches > 0) {
 		int i;
+		int n_buckets;
 		void *buf;
 		int cache_bytes =
 		    dev->param.n_caches * sizeof(struct yaffs_cache);
@@ -4959,18 +5181,33 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 
 		for (i = 0; i < dev->param.n_caches && buf; i++) {
 			dev->cache[i].object = NULL;
-			dev->cache[i].last_use = 0;
 			dev->cache[i].dirty = 0;
+			INIT_LIST_HEAD(&dev->cache[i].hash_link);
+			INIT_LIST_HEAD(&dev->cache[i].obj_link);
+			list_add_tail(&dev->cache[i].lru, &dev->cache_lru);
 			dev->cache[i].data = buf =
 			    kmalloc(dev->param.total_bytes_per_chunk, GFP_NOFS);
 		}
+
+		/* One hash bucket per cache entry, rounded up to a power of 2 */
+		for (n_buckets = 1; n_buckets < dev->param.n_caches;)
+			n_buckets <<= 1;
+		if (buf)
+			buf = dev->cache_hash =
+			    kmalloc(n_buckets * sizeof(struct list_head),
+				    GFP_NOFS);
+		for (i = 0; i < n_buckets && buf; i++)
+			INIT_LIST_HEAD(&dev->cache_hash[i]);
+		dev->cache_hash_mask = n_buckets - 1;
+
 		if (!buf)
 			init_failed = 1;
-
-		dev->cache_last_use = 0;
 	}
 
 	dev->cache_hits = 0;
+	dev->cache_misses = 0;
+	dev->cache_pushouts = 0;
+	dev->cache_combined = 0;
 
 	if (!init_failed) {
 		dev->gc_cleanup_list =
@@ -5086,6 +5323,8 @@ void yaffs_deinitialise(struct yaffs_dev *dev)
 
 			kfree(dev->cache);
 			dev->cache = NULL;
+			kfree(dev->cache_hash);
+			dev->cache_hash = NULL;
 		}
 
 		kfree(dev->gc_cleanup_list);
@@ -83,10 +83,15 @@
 #define YAFFS_OBJECTID_CHECKPOINT_DATA	0x20
 #define YAFFS_SEQUENCE_CHECKPOINT_DATA  0x21
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+#define YAFFS_MAX_SHORT_OP_CACHES	256
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
+/* Flags returned by the gc_control callback */
+#define YAFFS_GC_CONTROL_ENABLE		0x01	/* gc may run at all */
+#define YAFFS_GC_CONTROL_COST_BENEFIT	0x02	/* background gc picks blocks
+						 * by cost-benefit */
+
 /* We limit the number attempts at sucessfully saving a chunk of data.
  * Small-page devices have 32 pages per block; large-page devices have 64.
  * Default to something in the order of 5 to 10 blocks worth of chunks.
@@ -106,15 +111,22 @@
 /* Special sequence number for bad block that failed to be marked bad */
 #define YAFFS_SEQUENCE_BAD_BLOCK	0xFFFF0000
 
-/* ChunkCache is used for short read/write operations.*/
+/* ChunkCache is used for short read/write operations.
+ * Each entry in use sits in a hash bucket keyed by (object, chunk_id) and on
+ * its object's cache list, which is kept sorted by chunk_id so that dirty
+ * chunks can be written out in file order. All entries are on the device
+ * LRU list: free entries at the head, then least recently used first.
+ */
 struct yaffs_cache {
 	struct yaffs_obj *object;
 	int chunk_id;
-	int last_use;
 	int dirty;
 	int n_bytes;		/* Only valid if the cache is dirty */
 	int locked;		/* Can't push out or flush while locked. */
 	u8 *data;
+	struct list_head hash_link;	/* entries in this hash bucket */
+	struct list_head obj_link;	/* the object's entries, by chunk_id */
+	struct list_head lru;		/* device LRU list */
 };
 
 /* Tags structures in RAM
@@ -408,6 +420,8 @@ struct yaffs_obj {
 
 	struct list_head hard_links;	/* all the equivalent hard linked objects */
 
+	struct list_head cache_list;	/* short op cache entries, by chunk_id */
+
 	/* directory structure stuff */
 	/* also used for linking up the free list */
 	struct yaffs_obj *parent;
@@ -559,7 +573,9 @@ struct yaffs_param {
 	/* Callback to mark the superblock dirty */
 	void (*sb_dirty_fn) (struct yaffs_dev * dev);
 
-	/*  Callback to control garbage collection. */
+	/*  Callback to control garbage collection. Returns YAFFS_GC_CONTROL_*
+	 *  flags.
+	 */
 	unsigned (*gc_control) (struct yaffs_dev * dev);
 
 	/* Debug control flags. Don't use unless you know what you're doing */
@@ -685,7 +701,9 @@ struct yaffs_dev {
 	int doing_buffered_block_rewrite;
 
 	struct yaffs_cache *cache;
-	int cache_last_use;
+	struct list_head cache_lru;	/* free entries first, then by last use */
+	struct list_head *cache_hash;	/* chunk cache hash buckets */
+	u32 cache_hash_mask;
 
 	/* Stuff for background deletion and unlinked files. */
 	struct yaffs_obj *unlinked_dir;	/* Directory where unlinked and deleted files live. */
@@ -733,7 +751,14 @@ struct yaffs_dev {
 	u32 n_deletions;
 	u32 n_unmarked_deletions;
 	u32 refresh_count;
+	u32 fg_gc_copies;	/* chunks copied by gc inline with a write */
+	u32 bg_gc_copies;	/* chunks copied by the background thread */
+	u32 bg_gc_idle_blocks;	/* blocks collected while the device was idle */
+	u32 gc_cb_selected;	/* blocks picked by cost-benefit selection */
 	u32 cache_hits;
+	u32 cache_misses;
+	u32 cache_pushouts;	/* dirty chunks written to make room */
+	u32 cache_combined;	/* of those, written alongside a neighbour */
 
 };
 
@@ -857,6 +882,8 @@ void yaffs_handle_defered_free(struct yaffs_obj *obj);
 void yaffs_update_dirty_dirs(struct yaffs_dev *dev);
 
 int yaffs_bg_gc(struct yaffs_dev *dev, unsigned urgency);
+int yaffs_bg_gc_idle(struct yaffs_dev *dev, unsigned target_pct,
+		     unsigned max_used_pct);
 
 /* Debug dump  */
 int yaffs_dump_obj(struct yaffs_obj *obj);
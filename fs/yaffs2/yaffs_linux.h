@@ -24,6 +24,8 @@ struct yaffs_linux_context {
 	struct super_block *super;
 	struct task_struct *bg_thread;	/* Background thread for this device */
 	int bg_running;
+	u32 bg_last_writes;	/* n_page_writes when last looked at */
+	unsigned long bg_idle_since;	/* jiffies of the last write seen */
 	struct mutex gross_lock;	/* Gross locking mutex*/
 	u8 *spare_buffer;	/* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
@@ -98,12 +98,24 @@ unsigned int yaffs_auto_checkpoint = 1;
 unsigned int yaffs_gc_control = 1;
 unsigned int yaffs_bg_enable = 1;
 
+/* Background gc tuning */
+unsigned int yaffs_gc_cost_benefit = 1;	/* pick bg gc blocks by cost-benefit */
+unsigned int yaffs_bg_gc_idle_ms = 500;	/* no writes for this long is idle */
+unsigned int yaffs_bg_gc_target = 75;	/* % of free chunks to erase when idle */
+unsigned int yaffs_bg_gc_max_used = 75;	/* max % of a block in use to collect */
+unsigned int yaffs_bg_gc_batch = 4;	/* blocks to collect per idle wake up */
+
 /* Module Parameters */
 module_param(yaffs_trace_mask, uint, 0644);
 module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
 module_param(yaffs_gc_control, uint, 0644);
 module_param(yaffs_bg_enable, uint, 0644);
+module_param(yaffs_gc_cost_benefit, uint, 0644);
+module_param(yaffs_bg_gc_idle_ms, uint, 0644);
+module_param(yaffs_bg_gc_target, uint, 0644);
+module_param(yaffs_bg_gc_max_used, uint, 0644);
+module_param(yaffs_bg_gc_batch, uint, 0644);
 
 
 #define yaffs_inode_to_obj_lv(iptr) ((iptr)->i_private)
@@ -118,7 +130,8 @@ module_param(yaffs_bg_enable, uint, 0644);
 
 static unsigned yaffs_gc_control_callback(struct yaffs_dev *dev)
 {
-	return yaffs_gc_control;
+	return yaffs_gc_control |
+	    (yaffs_gc_cost_benefit ? YAFFS_GC_CONTROL_COST_BENEFIT : 0);
 }
 
 static void yaffs_gross_lock(struct yaffs_dev *dev)
@@ -1629,6 +1642,55 @@ void yaffs_background_waker(unsigned long data)
 	wake_up_process((struct task_struct *)data);
 }
 
+/*
+ * Collect whole blocks while nobody is writing, so that writers find erased
+ * blocks ready rather than having to collect them inline. The gross lock is
+ * dropped between blocks, and we back off as soon as a writer gets in.
+ * Called with the gross lock held. Returns when it next wants to run, or 0
+ * if there is nothing for it to do.
+ */
+static unsigned long yaffs_bg_gc_when_idle(struct yaffs_dev *dev,
+					   unsigned long now)
+{
+	struct yaffs_linux_context *context = yaffs_dev_to_lc(dev);
+	unsigned long idle = msecs_to_jiffies(yaffs_bg_gc_idle_ms);
+	unsigned n = 0;
+	u32 writes;
+
+	if (!yaffs_bg_gc_idle_ms || !yaffs_bg_gc_batch)
+		return 0;
+
+	/* Any page written since we last looked means we are not idle. */
+	if (dev->n_page_writes != context->bg_last_writes) {
+		context->bg_last_writes = dev->n_page_writes;
+		context->bg_idle_since = now;
+	}
+
+	if (time_before(now, context->bg_idle_since + idle))
+		return context->bg_idle_since + idle + 1;
+
+	while (n < yaffs_bg_gc_batch && context->bg_running &&
+	       yaffs_bg_gc_idle(dev, yaffs_bg_gc_target,
+				yaffs_bg_gc_max_used)) {
+		n++;
+		writes = dev->n_page_writes;
+		yaffs_gross_unlock(dev);
+		cond_resched();
+		yaffs_gross_lock(dev);
+		if (dev->n_page_writes != writes) {
+			/* A writer got in, leave it alone for a while */
+			context->bg_last_writes = dev->n_page_writes;
+			context->bg_idle_since = jiffies;
+			return context->bg_idle_since + idle + 1;
+		}
+	}
+
+	/* Our own copies don't count as activity */
+	context->bg_last_writes = dev->n_page_writes;
+
+	return n < yaffs_bg_gc_batch ? 0 : now + HZ / 20 + 1;
+}
+
 static int yaffs_bg_thread_fn(void *data)
 {
 	struct yaffs_dev *dev = (struct yaffs_dev *)data;
@@ -1636,6 +1698,7 @@ static int yaffs_bg_thread_fn(void *data)
 	unsigned long now = jiffies;
 	unsigned long next_dir_update = now;
 	unsigned long next_gc = now;
+	unsigned long next_idle_gc = 0;
 	unsigned long expires;
 	unsigned int urgency;
 
@@ -1682,10 +1745,17 @@ static int yaffs_bg_thread_fn(void *data)
 				next_gc = next_dir_update;
                         }
 		}
+
+		if (yaffs_bg_enable && !dev->is_checkpointed &&
+		    (!next_idle_gc || !time_before(now, next_idle_gc)))
+			next_idle_gc = yaffs_bg_gc_when_idle(dev, now);
+
 		yaffs_gross_unlock(dev);
 		expires = next_dir_update;
 		if (time_before(next_gc, expires))
 			expires = next_gc;
+		if (next_idle_gc && time_before(next_idle_gc, expires))
+			expires = next_idle_gc;
 		if (time_before(expires, now))
 			expires = now + HZ;
 
@@ -1711,6 +1781,8 @@ static int yaffs_bg_start(struct yaffs_dev *dev)
 		return -1;
 
 	context->bg_running = 1;
+	context->bg_last_writes = dev->n_page_writes;
+	context->bg_idle_since = jiffies;
 
 	context->bg_thread = kthread_run(yaffs_bg_thread_fn,
 					 (void *)dev, "yaffs-bg-%d",
@@ -2227,7 +2299,8 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	param->chunks_per_block = YAFFS_CHUNKS_PER_BLOCK;
 	param->total_bytes_per_chunk = YAFFS_BYTES_PER_CHUNK;
 	param->n_reserved_blocks = 5;
-	param->n_caches = (options.no_cache) ? 0 : 10;
+	param->n_caches =
+	    (options.no_cache) ? 0 : CONFIG_YAFFS_SHORT_OP_CACHES;
 	param->inband_tags = options.inband_tags;
 
 #ifdef CONFIG_YAFFS_DISABLE_LAZY_LOAD
@@ -2484,6 +2557,11 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 		    dev->oldest_dirty_gc_count);
 	buf += sprintf(buf, "n_gc_blocks........... %u\n", dev->n_gc_blocks);
 	buf += sprintf(buf, "bg_gcs................ %u\n", dev->bg_gcs);
+	buf += sprintf(buf, "bg_gc_idle_blocks..... %u\n",
+		       dev->bg_gc_idle_blocks);
+	buf += sprintf(buf, "gc_cb_selected........ %u\n", dev->gc_cb_selected);
+	buf += sprintf(buf, "fg_gc_copies.......... %u\n", dev->fg_gc_copies);
+	buf += sprintf(buf, "bg_gc_copies.......... %u\n", dev->bg_gc_copies);
 	buf +=
 	    sprintf(buf, "n_retired_writes...... %u\n", dev->n_retired_writes);
 	buf +=
@@ -2496,6 +2574,9 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	    sprintf(buf, "n_tags_ecc_unfixed.... %u\n",
 		    dev->n_tags_ecc_unfixed);
 	buf += sprintf(buf, "cache_hits............ %u\n", dev->cache_hits);
+	buf += sprintf(buf, "cache_misses.......... %u\n", dev->cache_misses);
+	buf += sprintf(buf, "cache_pushouts........ %u\n", dev->cache_pushouts);
+	buf += sprintf(buf, "cache_combined........ %u\n", dev->cache_combined);
 	buf +=
 	    sprintf(buf, "n_deleted_files....... %u\n", dev->n_deleted_files);
 	buf +=
@@ -2506,6 +2587,62 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	return buf;
 }
 
+/*
+ * Background gc tunables. These are module parameters too; /proc/yaffs
+ * lists them and accepts "name=value" writes to change them.
+ */
+static struct {
+	char *name;
+	unsigned *value;
+} yaffs_tunables[] = {
+	{"gc_cost_benefit", &yaffs_gc_cost_benefit},
+	{"bg_gc_idle_ms", &yaffs_bg_gc_idle_ms},
+	{"bg_gc_target", &yaffs_bg_gc_target},
+	{"bg_gc_max_used", &yaffs_bg_gc_max_used},
+	{"bg_gc_batch", &yaffs_bg_gc_batch},
+	{NULL, NULL},
+};
+
+static char *yaffs_dump_tunables(char *buf)
+{
+	int i;
+
+	for (i = 0; yaffs_tunables[i].name != NULL; i++)
+		buf += sprintf(buf, "%s=%u\n", yaffs_tunables[i].name,
+			       *yaffs_tunables[i].value);
+	return buf;
+}
+
+/* Returns 1 if buf set a tunable, 0 if it is something else. */
+static int yaffs_proc_write_tunable(const char __user *buf,
+				    unsigned long count)
+{
+	char str[48];
+	char *end;
+	unsigned long val;
+	int len;
+	int i;
+
+	if (count >= sizeof(str))
+		return 0;
+	if (copy_from_user(str, buf, count))
+		return 0;
+	str[count] = '\0';
+
+	for (i = 0; yaffs_tunables[i].name != NULL; i++) {
+		len = strlen(yaffs_tunables[i].name);
+		if (strncmp(str, yaffs_tunables[i].name, len) ||
+		    str[len] != '=')
+			continue;
+		val = simple_strtoul(str + len + 1, &end, 0);
+		if (end == str + len + 1 || (*end && !isspace(*end)))
+			return 0;
+		*yaffs_tunables[i].value = val;
+		return 1;
+	}
+	return 0;
+}
+
 static int yaffs_proc_read(char *page,
 			   char **start,
 			   off_t offset, int count, int *eof, void *data)
@@ -2524,9 +2661,10 @@ static int yaffs_proc_read(char *page,
 	*(int *)start = 1;
 
 	/* Print header first */
-	if (step == 0)
+	if (step == 0) {
 		buf += sprintf(buf, "YAFFS built:" __DATE__ " " __TIME__ "\n");
-	else if (step == 1)
+		buf = yaffs_dump_tunables(buf);
+	} else if (step == 1)
 		buf += sprintf(buf, "\n");
 	else {
 		step -= 2;
@@ -2703,6 +2841,8 @@ static int yaffs_proc_write_trace_options(struct file *file, const char *buf,
 static int yaffs_proc_write(struct file *file, const char *buf,
 			    unsigned long count, void *data)
 {
+	if (yaffs_proc_write_tunable(buf, count))
+		return count;
 	return yaffs_proc_write_trace_options(file, buf, count, data);
 }
 
@@ -2,6 +2,7 @@
 #define __LINUX__AIO_H
 
 #include <linux/list.h>
+#include <linux/mutex.h>
 #include <linux/workqueue.h>
 #include <linux/aio_abi.h>
 #include <linux/uio.h>
@@ -119,6 +120,9 @@ struct kiocb {
 						 * for cancellation */
 	struct list_head	ki_batch;	/* batch allocation */
 
+	/* buffered reads that would block are run from aio_read_wq */
+	struct work_struct	ki_work;
+
 	/*
 	 * If the aio_resfd field of the userspace iocb is not zero,
 	 * this is the underlying eventfd context to deliver events to.
@@ -173,6 +177,11 @@ struct aio_ring_info {
 
 	unsigned		nr, tail;
 
+	/* submission ring, in ring_pages[sq_page] onwards, if sq_nr */
+	struct mutex		sq_mutex;
+	long			sq_page;
+	unsigned		sq_nr, sq_head;
+
 	struct page		*internal_pages[AIO_RING_PAGES];
 };
 
@@ -235,5 +244,9 @@ static inline struct kiocb *list_kiocb(struct list_head *h)
 /* for sysctl: */
 extern unsigned long aio_nr;
 extern unsigned long aio_max_nr;
+extern int aio_read_workers;
+struct ctl_table;
+extern int aio_read_workers_sysctl(struct ctl_table *table, int write,
+				   void __user *buffer, size_t *lenp, loff_t *ppos);
 
 #endif /* __LINUX__AIO_H */
@@ -104,6 +104,43 @@ struct iocb {
 	__u32	aio_resfd;
 }; /* 64 bytes */
 
+/*
+ * Or'ed into the nr_events argument of io_setup() to ask for a submission
+ * ring to be set up next to the completion ring.  Kernels without support
+ * fail io_setup(), with EINVAL or EAGAIN as the nr_events is out of range.
+ */
+#define IOCTX_FLAG_SQRING	(1U << 31)
+
+/* Set in the completion ring's compat_features when a submission ring exists */
+#define AIO_RING_COMPAT_SQRING	2
+
+/*
+ * The submission ring lives in the same mapping as the completion ring,
+ * starting at the first page boundary after the last io_event, i.e. at
+ *
+ *	ctx_id + round_up(ring->header_length +
+ *			  ring->nr * sizeof(struct io_event), page size)
+ *
+ * Userspace fills iocbs[tail], advances tail (modulo nr; the ring is full
+ * when that would make it equal to head) and then calls
+ *
+ *	io_submit(ctx_id, n, NULL)
+ *
+ * to submit up to n of the queued iocbs with a single system call.  The
+ * return value is the number submitted, as with an array of iocbs, and
+ * the kernel advances head past them.  An iocb that fails to submit with
+ * anything but EAGAIN is consumed as well, but only ever as the first one
+ * of a call, whose return value is then the error.  Completions carry the
+ * address of the ring slot in io_event.obj; use aio_data to match them.
+ */
+struct aio_sq_ring {
+	__u32	head;		/* written by the kernel */
+	__u32	tail;		/* written by userspace */
+	__u32	nr;		/* number of slots */
+	__u32	reserved[13];
+	struct iocb	iocbs[0];
+}; /* 64 byte header, so that no iocb straddles a page */
+
 #undef IFBIG
 #undef IFLITTLE
 
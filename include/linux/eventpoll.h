@@ -26,6 +26,13 @@
 #define EPOLL_CTL_DEL 2
 #define EPOLL_CTL_MOD 3
 
+/*
+ * Request an exclusive wakeup mode for the target file descriptor: when
+ * several epoll sets wait on the same file, an event wakes up one set
+ * with a waiter instead of all of them
+ */
+#define EPOLLEXCLUSIVE (1 << 28)
+
 /* Set the One Shot behaviour for the target file descriptor */
 #define EPOLLONESHOT (1 << 30)
 
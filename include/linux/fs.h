@@ -846,6 +846,7 @@ struct inode {
 		struct pipe_inode_info	*i_pipe;
 		struct block_device	*i_bdev;
 		struct cdev		*i_cdev;
+		unsigned		i_dir_seq;
 	};
 
 	__u32			i_generation;
@@ -866,6 +867,25 @@ static inline int inode_unhashed(struct inode *inode)
 	return hlist_unhashed(&inode->i_hash);
 }
 
+/*
+ * i_dir_seq is bumped under i_mutex after every change to the entries of
+ * a directory, so that lookups done without i_mutex (->lookup_shared) can
+ * tell whether their result is still current.
+ */
+static inline void dir_entries_changed(struct inode *dir)
+{
+	smp_wmb();
+	dir->i_dir_seq++;
+}
+
+static inline unsigned dir_entries_seq(struct inode *dir)
+{
+	unsigned seq = ACCESS_ONCE(dir->i_dir_seq);
+
+	smp_rmb();
+	return seq;
+}
+
 /*
  * inode->i_mutex nesting subclasses for the lock validator:
  *
@@ -1656,6 +1676,7 @@ typedef struct file_operations __no_const file_operations_no_const;
 
 struct inode_operations {
 	struct dentry * (*lookup) (struct inode *,struct dentry *, struct nameidata *);
+	struct inode * (*lookup_shared) (struct inode *,struct dentry *, struct nameidata *);
 	void * (*follow_link) (struct dentry *, struct nameidata *);
 	int (*permission) (struct inode *, int);
 	struct posix_acl * (*get_acl)(struct inode *, int);
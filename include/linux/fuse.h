@@ -60,6 +60,7 @@
 #define _LINUX_FUSE_H
 
 #include <linux/types.h>
+#include <linux/ioctl.h>
 
 /*
  * Version negotiation:
@@ -152,10 +153,13 @@ struct fuse_file_lock {
  * FOPEN_DIRECT_IO: bypass page cache for this open file
  * FOPEN_KEEP_CACHE: don't invalidate the data cache on open
  * FOPEN_NONSEEKABLE: the file is not seekable
+ * FOPEN_PASSTHROUGH: read, write and mmap go to the file passed in
+ *                    fuse_open_out.passthrough_fd
  */
 #define FOPEN_DIRECT_IO		(1 << 0)
 #define FOPEN_KEEP_CACHE	(1 << 1)
 #define FOPEN_NONSEEKABLE	(1 << 2)
+#define FOPEN_PASSTHROUGH	(1 << 7)
 
 /**
  * INIT request/reply flags
@@ -164,6 +168,8 @@ struct fuse_file_lock {
  * FUSE_EXPORT_SUPPORT: filesystem handles lookups of "." and ".."
  * FUSE_DONT_MASK: don't apply umask to file mode on create operations
  * FUSE_FLOCK_LOCKS: remote locking for BSD style file locks
+ * FUSE_WRITEBACK_CACHE: use writeback cache for buffered writes
+ * FUSE_PASSTHROUGH: filesystem may pass files through with FOPEN_PASSTHROUGH
  */
 #define FUSE_ASYNC_READ		(1 << 0)
 #define FUSE_POSIX_LOCKS	(1 << 1)
@@ -173,6 +179,8 @@ struct fuse_file_lock {
 #define FUSE_BIG_WRITES		(1 << 5)
 #define FUSE_DONT_MASK		(1 << 6)
 #define FUSE_FLOCK_LOCKS	(1 << 10)
+#define FUSE_WRITEBACK_CACHE	(1 << 16)
+#define FUSE_PASSTHROUGH	(1 << 31)
 
 /**
  * CUSE INIT request/reply flags
@@ -394,7 +402,7 @@ struct fuse_create_in {
 struct fuse_open_out {
 	__u64	fh;
 	__u32	open_flags;
-	__u32	padding;
+	__u32	passthrough_fd;
 };
 
 struct fuse_release_in {
@@ -645,4 +653,16 @@ struct fuse_notify_retrieve_in {
 	__u64	dummy4;
 };
 
+/*
+ * Device ioctls
+ *
+ * FUSE_DEV_IOC_CLONE: attach a newly opened /dev/fuse to the connection
+ * of the device file descriptor passed in, as another channel
+ * FUSE_DEV_IOC_BIND_CPU: route requests submitted on the given CPU to
+ * this channel, -1 to unbind
+ */
+#define FUSE_DEV_IOC_MAGIC		229
+#define FUSE_DEV_IOC_CLONE		_IOR(FUSE_DEV_IOC_MAGIC, 0, __u32)
+#define FUSE_DEV_IOC_BIND_CPU		_IOW(FUSE_DEV_IOC_MAGIC, 1, __s32)
+
 #endif /* _LINUX_FUSE_H */
@@ -0,0 +1,62 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Public Kernel Interface
+ *
+ *  LZ4 is a fast LZ77 type block compression format by Yann Collet,
+ *  see http://code.google.com/p/lz4/ for the format description and the
+ *  reference implementation.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+/*
+ * lz4_compressbound()
+ * Provides the maximum size that LZ4 may output in a "worst case" scenario
+ * (input data not compressible)
+ */
+static inline size_t lz4_compressbound(size_t isize)
+{
+	return isize + (isize / 255) + 16;
+}
+
+/* Size of the work memory lz4_compress() needs */
+#define LZ4_MEM_COMPRESS_LOG	14
+#define LZ4_MEM_COMPRESS	(1 << LZ4_MEM_COMPRESS_LOG)
+
+/*
+ * lz4_compress()
+ *	src     : source address of the original data
+ *	src_len : size of the original data
+ *	dest    : output buffer address of the compressed data
+ *	dest_len: is the size of the destination buffer, and on return
+ *			the size of the compressed data
+ *	wrkmem  : address of the working memory, LZ4_MEM_COMPRESS bytes
+ *	return  : Success if return 0
+ *		  Error if return (< 0), which only happens when the
+ *			output does not fit in dest_len bytes
+ *	note :  A destination buffer of lz4_compressbound(src_len) bytes
+ *		is always large enough.
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len, void *wrkmem);
+
+/*
+ * lz4_decompress_unknownoutputsize()
+ *	src     : source address of the compressed data
+ *	src_len : is the input size, therefore the compressed size
+ *	dest    : output buffer address of the decompressed data
+ *	dest_len: is the max size of the destination buffer, which is
+ *			expected to be large enough, and on return the
+ *			number of bytes decompressed
+ *	return  : Success if return 0
+ *		  Error if return (< 0)
+ *	note :  Destination buffer must be already allocated.
+ *		The whole of src must be a single LZ4 block; the decoder
+ *		never reads beyond src_len nor writes beyond dest_len.
+ */
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len);
+#endif
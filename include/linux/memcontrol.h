@@ -195,6 +195,9 @@ unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 u64 mem_cgroup_get_limit(struct mem_cgroup *memcg);
 
 void mem_cgroup_count_vm_event(struct mm_struct *mm, enum vm_event_item idx);
+struct mem_cgroup *mem_cgroup_ion_get(struct mm_struct *mm);
+void mem_cgroup_ion_put(struct mem_cgroup *memcg);
+void mem_cgroup_ion_stat(struct mem_cgroup *memcg, long nr_pages);
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 void mem_cgroup_split_huge_fixup(struct page *head);
 #endif
@@ -411,6 +414,19 @@ static inline
 void mem_cgroup_count_vm_event(struct mm_struct *mm, enum vm_event_item idx)
 {
 }
+
+static inline struct mem_cgroup *mem_cgroup_ion_get(struct mm_struct *mm)
+{
+	return NULL;
+}
+
+static inline void mem_cgroup_ion_put(struct mem_cgroup *memcg)
+{
+}
+
+static inline void mem_cgroup_ion_stat(struct mem_cgroup *memcg, long nr_pages)
+{
+}
 static inline void mem_cgroup_replace_page_cache(struct page *oldpage,
 				struct page *newpage)
 {
@@ -276,6 +276,7 @@ enum {
 	MM_FILEPAGES,
 	MM_ANONPAGES,
 	MM_SWAPENTS,
+	MM_IONPAGES,	/* ion buffers allocated by this mm, not part of rss */
 	NR_MM_COUNTERS
 };
 
@@ -512,6 +512,22 @@ struct ion_flush_data {
 	unsigned int length;
 };
 
+/* struct ion_flush_batch_data - several cache operations in one call
+ *
+ * @entries:	array of @count struct ion_flush_data
+ * @count:	number of entries, at most ION_FLUSH_BATCH_MAX.  If an entry
+ *		fails, set on return to the number of entries completed
+ * @cmd:	ION_IOC_CLEAN_CACHES, ION_IOC_INV_CACHES or
+ *		ION_IOC_CLEAN_INV_CACHES, applied to every entry
+ */
+struct ion_flush_batch_data {
+	struct ion_flush_data *entries;
+	unsigned int count;
+	unsigned int cmd;
+};
+
+#define ION_FLUSH_BATCH_MAX	64
+
 struct ion_prefetch_data {
        int heap_id;
        unsigned long len;
@@ -547,4 +563,14 @@ struct ion_prefetch_data {
 #define ION_IOC_DRAIN                  _IOWR(ION_IOC_MSM_MAGIC, 4, \
                                                struct ion_prefetch_data)
 
+/**
+ * DOC: ION_IOC_FLUSH_BATCH - run one cache operation on many buffers
+ *
+ * Performs the same cache operation on every entry of the array, with a
+ * single ioctl and mmap_sem round trip.  Whole buffer cleans of cached
+ * buffers only write back the pages dirtied through their user mappings.
+ */
+#define ION_IOC_FLUSH_BATCH	_IOWR(ION_IOC_MSM_MAGIC, 5, \
+						struct ion_flush_batch_data)
+
 #endif
@@ -206,6 +206,8 @@ struct proto_ops {
 				      int offset, size_t size, int flags);
 	ssize_t 	(*splice_read)(struct socket *sock,  loff_t *ppos,
 				       struct pipe_inode_info *pipe, size_t len, unsigned int flags);
+	ssize_t		(*splice_write)(struct pipe_inode_info *pipe, struct socket *sock,
+					loff_t *ppos, size_t len, unsigned int flags);
 	void		(*set_peek_off)(struct sock *sk, int val);
 };
 
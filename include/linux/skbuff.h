@@ -108,6 +108,8 @@
 struct net_device;
 struct scatterlist;
 struct pipe_inode_info;
+struct pipe_buffer;
+struct splice_desc;
 
 #if defined(CONFIG_NF_CONNTRACK) || defined(CONFIG_NF_CONNTRACK_MODULE)
 struct nf_conntrack {
@@ -2136,6 +2138,12 @@ extern int             skb_splice_bits(struct sk_buff *skb,
 						struct pipe_inode_info *pipe,
 						unsigned int len,
 						unsigned int flags);
+extern ssize_t         skb_splice_from_pipe(struct pipe_inode_info *pipe,
+						struct sock *sk, size_t len,
+						unsigned int flags,
+						int (*actor)(struct pipe_inode_info *,
+							     struct pipe_buffer *,
+							     struct splice_desc *));
 extern void	       skb_copy_and_csum_dev(const struct sk_buff *skb, u8 *to);
 extern void	       skb_split(struct sk_buff *skb,
 				 struct sk_buff *skb1, const u32 len);
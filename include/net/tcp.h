@@ -351,6 +351,9 @@ extern void tcp_twsk_destructor(struct sock *sk);
 extern ssize_t tcp_splice_read(struct socket *sk, loff_t *ppos,
 			       struct pipe_inode_info *pipe, size_t len,
 			       unsigned int flags);
+extern ssize_t tcp_splice_write(struct pipe_inode_info *pipe,
+				struct socket *sock, loff_t *ppos, size_t len,
+				unsigned int flags);
 
 extern int tcp_use_userconfig_sysctl_handler(struct ctl_table *, int,
                                          void __user *, size_t *, loff_t *);
@@ -128,6 +128,9 @@ static int __maybe_unused two = 2;
 static int __maybe_unused three = 3;
 static unsigned long one_ul = 1;
 static int one_hundred = 100;
+#ifdef CONFIG_AIO
+static int aio_read_workers_max = WQ_MAX_ACTIVE;
+#endif
 #ifdef CONFIG_PRINTK
 static int ten_thousand = 10000;
 #endif
@@ -1589,6 +1592,15 @@ static struct ctl_table fs_table[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_doulongvec_minmax,
 	},
+	{
+		.procname	= "aio-read-workers",
+		.data		= &aio_read_workers,
+		.maxlen		= sizeof(aio_read_workers),
+		.mode		= 0644,
+		.proc_handler	= aio_read_workers_sysctl,
+		.extra1		= &zero,
+		.extra2		= &aio_read_workers_max,
+	},
 #endif /* CONFIG_AIO */
 #ifdef CONFIG_INOTIFY_USER
 	{
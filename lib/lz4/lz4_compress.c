@@ -0,0 +1,166 @@
+/*
+ *  LZ4 Compressor for the Linux kernel
+ *
+ *  LZ4 is a fast LZ77 type block compression format by Yann Collet,
+ *  see http://code.google.com/p/lz4/.  This is a single pass greedy
+ *  compressor for its block format, the counterpart of lz4_decompress.c.
+ *  Its output can be decompressed by any conforming LZ4 block decoder.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+
+#include "lz4defs.h"
+
+/*
+ * Positions are remembered in a table indexed by a hash of the four bytes
+ * found there.  The table holds offsets from the start of the input, which
+ * is why the input size is limited.
+ */
+#define HASH_LOG	(LZ4_MEM_COMPRESS_LOG - 2)
+#define MAX_INPUT_SIZE	0x7E000000
+
+/*
+ * When no match has been found for a while, the data is probably not
+ * compressible; start skipping ahead faster, one more byte per step for
+ * every 1 << SKIP_TRIGGER bytes without a match.
+ */
+#define SKIP_TRIGGER	6
+
+static inline u32 lz4_hash(u32 sequence)
+{
+	return (sequence * 2654435761U) >> (32 - HASH_LOG);
+}
+
+static inline u32 lz4_read32(const u8 *p)
+{
+	return get_unaligned((const u32 *)p);
+}
+
+/* Write a run length continuation after a nibble of 15. */
+static inline u8 *lz4_write_length(u8 *op, size_t length)
+{
+	while (length >= 255) {
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = length;
+	return op;
+}
+
+/* The most output one sequence can produce, used for bounds checks. */
+static inline size_t lz4_sequence_bound(size_t literals, size_t match)
+{
+	return 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		 unsigned char *dest, size_t *dest_len, void *wrkmem)
+{
+	u32 *table = wrkmem;
+	const u8 *ip = src;
+	const u8 *anchor = src;
+	const u8 *const iend = src + src_len;
+	const u8 *const mflimit = iend - MFLIMIT;
+	const u8 *const matchlimit = iend - LASTLITERALS;
+	u8 *op = dest;
+	u8 *const oend = dest + *dest_len;
+	size_t literals, length;
+	u8 *token;
+
+	if (src_len > MAX_INPUT_SIZE)
+		return -1;
+
+	memset(table, 0, LZ4_MEM_COMPRESS);
+
+	/* too short for any match, everything is literals */
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	while (ip < mflimit) {
+		u32 sequence = lz4_read32(ip);
+		u32 h = lz4_hash(sequence);
+		const u8 *ref = src + table[h];
+
+		table[h] = ip - src;
+		if (ref >= ip || ip - ref > MAX_DISTANCE ||
+		    lz4_read32(ref) != sequence) {
+			ip += 1 + ((ip - anchor) >> SKIP_TRIGGER);
+			continue;
+		}
+
+		/* extend the match backwards over pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		/* and forwards, stopping short of the last literals */
+		length = MINMATCH;
+		while (ip + length < matchlimit && ip[length] == ref[length])
+			length++;
+
+		literals = ip - anchor;
+		if (lz4_sequence_bound(literals, length - MINMATCH) >
+		    (size_t)(oend - op))
+			return -1;
+
+		token = op++;
+		if (literals >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_write_length(op, literals - RUN_MASK);
+		} else {
+			*token = literals << ML_BITS;
+		}
+		memcpy(op, anchor, literals);
+		op += literals;
+
+		*op++ = (ip - ref) & 0xff;
+		*op++ = (ip - ref) >> 8;
+
+		length -= MINMATCH;
+		if (length >= ML_MASK) {
+			*token |= ML_MASK;
+			op = lz4_write_length(op, length - ML_MASK);
+		} else {
+			*token |= length;
+		}
+
+		ip += length + MINMATCH;
+		anchor = ip;
+
+		/* remember a position inside the match for the next search */
+		if (ip < mflimit)
+			table[lz4_hash(lz4_read32(ip - 2))] = ip - 2 - src;
+	}
+
+last_literals:
+	literals = iend - anchor;
+	if (1 + literals / 255 + 1 + literals > (size_t)(oend - op))
+		return -1;
+
+	token = op++;
+	if (literals >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = lz4_write_length(op, literals - RUN_MASK);
+	} else {
+		*token = literals << ML_BITS;
+	}
+	memcpy(op, anchor, literals);
+	op += literals;
+
+	*dest_len = op - dest;
+	return 0;
+}
+EXPORT_SYMBOL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
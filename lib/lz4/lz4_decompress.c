@@ -0,0 +1,129 @@
+/*
+ *  LZ4 Decompressor for the Linux kernel
+ *
+ *  LZ4 is a fast LZ77 type block compression format by Yann Collet,
+ *  see http://code.google.com/p/lz4/.  This is an independent decoder
+ *  for its block format which checks every input and output access, so
+ *  it is safe to use on untrusted data such as filesystem images.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#ifndef STATIC
+#include <linux/module.h>
+#include <linux/kernel.h>
+#endif
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+
+#include "lz4defs.h"
+
+/*
+ * Read a run length continuation: bytes are added to the length until
+ * one is not 255.  Returns false if the input runs out first.
+ */
+static inline bool lz4_read_length(const u8 **ip, const u8 *iend,
+				   size_t *length)
+{
+	unsigned int s;
+
+	do {
+		if (*ip >= iend)
+			return false;
+		s = *(*ip)++;
+		*length += s;
+	} while (s == 255);
+
+	return true;
+}
+
+/*
+ * Copy a match of @length bytes from @offset bytes back in the output.
+ * The source may overlap the destination when the offset is shorter than
+ * the length, which is how LZ4 encodes runs; copying in 8 byte steps is
+ * still correct as long as each step reads bytes already written.
+ */
+static inline void lz4_copy_match(u8 *op, size_t offset, size_t length)
+{
+	const u8 *match = op - offset;
+
+	if (offset >= length) {
+		memcpy(op, match, length);
+		return;
+	}
+
+	if (offset >= 8) {
+		while (length >= 8) {
+			memcpy(op, match, 8);
+			op += 8;
+			match += 8;
+			length -= 8;
+		}
+	}
+
+	while (length--)
+		*op++ = *match++;
+}
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len)
+{
+	const u8 *ip = src;
+	const u8 *const iend = src + src_len;
+	u8 *op = dest;
+	u8 *const oend = dest + *dest_len;
+
+	while (ip < iend) {
+		unsigned int token = *ip++;
+		size_t length, offset;
+
+		/* literal run */
+		length = token >> ML_BITS;
+		if (length == RUN_MASK && !lz4_read_length(&ip, iend, &length))
+			goto _output_error;
+		if (length > (size_t)(iend - ip) ||
+		    length > (size_t)(oend - op))
+			goto _output_error;
+		memcpy(op, ip, length);
+		ip += length;
+		op += length;
+
+		/* the last sequence has no match */
+		if (ip == iend)
+			break;
+
+		/* match */
+		if (iend - ip < 2)
+			goto _output_error;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - dest))
+			goto _output_error;
+
+		length = token & ML_MASK;
+		if (length == ML_MASK && !lz4_read_length(&ip, iend, &length))
+			goto _output_error;
+		length += MINMATCH;
+		if (length > (size_t)(oend - op))
+			goto _output_error;
+
+		lz4_copy_match(op, offset, length);
+		op += length;
+	}
+
+	*dest_len = op - dest;
+	return 0;
+
+	/* write overflow error detected */
+_output_error:
+	return -1;
+}
+#ifndef STATIC
+EXPORT_SYMBOL(lz4_decompress_unknownoutputsize);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
+#endif
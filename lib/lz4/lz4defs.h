@@ -0,0 +1,29 @@
+/*
+ *  lz4defs.h -- LZ4 block format constants
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+/*
+ * A block is a sequence of (literals, match) pairs.  Each starts with a
+ * token byte: the high nibble is the literal run length, the low nibble
+ * the match length less MINMATCH.  A nibble of 15 is continued by bytes
+ * that are added to it until one is not 255.  The literals are followed
+ * by a 16 bit little endian match offset and the match length bytes.
+ * The last sequence of a block is literals only.
+ */
+#define MINMATCH	4
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+#define MAXD_LOG	16
+#define MAX_DISTANCE	((1 << MAXD_LOG) - 1)
+
+/* the last 5 bytes are always literals, the last match starts 12 before */
+#define LASTLITERALS	5
+#define MFLIMIT		(8 + MINMATCH)
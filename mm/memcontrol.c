@@ -88,6 +88,7 @@ enum mem_cgroup_stat_index {
 	MEM_CGROUP_STAT_RSS,	   /* # of pages charged as anon rss */
 	MEM_CGROUP_STAT_FILE_MAPPED,  /* # of pages charged as file rss */
 	MEM_CGROUP_STAT_SWAPOUT, /* # of pages, swapped out */
+	MEM_CGROUP_STAT_ION,	   /* # of pages allocated from ion heaps */
 	MEM_CGROUP_STAT_DATA, /* end of data requires synchronization */
 	MEM_CGROUP_STAT_NSTATS,
 };
@@ -1010,6 +1011,42 @@ out:
 }
 EXPORT_SYMBOL(mem_cgroup_count_vm_event);
 
+/*
+ * ion buffers are not on any LRU and are not charged against the limit,
+ * they are only reported in memory.stat.  Their owner keeps a reference
+ * on the memcg it charged so the uncharge lands in the same place even
+ * after the task moved or the mm lost its owner.
+ */
+struct mem_cgroup *mem_cgroup_ion_get(struct mm_struct *mm)
+{
+	struct mem_cgroup *memcg;
+
+	if (mem_cgroup_disabled() || !mm)
+		return NULL;
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(rcu_dereference(mm->owner));
+	if (memcg)
+		mem_cgroup_get(memcg);
+	rcu_read_unlock();
+	return memcg;
+}
+EXPORT_SYMBOL(mem_cgroup_ion_get);
+
+void mem_cgroup_ion_put(struct mem_cgroup *memcg)
+{
+	if (memcg)
+		mem_cgroup_put(memcg);
+}
+EXPORT_SYMBOL(mem_cgroup_ion_put);
+
+void mem_cgroup_ion_stat(struct mem_cgroup *memcg, long nr_pages)
+{
+	if (memcg)
+		this_cpu_add(memcg->stat->count[MEM_CGROUP_STAT_ION], nr_pages);
+}
+EXPORT_SYMBOL(mem_cgroup_ion_stat);
+
 /**
  * mem_cgroup_zone_lruvec - get the lru list vector for a zone and memcg
  * @zone: zone of the wanted lruvec
@@ -4049,6 +4086,7 @@ enum {
 	MCS_PGPGIN,
 	MCS_PGPGOUT,
 	MCS_SWAP,
+	MCS_ION,
 	MCS_PGFAULT,
 	MCS_PGMAJFAULT,
 	MCS_INACTIVE_ANON,
@@ -4073,6 +4111,7 @@ struct {
 	{"pgpgin", "total_pgpgin"},
 	{"pgpgout", "total_pgpgout"},
 	{"swap", "total_swap"},
+	{"ion", "total_ion"},
 	{"pgfault", "total_pgfault"},
 	{"pgmajfault", "total_pgmajfault"},
 	{"inactive_anon", "total_inactive_anon"},
@@ -4103,6 +4142,8 @@ mem_cgroup_get_local_stat(struct mem_cgroup *memcg, struct mcs_total_stat *s)
 		val = mem_cgroup_read_stat(memcg, MEM_CGROUP_STAT_SWAPOUT);
 		s->stat[MCS_SWAP] += val * PAGE_SIZE;
 	}
+	val = mem_cgroup_read_stat(memcg, MEM_CGROUP_STAT_ION);
+	s->stat[MCS_ION] += val * PAGE_SIZE;
 	val = mem_cgroup_read_events(memcg, MEM_CGROUP_EVENTS_PGFAULT);
 	s->stat[MCS_PGFAULT] += val;
 	val = mem_cgroup_read_events(memcg, MEM_CGROUP_EVENTS_PGMAJFAULT);
@@ -210,6 +210,7 @@ unsigned int oom_badness(struct task_struct *p, struct mem_cgroup *memcg,
 	 */
 	points = get_mm_rss(p->mm) + p->mm->nr_ptes;
 	points += get_mm_counter(p->mm, MM_SWAPENTS);
+	points += get_mm_counter(p->mm, MM_IONPAGES);
 
 	points *= 1000;
 	points /= totalpages;
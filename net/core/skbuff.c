@@ -1762,6 +1762,72 @@ done:
 	return ret;
 }
 
+/*
+ * Confirm the buffers that the next splice_from_pipe_feed() will consume,
+ * so that waiting for page cache reads happens before the socket is
+ * locked.  Stops at the first buffer that fails; the feed reports that
+ * error when it gets there.  Called with the pipe locked.
+ */
+static void skb_splice_confirm(struct pipe_inode_info *pipe, size_t len)
+{
+	int i;
+
+	for (i = 0; i < pipe->nrbufs && len; i++) {
+		struct pipe_buffer *buf;
+
+		buf = pipe->bufs + ((pipe->curbuf + i) & (pipe->buffers - 1));
+		if (buf->ops->confirm(pipe, buf))
+			break;
+		len -= min_t(size_t, len, buf->len);
+	}
+}
+
+/**
+ *	skb_splice_from_pipe - feed pipe buffers to a socket
+ *	@pipe: pipe to splice from
+ *	@sk: socket to splice to
+ *	@len: number of bytes to splice
+ *	@flags: splice modifier flags
+ *	@actor: attaches one pipe buffer to the send queue of @sk
+ *
+ *	The sending counterpart of skb_splice_bits(). @actor is called with
+ *	@sk locked for every buffer queued in the pipe, so the pages of a
+ *	full pipe, page cache pages from a file or user pages gifted with
+ *	vmsplice(), are referenced from skb frags under a single
+ *	lock_sock(). The buffers are confirmed beforehand, so a cold page
+ *	cache page is read in without the socket locked. The socket lock is
+ *	only dropped while waiting for the pipe to be refilled. The pipe lock
+ *	is taken before the socket lock, as for ->sendpage().
+ */
+ssize_t skb_splice_from_pipe(struct pipe_inode_info *pipe, struct sock *sk,
+			     size_t len, unsigned int flags,
+			     splice_actor *actor)
+{
+	struct splice_desc sd = {
+		.total_len = len,
+		.flags = flags,
+		.u.data = sk,
+	};
+	int ret;
+
+	pipe_lock(pipe);
+	splice_from_pipe_begin(&sd);
+	do {
+		ret = splice_from_pipe_next(pipe, &sd);
+		if (ret > 0) {
+			skb_splice_confirm(pipe, sd.total_len);
+			lock_sock(sk);
+			ret = splice_from_pipe_feed(pipe, &sd, actor);
+			release_sock(sk);
+		}
+	} while (ret > 0);
+	splice_from_pipe_end(pipe, &sd);
+	pipe_unlock(pipe);
+
+	return sd.num_spliced ? sd.num_spliced : ret;
+}
+EXPORT_SYMBOL(skb_splice_from_pipe);
+
 /**
  *	skb_store_bits - store bits from kernel buffer to skb
  *	@skb: destination buffer
@@ -902,6 +902,58 @@ int tcp_sendpage(struct sock *sk, struct page *page, int offset,
 }
 EXPORT_SYMBOL(tcp_sendpage);
 
+/*
+ * Reference one pipe buffer from the write queue. Called by
+ * skb_splice_from_pipe() with the socket locked.
+ */
+static int tcp_pipe_to_skb(struct pipe_inode_info *pipe,
+			   struct pipe_buffer *buf, struct splice_desc *sd)
+{
+	struct sock *sk = sd->u.data;
+	int flags = 0;
+
+	if (sk->sk_socket->file->f_flags & O_NONBLOCK)
+		flags |= MSG_DONTWAIT;
+	if (sd->flags & SPLICE_F_MORE)
+		flags |= MSG_MORE;
+	/* Push once the pipe runs dry, rather than wait for a refill */
+	if (sd->len < sd->total_len && pipe->nrbufs > 1)
+		flags |= MSG_SENDPAGE_NOTLAST;
+
+	return do_tcp_sendpages(sk, &buf->page, buf->offset, sd->len, flags);
+}
+
+/**
+ *  tcp_splice_write - splice data from a pipe to a TCP socket
+ * @pipe:	pipe to splice from
+ * @sock:	socket to splice to
+ * @ppos:	position (not valid)
+ * @len:	number of bytes to splice
+ * @flags:	splice modifier flags
+ *
+ * Description:
+ *    Will put the pages of the pipe buffers in skb frags without copying
+ *    them, all buffers available at once under one socket lock.  Routes
+ *    without scatter-gather and checksum offload take the copying
+ *    ->sendpage() path instead.
+ *
+ **/
+ssize_t tcp_splice_write(struct pipe_inode_info *pipe, struct socket *sock,
+			 loff_t *ppos, size_t len, unsigned int flags)
+{
+	struct sock *sk = sock->sk;
+
+	sock_rps_record_flow(sk);
+
+	if (!(sk->sk_route_caps & NETIF_F_SG) ||
+	    !(sk->sk_route_caps & NETIF_F_ALL_CSUM))
+		return generic_splice_sendpage(pipe, sock->file, ppos, len,
+					       flags);
+
+	return skb_splice_from_pipe(pipe, sk, len, flags, tcp_pipe_to_skb);
+}
+EXPORT_SYMBOL(tcp_splice_write);
+
 static inline int select_size(const struct sock *sk, bool sg)
 {
 	const struct tcp_sock *tp = tcp_sk(sk);
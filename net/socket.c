@@ -129,6 +129,9 @@ static ssize_t sock_sendpage(struct file *file, struct page *page,
 static ssize_t sock_splice_read(struct file *file, loff_t *ppos,
 				struct pipe_inode_info *pipe, size_t len,
 				unsigned int flags);
+static ssize_t sock_splice_write(struct pipe_inode_info *pipe,
+				 struct file *out, loff_t *ppos, size_t len,
+				 unsigned int flags);
 
 /*
  *	Socket files have a set of 'special' operations as well as the generic file ones. These don't appear
@@ -150,7 +153,7 @@ static const struct file_operations socket_file_ops = {
 	.release =	sock_close,
 	.fasync =	sock_fasync,
 	.sendpage =	sock_sendpage,
-	.splice_write = generic_splice_sendpage,
+	.splice_write = sock_splice_write,
 	.splice_read =	sock_splice_read,
 };
 
@@ -835,6 +838,19 @@ static ssize_t sock_splice_read(struct file *file, loff_t *ppos,
 	return sock->ops->splice_read(sock, ppos, pipe, len, flags);
 }
 
+static ssize_t sock_splice_write(struct pipe_inode_info *pipe,
+				 struct file *out, loff_t *ppos, size_t len,
+				 unsigned int flags)
+{
+	struct socket *sock = out->private_data;
+
+	/* One ->sendpage() per pipe buffer, unless the protocol can batch */
+	if (!sock->ops->splice_write)
+		return generic_splice_sendpage(pipe, out, ppos, len, flags);
+
+	return sock->ops->splice_write(pipe, sock, ppos, len, flags);
+}
+
 static struct sock_iocb *alloc_sock_iocb(struct kiocb *iocb,
 					 struct sock_iocb *siocb)
 {
@@ -0,0 +1,430 @@
+/*
+ * aiobench: random read IOPS with pread, io_submit and the aio submission ring
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Keeps a fixed number of random, block aligned reads in flight against a
+ * file or block device for a while, and reports the rate, the latency
+ * distribution and the number of system calls per read.  The modes are:
+ *
+ *	pread	one thread per queue slot, each doing blocking pread()s
+ *	submit	io_submit() with an array of iocbs, io_getevents() to reap
+ *	ring	iocbs queued on the submission ring and submitted with
+ *		io_submit(ctx, n, NULL), completions reaped straight from
+ *		the mapped completion ring, io_getevents() only to wait
+ *
+ * Reads are buffered unless -d is given.  With -c the page cache for the
+ * target is dropped before the run, so buffered reads miss and io_submit
+ * has to hand them to the aio read workers (fs.aio-read-workers) instead
+ * of waiting for them itself.
+ *
+ * Example, on a 512MiB RAM disk:
+ *
+ *	modprobe brd rd_nr=1 rd_size=524288
+ *	dd if=/dev/urandom of=/dev/ram0 bs=1M count=512
+ *	aiobench -m pread -q 32 -c /dev/ram0
+ *	aiobench -m submit -q 32 -c /dev/ram0
+ *	aiobench -m ring -q 32 -c /dev/ram0
+ *	aiobench -m ring -q 32 -d /dev/ram0
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+#ifndef IOCTX_FLAG_SQRING
+#define IOCTX_FLAG_SQRING	(1U << 31)
+#define AIO_RING_COMPAT_SQRING	2
+
+struct aio_sq_ring {
+	__u32	head;
+	__u32	tail;
+	__u32	nr;
+	__u32	reserved[13];
+	struct iocb	iocbs[0];
+};
+#endif
+
+/* The completion ring header, as mapped at the context id */
+struct aio_ring {
+	unsigned	id;
+	unsigned	nr;
+	unsigned	head;
+	unsigned	tail;
+	unsigned	magic;
+	unsigned	compat_features;
+	unsigned	incompat_features;
+	unsigned	header_length;
+	struct io_event	io_events[0];
+};
+
+enum { MODE_PREAD, MODE_SUBMIT, MODE_RING };
+
+static const char *path;
+static int mode = MODE_SUBMIT;
+static unsigned int depth = 32;
+static unsigned int bs = 4096;
+static unsigned int seconds = 10;
+static int direct;
+static int cold;
+
+static int fd;
+static unsigned long long nblocks;
+static volatile int stop;
+
+static unsigned long long reads;
+static unsigned long long syscalls;
+static unsigned long *lat;
+static unsigned long nlat, maxlat;
+static pthread_mutex_t lat_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static unsigned long long rand_block(unsigned int *seed)
+{
+	unsigned long long r;
+
+	r = (unsigned long long)rand_r(seed) << 31 | rand_r(seed);
+	return r % nblocks;
+}
+
+/* Latencies go into a fixed buffer; later ones are dropped */
+static void record(unsigned long ns)
+{
+	if (nlat < maxlat)
+		lat[nlat++] = ns;
+}
+
+static void *pread_thread(void *arg)
+{
+	unsigned int seed = (unsigned long)arg;
+	unsigned long long n = 0, calls = 0;
+	unsigned long start;
+	void *buf;
+
+	if (posix_memalign(&buf, 4096, bs))
+		return NULL;
+	while (!stop) {
+		start = now_ns();
+		if (pread(fd, buf, bs, rand_block(&seed) * bs) != (ssize_t)bs) {
+			perror("pread");
+			exit(1);
+		}
+		start = now_ns() - start;
+		pthread_mutex_lock(&lat_lock);
+		record(start);
+		pthread_mutex_unlock(&lat_lock);
+		n++;
+		calls++;
+	}
+	pthread_mutex_lock(&lat_lock);
+	reads += n;
+	syscalls += calls;
+	pthread_mutex_unlock(&lat_lock);
+	free(buf);
+	return NULL;
+}
+
+static void run_pread(void)
+{
+	pthread_t *tids = calloc(depth, sizeof(*tids));
+	unsigned int i;
+
+	for (i = 0; i < depth; i++)
+		if (pthread_create(&tids[i], NULL, pread_thread,
+				   (void *)(unsigned long)(i + 1))) {
+			perror("pthread_create");
+			exit(1);
+		}
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < depth; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+}
+
+static void prep(struct iocb *cb, void *buf, unsigned int slot,
+		 unsigned int *seed)
+{
+	memset(cb, 0, sizeof(*cb));
+	cb->aio_data = slot;
+	cb->aio_lio_opcode = IOCB_CMD_PREAD;
+	cb->aio_fildes = fd;
+	cb->aio_buf = (unsigned long)buf;
+	cb->aio_nbytes = bs;
+	cb->aio_offset = rand_block(seed) * bs;
+}
+
+static void complete(struct io_event *ev, unsigned long *issued)
+{
+	if (ev->res != (long long)bs) {
+		fprintf(stderr, "read failed: %lld\n", (long long)ev->res);
+		exit(1);
+	}
+	record(now_ns() - issued[ev->data]);
+	reads++;
+}
+
+static void run_aio(void)
+{
+	unsigned int setup = depth + 1;
+	struct io_event *events = calloc(depth, sizeof(*events));
+	struct iocb *cbs = calloc(depth, sizeof(*cbs));
+	struct iocb **cbp = calloc(depth, sizeof(*cbp));
+	unsigned long *issued = calloc(depth, sizeof(*issued));
+	void **bufs = calloc(depth, sizeof(*bufs));
+	unsigned int *ready = calloc(depth, sizeof(*ready));
+	struct aio_sq_ring *sq = NULL;
+	struct aio_ring *ring;
+	aio_context_t ctx = 0;
+	unsigned int seed = 1, nready, i;
+	unsigned long end;
+	long ret;
+
+	if (mode == MODE_RING)
+		setup |= IOCTX_FLAG_SQRING;
+	if (syscall(__NR_io_setup, setup, &ctx)) {
+		/* older kernels see the flag as a huge nr_events */
+		if ((errno == EINVAL || errno == EAGAIN) && mode == MODE_RING)
+			fprintf(stderr, "no aio submission ring support\n");
+		else
+			perror("io_setup");
+		exit(1);
+	}
+	ring = (struct aio_ring *)ctx;
+	if (mode == MODE_RING) {
+		long page = sysconf(_SC_PAGESIZE);
+		unsigned long off = ring->header_length +
+			ring->nr * sizeof(struct io_event);
+
+		if (!(ring->compat_features & AIO_RING_COMPAT_SQRING)) {
+			fprintf(stderr, "no submission ring in the mapping\n");
+			exit(1);
+		}
+		sq = (struct aio_sq_ring *)(ctx + ((off + page - 1) & ~(page - 1)));
+	}
+
+	for (i = 0; i < depth; i++) {
+		if (posix_memalign(&bufs[i], 4096, bs)) {
+			perror("posix_memalign");
+			exit(1);
+		}
+		ready[i] = i;
+	}
+	nready = depth;
+
+	end = now_ns() + seconds * 1000000000UL;
+	while (now_ns() < end) {
+		/* (re)issue every free slot with one call */
+		if (mode == MODE_RING) {
+			unsigned int tail = sq->tail;
+
+			for (i = 0; i < nready; i++) {
+				prep(&sq->iocbs[tail], bufs[ready[i]], ready[i], &seed);
+				issued[ready[i]] = now_ns();
+				if (++tail == sq->nr)
+					tail = 0;
+			}
+			__sync_synchronize();
+			sq->tail = tail;
+			ret = syscall(__NR_io_submit, ctx, (long)nready, NULL);
+		} else {
+			for (i = 0; i < nready; i++) {
+				prep(&cbs[ready[i]], bufs[ready[i]], ready[i], &seed);
+				issued[ready[i]] = now_ns();
+				cbp[i] = &cbs[ready[i]];
+			}
+			ret = syscall(__NR_io_submit, ctx, (long)nready, cbp);
+		}
+		syscalls++;
+		if (ret != (long)nready) {
+			perror("io_submit");
+			exit(1);
+		}
+		nready = 0;
+
+		/* reap from the mapped ring, only entering the kernel to wait */
+		if (mode == MODE_RING) {
+			unsigned int head = ring->head;
+
+			while (head != ring->tail) {
+				__sync_synchronize();
+				complete(&ring->io_events[head], issued);
+				ready[nready++] = ring->io_events[head].data;
+				if (++head == ring->nr)
+					head = 0;
+			}
+			__sync_synchronize();
+			ring->head = head;
+			if (nready)
+				continue;
+		}
+		ret = syscall(__NR_io_getevents, ctx, 1L, (long)depth, events, NULL);
+		syscalls++;
+		if (ret < 0) {
+			perror("io_getevents");
+			exit(1);
+		}
+		for (i = 0; i < ret; i++) {
+			complete(&events[i], issued);
+			ready[nready++] = events[i].data;
+		}
+	}
+
+	/* io_destroy waits for whatever is still in flight */
+	syscall(__NR_io_destroy, ctx);
+	for (i = 0; i < depth; i++)
+		free(bufs[i]);
+	free(events);
+	free(cbs);
+	free(cbp);
+	free(issued);
+	free(bufs);
+	free(ready);
+}
+
+static void drop_cache(void)
+{
+	fdatasync(fd);
+	if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED))
+		perror("posix_fadvise");
+}
+
+static int cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double pct(unsigned long *sorted, unsigned int n, unsigned int permille)
+{
+	unsigned int idx = (unsigned long)n * permille / 1000;
+
+	if (!n)
+		return 0;
+	if (idx >= n)
+		idx = n - 1;
+	return sorted[idx] / 1000.0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] FILE|BLOCKDEV\n"
+		"  -m MODE   pread, submit or ring (default submit)\n"
+		"  -q N      reads in flight (default 32)\n"
+		"  -b N      read size, a multiple of 512 (default 4096)\n"
+		"  -t N      seconds to run (default 10)\n"
+		"  -d        O_DIRECT\n"
+		"  -c        drop the page cache for the target first\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long start, wall;
+	off_t size;
+	int c;
+
+	while ((c = getopt(argc, argv, "m:q:b:t:dch")) != -1) {
+		switch (c) {
+		case 'm':
+			if (!strcmp(optarg, "pread"))
+				mode = MODE_PREAD;
+			else if (!strcmp(optarg, "submit"))
+				mode = MODE_SUBMIT;
+			else if (!strcmp(optarg, "ring"))
+				mode = MODE_RING;
+			else
+				usage(argv[0]);
+			break;
+		case 'q':
+			depth = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bs = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			direct = 1;
+			break;
+		case 'c':
+			cold = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || !depth || !bs || bs % 512 || !seconds)
+		usage(argv[0]);
+	path = argv[optind];
+
+	fd = open(path, O_RDONLY | (direct ? O_DIRECT : 0));
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+	size = lseek(fd, 0, SEEK_END);
+	if (size < (off_t)bs) {
+		fprintf(stderr, "%s: too small\n", path);
+		return 1;
+	}
+	nblocks = size / bs;
+
+	/* room for a million latencies per second should be plenty */
+	maxlat = 1000000UL * seconds;
+	lat = malloc(maxlat * sizeof(*lat));
+	if (!lat) {
+		perror("malloc");
+		return 1;
+	}
+	if (cold)
+		drop_cache();
+
+	start = now_ns();
+	if (mode == MODE_PREAD)
+		run_pread();
+	else
+		run_aio();
+	wall = now_ns() - start;
+
+	qsort(lat, nlat, sizeof(*lat), cmp_ulong);
+	printf("%s, %u in flight, %u byte %s reads%s\n",
+	       mode == MODE_PREAD ? "pread" : mode == MODE_SUBMIT ?
+	       "io_submit" : "submission ring", depth, bs,
+	       direct ? "direct" : "buffered", cold ? ", cold cache" : "");
+	printf("%12s %10s %10s %10s %10s %10s %12s\n", "reads/s", "MiB/s",
+	       "p50", "p90", "p99", "max(us)", "calls/read");
+	printf("%12.0f %10.1f %10.1f %10.1f %10.1f %10.1f %12.3f\n",
+	       reads / (wall / 1e9), reads * bs / (wall / 1e9) / 1048576,
+	       pct(lat, nlat, 500), pct(lat, nlat, 900), pct(lat, nlat, 990),
+	       pct(lat, nlat, 1000), reads ? (double)syscalls / reads : 0.0);
+	return 0;
+}
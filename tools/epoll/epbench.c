@@ -0,0 +1,372 @@
+/*
+ * epbench: multi-threaded epoll event delivery and wakeup benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * Two workloads, both on eventfds so that no network stack is involved:
+ *
+ *	shared	one epoll set watching many eventfds, with producer threads
+ *		signalling random eventfds as fast as they can and worker
+ *		threads all sitting in epoll_wait() on the set, reading
+ *		whatever is reported ready.  This is the busy daemon case,
+ *		where the poll callbacks race with the event transfer.
+ *	herd	one eventfd added to a private epoll set per worker, with a
+ *		single producer signalling it once and waiting for a worker
+ *		to consume the event before signalling again.  Without -x
+ *		every worker wakes up for each event and all but one find
+ *		nothing ready and go back to sleep inside epoll_wait(); with
+ *		-x (EPOLLEXCLUSIVE) only one should.  Those wake ups never
+ *		reach userspace, they show in the cpu time per event.
+ *
+ * Example:
+ *
+ *	epbench -m shared -w 8 -p 4 -n 4096
+ *	epbench -m shared -w 8 -p 4 -n 4096 -e
+ *	epbench -m herd -w 16
+ *	epbench -m herd -w 16 -x
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE	(1U << 28)
+#endif
+
+#define MAX_EVENTS	64
+
+enum { MODE_SHARED, MODE_HERD };
+
+static int mode = MODE_SHARED;
+static unsigned int workers = 4;
+static unsigned int producers = 2;
+static unsigned int nfds = 1024;
+static unsigned int seconds = 5;
+static int edge;
+static int exclusive;
+
+static int *fds;
+static int shared_epfd;
+static volatile int stop;
+
+/* per worker counters, padded apart */
+struct worker {
+	pthread_t tid;
+	int epfd;
+	unsigned long long events;
+	unsigned long long waits;
+	unsigned long long spurious;
+	char pad[64];
+};
+
+static struct worker *w;
+
+/* herd mode hand-off between the producer and the workers */
+static volatile unsigned long herd_done;
+static unsigned long herd_sent;
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void *producer(void *arg)
+{
+	unsigned int seed = (unsigned long)arg;
+	uint64_t one = 1;
+
+	while (!stop)
+		if (write(fds[rand_r(&seed) % nfds], &one, sizeof(one)) < 0 &&
+		    errno != EAGAIN) {
+			perror("write");
+			exit(1);
+		}
+	return NULL;
+}
+
+static void *worker(void *arg)
+{
+	struct worker *me = arg;
+	struct epoll_event ev[MAX_EVENTS];
+	uint64_t val;
+	int i, n;
+
+	while (!stop) {
+		n = epoll_wait(me->epfd, ev, MAX_EVENTS, 100);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			exit(1);
+		}
+		if (!n)
+			continue;
+		me->waits++;
+		for (i = 0; i < n; i++) {
+			if (read(ev[i].data.fd, &val, sizeof(val)) < 0) {
+				if (errno != EAGAIN) {
+					perror("read");
+					exit(1);
+				}
+				/* someone else got it first */
+				me->spurious++;
+				continue;
+			}
+			me->events++;
+			if (mode == MODE_HERD)
+				__sync_fetch_and_add(&herd_done, 1);
+		}
+	}
+	return NULL;
+}
+
+static int add_fd(int epfd, int fd)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	if (edge)
+		ev.events |= EPOLLET;
+	if (exclusive)
+		ev.events |= EPOLLEXCLUSIVE;
+	ev.data.fd = fd;
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void setup(void)
+{
+	unsigned int i;
+
+	fds = calloc(nfds, sizeof(*fds));
+	w = calloc(workers, sizeof(*w));
+	if (!fds || !w) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0; i < nfds; i++) {
+		fds[i] = eventfd(0, EFD_NONBLOCK);
+		if (fds[i] < 0) {
+			perror("eventfd");
+			exit(1);
+		}
+	}
+
+	if (mode == MODE_SHARED) {
+		shared_epfd = epoll_create1(0);
+		for (i = 0; i < nfds; i++)
+			if (add_fd(shared_epfd, fds[i])) {
+				perror("epoll_ctl");
+				exit(1);
+			}
+	}
+	for (i = 0; i < workers; i++) {
+		if (mode == MODE_SHARED) {
+			w[i].epfd = shared_epfd;
+			continue;
+		}
+		w[i].epfd = epoll_create1(0);
+		if (add_fd(w[i].epfd, fds[0])) {
+			if (errno == EINVAL && exclusive)
+				fprintf(stderr, "no EPOLLEXCLUSIVE support\n");
+			else
+				perror("epoll_ctl");
+			exit(1);
+		}
+	}
+}
+
+/* One event at a time, each signalled only once the last is consumed */
+static void run_herd(unsigned long *lat, unsigned long maxlat)
+{
+	unsigned long end = now_ns() + seconds * 1000000000UL;
+	unsigned long start;
+	uint64_t one = 1;
+
+	while (now_ns() < end) {
+		start = now_ns();
+		if (write(fds[0], &one, sizeof(one)) < 0) {
+			perror("write");
+			exit(1);
+		}
+		while (herd_done == herd_sent)
+			if (now_ns() > end)
+				return;
+		if (herd_sent < maxlat)
+			lat[herd_sent] = now_ns() - start;
+		herd_sent++;
+	}
+}
+
+/* user plus system time of the whole process */
+static unsigned long cpu_ns(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000UL +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000UL;
+}
+
+static int cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double pct(unsigned long *sorted, unsigned long n, unsigned int permille)
+{
+	unsigned long idx = n * permille / 1000;
+
+	if (!n)
+		return 0;
+	if (idx >= n)
+		idx = n - 1;
+	return sorted[idx] / 1000.0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -m MODE   shared or herd (default shared)\n"
+		"  -w N      worker threads (default 4)\n"
+		"  -p N      producer threads, shared mode (default 2)\n"
+		"  -n N      eventfds, shared mode (default 1024)\n"
+		"  -t N      seconds to run (default 5)\n"
+		"  -e        edge triggered\n"
+		"  -x        EPOLLEXCLUSIVE\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long events = 0, waits = 0, spurious = 0;
+	unsigned long *lat = NULL, maxlat = 0, nlat;
+	pthread_t *ptid = NULL;
+	unsigned long start, wall, cpu;
+	unsigned int i;
+	int c;
+
+	while ((c = getopt(argc, argv, "m:w:p:n:t:exh")) != -1) {
+		switch (c) {
+		case 'm':
+			if (!strcmp(optarg, "shared"))
+				mode = MODE_SHARED;
+			else if (!strcmp(optarg, "herd"))
+				mode = MODE_HERD;
+			else
+				usage(argv[0]);
+			break;
+		case 'w':
+			workers = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			producers = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			nfds = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			edge = 1;
+			break;
+		case 'x':
+			exclusive = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !workers || !producers || !nfds || !seconds)
+		usage(argv[0]);
+	if (mode == MODE_HERD)
+		nfds = 1;
+
+	setup();
+	for (i = 0; i < workers; i++)
+		if (pthread_create(&w[i].tid, NULL, worker, &w[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+
+	cpu = cpu_ns();
+	start = now_ns();
+	if (mode == MODE_SHARED) {
+		ptid = calloc(producers, sizeof(*ptid));
+		for (i = 0; i < producers; i++)
+			if (pthread_create(&ptid[i], NULL, producer,
+					   (void *)(unsigned long)(i + 1))) {
+				perror("pthread_create");
+				return 1;
+			}
+		sleep(seconds);
+	} else {
+		maxlat = 1000000UL * seconds;
+		lat = malloc(maxlat * sizeof(*lat));
+		if (!lat) {
+			perror("malloc");
+			return 1;
+		}
+		run_herd(lat, maxlat);
+	}
+	wall = now_ns() - start;
+	cpu = cpu_ns() - cpu;
+	stop = 1;
+
+	if (mode == MODE_SHARED)
+		for (i = 0; i < producers; i++)
+			pthread_join(ptid[i], NULL);
+	for (i = 0; i < workers; i++) {
+		pthread_join(w[i].tid, NULL);
+		events += w[i].events;
+		waits += w[i].waits;
+		spurious += w[i].spurious;
+	}
+
+	if (mode == MODE_SHARED) {
+		printf("shared set, %u eventfds, %u producers, %u workers, %s\n",
+		       nfds, producers, workers,
+		       edge ? "edge triggered" : "level triggered");
+		printf("%12s %12s %12s %12s %12s\n", "events/s", "waits/s",
+		       "events/wait", "spurious", "cpu(us)/ev");
+		printf("%12.0f %12.0f %12.2f %12llu %12.2f\n",
+		       events / (wall / 1e9), waits / (wall / 1e9),
+		       waits ? (double)events / waits : 0.0, spurious,
+		       events ? cpu / 1e3 / events : 0.0);
+		return 0;
+	}
+
+	nlat = herd_sent < maxlat ? herd_sent : maxlat;
+	qsort(lat, nlat, sizeof(*lat), cmp_ulong);
+	printf("herd, %u workers%s\n", workers,
+	       exclusive ? ", EPOLLEXCLUSIVE" : "");
+	printf("%12s %12s %10s %10s %10s\n", "events/s", "cpu(us)/ev",
+	       "p50", "p99", "max(us)");
+	printf("%12.0f %12.2f %10.1f %10.1f %10.1f\n",
+	       herd_sent / (wall / 1e9),
+	       herd_sent ? cpu / 1e3 / herd_sent : 0.0,
+	       pct(lat, nlat, 500), pct(lat, nlat, 990), pct(lat, nlat, 1000));
+	return 0;
+}
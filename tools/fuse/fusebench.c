@@ -0,0 +1,680 @@
+/*
+ * fusebench: request throughput of a loopback fuse filesystem
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Mounts a tiny fuse filesystem served from this process, speaking the raw
+ * protocol on /dev/fuse, and hammers it from a number of client threads.
+ * The filesystem has a single file whose attributes never stay cached and
+ * which is opened with direct I/O, so every fstat() or pread() of a client
+ * is a round trip through the daemon.  With -q the daemon clones more
+ * channels off the mount's /dev/fuse and serves each from its own thread;
+ * -p binds channel N to CPU N and pins its thread there, so that requests
+ * stay on the CPU they were submitted on.  Needs to run as root.
+ *
+ * With -f the file is backed by a real file, the way a passthrough
+ * filesystem would serve it, and -m seq reads it sequentially through the
+ * page cache over and over.  READ replies are then copied out of the
+ * backing file with pread() and write(), or with -z spliced from it
+ * through a pipe into /dev/fuse with SPLICE_F_MOVE, so that its page cache
+ * pages can be moved into the fuse file instead of being copied twice.
+ * The backing file should not be on tmpfs, whose pages are never moved.
+ *
+ * Example, comparing one queue to one queue per CPU on a quad core:
+ *
+ *	mkdir -p /data/mnt
+ *	fusebench -t 4 /data/mnt
+ *	fusebench -t 4 -q 4 -p /data/mnt
+ *	fusebench -t 4 -q 4 -p -m read -b 64 /data/mnt
+ *
+ * and copied against spliced READ replies:
+ *
+ *	fusebench -t 1 -m seq -b 128 -f /data/big.img /data/mnt
+ *	fusebench -t 1 -m seq -b 128 -f /data/big.img -z /data/mnt
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/uio.h>
+#include "../../include/linux/fuse.h"
+
+#define DATA_INO	2
+#define DATA_NAME	"data"
+#define DATA_SIZE	(1ULL << 30)
+#define MAX_WRITE	(128 << 10)
+#define MAX_SAMPLES	(1 << 20)
+
+enum { MODE_STAT, MODE_READ, MODE_SEQ };
+
+static unsigned long long data_size = DATA_SIZE;
+static int backing_fd = -1;
+static int splice_reply;
+static unsigned int nchans = 1;
+static unsigned int nthreads;
+static unsigned int duration = 5;
+static size_t bufsize = 4 << 10;
+static int mode = MODE_STAT;
+static int bind_cpus;
+static volatile int stop;
+
+struct chan {
+	pthread_t tid;
+	int fd;
+	int cpu;
+	int pipe[2];
+	void *data;
+	unsigned long long served;
+};
+
+struct thread {
+	pthread_t tid;
+	const char *path;
+	int cpu;
+	unsigned long long ops;
+	unsigned long long bytes;
+	unsigned int errors;
+	unsigned int nlat;
+	unsigned long *lat;
+};
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void pin(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static int reply(int fd, struct fuse_in_header *in, int error,
+		 const void *arg, size_t size)
+{
+	struct fuse_out_header out = {
+		.len = sizeof(out) + (error ? 0 : size),
+		.error = error,
+		.unique = in->unique,
+	};
+	struct iovec iov[2] = {
+		{ .iov_base = &out, .iov_len = sizeof(out) },
+		{ .iov_base = (void *)arg, .iov_len = size },
+	};
+
+	/* ENOENT: the request was interrupted and is already gone */
+	if (writev(fd, iov, error ? 1 : 2) < 0 && errno != ENOENT)
+		return -1;
+	return 0;
+}
+
+static void fill_attr(struct fuse_attr *attr, __u64 ino)
+{
+	memset(attr, 0, sizeof(*attr));
+	attr->ino = ino;
+	if (ino == FUSE_ROOT_ID) {
+		attr->mode = S_IFDIR | 0755;
+		attr->nlink = 2;
+	} else {
+		attr->mode = S_IFREG | 0444;
+		attr->nlink = 1;
+		attr->size = data_size;
+		attr->blocks = data_size / 512;
+	}
+	attr->blksize = 4096;
+}
+
+/* Empty the pipe after a failed splice */
+static void drain(struct chan *ch, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = read(ch->pipe[0], ch->data, len < MAX_WRITE ? len : MAX_WRITE);
+		if (n <= 0)
+			break;
+		len -= n;
+	}
+}
+
+/*
+ * Send the READ data from the backing file's page cache: the header and
+ * the pages go through a pipe into /dev/fuse, and with SPLICE_F_MOVE the
+ * kernel may take the pages over instead of copying them.
+ */
+static int reply_splice(struct chan *ch, struct fuse_in_header *in,
+			off_t off, size_t size)
+{
+	struct fuse_out_header out = {
+		.len = sizeof(out) + size,
+		.unique = in->unique,
+	};
+	size_t left = size;
+	ssize_t n;
+
+	if (write(ch->pipe[1], &out, sizeof(out)) != sizeof(out))
+		return -1;
+	while (left) {
+		n = splice(backing_fd, &off, ch->pipe[1], NULL, left,
+			   SPLICE_F_MOVE);
+		if (n <= 0) {
+			/* the backing file shrank under us */
+			drain(ch, sizeof(out) + size - left);
+			return reply(ch->fd, in, -EIO, NULL, 0);
+		}
+		left -= n;
+	}
+
+	n = splice(ch->pipe[0], NULL, ch->fd, NULL, out.len, SPLICE_F_MOVE);
+	if (n < 0 && errno != ENOENT)
+		return -1;
+	return 0;
+}
+
+static int reply_read(struct chan *ch, struct fuse_in_header *in)
+{
+	struct fuse_read_in *ri = (struct fuse_read_in *)(in + 1);
+	size_t size = ri->size;
+	ssize_t n;
+
+	if (ri->offset >= data_size)
+		size = 0;
+	else if (size > data_size - ri->offset)
+		size = data_size - ri->offset;
+
+	if (backing_fd < 0 || !size)
+		return reply(ch->fd, in, 0, ch->data, size);
+	if (splice_reply)
+		return reply_splice(ch, in, ri->offset, size);
+
+	n = pread(backing_fd, ch->data, size, ri->offset);
+	if (n < 0)
+		return reply(ch->fd, in, -errno, NULL, 0);
+	return reply(ch->fd, in, 0, ch->data, n);
+}
+
+static int handle(struct chan *ch, void *buf)
+{
+	struct fuse_in_header *in = buf;
+	int fd = ch->fd;
+	void *arg = in + 1;
+
+	switch (in->opcode) {
+	case FUSE_INIT: {
+		struct fuse_init_in *ii = arg;
+		struct fuse_init_out io = {
+			.major = FUSE_KERNEL_VERSION,
+			.minor = FUSE_KERNEL_MINOR_VERSION,
+			.max_readahead = ii->max_readahead,
+			.flags = ii->flags & FUSE_ASYNC_READ,
+			.max_background = 64,
+			.congestion_threshold = 48,
+			.max_write = MAX_WRITE,
+		};
+		return reply(fd, in, 0, &io, sizeof(io));
+	}
+	case FUSE_LOOKUP: {
+		struct fuse_entry_out eo;
+
+		if (in->nodeid != FUSE_ROOT_ID || strcmp(arg, DATA_NAME))
+			return reply(fd, in, -ENOENT, NULL, 0);
+		memset(&eo, 0, sizeof(eo));
+		eo.nodeid = DATA_INO;
+		eo.entry_valid = 3600;
+		fill_attr(&eo.attr, DATA_INO);
+		return reply(fd, in, 0, &eo, sizeof(eo));
+	}
+	case FUSE_GETATTR: {
+		struct fuse_attr_out ao;
+
+		/* attr_valid is left at zero, so every stat comes here */
+		memset(&ao, 0, sizeof(ao));
+		fill_attr(&ao.attr, in->nodeid);
+		return reply(fd, in, 0, &ao, sizeof(ao));
+	}
+	case FUSE_OPEN:
+	case FUSE_OPENDIR: {
+		struct fuse_open_out oo = {
+			.open_flags = in->opcode == FUSE_OPEN &&
+				      mode != MODE_SEQ ? FOPEN_DIRECT_IO : 0,
+		};
+		return reply(fd, in, 0, &oo, sizeof(oo));
+	}
+	case FUSE_READ:
+		return reply_read(ch, in);
+	case FUSE_READDIR:
+		return reply(fd, in, 0, NULL, 0);
+	case FUSE_RELEASE:
+	case FUSE_RELEASEDIR:
+	case FUSE_FLUSH:
+	case FUSE_DESTROY:
+		return reply(fd, in, 0, NULL, 0);
+	case FUSE_FORGET:
+	case FUSE_BATCH_FORGET:
+	case FUSE_INTERRUPT:
+		return 0;
+	default:
+		return reply(fd, in, -ENOSYS, NULL, 0);
+	}
+}
+
+static void *chan_thread(void *arg)
+{
+	struct chan *ch = arg;
+	size_t size = MAX_WRITE + 4096;
+	void *buf;
+	ssize_t n;
+
+	if (ch->cpu >= 0)
+		pin(ch->cpu);
+
+	buf = malloc(size);
+	if (!buf)
+		return NULL;
+
+	for (;;) {
+		n = read(ch->fd, buf, size);
+		if (n < 0) {
+			/* ENOENT: the request was interrupted before we got it */
+			if (errno == EINTR || errno == EAGAIN || errno == ENOENT)
+				continue;
+			/* ENODEV: unmounted */
+			break;
+		}
+		if ((size_t)n < sizeof(struct fuse_in_header))
+			continue;
+		ch->served++;
+		if (handle(ch, buf))
+			break;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static void *client_thread(void *arg)
+{
+	struct thread *t = arg;
+	unsigned long start;
+	struct stat st;
+	off_t off = 0;
+	char *buf;
+	ssize_t n;
+	int fd;
+
+	pin(t->cpu);
+
+	buf = malloc(bufsize);
+	fd = open(t->path, O_RDONLY);
+	if (!buf || fd < 0) {
+		t->errors++;
+		free(buf);
+		return NULL;
+	}
+
+	while (!stop) {
+		start = now_ns();
+		if (mode == MODE_STAT) {
+			if (fstat(fd, &st))
+				t->errors++;
+		} else if (mode == MODE_READ) {
+			n = pread(fd, buf, bufsize, off);
+			if (n < 0)
+				t->errors++;
+			else
+				t->bytes += n;
+			off += bufsize;
+			if (off + bufsize > data_size)
+				off = 0;
+		} else {
+			n = read(fd, buf, bufsize);
+			if (n < 0)
+				t->errors++;
+			else
+				t->bytes += n;
+			if (n <= 0) {
+				/* reopening drops the cached pages */
+				close(fd);
+				fd = open(t->path, O_RDONLY);
+				if (fd < 0) {
+					t->errors++;
+					break;
+				}
+			}
+		}
+		if (t->nlat < MAX_SAMPLES)
+			t->lat[t->nlat++] = now_ns() - start;
+		t->ops++;
+	}
+
+	if (fd >= 0)
+		close(fd);
+	free(buf);
+	return NULL;
+}
+
+static int cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double pct(unsigned long *sorted, unsigned int n, unsigned int permille)
+{
+	unsigned int idx = (unsigned long)n * permille / 1000;
+
+	if (!n)
+		return 0;
+	if (idx >= n)
+		idx = n - 1;
+	return sorted[idx] / 1000.0;
+}
+
+static void drop_caches(void)
+{
+	int fd;
+
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0 || write(fd, "3", 1) != 1)
+		perror("drop_caches");
+	if (fd >= 0)
+		close(fd);
+}
+
+static unsigned long read_counter(unsigned int dev, const char *name)
+{
+	char path[128];
+	unsigned long val = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/fs/fuse/connections/%u/%s",
+		 dev, name);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%lu", &val) != 1)
+		val = 0;
+	fclose(f);
+	return val;
+}
+
+/* Counters of the connection in the fuse control filesystem */
+static void print_page_moves(const char *mnt)
+{
+	struct stat st;
+
+	if (stat(mnt, &st))
+		return;
+	printf("pages moved %lu, copied %lu\n",
+	       read_counter(minor(st.st_dev), "pages_moved"),
+	       read_counter(minor(st.st_dev), "pages_copied"));
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] MOUNTPOINT\n"
+		"  -q N      number of /dev/fuse channels (default 1)\n"
+		"  -p        bind channel N to CPU N and pin its thread\n"
+		"  -t N      number of client threads (default: online CPUs)\n"
+		"  -m MODE   stat, read or seq (default stat)\n"
+		"  -b SIZE   read size in KiB (default 4)\n"
+		"  -d SECS   duration of the run (default 5)\n"
+		"  -f FILE   serve the contents of FILE\n"
+		"  -z        splice READ replies from FILE with SPLICE_F_MOVE\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	char opts[128], path[4096];
+	const char *backing = NULL;
+	unsigned long long ops, bytes, served;
+	unsigned long *all, start, wall;
+	unsigned int i, n, errors;
+	struct thread *threads;
+	struct chan *chans;
+	long ncpus;
+	int c, ret = 1;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus < 1)
+		ncpus = 1;
+	nthreads = ncpus;
+
+	while ((c = getopt(argc, argv, "q:pt:m:b:d:f:zh")) != -1) {
+		switch (c) {
+		case 'q':
+			nchans = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			bind_cpus = 1;
+			break;
+		case 't':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			if (!strcmp(optarg, "stat"))
+				mode = MODE_STAT;
+			else if (!strcmp(optarg, "read"))
+				mode = MODE_READ;
+			else if (!strcmp(optarg, "seq"))
+				mode = MODE_SEQ;
+			else
+				usage(argv[0]);
+			break;
+		case 'b':
+			bufsize = strtoul(optarg, NULL, 0) << 10;
+			break;
+		case 'd':
+			duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			backing = optarg;
+			break;
+		case 'z':
+			splice_reply = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || !nchans || !nthreads || !duration ||
+	    !bufsize || bufsize > MAX_WRITE || (splice_reply && !backing))
+		usage(argv[0]);
+
+	if (backing) {
+		struct stat st;
+
+		backing_fd = open(backing, O_RDONLY);
+		if (backing_fd < 0 || fstat(backing_fd, &st)) {
+			perror(backing);
+			return 1;
+		}
+		data_size = st.st_size;
+		if (data_size < bufsize) {
+			fprintf(stderr, "%s: too small\n", backing);
+			return 1;
+		}
+	}
+
+	chans = calloc(nchans, sizeof(*chans));
+	threads = calloc(nthreads, sizeof(*threads));
+	if (!chans || !threads) {
+		perror("calloc");
+		return 1;
+	}
+
+	chans[0].fd = open("/dev/fuse", O_RDWR);
+	if (chans[0].fd < 0) {
+		perror("/dev/fuse");
+		return 1;
+	}
+	snprintf(opts, sizeof(opts),
+		 "fd=%d,rootmode=40000,user_id=%u,group_id=%u,max_read=%u",
+		 chans[0].fd, getuid(), getgid(), MAX_WRITE);
+	if (mount("fusebench", argv[optind], "fuse", MS_NOSUID | MS_NODEV,
+		  opts)) {
+		perror("mount");
+		return 1;
+	}
+
+	for (i = 0; i < nchans; i++) {
+		struct chan *ch = &chans[i];
+		__u32 fd0 = chans[0].fd;
+
+		if (i) {
+			ch->fd = open("/dev/fuse", O_RDWR);
+			if (ch->fd < 0 ||
+			    ioctl(ch->fd, FUSE_DEV_IOC_CLONE, &fd0)) {
+				perror("FUSE_DEV_IOC_CLONE");
+				goto out_umount;
+			}
+		}
+		ch->data = calloc(1, MAX_WRITE);
+		if (!ch->data) {
+			perror("calloc");
+			goto out_umount;
+		}
+		if (splice_reply) {
+			/* room for the header and a full READ reply */
+			if (pipe(ch->pipe) ||
+			    fcntl(ch->pipe[1], F_SETPIPE_SZ, 2 * MAX_WRITE) < 0) {
+				perror("pipe");
+				goto out_umount;
+			}
+		}
+		ch->cpu = -1;
+		if (bind_cpus) {
+			__s32 cpu = i % ncpus;
+
+			if (ioctl(ch->fd, FUSE_DEV_IOC_BIND_CPU, &cpu)) {
+				perror("FUSE_DEV_IOC_BIND_CPU");
+				goto out_umount;
+			}
+			ch->cpu = cpu;
+		}
+		if (pthread_create(&ch->tid, NULL, chan_thread, ch)) {
+			perror("pthread_create");
+			goto out_umount;
+		}
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", argv[optind], DATA_NAME);
+	for (i = 0; i < nthreads; i++) {
+		threads[i].path = path;
+		threads[i].cpu = i % ncpus;
+		threads[i].lat = calloc(MAX_SAMPLES, sizeof(unsigned long));
+		if (!threads[i].lat) {
+			perror("calloc");
+			goto out_umount;
+		}
+	}
+
+	if (mode == MODE_SEQ)
+		drop_caches();
+
+	start = now_ns();
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i].tid, NULL, client_thread,
+				   &threads[i])) {
+			perror("pthread_create");
+			stop = 1;
+			nthreads = i;
+			break;
+		}
+	}
+	sleep(duration);
+	stop = 1;
+
+	ops = 0;
+	bytes = 0;
+	errors = 0;
+	n = 0;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		ops += threads[i].ops;
+		bytes += threads[i].bytes;
+		errors += threads[i].errors;
+	}
+	wall = now_ns() - start;
+
+	all = malloc((size_t)nthreads * MAX_SAMPLES * sizeof(*all));
+	if (all) {
+		for (i = 0; i < nthreads; i++) {
+			memcpy(all + n, threads[i].lat,
+			       threads[i].nlat * sizeof(*all));
+			n += threads[i].nlat;
+		}
+		qsort(all, n, sizeof(*all), cmp_ulong);
+	}
+
+	printf("%u channels%s, %u clients, ", nchans,
+	       bind_cpus ? " (bound)" : "", nthreads);
+	if (mode == MODE_STAT)
+		printf("fstat\n");
+	else
+		printf("%zu KiB %s%s\n", bufsize >> 10,
+		       mode == MODE_READ ? "pread" : "sequential read",
+		       splice_reply ? ", spliced replies" : "");
+	printf("%12s %12s %10s %10s %10s %10s %10s\n", "ops", "ops/s",
+	       "MiB/s", "p50", "p90", "p99", "max(us)");
+	printf("%12llu %12.0f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+	       ops, wall ? ops / (wall / 1e9) : 0.0,
+	       wall ? bytes / 1048576.0 / (wall / 1e9) : 0.0,
+	       pct(all, n, 500), pct(all, n, 900), pct(all, n, 990),
+	       pct(all, n, 1000));
+	if (errors)
+		printf("%u errors\n", errors);
+	if (backing)
+		print_page_moves(argv[optind]);
+	ret = 0;
+
+out_umount:
+	stop = 1;
+	if (umount2(argv[optind], MNT_DETACH))
+		perror("umount");
+	served = 0;
+	for (i = 0; i < nchans && chans[i].tid; i++) {
+		pthread_join(chans[i].tid, NULL);
+		served += chans[i].served;
+	}
+	for (i = 0; i < nchans && chans[i].tid; i++)
+		printf("channel %u: %llu requests (%.1f%%)\n", i,
+		       chans[i].served,
+		       served ? 100.0 * chans[i].served / served : 0.0);
+	for (i = 0; i < nchans; i++)
+		if (chans[i].fd > 0)
+			close(chans[i].fd);
+
+	return ret;
+}
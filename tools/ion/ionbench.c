@@ -0,0 +1,300 @@
+/*
+ * ionbench: exercise the ion userspace interface and report latencies
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Each thread opens its own ion client and repeatedly runs
+ * ION_IOC_ALLOC, ION_IOC_MAP + mmap (touching every page), ION_IOC_SHARE
+ * and ION_IOC_FREE, timing every step.  Optionally a chunk of anonymous
+ * memory is pinned for the duration of the run to apply memory pressure.
+ *
+ * Example, four threads allocating cached 1MB buffers from the system heap:
+ *
+ *	ionbench -H 25 -s 1M -c -t 4 -n 1000
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "../../include/linux/ion.h"
+
+#define ION_SYSTEM_HEAP_ID	25
+
+enum {
+	OP_ALLOC,
+	OP_MAP,
+	OP_SHARE,
+	OP_FREE,
+	NUM_OPS,
+};
+
+static const char *op_names[NUM_OPS] = { "alloc", "map", "share", "free" };
+
+static const char *dev_path = "/dev/ion";
+static unsigned int heap_id = ION_SYSTEM_HEAP_ID;
+static size_t size = 1 << 20;
+static unsigned int flags;
+static unsigned int iterations = 256;
+static unsigned int nthreads = 1;
+static size_t pressure;
+
+struct thread {
+	pthread_t tid;
+	unsigned int done;
+	unsigned int failed;
+	unsigned long *lat[NUM_OPS];
+};
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void *bench_thread(void *arg)
+{
+	struct thread *t = arg;
+	long page_size = sysconf(_SC_PAGESIZE);
+	unsigned int i;
+	int fd;
+
+	fd = open(dev_path, O_RDONLY);
+	if (fd < 0) {
+		perror(dev_path);
+		t->failed = iterations;
+		return NULL;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		struct ion_allocation_data alloc = {
+			.len = size,
+			.align = page_size,
+			.heap_mask = 1U << heap_id,
+			.flags = flags,
+		};
+		struct ion_handle_data free_data;
+		struct ion_fd_data fd_data;
+		unsigned long start;
+		unsigned char *p;
+		size_t off;
+
+		start = now_ns();
+		if (ioctl(fd, ION_IOC_ALLOC, &alloc) < 0) {
+			t->failed++;
+			continue;
+		}
+		t->lat[OP_ALLOC][t->done] = now_ns() - start;
+
+		start = now_ns();
+		fd_data.handle = alloc.handle;
+		if (!ioctl(fd, ION_IOC_MAP, &fd_data)) {
+			p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				 MAP_SHARED, fd_data.fd, 0);
+			if (p != MAP_FAILED) {
+				for (off = 0; off < size; off += page_size)
+					p[off] = 1;
+				munmap(p, size);
+			}
+			close(fd_data.fd);
+		}
+		t->lat[OP_MAP][t->done] = now_ns() - start;
+
+		start = now_ns();
+		fd_data.handle = alloc.handle;
+		if (!ioctl(fd, ION_IOC_SHARE, &fd_data))
+			close(fd_data.fd);
+		t->lat[OP_SHARE][t->done] = now_ns() - start;
+
+		start = now_ns();
+		free_data.handle = alloc.handle;
+		ioctl(fd, ION_IOC_FREE, &free_data);
+		t->lat[OP_FREE][t->done] = now_ns() - start;
+
+		t->done++;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static int cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double pct(unsigned long *sorted, unsigned int n, unsigned int permille)
+{
+	unsigned int idx = (unsigned long)n * permille / 1000;
+
+	if (!n)
+		return 0;
+	if (idx >= n)
+		idx = n - 1;
+	return sorted[idx] / 1000.0;
+}
+
+static size_t parse_size(const char *arg)
+{
+	char *end;
+	size_t val = strtoul(arg, &end, 0);
+
+	switch (*end) {
+	case 'g': case 'G':
+		val <<= 10;
+		/* fall through */
+	case 'm': case 'M':
+		val <<= 10;
+		/* fall through */
+	case 'k': case 'K':
+		val <<= 10;
+	}
+	return val;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -d PATH   ion device (default /dev/ion)\n"
+		"  -H ID     heap id to allocate from (default %d, system)\n"
+		"  -s SIZE   allocation size, k/M suffixes allowed (default 1M)\n"
+		"  -c        allocate cached buffers (ION_FLAG_CACHED)\n"
+		"  -f FLAGS  raw ion allocation flags\n"
+		"  -n N      iterations per thread (default 256)\n"
+		"  -t N      number of threads (default 1)\n"
+		"  -p SIZE   pin SIZE of anonymous memory during the run\n",
+		prog, ION_SYSTEM_HEAP_ID);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct thread *threads;
+	unsigned long *all, start, wall;
+	unsigned int i, op, total = 0, failed = 0;
+	void *hostage = NULL;
+	int c;
+
+	while ((c = getopt(argc, argv, "d:H:s:cf:n:t:p:h")) != -1) {
+		switch (c) {
+		case 'd':
+			dev_path = optarg;
+			break;
+		case 'H':
+			heap_id = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = parse_size(optarg);
+			break;
+		case 'c':
+			flags |= ION_FLAG_CACHED;
+			break;
+		case 'f':
+			flags = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			pressure = parse_size(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!size || !iterations || !nthreads || heap_id >= 32)
+		usage(argv[0]);
+
+	threads = calloc(nthreads, sizeof(*threads));
+	all = calloc((size_t)iterations * nthreads, sizeof(*all));
+	if (!threads || !all) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < nthreads; i++) {
+		for (op = 0; op < NUM_OPS; op++) {
+			threads[i].lat[op] = calloc(iterations,
+						    sizeof(unsigned long));
+			if (!threads[i].lat[op]) {
+				perror("calloc");
+				return 1;
+			}
+		}
+	}
+
+	if (pressure) {
+		hostage = mmap(NULL, pressure, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+			       -1, 0);
+		if (hostage == MAP_FAILED) {
+			perror("mmap pressure");
+			return 1;
+		}
+		mlock(hostage, pressure);
+	}
+
+	start = now_ns();
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i].tid, NULL, bench_thread,
+				   &threads[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		total += threads[i].done;
+		failed += threads[i].failed;
+	}
+	wall = now_ns() - start;
+
+	if (hostage)
+		munmap(hostage, pressure);
+
+	printf("heap %u size %zu flags 0x%x threads %u pressure %zu\n",
+	       heap_id, size, flags, nthreads, pressure);
+	printf("%u iterations ok, %u failed, %.1f ms wall clock, %.1f allocs/s\n",
+	       total, failed, wall / 1e6,
+	       wall ? total / (wall / 1e9) : 0.0);
+	printf("%-6s %10s %10s %10s %10s %10s (us)\n",
+	       "op", "p50", "p90", "p99", "p99.9", "max");
+
+	for (op = 0; op < NUM_OPS; op++) {
+		unsigned int n = 0;
+
+		for (i = 0; i < nthreads; i++) {
+			memcpy(all + n, threads[i].lat[op],
+			       threads[i].done * sizeof(*all));
+			n += threads[i].done;
+		}
+		qsort(all, n, sizeof(*all), cmp_ulong);
+		printf("%-6s %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+		       op_names[op], pct(all, n, 500), pct(all, n, 900),
+		       pct(all, n, 990), pct(all, n, 999), pct(all, n, 1000));
+	}
+
+	return failed ? 2 : 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * iontlb: measure TLB reach of ion buffers mapped into userspace
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Allocates one buffer from an ion heap and maps it twice: once at a 64K
+ * aligned user address, where the kernel can use large page descriptors
+ * for the heap's high order chunks, and once deliberately 4K off that
+ * alignment, which forces small pages.  Each mapping is then walked one
+ * word per page in a random page order, so that nearly every access
+ * needs a new translation, and the average cost per access is reported.
+ *
+ * Example, a 16MB write-combined buffer from the system heap:
+ *
+ *	iontlb -H 25 -s 16M -n 20
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "../../include/linux/ion.h"
+
+#define ION_SYSTEM_HEAP_ID	25
+#define LARGE_PAGE_SIZE		(64 << 10)
+
+static const char *dev_path = "/dev/ion";
+static unsigned int heap_id = ION_SYSTEM_HEAP_ID;
+static size_t size = 16 << 20;
+static unsigned int flags;
+static unsigned int passes = 10;
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/*
+ * Map @fd at an address that is @skew bytes past a 64K boundary.  A
+ * PROT_NONE reservation picks the spot, the buffer is then mapped over
+ * it with MAP_FIXED.
+ */
+static void *map_at(int fd, size_t skew)
+{
+	size_t reserve = size + 2 * LARGE_PAGE_SIZE;
+	uintptr_t base, addr;
+	void *p;
+
+	p = mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+		 -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	base = (uintptr_t)p;
+	addr = ((base + LARGE_PAGE_SIZE - 1) & ~(uintptr_t)(LARGE_PAGE_SIZE - 1))
+		+ skew;
+
+	p = mmap((void *)addr, size, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_FIXED, fd, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	/* give back the unused ends of the reservation */
+	if (addr > base)
+		munmap((void *)base, addr - base);
+	if (base + reserve > addr + size)
+		munmap((void *)(addr + size), base + reserve - addr - size);
+	return p;
+}
+
+/* ns per access for @passes random-order walks over every page of @p */
+static double walk(volatile unsigned int *p, unsigned int *order,
+		   unsigned int npages, long page_size)
+{
+	unsigned long start, sum = 0;
+	unsigned int pass, i;
+	size_t stride = page_size / sizeof(*p);
+
+	/* fault everything in first so only TLB misses are measured */
+	for (i = 0; i < npages; i++)
+		p[i * stride] = i;
+
+	start = now_ns();
+	for (pass = 0; pass < passes; pass++)
+		for (i = 0; i < npages; i++)
+			sum += p[order[i] * stride + (i & 15)];
+	if (sum == 1)
+		printf(" ");
+	return (double)(now_ns() - start) / ((double)passes * npages);
+}
+
+static size_t parse_size(const char *arg)
+{
+	char *end;
+	size_t val = strtoul(arg, &end, 0);
+
+	switch (*end) {
+	case 'g': case 'G':
+		val <<= 10;
+		/* fall through */
+	case 'm': case 'M':
+		val <<= 10;
+		/* fall through */
+	case 'k': case 'K':
+		val <<= 10;
+	}
+	return val;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -d PATH   ion device (default /dev/ion)\n"
+		"  -H ID     heap id to allocate from (default %d, system)\n"
+		"  -s SIZE   buffer size, k/M suffixes allowed (default 16M)\n"
+		"  -c        cached buffer (ION_FLAG_CACHED|ION_FLAG_CACHED_NEEDS_SYNC)\n"
+		"  -n N      passes over the buffer per mapping (default 10)\n",
+		prog, ION_SYSTEM_HEAP_ID);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	struct ion_allocation_data alloc;
+	struct ion_handle_data free_data;
+	struct ion_fd_data fd_data;
+	unsigned int *order, npages, i;
+	void *aligned, *skewed;
+	double t_aligned, t_skewed;
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "d:H:s:cn:h")) != -1) {
+		switch (c) {
+		case 'd':
+			dev_path = optarg;
+			break;
+		case 'H':
+			heap_id = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = parse_size(optarg);
+			break;
+		case 'c':
+			flags = ION_FLAG_CACHED | ION_FLAG_CACHED_NEEDS_SYNC;
+			break;
+		case 'n':
+			passes = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	size &= ~(size_t)(page_size - 1);
+	if (!size || !passes || heap_id >= 32)
+		usage(argv[0]);
+
+	fd = open(dev_path, O_RDONLY);
+	if (fd < 0) {
+		perror(dev_path);
+		return 1;
+	}
+
+	memset(&alloc, 0, sizeof(alloc));
+	alloc.len = size;
+	alloc.align = page_size;
+	alloc.heap_mask = 1U << heap_id;
+	alloc.flags = flags;
+	if (ioctl(fd, ION_IOC_ALLOC, &alloc) < 0) {
+		perror("ION_IOC_ALLOC");
+		return 1;
+	}
+	fd_data.handle = alloc.handle;
+	if (ioctl(fd, ION_IOC_MAP, &fd_data) < 0) {
+		perror("ION_IOC_MAP");
+		return 1;
+	}
+
+	aligned = map_at(fd_data.fd, 0);
+	skewed = map_at(fd_data.fd, page_size);
+	if (!aligned || !skewed) {
+		perror("mmap");
+		return 1;
+	}
+
+	npages = size / page_size;
+	order = malloc(npages * sizeof(*order));
+	if (!order) {
+		perror("malloc");
+		return 1;
+	}
+	for (i = 0; i < npages; i++)
+		order[i] = i;
+	srand(1);
+	for (i = npages - 1; i > 0; i--) {
+		unsigned int j = rand() % (i + 1);
+		unsigned int tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	t_skewed = walk(skewed, order, npages, page_size);
+	t_aligned = walk(aligned, order, npages, page_size);
+
+	printf("heap %u size %zu flags 0x%x pages %u passes %u\n",
+	       heap_id, size, flags, npages, passes);
+	printf("64K aligned mapping:   %8.2f ns/access\n", t_aligned);
+	printf("4K skewed mapping:     %8.2f ns/access\n", t_skewed);
+	printf("speedup:               %8.2fx\n",
+	       t_aligned > 0 ? t_skewed / t_aligned : 0.0);
+
+	munmap(aligned, size);
+	munmap(skewed, size);
+	close(fd_data.fd);
+	free_data.handle = alloc.handle;
+	ioctl(fd, ION_IOC_FREE, &free_data);
+	close(fd);
+	free(order);
+	return 0;
+}
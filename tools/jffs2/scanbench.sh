@@ -0,0 +1,100 @@
+#!/bin/sh
+#
+# scanbench.sh: compare jffs2 mount times with different numbers of scan
+# read-ahead threads
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the Free
+# Software Foundation; version 2.
+#
+# Optionally writes a jffs2 image of SRCDIR to the MTD device first (with
+# mkfs.jffs2, and sumtool for -S, from mtd-utils), then mounts it once per
+# pass for each setting of the jffs2 scan_threads module parameter and
+# reports the wall clock mount time next to the scan/build breakdown the
+# kernel logs at mount.  Needs root and the mtd-utils tools in $PATH.
+#
+# Example, on a 128MiB 2K-page nandsim device, with and without
+# summaries:
+#
+#	modprobe nandsim first_id_byte=0x20 second_id_byte=0xaa \
+#		third_id_byte=0x00 fourth_id_byte=0x15
+#	scanbench.sh -d 0 /data/system-tree
+#	scanbench.sh -d 0 -S /data/system-tree
+#
+# mtdram (modprobe mtdram total_size=65536 erase_size=128) can be used
+# the same way, but since it lets jffs2 point at its memory directly the
+# scan never reads ahead there, so it only gives the baseline numbers.
+#
+
+mtd=0
+passes=3
+threads="1 2 4"
+summary=
+work=${TMPDIR:-/tmp}/scanbench.$$
+param=/sys/module/jffs2/parameters/scan_threads
+
+usage() {
+	echo "usage: $0 -d mtdnum [-n passes] [-t \"threads\"] [-S] [SRCDIR]" >&2
+	exit 1
+}
+
+while getopts "d:n:t:Sh" c; do
+	case $c in
+	d) mtd=$OPTARG ;;
+	n) passes=$OPTARG ;;
+	t) threads=$OPTARG ;;
+	S) summary=1 ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -le 1 ] || usage
+
+sys=/sys/class/mtd/mtd$mtd
+[ -d $sys ] || { echo "$0: no mtd$mtd" >&2; exit 1; }
+[ -w $param ] || { echo "$0: $param not writable, jffs2 not loaded?" >&2; exit 1; }
+old=$(cat $param)
+
+mkdir -p "$work/mnt" || exit 1
+trap 'umount "$work/mnt" 2>/dev/null; echo $old > $param; rm -rf "$work"' EXIT
+
+if [ $# -eq 1 ]; then
+	erase=$(cat $sys/erasesize)
+	page=$(cat $sys/writesize)
+	flags=
+	[ "$(cat $sys/type)" = nand ] && flags="-n -s $page"
+	mkfs.jffs2 -r "$1" -e $erase $flags -o "$work/img" || exit 1
+	if [ -n "$summary" ]; then
+		sumtool -e $erase $flags -i "$work/img" -o "$work/img.sum" || exit 1
+		mv "$work/img.sum" "$work/img"
+	fi
+	flash_erase -q /dev/mtd$mtd 0 0 || exit 1
+	if [ "$(cat $sys/type)" = nand ]; then
+		nandwrite -q -p /dev/mtd$mtd "$work/img" || exit 1
+	else
+		flashcp "$work/img" /dev/mtd$mtd || exit 1
+	fi
+	rm -f "$work/img"
+fi
+
+printf "%-8s %10s %10s %10s\n" threads "mount(ms)" "scan(ms)" "build(ms)"
+for t in $threads; do
+	echo $t > $param
+	total=0 scan=0 build=0
+	i=0
+	while [ $i -lt $passes ]; do
+		start=$(date +%s%N)
+		mount -t jffs2 mtd$mtd "$work/mnt" || exit 1
+		end=$(date +%s%N)
+		umount "$work/mnt"
+		total=$((total + (end - start) / 1000000))
+		# "mtdN: B eraseblocks scanned in S ms, built in B ms"
+		set -- $(dmesg | sed -n 's/.*eraseblocks scanned in \([0-9]*\) ms, built in \([0-9]*\) ms.*/\1 \2/p' | tail -n 1)
+		scan=$((scan + ${1:-0}))
+		build=$((build + ${2:-0}))
+		i=$((i + 1))
+	done
+	printf "%-8s %10d %10d %10d\n" $t $((total / passes)) \
+		$((scan / passes)) $((build / passes))
+	dmesg | grep "read-ahead threads" | tail -n 1
+done
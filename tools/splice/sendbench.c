@@ -0,0 +1,271 @@
+/*
+ * sendbench: serve a file over loopback TCP with copies, sendfile and splice
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * A server thread sends FILE over and over on a loopback TCP connection to
+ * a client thread that reads and discards it, for a while, then the rate
+ * and the cpu time spent per GiB are reported.  The ways of sending are:
+ *
+ *	rw		read() into a buffer, write() to the socket
+ *	sendfile	sendfile() from the file
+ *	splice		splice() from the file to a pipe, then to the socket
+ *	vmsplice	read() into freshly mapped pages, vmsplice() them to a
+ *			pipe with SPLICE_F_GIFT, then splice() to the socket
+ *
+ * Only rw copies the file data on the sending side; the others hand page
+ * cache or gifted pages to the socket.  Run once beforehand (or cat the
+ * file to /dev/null) so the page cache is warm.
+ *
+ * Example:
+ *
+ *	dd if=/dev/urandom of=/tmp/blob bs=1M count=64
+ *	for m in rw sendfile splice vmsplice; do sendbench -m $m /tmp/blob; done
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+enum { MODE_RW, MODE_SENDFILE, MODE_SPLICE, MODE_VMSPLICE };
+
+static const char *const mode_names[] = { "rw", "sendfile", "splice", "vmsplice" };
+
+static int mode = MODE_SPLICE;
+static size_t chunk = 65536;
+static unsigned int seconds = 5;
+
+static int file_fd;
+static off_t file_size;
+static unsigned long deadline;
+static unsigned long long received;
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* user plus system time of the whole process */
+static unsigned long cpu_ns(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000UL +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000UL;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void *client(void *arg)
+{
+	int fd = (long)arg;
+	char *buf = malloc(chunk);
+	ssize_t n;
+
+	if (!buf)
+		die("malloc");
+	while ((n = read(fd, buf, chunk)) > 0)
+		received += n;
+	if (n < 0)
+		die("read");
+	free(buf);
+	return NULL;
+}
+
+/* Moves len bytes out of the pipe into the socket */
+static void drain_pipe(int pipe_rd, int sock, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = splice(pipe_rd, NULL, sock, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (n <= 0)
+			die("splice to socket");
+		len -= n;
+	}
+}
+
+/* Sends the whole file once */
+static void send_file(int sock, int *pfd, char *buf)
+{
+	off_t off = 0;
+	ssize_t n = 0, w;
+
+	while (off < file_size && now_ns() < deadline) {
+		size_t len = chunk;
+
+		if (file_size - off < (off_t)chunk)
+			len = file_size - off;
+
+		switch (mode) {
+		case MODE_RW:
+			n = pread(file_fd, buf, len, off);
+			if (n <= 0)
+				die("pread");
+			for (w = 0; w < n; ) {
+				ssize_t r = write(sock, buf + w, n - w);
+
+				if (r <= 0)
+					die("write");
+				w += r;
+			}
+			break;
+		case MODE_SENDFILE:
+			n = sendfile(sock, file_fd, &off, len);
+			if (n <= 0)
+				die("sendfile");
+			continue;
+		case MODE_SPLICE: {
+			loff_t loff = off;
+
+			n = splice(file_fd, &loff, pfd[1], NULL, len, SPLICE_F_MOVE);
+			if (n <= 0)
+				die("splice from file");
+			drain_pipe(pfd[0], sock, n);
+			break;
+		}
+		case MODE_VMSPLICE: {
+			/* gifted pages must not be touched again, use new ones */
+			struct iovec iov;
+			char *pages = mmap(NULL, chunk, PROT_READ | PROT_WRITE,
+					   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+			if (pages == MAP_FAILED)
+				die("mmap");
+			n = pread(file_fd, pages, len, off);
+			if (n <= 0)
+				die("pread");
+			/* gifts must be whole pages */
+			iov.iov_base = pages;
+			iov.iov_len = (n + 4095) & ~4095UL;
+			if (iov.iov_len > chunk)
+				iov.iov_len = chunk;
+			w = vmsplice(pfd[1], &iov, 1, SPLICE_F_GIFT);
+			if (w < n)
+				die("vmsplice");
+			drain_pipe(pfd[0], sock, w);
+			munmap(pages, chunk);
+			break;
+		}
+		}
+		off += n;
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] FILE\n"
+		"  -m MODE   rw, sendfile, splice or vmsplice (default splice)\n"
+		"  -s N      bytes per call, a multiple of the page size (default 65536)\n"
+		"  -t N      seconds to run (default 5)\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in addr;
+	socklen_t alen = sizeof(addr);
+	unsigned long start, wall, cpu;
+	int lfd, sock, cfd, pfd[2], c, i;
+	pthread_t tid;
+	struct stat st;
+	char *buf;
+
+	while ((c = getopt(argc, argv, "m:s:t:h")) != -1) {
+		switch (c) {
+		case 'm':
+			for (i = 0; i < 4; i++)
+				if (!strcmp(optarg, mode_names[i]))
+					break;
+			if (i == 4)
+				usage(argv[0]);
+			mode = i;
+			break;
+		case 's':
+			chunk = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || !chunk || chunk % 4096 || !seconds)
+		usage(argv[0]);
+
+	file_fd = open(argv[optind], O_RDONLY);
+	if (file_fd < 0 || fstat(file_fd, &st))
+		die(argv[optind]);
+	file_size = st.st_size;
+	if (!file_size) {
+		fprintf(stderr, "%s: empty\n", argv[optind]);
+		return 1;
+	}
+
+	buf = malloc(chunk);
+	if (!buf || pipe(pfd))
+		die("setup");
+	/* room for a whole chunk in the pipe */
+	fcntl(pfd[1], F_SETPIPE_SZ, (int)chunk);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(lfd, 1) || getsockname(lfd, (struct sockaddr *)&addr, &alen))
+		die("listen");
+	cfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (cfd < 0 || connect(cfd, (struct sockaddr *)&addr, sizeof(addr)))
+		die("connect");
+	sock = accept(lfd, NULL, NULL);
+	if (sock < 0)
+		die("accept");
+	if (pthread_create(&tid, NULL, client, (void *)(long)cfd))
+		die("pthread_create");
+
+	cpu = cpu_ns();
+	start = now_ns();
+	deadline = start + seconds * 1000000000UL;
+	while (now_ns() < deadline)
+		send_file(sock, pfd, buf);
+	shutdown(sock, SHUT_WR);
+	pthread_join(tid, NULL);
+	wall = now_ns() - start;
+	cpu = cpu_ns() - cpu;
+
+	printf("%s, %zu byte calls, %lld byte file\n", mode_names[mode], chunk,
+	       (long long)file_size);
+	printf("%12s %14s\n", "MiB/s", "cpu(ms)/GiB");
+	printf("%12.1f %14.2f\n", received / (wall / 1e9) / 1048576,
+	       received ? cpu / 1e6 / (received / 1073741824.0) : 0.0);
+	return 0;
+}
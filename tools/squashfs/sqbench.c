@@ -0,0 +1,294 @@
+/*
+ * sqbench: parallel read benchmark for a mounted squashfs image
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Walks a directory tree, normally the mount point of a squashfs image on
+ * a loop device, and reads every regular file with a number of threads.
+ * Files are handed out to the threads from a shared index, so the threads
+ * read different files at the same time much like app launch does.  The
+ * page cache is dropped before the run (unless -k is given) so that every
+ * block has to be read and decompressed.
+ *
+ * Example, comparing decompressor backends on a system image:
+ *
+ *	losetup /dev/loop0 system.sqsh
+ *	for t in single multi percpu; do
+ *		mount -t squashfs -o ro,threads=$t /dev/loop0 /mnt
+ *		sqbench -t 4 /mnt
+ *		umount /mnt
+ *	done
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static unsigned int nthreads = 1;
+static unsigned int passes = 1;
+static size_t bufsize = 128 << 10;
+static int keep_cache;
+
+static char **files;
+static unsigned int nfiles, files_max;
+static unsigned int next_file;
+static pthread_mutex_t next_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct thread {
+	pthread_t tid;
+	unsigned long long bytes;
+	unsigned int files;
+	unsigned int errors;
+	unsigned long *lat;
+};
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static int add_file(const char *path)
+{
+	if (nfiles == files_max) {
+		files_max = files_max ? files_max * 2 : 1024;
+		files = realloc(files, files_max * sizeof(*files));
+		if (!files)
+			return -1;
+	}
+	files[nfiles] = strdup(path);
+	if (!files[nfiles])
+		return -1;
+	nfiles++;
+	return 0;
+}
+
+static int walk(const char *dir)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	struct stat st;
+	DIR *d;
+	int ret = 0;
+
+	d = opendir(dir);
+	if (!d) {
+		perror(dir);
+		return 0;
+	}
+	while (!ret && (de = readdir(d)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		if (lstat(path, &st))
+			continue;
+		if (S_ISDIR(st.st_mode))
+			ret = walk(path);
+		else if (S_ISREG(st.st_mode) && st.st_size)
+			ret = add_file(path);
+	}
+	closedir(d);
+	return ret;
+}
+
+static void drop_caches(void)
+{
+	int fd;
+
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0 || write(fd, "3", 1) != 1)
+		perror("drop_caches");
+	if (fd >= 0)
+		close(fd);
+}
+
+static void *bench_thread(void *arg)
+{
+	struct thread *t = arg;
+	unsigned long start;
+	char *buf;
+	ssize_t n;
+	int fd;
+
+	buf = malloc(bufsize);
+	if (!buf)
+		return NULL;
+
+	for (;;) {
+		unsigned int i;
+
+		pthread_mutex_lock(&next_lock);
+		i = next_file++;
+		pthread_mutex_unlock(&next_lock);
+		if (i >= nfiles)
+			break;
+
+		start = now_ns();
+		fd = open(files[i], O_RDONLY);
+		if (fd < 0) {
+			t->errors++;
+			continue;
+		}
+		while ((n = read(fd, buf, bufsize)) > 0)
+			t->bytes += n;
+		if (n < 0)
+			t->errors++;
+		close(fd);
+		t->lat[t->files++] = now_ns() - start;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static int cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double pct(unsigned long *sorted, unsigned int n, unsigned int permille)
+{
+	unsigned int idx = (unsigned long)n * permille / 1000;
+
+	if (!n)
+		return 0;
+	if (idx >= n)
+		idx = n - 1;
+	return sorted[idx] / 1000.0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] DIR\n"
+		"  -t N      number of reader threads (default 1)\n"
+		"  -n N      number of passes over the tree (default 1)\n"
+		"  -b SIZE   read size in KiB (default 128)\n"
+		"  -k        keep the page cache, don't drop it before a pass\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct thread *threads;
+	unsigned long long bytes;
+	unsigned long *all, start, wall;
+	unsigned int i, pass, n, errors;
+	int c;
+
+	while ((c = getopt(argc, argv, "t:n:b:kh")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			passes = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bufsize = strtoul(optarg, NULL, 0) << 10;
+			break;
+		case 'k':
+			keep_cache = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || !nthreads || !passes || !bufsize)
+		usage(argv[0]);
+
+	if (walk(argv[optind])) {
+		perror("walk");
+		return 1;
+	}
+	if (!nfiles) {
+		fprintf(stderr, "%s: no files found\n", argv[optind]);
+		return 1;
+	}
+
+	threads = calloc(nthreads, sizeof(*threads));
+	all = calloc(nfiles, sizeof(*all));
+	if (!threads || !all) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < nthreads; i++) {
+		threads[i].lat = calloc(nfiles, sizeof(unsigned long));
+		if (!threads[i].lat) {
+			perror("calloc");
+			return 1;
+		}
+	}
+
+	printf("%u files, %u threads, %zu KiB reads\n", nfiles, nthreads,
+	       bufsize >> 10);
+	printf("%-4s %10s %10s %10s %10s %10s %10s %10s\n", "pass", "MiB",
+	       "ms", "MiB/s", "p50", "p90", "p99", "max(us)");
+
+	for (pass = 0; pass < passes; pass++) {
+		if (!keep_cache)
+			drop_caches();
+
+		next_file = 0;
+		for (i = 0; i < nthreads; i++) {
+			threads[i].bytes = 0;
+			threads[i].files = 0;
+			threads[i].errors = 0;
+		}
+
+		start = now_ns();
+		for (i = 0; i < nthreads; i++) {
+			if (pthread_create(&threads[i].tid, NULL, bench_thread,
+					   &threads[i])) {
+				perror("pthread_create");
+				return 1;
+			}
+		}
+		bytes = 0;
+		errors = 0;
+		n = 0;
+		for (i = 0; i < nthreads; i++) {
+			pthread_join(threads[i].tid, NULL);
+			bytes += threads[i].bytes;
+			errors += threads[i].errors;
+			memcpy(all + n, threads[i].lat,
+			       threads[i].files * sizeof(*all));
+			n += threads[i].files;
+		}
+		wall = now_ns() - start;
+
+		qsort(all, n, sizeof(*all), cmp_ulong);
+		printf("%-4u %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+		       pass, bytes / 1048576.0, wall / 1e6,
+		       wall ? bytes / 1048576.0 / (wall / 1e9) : 0.0,
+		       pct(all, n, 500), pct(all, n, 900), pct(all, n, 990),
+		       pct(all, n, 1000));
+		if (errors)
+			printf("     %u read errors\n", errors);
+	}
+
+	return 0;
+}
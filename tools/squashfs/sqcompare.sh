@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+# sqcompare.sh: compare cold cache squashfs read throughput across
+# compressors
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the Free
+# Software Foundation; version 2.
+#
+# Builds one squashfs image of SRCDIR per compressor with mksquashfs,
+# loop mounts each in turn and reads it back with sqbench, which drops
+# the page cache before every pass.  Needs root, mksquashfs built with
+# lz4, lzo and xz support, and a kernel with CONFIG_SQUASHFS_LZ4 etc.
+#
+# Example, four reader threads over an unpacked system image:
+#
+#	sqcompare.sh -t 4 -o threads=percpu /data/system-tree
+#
+
+threads=1
+passes=3
+opts=
+comps="gzip lzo lz4 xz"
+block=131072
+work=${TMPDIR:-/tmp}/sqcompare.$$
+
+usage() {
+	echo "usage: $0 [-t threads] [-n passes] [-b block] [-o mountopts]" \
+		"[-c \"comps\"] SRCDIR" >&2
+	exit 1
+}
+
+while getopts "t:n:b:o:c:h" c; do
+	case $c in
+	t) threads=$OPTARG ;;
+	n) passes=$OPTARG ;;
+	b) block=$OPTARG ;;
+	o) opts=,$OPTARG ;;
+	c) comps=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -eq 1 ] || usage
+src=$1
+
+bench=$(dirname "$0")/sqbench
+[ -x "$bench" ] || bench=sqbench
+
+mkdir -p "$work/mnt" || exit 1
+trap 'umount "$work/mnt" 2>/dev/null; rm -rf "$work"' EXIT
+
+printf "%-6s %10s %10s\n" comp "size(KiB)" "MiB/s"
+for comp in $comps; do
+	img=$work/$comp.sqsh
+	extra=
+	[ $comp = lz4 ] && extra=-Xhc
+	if ! mksquashfs "$src" "$img" -comp $comp $extra -b $block \
+			-noappend -no-progress >/dev/null 2>&1; then
+		printf "%-6s %10s\n" $comp "mksquashfs failed"
+		continue
+	fi
+	if ! mount -t squashfs -o loop,ro$opts "$img" "$work/mnt"; then
+		printf "%-6s %10s\n" $comp "mount failed"
+		rm -f "$img"
+		continue
+	fi
+	# average MiB/s over the passes, column 4 of sqbench's pass lines
+	rate=$("$bench" -t $threads -n $passes "$work/mnt" |
+		awk 'NF == 8 && $1 ~ /^[0-9]+$/ { s += $4; n++ } END { if (n) printf "%.1f", s / n }')
+	umount "$work/mnt"
+	printf "%-6s %10d %10s\n" $comp $(($(stat -c %s "$img") / 1024)) "$rate"
+	rm -f "$img"
+done
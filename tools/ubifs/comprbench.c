@@ -0,0 +1,288 @@
+/*
+ * comprbench: UBIFS compression cost on a mix of media and text files
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Writes a set of files into DIR, some of them random bytes standing in for
+ * already compressed media, the rest text-like data that compresses well,
+ * and syncs.  Then drops the page cache and reads everything back.  Since
+ * UBIFS compresses at writeback time, in the flusher threads, CPU cost is
+ * measured system wide from /proc/stat rather than for this process, so
+ * run it on an otherwise idle system.  Space used comes from statfs() on
+ * DIR before and after writing.  Needs to run as root.
+ *
+ * Example, on a 256MiB 2K-page nandsim device, comparing compressors:
+ *
+ *	modprobe nandsim first_id_byte=0x20 second_id_byte=0xaa \
+ *		third_id_byte=0x00 fourth_id_byte=0x15 parts=2048
+ *	modprobe ubi mtd=0
+ *	ubimkvol /dev/ubi0 -N bench -m
+ *	for c in none lzo zlib lz4; do
+ *		mount -t ubifs -o compr=$c ubi0:bench /mnt/ubifs
+ *		comprbench -n 64 -s 1024 -m 50 /mnt/ubifs
+ *		umount /mnt/ubifs
+ *	done
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/statfs.h>
+
+static const char *dir;
+static unsigned int nfiles = 32;
+static unsigned int size_kb = 1024;
+static unsigned int media_pct = 50;
+
+static const char *const words[] = {
+	"the", "flash", "block", "erase", "page", "inode", "journal", "commit",
+	"index", "node", "compress", "data", "write", "read", "of", "and",
+	"a", "to", "in", "is", "log", "UBIFS", "volume", "LEB", "garbage",
+	"collection", "budget", "orphan", "master", "superblock", "key", "tree",
+};
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* Busy and total jiffies over all CPUs, from the first line of /proc/stat */
+static int cpu_ticks(unsigned long long *busy, unsigned long long *total)
+{
+	unsigned long long v[8];
+	FILE *f;
+	int n, i;
+
+	f = fopen("/proc/stat", "r");
+	if (!f)
+		return -1;
+	n = fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+		   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+	fclose(f);
+	if (n < 4)
+		return -1;
+	*total = 0;
+	for (i = 0; i < n; i++)
+		*total += v[i];
+	/* idle and iowait are not busy */
+	*busy = *total - v[3] - (n > 4 ? v[4] : 0);
+	return 0;
+}
+
+static unsigned long long used_bytes(void)
+{
+	struct statfs st;
+
+	if (statfs(dir, &st))
+		return 0;
+	return (unsigned long long)(st.f_blocks - st.f_bfree) * st.f_bsize;
+}
+
+static void fill_text(char *buf, size_t len)
+{
+	size_t i = 0, w;
+
+	while (i < len) {
+		const char *word = words[random() % (sizeof(words) /
+						      sizeof(words[0]))];
+
+		w = strlen(word);
+		if (i + w + 1 > len)
+			w = len - i - 1;
+		memcpy(buf + i, word, w);
+		i += w;
+		if (i < len)
+			buf[i++] = random() % 12 ? ' ' : '\n';
+	}
+}
+
+static void fill_media(char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + 4 <= len; i += 4) {
+		unsigned int r = random() ^ (random() << 16);
+
+		memcpy(buf + i, &r, 4);
+	}
+	for (; i < len; i++)
+		buf[i] = random();
+}
+
+static int is_media(unsigned int i)
+{
+	return i * 100 / nfiles < media_pct;
+}
+
+static void drop_caches(void)
+{
+	int fd;
+
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0 || write(fd, "3", 1) != 1)
+		perror("drop_caches");
+	if (fd >= 0)
+		close(fd);
+}
+
+static int write_files(char *buf, size_t len)
+{
+	char path[4096];
+	unsigned int i;
+	int fd;
+
+	for (i = 0; i < nfiles; i++) {
+		snprintf(path, sizeof(path), "%s/%c%05u", dir,
+			 is_media(i) ? 'm' : 't', i);
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 ||
+		    write(fd, buf + (is_media(i) ? len : 0), len) !=
+		    (ssize_t)len) {
+			perror(path);
+			return -1;
+		}
+		close(fd);
+	}
+	sync();
+	return 0;
+}
+
+static int read_files(char *buf, size_t len)
+{
+	char path[4096];
+	unsigned int i;
+	int fd;
+
+	for (i = 0; i < nfiles; i++) {
+		snprintf(path, sizeof(path), "%s/%c%05u", dir,
+			 is_media(i) ? 'm' : 't', i);
+		fd = open(path, O_RDONLY);
+		if (fd < 0 || read(fd, buf, len) != (ssize_t)len) {
+			perror(path);
+			return -1;
+		}
+		close(fd);
+	}
+	return 0;
+}
+
+static void remove_files(void)
+{
+	char path[4096];
+	unsigned int i;
+
+	for (i = 0; i < nfiles; i++) {
+		snprintf(path, sizeof(path), "%s/%c%05u", dir,
+			 is_media(i) ? 'm' : 't', i);
+		unlink(path);
+	}
+	sync();
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] DIR\n"
+		"  -n N      number of files (default 32)\n"
+		"  -s N      size of each file in KiB (default 1024)\n"
+		"  -m N      percentage of media (random) files (default 50)\n",
+		prog);
+	exit(1);
+}
+
+static void report(const char *what, unsigned long ns,
+		   unsigned long long busy, unsigned long long total)
+{
+	double mib = (double)nfiles * size_kb / 1024;
+
+	printf("%-6s %10.1f %10.1f %9.1f%%\n", what,
+	       ns ? mib / (ns / 1e9) : 0.0,
+	       (double)busy / sysconf(_SC_CLK_TCK),
+	       total ? 100.0 * busy / total : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long b0, t0, b1, t1, used0, used1;
+	unsigned long start, ns;
+	size_t len;
+	char *buf;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:s:m:h")) != -1) {
+		switch (c) {
+		case 'n':
+			nfiles = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size_kb = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			media_pct = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || !nfiles || !size_kb || media_pct > 100)
+		usage(argv[0]);
+	dir = argv[optind];
+
+	len = (size_t)size_kb * 1024;
+	buf = malloc(2 * len);
+	if (!buf) {
+		perror("malloc");
+		return 1;
+	}
+	srandom(1);
+	fill_text(buf, len);
+	fill_media(buf + len, len);
+
+	remove_files();
+	used0 = used_bytes();
+	printf("%u files of %u KiB, %u%% media\n", nfiles, size_kb, media_pct);
+	printf("%-6s %10s %10s %10s\n", "", "MiB/s", "cpu(s)", "cpu busy");
+
+	if (cpu_ticks(&b0, &t0))
+		return 1;
+	start = now_ns();
+	if (write_files(buf, len))
+		return 1;
+	ns = now_ns() - start;
+	cpu_ticks(&b1, &t1);
+	report("write", ns, b1 - b0, t1 - t0);
+	used1 = used_bytes();
+
+	drop_caches();
+	cpu_ticks(&b0, &t0);
+	start = now_ns();
+	if (read_files(buf, len))
+		return 1;
+	ns = now_ns() - start;
+	cpu_ticks(&b1, &t1);
+	report("read", ns, b1 - b0, t1 - t0);
+
+	printf("space used %.1f MiB for %.1f MiB of data (%.0f%%)\n",
+	       (used1 - used0) / 1048576.0, (double)nfiles * size_kb / 1024,
+	       100.0 * (used1 - used0) / ((double)nfiles * len));
+
+	remove_files();
+	return 0;
+}
@@ -0,0 +1,266 @@
+/*
+ * statbench: parallel stat() of the entries of a large directory
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Populates a directory with empty files, then runs a number of rounds in
+ * which the dentry and inode caches are dropped and all threads stat()
+ * the files at once, each taking every Nth name.  Every stat() is thus a
+ * dcache miss that goes down to the filesystem's ->lookup, which is where
+ * lookups in one directory used to serialise on its i_mutex.  With -c the
+ * page cache is dropped as well, so that the directory blocks and inode
+ * tables have to be read from disk too.  With -x the names looked up do
+ * not exist, which measures negative lookups.  Needs to run as root.
+ *
+ * Example, on a filesystem with and without parallel lookups:
+ *
+ *	mkdir -p /data/statbench
+ *	statbench -n 20000 -t 1 /data/statbench
+ *	statbench -n 20000 -t 4 /data/statbench
+ *	statbench -n 20000 -t 4 -c /data/statbench
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char *dir;
+static unsigned int nfiles = 10000;
+static unsigned int nthreads;
+static unsigned int rounds = 5;
+static int drop_pages;
+static int negative;
+static pthread_barrier_t barrier;
+
+struct thread {
+	pthread_t tid;
+	unsigned int idx;
+	unsigned long ops;
+	unsigned int errors;
+	unsigned int nlat;
+	unsigned long *lat;
+};
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void name(char *buf, size_t len, unsigned int i)
+{
+	snprintf(buf, len, "%s/%c%07u", dir, negative ? 'x' : 'f', i);
+}
+
+static int populate(void)
+{
+	char path[4096];
+	unsigned int i;
+	int fd;
+
+	for (i = 0; i < nfiles; i++) {
+		snprintf(path, sizeof(path), "%s/f%07u", dir, i);
+		fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (fd < 0) {
+			if (errno == EEXIST)
+				continue;
+			perror(path);
+			return -1;
+		}
+		close(fd);
+	}
+	return 0;
+}
+
+static void drop_caches(void)
+{
+	const char *level = drop_pages ? "3" : "2";
+	int fd;
+
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0 || write(fd, level, 1) != 1)
+		perror("drop_caches");
+	if (fd >= 0)
+		close(fd);
+}
+
+static void *stat_thread(void *arg)
+{
+	struct thread *t = arg;
+	char path[4096];
+	unsigned long start;
+	struct stat st;
+	unsigned int i;
+	int ret;
+
+	pthread_barrier_wait(&barrier);
+	for (i = t->idx; i < nfiles; i += nthreads) {
+		name(path, sizeof(path), i);
+		start = now_ns();
+		ret = stat(path, &st);
+		t->lat[t->nlat++] = now_ns() - start;
+		if (ret != 0 && !(negative && errno == ENOENT))
+			t->errors++;
+		t->ops++;
+	}
+	return NULL;
+}
+
+static int cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double pct(unsigned long *sorted, unsigned int n, unsigned int permille)
+{
+	unsigned int idx = (unsigned long)n * permille / 1000;
+
+	if (!n)
+		return 0;
+	if (idx >= n)
+		idx = n - 1;
+	return sorted[idx] / 1000.0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] DIR\n"
+		"  -n N      number of files in DIR (default 10000)\n"
+		"  -t N      number of threads (default: online CPUs)\n"
+		"  -r N      number of rounds (default 5)\n"
+		"  -c        drop the page cache too before each round\n"
+		"  -x        look up names that do not exist\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long *all, start, wall, total_wall = 0;
+	unsigned long long ops, total_ops = 0;
+	unsigned int i, r, n, errors;
+	struct thread *threads;
+	long ncpus;
+	int c;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus < 1)
+		ncpus = 1;
+	nthreads = ncpus;
+
+	while ((c = getopt(argc, argv, "n:t:r:cxh")) != -1) {
+		switch (c) {
+		case 'n':
+			nfiles = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			drop_pages = 1;
+			break;
+		case 'x':
+			negative = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || !nfiles || !nthreads || !rounds)
+		usage(argv[0]);
+	dir = argv[optind];
+
+	if (populate())
+		return 1;
+
+	threads = calloc(nthreads, sizeof(*threads));
+	all = malloc((size_t)nfiles * sizeof(*all));
+	if (!threads || !all) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < nthreads; i++) {
+		threads[i].idx = i;
+		threads[i].lat = calloc(nfiles / nthreads + 1,
+					sizeof(unsigned long));
+		if (!threads[i].lat) {
+			perror("calloc");
+			return 1;
+		}
+	}
+
+	printf("%u %s names, %u threads%s\n", nfiles,
+	       negative ? "missing" : "existing", nthreads,
+	       drop_pages ? ", cold page cache" : "");
+	printf("%6s %12s %10s %10s %10s %10s\n", "round", "stat/s",
+	       "p50", "p90", "p99", "max(us)");
+
+	for (r = 0; r < rounds; r++) {
+		drop_caches();
+		pthread_barrier_init(&barrier, NULL, nthreads + 1);
+		for (i = 0; i < nthreads; i++) {
+			threads[i].ops = 0;
+			threads[i].nlat = 0;
+			threads[i].errors = 0;
+			if (pthread_create(&threads[i].tid, NULL, stat_thread,
+					   &threads[i])) {
+				perror("pthread_create");
+				return 1;
+			}
+		}
+		start = now_ns();
+		pthread_barrier_wait(&barrier);
+
+		ops = 0;
+		errors = 0;
+		n = 0;
+		for (i = 0; i < nthreads; i++) {
+			pthread_join(threads[i].tid, NULL);
+			ops += threads[i].ops;
+			errors += threads[i].errors;
+			memcpy(all + n, threads[i].lat,
+			       threads[i].nlat * sizeof(*all));
+			n += threads[i].nlat;
+		}
+		wall = now_ns() - start;
+		pthread_barrier_destroy(&barrier);
+		qsort(all, n, sizeof(*all), cmp_ulong);
+
+		printf("%6u %12.0f %10.1f %10.1f %10.1f %10.1f\n", r,
+		       wall ? ops / (wall / 1e9) : 0.0,
+		       pct(all, n, 500), pct(all, n, 900), pct(all, n, 990),
+		       pct(all, n, 1000));
+		if (errors)
+			printf("%u errors\n", errors);
+		total_ops += ops;
+		total_wall += wall;
+	}
+	printf("%6s %12.0f\n", "all",
+	       total_wall ? total_ops / (total_wall / 1e9) : 0.0);
+	return 0;
+}
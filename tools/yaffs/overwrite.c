@@ -0,0 +1,228 @@
+/*
+ * overwrite: write latency under sustained random overwrites on yaffs
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * Fills a file, then overwrites random aligned blocks of it with O_SYNC
+ * writes, so that every write goes to the NAND and the device keeps
+ * running out of erased blocks.  Writes are issued in bursts separated by
+ * idle gaps, which is when the background collector is meant to get ahead.
+ * Reports the write latency distribution over the whole run, and, if
+ * /proc/yaffs is readable, the change in the garbage collection counters:
+ * fg_gc_copies are chunks copied inline with a write, bg_gc_copies those
+ * copied by the background thread.
+ *
+ * Example, on a 128MiB 2K-page nandsim device, with and without idle
+ * collection:
+ *
+ *	modprobe nandsim first_id_byte=0x20 second_id_byte=0xaa \
+ *		third_id_byte=0x00 fourth_id_byte=0x15
+ *	flash_erase /dev/mtd0 0 0
+ *	mount -t yaffs2 /dev/mtdblock0 /mnt/yaffs
+ *	overwrite -s 96 -b 64 -i 1000 -t 120 /mnt/yaffs/ow
+ *	echo bg_gc_idle_ms=0 > /proc/yaffs
+ *	overwrite -s 96 -b 64 -i 1000 -t 120 /mnt/yaffs/ow
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static unsigned int size_mb = 64;
+static unsigned int block_size = 4096;
+static unsigned int burst = 64;
+static unsigned int idle_ms = 500;
+static unsigned int seconds = 60;
+
+static const char * const counters[] = {
+	"n_gc_blocks", "bg_gcs", "bg_gc_idle_blocks", "gc_cb_selected",
+	"fg_gc_copies", "bg_gc_copies", "n_erasures", "n_page_writes",
+};
+#define NR_COUNTERS (sizeof(counters) / sizeof(counters[0]))
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* Sum the given counters over all devices listed in /proc/yaffs. */
+static int read_counters(unsigned long long *val)
+{
+	char line[256], key[64];
+	unsigned long long v;
+	unsigned int i;
+	FILE *f;
+
+	memset(val, 0, NR_COUNTERS * sizeof(*val));
+	f = fopen("/proc/yaffs", "r");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%63[a-z_0-9].%*[.] %llu", key, &v) != 2)
+			continue;
+		for (i = 0; i < NR_COUNTERS; i++)
+			if (!strcmp(key, counters[i]))
+				val[i] += v;
+	}
+	fclose(f);
+	return 0;
+}
+
+static int fill(const char *path, char *buf)
+{
+	unsigned long long off, end = (unsigned long long)size_mb << 20;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	for (off = 0; off < end; off += block_size) {
+		if (write(fd, buf, block_size) != (ssize_t)block_size) {
+			perror(path);
+			close(fd);
+			return -1;
+		}
+	}
+	fsync(fd);
+	return close(fd);
+}
+
+static int cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double pct(unsigned long *sorted, unsigned int n, unsigned int permille)
+{
+	unsigned int idx = (unsigned long)n * permille / 1000;
+
+	if (!n)
+		return 0;
+	if (idx >= n)
+		idx = n - 1;
+	return sorted[idx] / 1000.0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] FILE\n"
+		"  -s N      file size in MiB (default 64)\n"
+		"  -w N      size of each write (default 4096)\n"
+		"  -b N      writes per burst (default 64)\n"
+		"  -i N      idle time between bursts in ms (default 500)\n"
+		"  -t N      run time in seconds, excluding idle (default 60)\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long before[NR_COUNTERS], after[NR_COUNTERS];
+	unsigned long *lat, start, t, busy = 0;
+	unsigned int n = 0, max_lat, nblocks, i;
+	int have_counters;
+	const char *path;
+	char *buf;
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "s:w:b:i:t:h")) != -1) {
+		switch (c) {
+		case 's':
+			size_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			block_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			burst = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			idle_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || !size_mb || !block_size || !burst ||
+	    !seconds)
+		usage(argv[0]);
+	path = argv[optind];
+
+	nblocks = ((unsigned long long)size_mb << 20) / block_size;
+	max_lat = 1 << 20;
+	buf = malloc(block_size);
+	lat = malloc(max_lat * sizeof(*lat));
+	if (!buf || !lat || !nblocks) {
+		fprintf(stderr, "bad size or out of memory\n");
+		return 1;
+	}
+	memset(buf, 0x5a, block_size);
+	srandom(getpid());
+
+	printf("filling %u MiB\n", size_mb);
+	if (fill(path, buf))
+		return 1;
+	fd = open(path, O_WRONLY | O_SYNC);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+
+	have_counters = read_counters(before) == 0;
+	printf("%u byte O_SYNC overwrites, bursts of %u, %u ms idle\n",
+	       block_size, burst, idle_ms);
+
+	while (busy < seconds * 1000000000UL && n < max_lat) {
+		for (i = 0; i < burst && n < max_lat; i++) {
+			off_t off = (off_t)(random() % nblocks) * block_size;
+
+			buf[0] = n;
+			start = now_ns();
+			if (pwrite(fd, buf, block_size, off) !=
+			    (ssize_t)block_size) {
+				perror("pwrite");
+				return 1;
+			}
+			t = now_ns() - start;
+			lat[n++] = t;
+			busy += t;
+		}
+		if (idle_ms)
+			usleep(idle_ms * 1000);
+	}
+	close(fd);
+
+	qsort(lat, n, sizeof(*lat), cmp_ulong);
+	printf("%10s %10s %10s %10s %10s %10s %10s\n", "writes", "KiB/s",
+	       "p50", "p90", "p99", "p99.9", "max(us)");
+	printf("%10u %10.0f %10.1f %10.1f %10.1f %10.1f %10.1f\n", n,
+	       busy ? (double)n * block_size / 1024 / (busy / 1e9) : 0.0,
+	       pct(lat, n, 500), pct(lat, n, 900), pct(lat, n, 990),
+	       pct(lat, n, 999), pct(lat, n, 1000));
+
+	if (have_counters && read_counters(after) == 0)
+		for (i = 0; i < NR_COUNTERS; i++)
+			printf("%-18s %llu\n", counters[i],
+			       after[i] - before[i]);
+	return 0;
+}
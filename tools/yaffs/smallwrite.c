@@ -0,0 +1,245 @@
+/*
+ * smallwrite: small-file write throughput on a yaffs mount
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Each round creates a number of files in DIR, writes each one in short
+ * write() calls, closes it (optionally after an fsync()), and finally
+ * syncs the filesystem.  The partial chunk at the tail of every file goes
+ * through the yaffs short op cache, as does everything on inband-tags
+ * mounts.  The files are removed again before the next round.  The
+ * per-round rate includes the final sync, and the latency percentiles are
+ * per file, from open() to close().  If /proc/yaffs is readable, the
+ * change in the short op cache counters over the run is printed as well.
+ *
+ * Example, on a 128MiB 2K-page nandsim device:
+ *
+ *	modprobe nandsim first_id_byte=0x20 second_id_byte=0xaa \
+ *		third_id_byte=0x00 fourth_id_byte=0x15
+ *	flash_erase /dev/mtd0 0 0
+ *	mount -t yaffs2 /dev/mtdblock0 /mnt/yaffs
+ *	mkdir /mnt/yaffs/sw
+ *	smallwrite -n 2000 -s 1500 -w 256 /mnt/yaffs/sw
+ *	smallwrite -n 500 -s 20000 -w 512 -f /mnt/yaffs/sw
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *dir;
+static unsigned int nfiles = 1000;
+static unsigned int file_size = 1500;
+static unsigned int write_size = 256;
+static unsigned int rounds = 3;
+static int do_fsync;
+
+static const char * const counters[] = {
+	"cache_hits", "cache_misses", "cache_pushouts", "cache_combined",
+	"n_page_writes",
+};
+#define NR_COUNTERS (sizeof(counters) / sizeof(counters[0]))
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* Sum the given counters over all devices listed in /proc/yaffs. */
+static int read_counters(unsigned long long *val)
+{
+	char line[256], key[64];
+	unsigned long long v;
+	unsigned int i;
+	FILE *f;
+
+	memset(val, 0, NR_COUNTERS * sizeof(*val));
+	f = fopen("/proc/yaffs", "r");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%63[a-z_0-9].%*[.] %llu", key, &v) != 2)
+			continue;
+		for (i = 0; i < NR_COUNTERS; i++)
+			if (!strcmp(key, counters[i]))
+				val[i] += v;
+	}
+	fclose(f);
+	return 0;
+}
+
+static int write_file(unsigned int i, const char *buf)
+{
+	char path[4096];
+	unsigned int done, len;
+	ssize_t ret;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/s%07u", dir, i);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	for (done = 0; done < file_size; done += len) {
+		len = file_size - done;
+		if (len > write_size)
+			len = write_size;
+		ret = write(fd, buf + done, len);
+		if (ret != (ssize_t)len) {
+			perror(path);
+			close(fd);
+			return -1;
+		}
+	}
+	if (do_fsync && fsync(fd)) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	return close(fd);
+}
+
+static void remove_files(void)
+{
+	char path[4096];
+	unsigned int i;
+
+	for (i = 0; i < nfiles; i++) {
+		snprintf(path, sizeof(path), "%s/s%07u", dir, i);
+		unlink(path);
+	}
+	sync();
+}
+
+static int cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double pct(unsigned long *sorted, unsigned int n, unsigned int permille)
+{
+	unsigned int idx = (unsigned long)n * permille / 1000;
+
+	if (!n)
+		return 0;
+	if (idx >= n)
+		idx = n - 1;
+	return sorted[idx] / 1000.0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] DIR\n"
+		"  -n N      number of files per round (default 1000)\n"
+		"  -s N      size of each file in bytes (default 1500)\n"
+		"  -w N      size of each write() (default 256)\n"
+		"  -r N      number of rounds (default 3)\n"
+		"  -f        fsync() each file before closing it\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long before[NR_COUNTERS], after[NR_COUNTERS];
+	unsigned long *lat, start, t, wall, total_wall = 0;
+	unsigned long long total_files = 0;
+	unsigned int i, r;
+	int have_counters;
+	char *buf;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:s:w:r:fh")) != -1) {
+		switch (c) {
+		case 'n':
+			nfiles = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			file_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			write_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			do_fsync = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || !nfiles || !write_size || !rounds)
+		usage(argv[0]);
+	dir = argv[optind];
+
+	buf = malloc(file_size + 1);
+	lat = calloc(nfiles, sizeof(*lat));
+	if (!buf || !lat) {
+		perror("malloc");
+		return 1;
+	}
+	for (i = 0; i < file_size; i++)
+		buf[i] = 'a' + i % 26;
+
+	remove_files();
+	have_counters = read_counters(before) == 0;
+
+	printf("%u files of %u bytes in %u byte writes%s\n", nfiles,
+	       file_size, write_size, do_fsync ? ", fsync each" : "");
+	printf("%6s %10s %10s %10s %10s %10s\n", "round", "files/s",
+	       "KiB/s", "p50", "p99", "max(us)");
+
+	for (r = 0; r < rounds; r++) {
+		start = now_ns();
+		for (i = 0; i < nfiles; i++) {
+			t = now_ns();
+			if (write_file(i, buf))
+				return 1;
+			lat[i] = now_ns() - t;
+		}
+		sync();
+		wall = now_ns() - start;
+		qsort(lat, nfiles, sizeof(*lat), cmp_ulong);
+
+		printf("%6u %10.0f %10.0f %10.1f %10.1f %10.1f\n", r,
+		       wall ? nfiles / (wall / 1e9) : 0.0,
+		       wall ? (double)nfiles * file_size / 1024 /
+			      (wall / 1e9) : 0.0,
+		       pct(lat, nfiles, 500), pct(lat, nfiles, 990),
+		       pct(lat, nfiles, 1000));
+		total_files += nfiles;
+		total_wall += wall;
+		remove_files();
+	}
+	printf("%6s %10.0f\n", "all",
+	       total_wall ? total_files / (total_wall / 1e9) : 0.0);
+
+	if (have_counters && read_counters(after) == 0)
+		for (i = 0; i < NR_COUNTERS; i++)
+			printf("%-16s %llu\n", counters[i],
+			       after[i] - before[i]);
+	return 0;
+}